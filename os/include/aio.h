@@ -0,0 +1,110 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sync.h>
+#include <sched.h>
+
+// Asynchronous I/O through a pair of rings, io_uring style. The owner fills submission entries,
+// aio_submit hands every run of entries for the same file to its backend in one call (one
+// device notify per run), and completions land in the completion ring from whatever context
+// finished them. The owner reaps them in batches; aio_wait sleeps until enough have arrived
+// and is only woken once they have.
+//
+//     AioSqe_t* sqe = aio_get_sqe(ring);
+//     *sqe = (AioSqe_t) { .op = AIO_OP_WRITE, .file = console_aio(), .buffer = text, .length = n, .user_data = 1 };
+//     aio_enter(ring, 1);
+//     aio_reap(ring, completions, max);
+//
+// One thread owns a ring: submitting and reaping aren't locked against each other.
+
+#define AIO_OP_NOP   0
+#define AIO_OP_READ  1
+#define AIO_OP_WRITE 2
+#define AIO_OP_FSYNC 3
+
+#define AIO_BATCH_MAX 32 // Most entries handed to a backend in one call
+#define AIO_BACKEND_SIZE 64 // Per-request room a backend keeps its own state in
+
+#define AIO_ERROR_INVALID -1 // Bad op, alignment or range for this file
+#define AIO_ERROR_IO      -2 // The device failed it
+
+typedef struct AioFile AioFile_t;
+typedef struct AioRing AioRing_t;
+typedef struct AioRequest AioRequest_t;
+
+typedef struct {
+    uint8_t op;
+    uint8_t reserved[3];
+    uint32_t length;
+    AioFile_t* file;      // NULL only for AIO_OP_NOP
+    void* buffer;
+    uint64_t offset;      // Bytes, for block devices (sector aligned)
+    uint64_t user_data;   // Handed back in the completion
+} AioSqe_t;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t result;       // Bytes moved, or AIO_ERROR_*
+} AioCqe_t;
+
+// In flight, owned by the backend until aio_complete
+struct AioRequest {
+    AioRing_t* ring;
+    AioSqe_t sqe;         // Copied at submit, the SQ slot is reusable straight away
+    AioRequest_t* next;   // Free list, or a backend's own queue
+    uint64_t backend[AIO_BACKEND_SIZE / sizeof(uint64_t)]; // The backend's, whatever it needs per request
+};
+
+typedef struct {
+    const char* name;
+    int (*submit)(AioFile_t* file, AioRequest_t** requests, int count); // How many it took, the rest stay queued
+} AioOps_t;
+
+struct AioFile {
+    const AioOps_t* ops;
+    void* object;
+};
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t batches;     // Backend submit calls
+    uint64_t enters;      // aio_enter calls
+    uint64_t sleeps;      // ...that had to wait
+    uint64_t wakeups;     // Completions that woke the owner
+    uint64_t full;        // Submits cut short by a full completion ring or backend
+} AioStats_t;
+
+struct AioRing {
+    AioSqe_t* sq;
+    uint32_t sq_entries;      // Power of two
+    uint32_t sq_head;         // Next to submit
+    uint32_t sq_tail;         // Next free
+    AioCqe_t* cq;
+    uint32_t cq_entries;      // Twice sq_entries
+    volatile uint32_t cq_head; // Next to reap
+    volatile uint32_t cq_tail; // Next to fill
+    volatile uint32_t inflight;
+    volatile uint32_t wake_at; // Completions the sleeping owner wants, UINT32_MAX when nobody sleeps
+    spinlock_t lock;          // Completion side: cq_tail, inflight and the request free list
+    WaitQueue_t waiters;
+    AioRequest_t* requests;
+    AioRequest_t* free_requests;
+    AioStats_t stats;
+};
+
+AioRing_t* aio_ring_create(uint32_t entries); // Rounded up to a power of two
+void aio_ring_destroy(AioRing_t* ring);       // Nothing may be in flight
+
+AioSqe_t* aio_get_sqe(AioRing_t* ring); // NULL if the submission ring is full
+int aio_submit(AioRing_t* ring);        // Entries handed to backends
+int aio_wait(AioRing_t* ring, uint32_t min_complete);  // Sleeps until that many are ready, returns how many are
+int aio_enter(AioRing_t* ring, uint32_t min_complete); // Submit, then wait
+int aio_reap(AioRing_t* ring, AioCqe_t* output, int max); // Copies out and frees up to max completions
+uint32_t aio_ready(const AioRing_t* ring);
+
+void aio_complete(AioRequest_t* request, int64_t result); // Backends, any context
+
+#endif // AIO_H
@@ -0,0 +1,93 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <stdint.h>
+
+// C11-style atomics spelled out with the A extension. amo* ops are .aqrl (sequentially
+// consistent) unless the name says otherwise; loads and stores pair a plain access with a fence.
+
+#define ATOMIC_AMO(name, op, type, suffix) \
+    static inline type atomic_##name(volatile type* pointer, type value) { \
+        type old; \
+        asm volatile(op "." suffix ".aqrl %0, %2, %1" : "=r"(old), "+A"(*pointer) : "r"(value) : "memory"); \
+        return old; \
+    }
+
+ATOMIC_AMO(fetch_add32, "amoadd", uint32_t, "w")
+ATOMIC_AMO(fetch_add64, "amoadd", uint64_t, "d")
+ATOMIC_AMO(fetch_or32,  "amoor",  uint32_t, "w")
+ATOMIC_AMO(fetch_or64,  "amoor",  uint64_t, "d")
+ATOMIC_AMO(fetch_and32, "amoand", uint32_t, "w")
+ATOMIC_AMO(fetch_and64, "amoand", uint64_t, "d")
+ATOMIC_AMO(swap32,      "amoswap", uint32_t, "w")
+ATOMIC_AMO(swap64,      "amoswap", uint64_t, "d")
+
+#undef ATOMIC_AMO
+
+// Compare-and-swap, returns the value seen (== expected means it worked)
+static inline uint64_t atomic_cas64(volatile uint64_t* pointer, uint64_t expected, uint64_t desired) {
+    uint64_t seen;
+    uint64_t failed;
+    asm volatile(
+        "1: lr.d.aqrl %0, %2\n"
+        "   bne %0, %3, 2f\n"
+        "   sc.d.rl %1, %4, %2\n"
+        "   bnez %1, 1b\n"
+        "2:"
+        : "=&r"(seen), "=&r"(failed), "+A"(*pointer)
+        : "r"(expected), "r"(desired)
+        : "memory");
+    return seen;
+}
+
+static inline uint32_t atomic_cas32(volatile uint32_t* pointer, uint32_t expected, uint32_t desired) {
+    int64_t seen; // lr.w sign extends, so compare against a sign extended expected
+    uint64_t failed;
+    asm volatile(
+        "1: lr.w.aqrl %0, %2\n"
+        "   bne %0, %3, 2f\n"
+        "   sc.w.rl %1, %4, %2\n"
+        "   bnez %1, 1b\n"
+        "2:"
+        : "=&r"(seen), "=&r"(failed), "+A"(*pointer)
+        : "r"((int64_t) (int32_t) expected), "r"(desired)
+        : "memory");
+    return (uint32_t) seen;
+}
+
+static inline void* atomic_swap_pointer(void* volatile* pointer, void* value) {
+    return (void*) atomic_swap64((volatile uint64_t*) pointer, (uint64_t) (uintptr_t) value);
+}
+
+static inline void* atomic_cas_pointer(void* volatile* pointer, void* expected, void* desired) {
+    return (void*) atomic_cas64((volatile uint64_t*) pointer, (uint64_t) (uintptr_t) expected, (uint64_t) (uintptr_t) desired);
+}
+
+// Later loads/stores can't move above an acquire load, earlier ones can't move below a release store
+static inline uint32_t atomic_load_acquire32(const volatile uint32_t* pointer) {
+    uint32_t value = *pointer;
+    asm volatile("fence r, rw" ::: "memory");
+    return value;
+}
+
+static inline uint64_t atomic_load_acquire64(const volatile uint64_t* pointer) {
+    uint64_t value = *pointer;
+    asm volatile("fence r, rw" ::: "memory");
+    return value;
+}
+
+static inline void atomic_store_release32(volatile uint32_t* pointer, uint32_t value) {
+    asm volatile("fence rw, w" ::: "memory");
+    *pointer = value;
+}
+
+static inline void atomic_store_release64(volatile uint64_t* pointer, uint64_t value) {
+    asm volatile("fence rw, w" ::: "memory");
+    *pointer = value;
+}
+
+static inline void atomic_fence(void) {
+    asm volatile("fence rw, rw" ::: "memory");
+}
+
+#endif // ATOMIC_H
@@ -0,0 +1,74 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <block.h>
+
+// Buffer cache. Blocks are looked up by (device, block) in a hash table, evicted with CLOCK and
+// written back lazily: dirty buffers go out sorted and in batches, from a flusher thread every
+// BCACHE_FLUSH_MS, from bcache_sync, or when eviction runs out of clean buffers. Reads that
+// follow on from the previous block on a device grow a read-ahead window that is fetched
+// asynchronously in one batch.
+//
+//     Buffer_t* buffer = bcache_get(device, block);
+//     ... read or change buffer->data, bcache_mark_dirty(buffer) if changed ...
+//     bcache_release(buffer);
+
+#define BCACHE_BLOCK_SIZE      4096
+#define BCACHE_BLOCK_SECTORS   (BCACHE_BLOCK_SIZE / BLOCK_SECTOR_SIZE)
+#define BCACHE_RAM_SHARE       64   // 1/64 of RAM goes to buffers...
+#define BCACHE_MIN_BUFFERS     64
+#define BCACHE_MAX_BUFFERS     8192 // ...within these
+#define BCACHE_READAHEAD_MIN   4    // Window after the first sequential read, doubling from there
+#define BCACHE_READAHEAD_MAX   32
+#define BCACHE_WRITEBACK_BATCH 32
+#define BCACHE_FLUSH_MS        1000
+
+#define BUFFER_VALID      (1u << 0) // data holds the block
+#define BUFFER_DIRTY      (1u << 1) // ...and is newer than the disk
+#define BUFFER_IO         (1u << 2) // A read or write is in flight
+#define BUFFER_ERROR      (1u << 3) // The last read failed
+#define BUFFER_REFERENCED (1u << 4) // CLOCK's second chance
+#define BUFFER_READAHEAD  (1u << 5) // Fetched ahead and not asked for yet
+
+typedef struct Buffer Buffer_t;
+
+struct Buffer {
+    BlockDevice_t* device;
+    uint64_t block;
+    volatile uint32_t flags;
+    uint32_t references;
+    uint8_t* data;            // BCACHE_BLOCK_SIZE bytes, page aligned
+    Buffer_t* hash_next;
+    BlockRequest_t request;
+};
+
+typedef struct {
+    uint32_t buffers;
+    uint32_t dirty;
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t waits;             // Hits that had to wait for a read already in flight
+    uint64_t evictions;
+    uint64_t evicted_dirty;     // Evictions that had to write back first
+    uint64_t readahead_issued;  // Blocks
+    uint64_t readahead_used;    // ...later asked for
+    uint64_t readahead_wasted;  // ...evicted before anyone asked
+    uint64_t writebacks;        // Blocks written
+    uint64_t writeback_batches;
+    uint64_t read_errors;
+    uint64_t write_errors;
+} BcacheStats_t;
+
+int bcache_init(void); // After the block devices are up, sizes itself from RAM
+
+Buffer_t* bcache_get(BlockDevice_t* device, uint64_t block); // Sleeps for the read, NULL on error
+void bcache_release(Buffer_t* buffer);
+void bcache_mark_dirty(Buffer_t* buffer);
+int bcache_sync(BlockDevice_t* device); // Writes back every dirty block of device (NULL for all), then waits
+
+void bcache_stats(BcacheStats_t* output);
+
+#endif // BCACHE_H
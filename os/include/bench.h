@@ -0,0 +1,10 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <kprintf.h>
+#include <riscv.h>
+
+// Entry point for the monitor's 'bench' command, argv[1] picks the benchmark
+int bench_main(int argc, char** argv);
+
+#endif // BENCH_H
@@ -0,0 +1,73 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sched.h>
+
+// Block devices. Drivers register a BlockDevice_t whose submit queues a batch of requests with
+// a single notify; completions come back through each request's done callback, from the
+// device's interrupt. block_rw wraps one request for callers that just want to wait.
+
+#define BLOCK_SECTOR_SIZE  512
+#define BLOCK_MAX_DEVICES  8
+#define BLOCK_NAME_LENGTH  8
+
+#define BLOCK_READ  0
+#define BLOCK_WRITE 1
+#define BLOCK_FLUSH 2
+
+#define BLOCK_PENDING 1 // status while in flight, then 0 or < 0
+
+typedef struct BlockRequest BlockRequest_t;
+
+struct BlockRequest {
+    uint32_t op;
+    volatile int32_t status;
+    uint64_t sector;
+    uint32_t count;           // Sectors
+    uint32_t tag;             // The driver's while in flight
+    void* buffer;             // Physically contiguous: page_alloc, dma_alloc or slab memory
+    void (*done)(BlockRequest_t* request); // Interrupt context (or inside submit, if the device had nothing to do), may submit more. NULL wakes block_rw
+    void* data;
+    BlockRequest_t* next;     // The owner's while not in flight
+};
+
+typedef struct {
+    uint64_t requests;
+    uint64_t batches;         // submit calls that queued something
+    uint64_t notifies;        // ...of which the device needed telling about
+    uint64_t interrupts;
+    uint64_t completions;
+    uint64_t errors;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} BlockStats_t;
+
+typedef struct BlockDevice BlockDevice_t;
+
+struct BlockDevice {
+    char name[BLOCK_NAME_LENGTH];
+    uint64_t sectors;
+    uint32_t read_only;
+    uint32_t queue_depth;     // Most requests in flight at once
+    int (*submit)(BlockDevice_t* device, BlockRequest_t** requests, int count); // How many it took
+    void* driver;
+    WaitQueue_t waiters;      // block_rw sleepers, woken on every completion
+    BlockStats_t stats;
+};
+
+int block_register(BlockDevice_t* device); // Names it vda, vdb, ...
+unsigned int block_device_count(void);
+BlockDevice_t* block_device(unsigned int index);
+BlockDevice_t* block_find(const char* name);
+
+// Checks and queues, returns how many were taken (the rest didn't fit), < 0 on a bad request
+int block_submit(BlockDevice_t* device, BlockRequest_t** requests, int count);
+void block_complete(BlockDevice_t* device, BlockRequest_t* request, int status); // Drivers, on completion
+
+int block_rw(BlockDevice_t* device, uint32_t op, uint64_t sector, uint32_t count, void* buffer); // Sleeps until done
+
+struct AioFile* block_aio(BlockDevice_t* device); // The device as an aio file, see aio.h
+
+#endif // BLOCK_H
@@ -0,0 +1,62 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <aio.h>
+
+// The console kprintf, klog and the monitor talk to. The NS16550 is always there from the first
+// line of boot; a faster driver (virtio-console) registers itself when it probes and takes over.
+// If its write ever fails the console drops back to the UART for good.
+
+#define CONSOLE_MAX_DRIVERS 4
+
+typedef struct {
+    const void* data;
+    size_t length;
+} ConsoleVector_t;
+
+typedef struct {
+    const char* name;
+    int (*write)(const char* data, size_t length, int binary); // "\n" becomes "\r\n" unless binary, < 0 if the device is gone
+    int (*writev)(const ConsoleVector_t* vectors, int count); // Text, one notify for the lot, may be NULL
+    int (*getc)(void);   // Sleeps until there's input
+    int (*poll)(void);   // Next input byte or -1, never sleeps
+    void (*flush)(void); // Returns once everything written is out
+    int (*panic)(void);  // Polled from here on, < 0 if it can't be trusted to get a panic out
+    void (*show)(void);  // Driver counters for the monitor, may be NULL
+} ConsoleDriver_t;
+
+typedef struct {
+    uint64_t writes;
+    uint64_t bytes;
+    uint64_t fallbacks; // Writes that failed and went out the UART instead
+} ConsoleStats_t;
+
+void console_register(const ConsoleDriver_t* driver); // And switch to it
+int console_select(const char* name);
+const ConsoleDriver_t* console_active(void);
+const ConsoleDriver_t* console_driver(unsigned int index); // Registered ones, the UART first
+
+void console_write(const char* data, size_t length);
+void console_write_binary(const void* data, size_t length);
+void console_writev(const ConsoleVector_t* vectors, int count);
+void console_putc(char c);
+void console_puts(const char* str);
+char console_getc(void);
+int console_poll(void);
+void console_gets(char* buffer, size_t max_length); // With echo and backspace
+void console_flush(void);
+
+// Held across several writes that must come out together, per hart recursive (interrupts off)
+void console_lock(void);
+void console_unlock(void);
+void console_panic(void); // Takes the lock from whoever has it and goes polled
+
+void console_stats(ConsoleStats_t* output);
+
+// The console as an aio file. Writes in a batch leave in one writev; a read completes with
+// whatever input there is once there's at least a byte, reads are served in submission order.
+AioFile_t* console_aio(void);
+
+#endif // CONSOLE_H
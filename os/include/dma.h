@@ -0,0 +1,40 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Physically contiguous memory for device rings and buffers, kept apart from the page allocator
+// so drivers never fragment it. The pool is a /reserved-memory "shared-dma-pool" node when the
+// FDT has one, otherwise a block carved from RAM at boot. Inside it a buddy allocator hands out
+// naturally aligned blocks from 64 bytes up; there are few enough orders that alloc and free are
+// bounded by a constant, and a ring freed and asked for again comes straight off its list.
+
+#define DMA_GRANULE_SHIFT 6 // 64 bytes, a cache line
+#define DMA_GRANULE       (1ull << DMA_GRANULE_SHIFT)
+#define DMA_MAX_ORDER     20 // Orders 0..19, up to 32 MiB
+#define DMA_POOL_ORDER    10 // Pages carved from RAM without a shared-dma-pool, 4 MiB
+
+typedef struct {
+    uint64_t base;      // Physical
+    uint64_t size;
+    uint64_t used;      // Bytes in allocated blocks
+    uint64_t peak;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures;
+    size_t free_blocks[DMA_MAX_ORDER];
+} DmaStats_t;
+
+int dma_init(void); // After vm_init
+
+// Zeroed, aligned to max(align, the block size rounded up to a power of two). The virtual
+// address comes back, the device-visible one through physical.
+void* dma_alloc(size_t size, size_t align, uint64_t* physical);
+void dma_free(void* address);
+
+uint64_t dma_to_physical(const void* address);
+void* dma_to_virtual(uint64_t physical);
+void dma_stats(DmaStats_t* output);
+
+#endif // DMA_H
@@ -0,0 +1,45 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fdt_index.h>
+
+// Drivers drop a Driver_t into the .drivers section with DRIVER_REGISTER. At boot driver_probe_all
+// hashes every compatible string once, then makes a single pass over the FDT index calling probe
+// for each enabled node whose compatible list hits, most specific entry first.
+
+#define DEVICE_MAX_REGS 4
+#define DEVICE_MAX_IRQS 8
+
+typedef struct {
+    const FDTNode_t* node;
+    const char* compatible;                // The entry that matched
+    FDTRegRegion_t reg[DEVICE_MAX_REGS];
+    int reg_count;
+    uint32_t irqs[DEVICE_MAX_IRQS];        // First cell of each specifier (the source number on a PLIC)
+    int irq_count;
+    const FDTNode_t* interrupt_parent;
+} Device_t;
+
+#define DRIVER_NO_DEVICE 1 // probe: the node is a placeholder with nothing behind it (empty virtio-mmio slots)
+
+typedef struct {
+    const char* name;
+    const char* const* compatible;         // NULL terminated
+    int (*probe)(const Device_t* device);  // < 0 if the device couldn't be brought up
+} Driver_t;
+
+#define DRIVER_REGISTER(driver_name, probe_function, ...) \
+    static const char* const driver_name##_compatible[] = { __VA_ARGS__, NULL }; \
+    static const Driver_t driver_name##_driver \
+        __attribute__((used, section(".drivers"), aligned(8))) = { \
+            .name = #driver_name, \
+            .compatible = driver_name##_compatible, \
+            .probe = probe_function, \
+        }
+
+int driver_probe_all(void); // Returns the number of devices bound
+int device_is_compatible(const Device_t* device, const char* compatible);
+
+#endif // DRIVER_H
@@ -0,0 +1,69 @@
+#ifndef FDT_INDEX_H
+#define FDT_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fdt_parser.h>
+
+// Unflattened FDT: one fdt_next pass at boot fills a static arena of nodes and properties,
+// after that path and phandle lookups are a hash probe instead of a rescan of the blob.
+
+#define FDT_INDEX_MAX_NODES   512
+#define FDT_INDEX_MAX_PROPS   2048
+#define FDT_INDEX_MAX_DEPTH   32
+#define FDT_PATH_BUCKETS      256 // Power of two
+#define FDT_PHANDLE_BUCKETS   64  // Power of two
+
+typedef struct FDTNode FDTNode_t;
+
+struct FDTNode {
+    const char* name;       // Points into the blob, unit address included ("uart@10000000")
+    size_t name_length;
+
+    const FDTNode_t* parent;
+    const FDTNode_t* child;   // First child
+    const FDTNode_t* sibling; // Next child of the same parent
+
+    const FDTNode_t* path_next;    // Hash chains
+    const FDTNode_t* phandle_next;
+
+    uint32_t first_prop; // Index into the property arena, a node's properties are contiguous
+    uint32_t prop_count;
+    uint32_t path_hash;  // FNV-1a of the full path
+    uint32_t phandle;    // 0 if none
+    uint16_t depth;      // Root is 0
+
+    // Cells for decoding this node's reg (set by the parent) and the ones it hands its children
+    uint8_t address_cells;
+    uint8_t size_cells;
+    uint8_t child_address_cells;
+    uint8_t child_size_cells;
+};
+
+int fdt_index_build(const FDTView_t* fdt);
+const FDTView_t* fdt_index_view(void);
+
+// Nodes are stored in tree order, so a walk over every node is fdt_node_at(0 .. count-1)
+size_t fdt_node_count(void);
+const FDTNode_t* fdt_node_at(size_t index);
+const FDTNode_t* fdt_root(void);
+
+const FDTNode_t* fdt_find_path(const char* path);
+const FDTNode_t* fdt_find_path_length(const char* path, size_t length);
+const FDTNode_t* fdt_find_phandle(uint32_t phandle);
+const FDTNode_t* fdt_find_alias(const char* alias); // Path or /aliases name
+
+int fdt_node_is(const FDTNode_t* node, const char* base_name); // Name ignoring the unit address
+const FDTNode_t* fdt_node_child(const FDTNode_t* node, const char* base_name);
+const FDTProp_t* fdt_node_prop(const FDTNode_t* node, const char* name);
+int fdt_node_reg(const FDTNode_t* node, FDTRegRegion_t* output, int max_regions);
+size_t fdt_node_path(const FDTNode_t* node, char* buffer, size_t size);
+
+// Boot-time lookups built on the index
+int fdt_resolve_stdout_uart(uint64_t* base, uint64_t* size, const char** path, const char** compatible);
+int fdt_memory_regions(FDTRegRegion_t* output, int max_regions);
+int fdt_reserved_regions(FDTRegRegion_t* output, int max_regions);
+int fdt_initrd(uint64_t* start, uint64_t* end);
+int fdt_cpu_isa(uint64_t hart_id, const char** isa, const char** extensions, size_t* extensions_length);
+
+#endif // FDT_INDEX_H
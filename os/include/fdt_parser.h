@@ -64,46 +64,6 @@ typedef struct {
     uint32_t name_offset;        // Offset into strings block for name
 } FDTProp_t;
 
-typedef struct {
-    const char* string; 
-    size_t length;
-} FDTPath_t;
-
-typedef struct {
-    FDTPath_t paths[32];
-    size_t depth;
-} FDTPathStack_t;
-
-typedef struct {
-    const char* key;
-    const char* value;
-} FDTAlias_t;
-
-typedef struct {
-    FDTAlias_t entries[32];
-    size_t count;
-} FDTAliasTable_t;
-
-typedef struct {
-    const char* raw;
-    const char* abs_path;
-    char abs_buffer[128];
-} FDTStdOut_t;
-
-typedef struct {
-    unsigned int reg_address_cells;
-    unsigned int reg_size_cells;
-
-    // What the child should inherit.
-    unsigned int child_address_cells;
-    unsigned int child_size_cells;
-} FDTAddressSizeFrame_t;
-
-typedef struct {
-    FDTAddressSizeFrame_t frames[32];
-    size_t depth;
-} FDTAddressSizeStack_t;
-
 typedef struct {
     uint64_t base;
     uint64_t size;
@@ -114,6 +74,12 @@ uint32_t read_be32(const void* pointer);
 uint64_t read_be64(const void* pointer);
 int fdt_init(FDTView_t* fdt, const void* blob, size_t size);
 int fdt_next(FDTCursor_t* cursor, FDTView_t* fdt, FDTToken_t* token, const char** name, FDTProp_t* prop);
-int fdt_resolve_stdout_uart(const FDTView_t* fdt, uint64_t* base, uint64_t* size, const char** path, const char** compatible);
+int fdt_prop_is(const FDTProp_t* prop, const char* name);
+const char* fdt_prop_string(const FDTProp_t* prop);
+int fdt_prop_next_string(const FDTProp_t* prop, const char** output, size_t* cursor);
+int fdt_prop_stringlist_contains(const FDTProp_t* prop, const char* string);
+int fdt_prop_read_u32(const FDTProp_t* prop, uint32_t* output, size_t index);
+int fdt_reg_decode(const FDTProp_t* prop, int address_cells, int size_cells, FDTRegRegion_t* output, int max_regions);
+int fdt_mem_reserve_entry(const FDTView_t* fdt, size_t index, FDTMemReserveEntry_t* entry);
 
 #endif // FDT_PARSER_H
\ No newline at end of file
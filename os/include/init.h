@@ -2,10 +2,24 @@
 #define INIT_H
 
 #include <fdt_parser.h>
+#include <fdt_index.h>
 #include <panic.h>
+#include <page_alloc.h>
+#include <slab.h>
+#include <isa.h>
+#include <driver.h>
+#include <percpu.h>
+#include <trap.h>
+#include <timer.h>
+#include <sched.h>
+#include <plic.h>
+#include <vm.h>
+#include <dma.h>
+#include <bcache.h>
+#include <initramfs.h>
 
 #define UART_DEFAULT_MAP 0x10000000ull
 
-void init(const void* fdt_blob);
+void init(uintptr_t hart_id, const void* fdt_blob);
 
 #endif // INIT_H
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef INITRAMFS_H
+#define INITRAMFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Read-only initramfs. QEMU's -initrd archive (cpio, "newc" format) stays where the loader put
+// it, reserved from the page allocator; initramfs_init indexes it once into a path hash and
+// every read after that is a pointer into the image. Paths are stored without a leading
+// "/" or "./", lookups accept either.
+
+#define INITRAMFS_MAX_PATH 256
+
+#define INITRAMFS_TYPE_MASK 0170000 // st_mode file type bits
+#define INITRAMFS_DIRECTORY 0040000
+#define INITRAMFS_REGULAR   0100000
+#define INITRAMFS_SYMLINK   0120000
+
+typedef struct InitramfsEntry InitramfsEntry_t;
+
+struct InitramfsEntry {
+    const char* path;         // In the image, NUL terminated
+    const uint8_t* data;      // In the image, size bytes (a symlink's target for links)
+    uint64_t size;
+    uint32_t mode;
+    uint32_t path_length;
+    uint32_t hash;
+    const InitramfsEntry_t* hash_next;
+};
+
+int initramfs_init(void); // After slab_init. 0 with no initrd, < 0 if the archive is bad
+
+const InitramfsEntry_t* initramfs_lookup(const char* path);
+int initramfs_read(const char* path, const void** data, size_t* size); // Zero-copy, regular files only
+
+// Entries in archive order, for listing
+size_t initramfs_count(void);
+const InitramfsEntry_t* initramfs_entry(size_t index);
+int initramfs_in_directory(const InitramfsEntry_t* entry, const char* directory); // Direct child of it
+
+void initramfs_image(uint64_t* start, uint64_t* end); // Both 0 if there's none
+
+#endif // INITRAMFS_H
@@ -0,0 +1,26 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ISA extensions we care about, parsed from the boot hart's FDT node
+#define ISA_EXT_V      (1u << 0) // Vector 1.0
+#define ISA_EXT_ZBB    (1u << 1) // Basic bit manipulation (orc.b, ctz, rev8, ...)
+#define ISA_EXT_ZBA    (1u << 2) // Address generation (sh1add, ...)
+#define ISA_EXT_SSTC   (1u << 3) // Supervisor stimecmp
+#define ISA_EXT_SVPBMT (1u << 4) // Page based memory types
+
+#define SSTATUS_VS_MASK    (3ull << 9)
+#define SSTATUS_VS_INITIAL (1ull << 9)
+
+// isa is the riscv,isa string, extensions the riscv,isa-extensions stringlist (preferred when present)
+void isa_init(const char* isa, const char* extensions, size_t extensions_length);
+int isa_has(uint32_t extension);
+uint32_t isa_extensions(void);
+const char* isa_string(void);
+
+// Per-hart enables for what isa_init found (sstatus.VS for vector), every hart runs this once
+void isa_enable_local(void);
+
+#endif // ISA_H
@@ -3,6 +3,7 @@
 
 #include <kprintf.h>
 #include <monitor.h>
+#include <sched.h>
 
 int kernel_main(void);
 
@@ -0,0 +1,110 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <riscv.h>
+
+#define KLOG_RECORDS 64          // Per hart, must be a power of two
+#define KLOG_RECORD_TEXT 112     // Longer messages are truncated
+#define KLOG_DRAIN_WATERMARK 48  // A producer this far ahead of the drain flushes on its own
+
+// One log line. sequence is 2 * index + 1 while being written and 2 * index + 2 once complete,
+// so a reader can tell a finished record from one that is being (over)written under it.
+typedef struct {
+    volatile uint64_t sequence;
+    uint64_t timestamp; // rdtime at the klog call
+    uint16_t length;
+    uint8_t hart;
+    uint8_t binary;     // text holds a deferred payload instead of a formatted line
+    char text[KLOG_RECORD_TEXT];
+} KLogRecord_t;
+
+// Single producer (its hart) / single consumer (whoever holds the drain) ring
+typedef struct {
+    volatile uint64_t head;    // Next record to write, only the owning hart moves it
+    volatile uint64_t drained; // Next record to print, only the drainer moves it
+    uint64_t dropped;          // Overwritten before they were drained
+    KLogRecord_t records[KLOG_RECORDS];
+} KLogRing_t;
+
+void klog_printf(const char* format_string, ...) __attribute__((format(printf, 1, 2)));
+void klogv(const char* format_string, va_list args);
+
+// Deferred (defmt-style) logging, build with KLOG_DEFERRED=1.
+// The format string goes into .klog_fmt, which the linker script keeps in the ELF but never loads.
+// The target only logs the string's offset in that section plus the raw arguments, and
+// tools/klog_decode.py turns the binary frames on the UART back into text using the ELF.
+//
+// Wire frame: 0x00, varint zigzag(timestamp delta), varint format id, signed-args mask byte,
+// then per argument a varint (zigzag'd if signed) or, for strings, varint length + bytes.
+
+#define KLOG_MAX_ARGS 8
+
+typedef enum {
+    KLOG_ARG_WORD,
+    KLOG_ARG_SIGNED,
+    KLOG_ARG_STRING,
+} KLogArgKind_t;
+
+typedef struct {
+    uint64_t value;
+    KLogArgKind_t kind;
+} KLogArg_t;
+
+void klog_deferred(uint32_t format_id, const KLogArg_t* args, size_t count);
+
+#define KLOG_ARG_KIND(x) _Generic((x), \
+    char*: KLOG_ARG_STRING, const char*: KLOG_ARG_STRING, \
+    signed char: KLOG_ARG_SIGNED, short: KLOG_ARG_SIGNED, int: KLOG_ARG_SIGNED, \
+    long: KLOG_ARG_SIGNED, long long: KLOG_ARG_SIGNED, \
+    default: KLOG_ARG_WORD)
+#define KLOG_ARG(x) { .value = (uint64_t) (uintptr_t) (x), .kind = KLOG_ARG_KIND(x) }
+
+// Expands to "KLOG_ARG(a), KLOG_ARG(b), ..." for up to KLOG_MAX_ARGS arguments
+#define KLOG_NARGS(...) KLOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define KLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define KLOG_CAT(a, b) KLOG_CAT_(a, b)
+#define KLOG_CAT_(a, b) a##b
+#define KLOG_ARGS(...) KLOG_CAT(KLOG_ARGS_, KLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define KLOG_ARGS_0()
+#define KLOG_ARGS_1(a) KLOG_ARG(a),
+#define KLOG_ARGS_2(a, ...) KLOG_ARG(a), KLOG_ARGS_1(__VA_ARGS__)
+#define KLOG_ARGS_3(a, ...) KLOG_ARG(a), KLOG_ARGS_2(__VA_ARGS__)
+#define KLOG_ARGS_4(a, ...) KLOG_ARG(a), KLOG_ARGS_3(__VA_ARGS__)
+#define KLOG_ARGS_5(a, ...) KLOG_ARG(a), KLOG_ARGS_4(__VA_ARGS__)
+#define KLOG_ARGS_6(a, ...) KLOG_ARG(a), KLOG_ARGS_5(__VA_ARGS__)
+#define KLOG_ARGS_7(a, ...) KLOG_ARG(a), KLOG_ARGS_6(__VA_ARGS__)
+#define KLOG_ARGS_8(a, ...) KLOG_ARG(a), KLOG_ARGS_7(__VA_ARGS__)
+
+// .klog_fmt is linked at address 0, so the string's address is its id. lui/addi gives us that
+// absolute value; a normal medany reference would be pc-relative and can't reach address 0.
+#define KLOG_FORMAT_ID(symbol) ({ \
+    uint32_t klog_id_; \
+    asm("lui %0, %%hi(%1)\n\taddi %0, %0, %%lo(%1)" : "=r"(klog_id_) : "i"(symbol)); \
+    klog_id_; \
+})
+
+#define KLOG_DEFER(format, ...) do { \
+    static const char klog_format_[] __attribute__((section(".klog_fmt"), used)) = format; \
+    const KLogArg_t klog_args_[] = { { 0, KLOG_ARG_WORD }, KLOG_ARGS(__VA_ARGS__) }; \
+    if (0) klog_printf(format, ##__VA_ARGS__); /* Type-check the arguments against the format */ \
+    klog_deferred(KLOG_FORMAT_ID(klog_format_), &klog_args_[1], \
+                  sizeof(klog_args_) / sizeof(klog_args_[0]) - 1); \
+} while (0)
+
+#ifdef KLOG_DEFERRED
+#define klog(...) KLOG_DEFER(__VA_ARGS__)
+#else
+#define klog(...) klog_printf(__VA_ARGS__)
+#endif
+
+// Print everything not yet drained, oldest first across all harts
+void klog_init(void);
+void klog_drain(void);
+
+// Print the retained history, drained or not (panic, dmesg)
+void klog_replay(void);
+
+#endif // KLOG_H
@@ -5,7 +5,11 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <uart.h>
+#include <console.h>
 
-void kprintf(const char* format_string, ...);
+void kprintf(const char* format_string, ...) __attribute__((format(printf, 1, 2)));
+void kvprintf(const char* format_string, va_list args);
+int ksnprintf(char* buffer, size_t size, const char* format_string, ...) __attribute__((format(printf, 3, 4)));
+int kvsnprintf(char* buffer, size_t size, const char* format_string, va_list args);
 
 #endif // KPRINTF_H
\ No newline at end of file
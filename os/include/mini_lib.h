@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <isa.h>
 
 void* memcpy(void* dest, const void* src, size_t n);
 int strcmp(const char* s1, const char* s2);
@@ -11,4 +12,8 @@ int memcmp(const void* a, const void* b, size_t n);
 void* memset(void* destination, int value, size_t n);
 void* memmove(void* destination, const void* source, size_t n);
 
+// Switch to the vector / Zbb variants the ISA_EXT_* mask allows, scalar otherwise
+void mem_select(uint32_t extensions);
+const char* mem_variant(void);
+
 #endif // MINI_LIB_H
\ No newline at end of file
@@ -5,6 +5,23 @@
 #include <mini_lib.h>
 #include <uart.h>
 #include <panic.h>
+#include <page_alloc.h>
+#include <slab.h>
+#include <bench.h>
+#include <klog.h>
+#include <percpu.h>
+#include <sync.h>
+#include <trap.h>
+#include <timer.h>
+#include <sched.h>
+#include <plic.h>
+#include <vm.h>
+#include <dma.h>
+#include <block.h>
+#include <bcache.h>
+#include <initramfs.h>
+#include <console.h>
+#include <aio.h>
 
 void kernel_monitor();
 
@@ -0,0 +1,29 @@
+#ifndef PAGE_ALLOC_H
+#define PAGE_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1ull << PAGE_SHIFT)
+#define PAGE_MAX_ORDER 19 // Orders 0..18, biggest block is 1 GiB
+
+#define PAGE_ALIGN_UP(x) (((uint64_t) (x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define PAGE_ALIGN_DOWN(x) ((uint64_t) (x) & ~(PAGE_SIZE - 1))
+
+// Boot-time setup: describe RAM and the holes in it, then build the free lists once
+void page_alloc_add_region(uint64_t base, uint64_t size);
+void page_alloc_reserve(uint64_t base, uint64_t size);
+int page_alloc_init(void);
+
+// Blocks are 2^order pages, naturally aligned to their size
+void* page_alloc(unsigned int order);
+void page_free(void* address);
+void* page_block_start(const void* address);
+unsigned int page_order_for(size_t bytes);
+
+size_t page_free_count(void);
+size_t page_total_count(void);
+size_t page_free_blocks(unsigned int order);
+
+#endif // PAGE_ALLOC_H
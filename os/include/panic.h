@@ -3,6 +3,7 @@
 
 #include <kprintf.h>
 #include <sbi.h>
+#include <klog.h>
 
 #define panic(msg) _panic(msg, __FILE__, __LINE__, __func__)
 
@@ -0,0 +1,36 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <riscv.h>
+
+#define KERNEL_STACK_SIZE (16u * 1024u) // Per hart, the .stack section in linker.ld holds MAX_HARTS of them
+
+// One per logical CPU, tp points at the running hart's entry. Cache line aligned so harts
+// updating their own entry don't bounce each other's lines.
+typedef struct {
+    uint32_t index;          // Must stay first, cpu_index() loads it straight off tp
+    volatile uint32_t online;
+    uintptr_t stack_top;     // Offset 8, _start_secondary loads sp from here
+    uint64_t hart_id;
+    uint64_t started_at;     // rdtime when the hart reported in
+    struct Thread* current;  // Running thread, NULL until sched_start
+    uint32_t preempt_count;  // Non-zero: interrupts don't switch threads on the way out
+    volatile uint32_t need_resched;
+} __attribute__((aligned(64))) PerCpu_t;
+
+extern PerCpu_t cpus[MAX_HARTS];
+
+static inline PerCpu_t* this_cpu(void) {
+    PerCpu_t* cpu;
+    asm volatile("mv %0, tp" : "=r"(cpu));
+    return cpu;
+}
+
+void smp_init(uint64_t boot_hart_id);
+int smp_boot_secondaries(void); // Returns how many harts are online afterwards
+unsigned int cpu_count(void);    // Logical CPUs handed out, online or not
+unsigned int cpu_online_count(void);
+
+#endif // PERCPU_H
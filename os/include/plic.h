@@ -0,0 +1,49 @@
+#ifndef PLIC_H
+#define PLIC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// RISC-V platform-level interrupt controller. Found through the driver registry, it owns the
+// supervisor external interrupt on every hart and hands each claimed source to its handler.
+// A source goes to the S-mode context of every hart in its affinity mask; whichever claims it
+// first runs the handler, the others read 0 from claim and move on.
+
+#define PLIC_MAX_SOURCES  128 // QEMU virt has 96
+#define PLIC_MAX_CONTEXTS 32  // M and S for 16 harts
+#define PLIC_MAX_PRIORITY 7   // QEMU and SiFive implement 3 bits
+
+#define PLIC_PRIORITY(source)        (0x000000u + (source) * 4u)
+#define PLIC_PENDING(source)         (0x001000u + ((source) / 32u) * 4u)
+#define PLIC_ENABLE(context, source) (0x002000u + (context) * 0x80u + ((source) / 32u) * 4u)
+#define PLIC_THRESHOLD(context)      (0x200000u + (context) * 0x1000u)
+#define PLIC_CLAIM(context)          (0x200004u + (context) * 0x1000u)
+
+typedef void (*plic_handler_t)(void* data);
+
+typedef struct {
+    plic_handler_t handler;
+    uint32_t priority;
+    uint32_t affinity;            // cpu_index() bits
+    uint64_t count[8];            // Claims per cpu (the first 8)
+} PlicSourceInfo_t;
+
+int plic_present(void);
+void plic_init_local(void); // Every hart after the boot one, once it's running
+
+// Priority 1, routed to the boot hart until plic_set_affinity or plic_balance says otherwise.
+// Drivers probed before the PLIC are fine, the source is held back and set up when it appears.
+int plic_enable(uint32_t source, plic_handler_t handler, void* data);
+void plic_disable(uint32_t source);
+
+int plic_set_priority(uint32_t source, uint32_t priority); // 0 masks the source everywhere
+int plic_set_threshold(unsigned int cpu, uint32_t threshold); // Only priorities above it get through
+int plic_set_affinity(uint32_t source, uint32_t cpu_mask);
+void plic_balance(void); // One hart per enabled source, round robin over the online ones
+
+uint32_t plic_source_count(void);
+int plic_source_info(uint32_t source, PlicSourceInfo_t* output); // < 0 if nothing is registered
+uint32_t plic_threshold(unsigned int cpu);
+uint64_t plic_spurious(unsigned int cpu);
+
+#endif // PLIC_H
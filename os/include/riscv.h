@@ -0,0 +1,65 @@
+#ifndef RISCV_H
+#define RISCV_H
+
+#include <stdint.h>
+
+#define MAX_HARTS 8
+#define TIMEBASE_DEFAULT_HZ 10000000ull // QEMU virt's rdtime rate
+
+// CSR helpers, csr is the bare register name (e.g. csr_read(sstatus))
+#define csr_read(csr) ({ uint64_t __value; asm volatile("csrr %0, " #csr : "=r"(__value)); __value; })
+#define csr_write(csr, value) asm volatile("csrw " #csr ", %0" :: "rK"((uint64_t) (value)) : "memory")
+#define csr_set(csr, bits) asm volatile("csrs " #csr ", %0" :: "rK"((uint64_t) (bits)) : "memory")
+#define csr_clear(csr, bits) asm volatile("csrc " #csr ", %0" :: "rK"((uint64_t) (bits)) : "memory")
+
+#define SSTATUS_SIE (1ull << 1)
+
+// Disable supervisor interrupts, returns whether they were on
+static inline uint64_t irq_save(void) {
+    uint64_t status;
+    asm volatile("csrrci %0, sstatus, %1" : "=r"(status) : "i"(SSTATUS_SIE) : "memory");
+    return status & SSTATUS_SIE;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    if (flags) csr_set(sstatus, SSTATUS_SIE);
+}
+
+// Logical CPU number (0 is the boot hart). tp points at this hart's PerCpu_t (percpu.h),
+// whose first word is the index, so this is a single load
+static inline unsigned int cpu_index(void) {
+    uint32_t index;
+    asm volatile("lw %0, 0(tp)" : "=r"(index));
+    return index;
+}
+
+static inline uint64_t rdtime(void) {
+    uint64_t value;
+    asm volatile("rdtime %0" : "=r"(value));
+    return value;
+}
+
+static inline uint64_t rdcycle(void) {
+    uint64_t value;
+    asm volatile("rdcycle %0" : "=r"(value));
+    return value;
+}
+
+static inline void wfi(void) {
+    asm volatile("wfi" ::: "memory");
+}
+
+// Drop this hart's cached translations, all of them or just the ones for one page
+static inline void sfence_vma_all(void) {
+    asm volatile("sfence.vma zero, zero" ::: "memory");
+}
+
+static inline void sfence_vma_page(uintptr_t address) {
+    asm volatile("sfence.vma %0, zero" :: "r"(address) : "memory");
+}
+
+static inline void cpu_relax(void) {
+    asm volatile("nop" ::: "memory");
+}
+
+#endif // RISCV_H
@@ -31,12 +31,33 @@ enum {
     SBI_EID_TIMER  = 0x54494D45,  // "TIME" timer
     SBI_EID_IPI    = 0x735049,    // "sPI" IPI (platform dep.)
     SBI_EID_HSM    = 0x48534D,    // "HSM" hart state mgmt
+    SBI_EID_RFENCE = 0x52464E43,  // "RFNC" remote fences
 };
 
 enum { // Base
     SBI_FID_GET_SPEC_VERSION = 0,
     SBI_FID_GET_IMPL_ID      = 1,
     SBI_FID_GET_IMPL_VERSION = 2,
+    SBI_FID_PROBE_EXTENSION  = 3,
+};
+
+enum { // HSM
+    SBI_FID_HART_START      = 0,
+    SBI_FID_HART_STOP       = 1,
+    SBI_FID_HART_GET_STATUS = 2,
+};
+
+enum { // RFENCE
+    SBI_FID_REMOTE_FENCE_I         = 0,
+    SBI_FID_REMOTE_SFENCE_VMA      = 1,
+    SBI_FID_REMOTE_SFENCE_VMA_ASID = 2,
+};
+
+enum { // HSM hart states
+    SBI_HSM_STARTED         = 0,
+    SBI_HSM_STOPPED         = 1,
+    SBI_HSM_START_PENDING   = 2,
+    SBI_HSM_STOP_PENDING    = 3,
 };
 
 enum { // SRST
@@ -46,6 +67,43 @@ enum { // SRST
     SBI_SRST_REASON_NONE   = 0,
 };
 
+// Non-zero if the firmware implements the extension
+static inline long sbi_probe_extension(uint64_t eid) {
+    sbi_ret_t ret = sbi_call(SBI_EID_BASE, SBI_FID_PROBE_EXTENSION, eid, 0,0,0,0,0);
+    return ret.error ? 0 : ret.value;
+}
+
+// The hart starts in S-mode at start_address with a0 = hartid, a1 = opaque, satp = 0 and interrupts off
+static inline long sbi_hart_start(uint64_t hart_id, uint64_t start_address, uint64_t opaque) {
+    return sbi_call(SBI_EID_HSM, SBI_FID_HART_START, hart_id, start_address, opaque, 0,0,0).error;
+}
+
+static inline long sbi_hart_get_status(uint64_t hart_id) {
+    sbi_ret_t ret = sbi_call(SBI_EID_HSM, SBI_FID_HART_GET_STATUS, hart_id, 0,0,0,0,0);
+    return ret.error ? ret.error : ret.value;
+}
+
+// Next timer interrupt at an absolute rdtime value, UINT64_MAX to have none. Also clears a pending one
+static inline void sbi_set_timer(uint64_t deadline) {
+    (void)sbi_call(SBI_EID_TIMER, 0, deadline, 0,0,0,0,0);
+}
+
+// Supervisor software interrupt on every hart set in hart_mask (bit 0 is hart_mask_base)
+static inline long sbi_send_ipi(uint64_t hart_mask, uint64_t hart_mask_base) {
+    return sbi_call(SBI_EID_IPI, 0, hart_mask, hart_mask_base, 0,0,0,0).error;
+}
+
+// sfence.vma for [start, start + size) on every hart in hart_mask, size -1 for everything.
+// Returns once the remote harts have done it
+static inline long sbi_remote_sfence_vma(uint64_t hart_mask, uint64_t hart_mask_base, uint64_t start, uint64_t size) {
+    return sbi_call(SBI_EID_RFENCE, SBI_FID_REMOTE_SFENCE_VMA, hart_mask, hart_mask_base, start, size, 0,0).error;
+}
+
+static inline long sbi_remote_sfence_vma_asid(uint64_t hart_mask, uint64_t hart_mask_base, uint64_t start,
+                                              uint64_t size, uint64_t asid) {
+    return sbi_call(SBI_EID_RFENCE, SBI_FID_REMOTE_SFENCE_VMA_ASID, hart_mask, hart_mask_base, start, size, asid, 0).error;
+}
+
 static inline void sbi_system_shutdown(void) {
     (void)sbi_call(SBI_EID_SRST, 0, SBI_SRST_TYPE_SHUTDOWN, SBI_SRST_REASON_NONE, 0,0,0,0);
 }
@@ -0,0 +1,139 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <percpu.h>
+#include <timer.h>
+
+// Kernel threads. Each hart owns a run queue, a Chase-Lev style deque that only the owner pushes
+// to and that anyone (owner included) takes from the top of, with a CAS. The owner taking from
+// the top keeps it round robin; a hart with nothing to run takes from someone else's top the same
+// way, so stealing needs no lock. Wakeups aimed at another hart go through that hart's inbox,
+// a lock-free stack it drains into its deque the next time it schedules.
+// A hart with nothing to do sleeps in wfi, other harts IPI it when they have work it could take.
+// Threads are preempted from the timer interrupt when their slice runs out. Only interrupts
+// preempt, so anything done with interrupts off (every irqsave lock) is never switched away from.
+
+#define THREAD_STACK_ORDER 2  // 16 KiB
+#define THREAD_STACK_SIZE  (4096u << THREAD_STACK_ORDER)
+#define THREAD_NAME_LENGTH 16
+#define SCHED_SLICE_MS     10
+#define RUNQUEUE_SIZE      512 // Power of two, more than there will ever be threads
+
+#define THREAD_RUNNABLE 0 // On a run queue (or about to be)
+#define THREAD_RUNNING  1
+#define THREAD_BLOCKED  2 // Off every queue until thread_wake
+#define THREAD_DEAD     3 // Freed by the next thread to run on its hart
+
+#define THREAD_IDLE (1u << 0) // A hart's boot context, never queued or stolen
+
+// Callee-saved registers, switch.s has the offsets
+typedef struct {
+    uint64_t ra;
+    uint64_t sp;
+    uint64_t s[12];
+} ThreadContext_t;
+
+typedef struct Thread Thread_t;
+typedef void (*thread_function_t)(void* arg);
+
+struct Thread {
+    ThreadContext_t context;  // First, so switch.s can take the thread pointer as is
+    volatile uint32_t state;
+    volatile uint32_t on_cpu; // Registers still live on a hart, nobody may switch to it until clear
+    uint32_t id;
+    uint32_t cpu;             // Hart it last ran on, wakeups go back there
+    uint32_t flags;
+    void* stack;
+    uint64_t switches;        // Times switched in
+    uint64_t runtime;         // rdtime ticks spent running
+    uint64_t last_start;
+    Thread_t* inbox_next;
+    Thread_t* wait_next;
+    struct WaitQueue* waiting_on; // Set while queued on a wait queue
+    Thread_t* all_next;       // Every thread, for the monitor
+    Thread_t* all_prev;
+    char name[THREAD_NAME_LENGTH];
+};
+
+typedef struct {
+    uint64_t switches;
+    uint64_t switch_cycles; // Summed, from entering schedule() to running the next thread
+    uint64_t worst_switch;
+    uint64_t preemptions;   // Slice ran out and someone else got the hart
+    uint64_t steals;        // Threads taken from other harts
+    uint64_t steal_races;   // Lost the CAS to the owner or another thief
+    uint64_t idle_ticks;    // rdtime ticks in the idle thread
+    uint64_t wfi_ticks;     // ...of which asleep in wfi
+} SchedStats_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t cpu;
+    uint32_t state;
+    uint32_t flags;
+    uint64_t switches;
+    uint64_t runtime;
+    char name[THREAD_NAME_LENGTH];
+} ThreadInfo_t;
+
+void sched_init(void);                            // Boot hart, after slab_init and timer_init
+void sched_start(void) __attribute__((noreturn)); // Every hart, the caller becomes its idle thread
+
+Thread_t* thread_create(const char* name, thread_function_t function, void* arg);
+void thread_exit(void) __attribute__((noreturn));
+void thread_yield(void);
+void thread_sleep_ms(uint64_t ms);
+
+// Blocking: set thread_current()->state to THREAD_BLOCKED (under whatever lock the waker takes),
+// then thread_block. A wake that lands in between just makes thread_block return straight away.
+void thread_block(void);
+int thread_wake(Thread_t* thread); // 1 if it was blocked
+
+// Wait queues, for sleeping until something happens:
+//     wait_prepare(&queue);
+//     if (!condition) thread_block();
+//     wait_finish(&queue);
+// in a loop around the condition. Queuing before the check means a wake can't fall in between.
+typedef struct WaitQueue {
+    spinlock_t lock;
+    Thread_t* head;
+    Thread_t* tail;
+} WaitQueue_t;
+
+#define WAIT_QUEUE_INIT { .lock = SPINLOCK_INIT, .head = NULL, .tail = NULL }
+
+void wait_prepare(WaitQueue_t* queue);
+void wait_finish(WaitQueue_t* queue);
+int wake_up(WaitQueue_t* queue, int count); // Wakes up to count waiters, oldest first, returns how many
+
+// One load off tp, so there's no window where we could migrate between finding the hart and reading it
+static inline Thread_t* thread_current(void) {
+    Thread_t* thread;
+    asm volatile("ld %0, %1(tp)" : "=r"(thread) : "i"(offsetof(PerCpu_t, current)));
+    return thread;
+}
+
+// Interrupts off around the update: a preemption between reading tp and the store could
+// land us on another hart, bumping the wrong counter
+static inline void preempt_disable(void) {
+    uint64_t flags = irq_save();
+    this_cpu()->preempt_count++;
+    irq_restore(flags);
+}
+
+static inline void preempt_enable(void) {
+    uint64_t flags = irq_save();
+    this_cpu()->preempt_count--;
+    irq_restore(flags);
+}
+
+void sched_irq_exit(void); // trap.c, on the way out of every interrupt
+
+uint32_t sched_idle_mask(void); // Harts asleep in the idle loop, by cpu index
+void sched_stats(unsigned int cpu, SchedStats_t* output);
+int thread_list(ThreadInfo_t* output, int max);
+const char* thread_state_name(uint32_t state);
+
+#endif // SCHED_H
@@ -0,0 +1,81 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <riscv.h>
+#include <sync.h>
+
+#define SLAB_MAGAZINE_SIZE 14 // Rounds per magazine, keeps a magazine at 128 bytes
+#define SLAB_NAME_LENGTH 24
+
+#define SLAB_NO_MAGAZINES (1u << 0) // Internal caches that back the magazine layer itself
+
+// Fixed-size stack of free objects, each hart keeps two per cache
+typedef struct SlabMagazine {
+    struct SlabMagazine* next; // Depot linkage
+    size_t rounds;
+    void* objects[SLAB_MAGAZINE_SIZE];
+} SlabMagazine_t;
+
+typedef struct {
+    SlabMagazine_t* loaded;
+    SlabMagazine_t* previous;
+    uint64_t hits;   // Served from this hart's magazines
+    uint64_t misses; // Had to go to the depot or the slabs
+} SlabCpuCache_t;
+
+// Header at the start of every slab block (blocks are naturally aligned, so ptr & ~(size - 1) finds it)
+typedef struct Slab {
+    struct Slab* next;
+    struct Slab* prev;
+    struct SlabCache* cache;
+    void* free_list;
+    unsigned int in_use;
+} Slab_t;
+
+typedef struct SlabCache {
+    char name[SLAB_NAME_LENGTH];
+    size_t object_size;
+    size_t object_offset;          // First object, past the slab header
+    unsigned int slab_order;       // Pages per slab = 2^slab_order
+    unsigned int objects_per_slab;
+    unsigned int flags;
+
+    spinlock_t lock; // Depot and slab lists, never taken on the magazine fast path
+    Slab_t* partial;
+    Slab_t* full;
+    Slab_t* empty;
+    SlabMagazine_t* depot_full;
+    SlabMagazine_t* depot_empty;
+    size_t slab_count;
+    size_t slab_in_use;            // Objects out of the slabs, including those parked in magazines
+
+    SlabCpuCache_t cpu[MAX_HARTS];
+    struct SlabCache* next;        // All caches, for slabinfo
+} SlabCache_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    size_t slabs;
+    size_t total;    // Object slots across all slabs
+    size_t active;   // Handed out to callers
+    size_t cached;   // Sitting in magazines
+} SlabStats_t;
+
+void slab_init(void);
+
+SlabCache_t* slab_cache_create(const char* name, size_t size, size_t align, unsigned int flags);
+void slab_cache_destroy(SlabCache_t* cache);
+void* slab_alloc(SlabCache_t* cache);
+void slab_free(SlabCache_t* cache, void* object);
+
+// Size-class front end, anything bigger than the last class goes straight to the page allocator
+void* kmalloc(size_t size);
+void kfree(void* pointer);
+
+SlabCache_t* slab_cache_first(void);
+void slab_cache_stats(SlabCache_t* cache, SlabStats_t* stats);
+
+#endif // SLAB_H
@@ -0,0 +1,154 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <riscv.h>
+#include <atomic.h>
+
+// Locks for SMP:
+//  spinlock_t   ticket lock, FIFO and a single amoadd to take, the default
+//  mcs_lock_t   queue lock, every waiter spins on its own node, for locks all harts fight over
+//  rwlock_t     readers share, a waiting writer holds off new readers
+//  rlock_t      ticket lock a hart may retake while holding it (console: panic inside kprintf)
+// Every lock keeps LockStats_t, updated while held so the counters need no atomics.
+
+typedef struct {
+    uint64_t acquisitions;
+    uint64_t contended;   // Acquisitions that had to wait
+    uint64_t spin_cycles; // rdcycle spent waiting, summed over contended acquisitions
+} LockStats_t;
+
+static inline void lock_stats_record(LockStats_t* stats, uint64_t waited) {
+    stats->acquisitions++;
+    if (waited) {
+        stats->contended++;
+        stats->spin_cycles += waited;
+    }
+}
+
+// Named stats shown by the monitor's 'locks' command
+#define LOCK_STATS_MAX 32
+void lock_stats_register(const char* name, const LockStats_t* stats);
+int lock_stats_count(void);
+const char* lock_stats_get(int index, LockStats_t* output);
+
+// ---- Ticket lock ----
+typedef struct {
+    union {
+        volatile uint64_t word; // For trylock's CAS
+        struct {
+            volatile uint32_t owner; // Ticket being served
+            volatile uint32_t next;  // Next ticket to hand out
+        };
+    };
+    LockStats_t stats;
+} spinlock_t;
+
+#define SPINLOCK_INIT { .word = 0, .stats = { 0, 0, 0 } }
+#define TICKET_ONE (1ull << 32) // +1 on next in the combined word
+
+static inline void spin_lock(spinlock_t* lock) {
+    uint32_t ticket = (uint32_t) (atomic_fetch_add64(&lock->word, TICKET_ONE) >> 32);
+    uint64_t waited = 0;
+    if (atomic_load_acquire32(&lock->owner) != ticket) {
+        uint64_t start = rdcycle();
+        while (atomic_load_acquire32(&lock->owner) != ticket) cpu_relax();
+        waited = rdcycle() - start;
+        if (waited == 0) waited = 1;
+    }
+    lock_stats_record(&lock->stats, waited);
+}
+
+static inline int spin_trylock(spinlock_t* lock) {
+    uint64_t word = lock->word;
+    if ((uint32_t) word != (uint32_t) (word >> 32)) return 0; // Held or queued
+    if (atomic_cas64(&lock->word, word, word + TICKET_ONE) != word) return 0;
+    lock_stats_record(&lock->stats, 0);
+    return 1;
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    atomic_store_release32(&lock->owner, lock->owner + 1); // Only the holder writes owner
+}
+
+static inline int spin_is_locked(spinlock_t* lock) {
+    uint64_t word = lock->word;
+    return (uint32_t) word != (uint32_t) (word >> 32);
+}
+
+// Lock + interrupts off, for data also touched from trap context
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+// ---- MCS lock ----
+// The caller supplies the queue node (usually on its stack) and passes the same one to unlock
+typedef struct McsNode {
+    struct McsNode* volatile next;
+    volatile uint32_t locked;
+} McsNode_t;
+
+typedef struct {
+    McsNode_t* volatile tail;
+    LockStats_t stats;
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT { .tail = NULL, .stats = { 0, 0, 0 } }
+
+void mcs_lock(mcs_lock_t* lock, McsNode_t* node);
+void mcs_unlock(mcs_lock_t* lock, McsNode_t* node);
+
+static inline uint64_t mcs_lock_irqsave(mcs_lock_t* lock, McsNode_t* node) {
+    uint64_t flags = irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t* lock, McsNode_t* node, uint64_t flags) {
+    mcs_unlock(lock, node);
+    irq_restore(flags);
+}
+
+// ---- Reader-writer lock ----
+#define RWLOCK_WRITER  (1u << 31)
+#define RWLOCK_WAITING (1u << 30) // A writer is queued, readers back off
+#define RWLOCK_READERS (RWLOCK_WAITING - 1)
+
+typedef struct {
+    volatile uint32_t state;
+    LockStats_t stats; // Writers only, readers don't hold anything exclusively to count under
+} rwlock_t;
+
+#define RWLOCK_INIT { .state = 0, .stats = { 0, 0, 0 } }
+
+void read_lock(rwlock_t* lock);
+void read_unlock(rwlock_t* lock);
+void write_lock(rwlock_t* lock);
+void write_unlock(rwlock_t* lock);
+
+// ---- Hart-recursive lock ----
+#define RLOCK_NO_OWNER 0xffffffffu
+
+typedef struct {
+    spinlock_t lock;
+    volatile uint32_t owner; // cpu_index() of the holder
+    uint32_t depth;
+    uint64_t flags;          // irq state from the outermost acquire
+} rlock_t;
+
+#define RLOCK_INIT { .lock = SPINLOCK_INIT, .owner = RLOCK_NO_OWNER, .depth = 0, .flags = 0 }
+
+// Takes interrupts off for as long as the lock is held
+void rlock_acquire(rlock_t* lock);
+void rlock_release(rlock_t* lock);
+void rlock_force(rlock_t* lock); // Steal it for this hart no matter who holds it (panic)
+
+#endif // SYNC_H
@@ -0,0 +1,75 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <riscv.h>
+#include <sync.h>
+
+// Clock source: rdtime, at the /cpus timebase-frequency from the FDT
+void clock_init(void);
+uint64_t clock_hz(void);
+static inline uint64_t clock_now(void) {
+    return rdtime();
+}
+uint64_t clock_ticks_to_ns(uint64_t ticks);
+uint64_t clock_us_to_ticks(uint64_t us);
+uint64_t clock_ms_to_ticks(uint64_t ms);
+
+// Timers: each hart has a hierarchical wheel (Varghese & Lauck, cascading like the classic
+// Linux one). Level 0 has 256 slots of one granule, levels 1-4 have 64 slots each covering 64x
+// the level below, 2^32 granules in all. Arm and cancel are a list insert/unlink plus a bitmap
+// bit. Bitmaps also let the wheel jump straight to the next slot with work, so the hardware
+// deadline is only ever the next expiry or cascade, with no periodic tick.
+
+#define TIMER_LEVELS     5
+#define TIMER_L0_BITS    8
+#define TIMER_LN_BITS    6
+#define TIMER_L0_SLOTS   (1u << TIMER_L0_BITS)
+#define TIMER_LN_SLOTS   (1u << TIMER_LN_BITS)
+#define TIMER_SLOTS      (TIMER_L0_SLOTS + (TIMER_LEVELS - 1) * TIMER_LN_SLOTS)
+#define TIMER_RANGE_BITS (TIMER_L0_BITS + (TIMER_LEVELS - 1) * TIMER_LN_BITS) // Further out gets re-cascaded
+
+typedef struct Timer Timer_t;
+typedef struct TimerWheel TimerWheel_t;
+typedef void (*timer_function_t)(Timer_t* timer);
+
+struct Timer {
+    Timer_t* next;
+    Timer_t* prev;
+    uint64_t expires;          // Absolute, clock ticks
+    timer_function_t function; // Runs on the arming hart, in interrupt context, interrupts off
+    void* data;
+    TimerWheel_t* wheel;       // Set while pending, until its function is about to run. NULL to set only by CAS.
+    uint16_t slot;             // Which list it's on, so cancel doesn't have to look
+};
+
+#define TIMER_SLOT_EXPIRED 0xffff // Due, on the wheel's expired list waiting to run
+
+struct TimerWheel {
+    spinlock_t lock;
+    uint64_t now;        // Next granule to process
+    uint64_t deadline;   // What the hardware is programmed to, in ticks
+    uint64_t pending;
+    uint64_t fired;
+    uint64_t cascaded;   // Timers moved down a level
+    uint64_t interrupts;
+    Timer_t* slots[TIMER_SLOTS];
+    Timer_t* expired;    // Due, each taken off under the lock right before it runs
+    Timer_t* running;    // Whose function is running right now, timer_cancel waits it out
+    uint64_t bitmap[TIMER_SLOTS / 64]; // Which slots have timers
+};
+
+void timer_init(void);       // Boot hart: clock, wheels, the timer interrupt
+void timer_init_local(void); // Every other hart
+
+void timer_setup(Timer_t* timer, timer_function_t function, void* data);
+void timer_arm(Timer_t* timer, uint64_t expires); // (Re)arms on this hart's wheel
+void timer_arm_after(Timer_t* timer, uint64_t ticks);
+int timer_cancel(Timer_t* timer);                  // 1 if it was pending. Its function has finished on return
+                                                   // (not from a function that another hart's may be cancelling)
+int timer_pending(const Timer_t* timer);
+
+const TimerWheel_t* timer_wheel(unsigned int cpu);
+
+#endif // TIMER_H
@@ -0,0 +1,55 @@
+#ifndef TLB_H
+#define TLB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sync.h>
+
+// TLB shootdown. Invalidations are queued on their address space and merged into a handful of
+// ranges, then tlb_flush sends them in one go: one SBI remote fence per range, only to harts that
+// have had the space in satp, or one full flush once there's more than TLB_FLUSH_ALL_PAGES.
+// Harts asleep in the idle loop aren't woken for it, they flush everything on the way out.
+
+#define TLB_BATCH_RANGES    8
+#define TLB_FLUSH_ALL_PAGES 32 // Past this, page-by-page fences cost more than refilling the TLB
+
+struct VmSpace;
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} TlbRange_t;
+
+typedef struct {
+    spinlock_t lock;
+    uint32_t count;
+    uint32_t full;    // Too much to track, flush everything
+    TlbRange_t ranges[TLB_BATCH_RANGES];
+} TlbBatch_t;
+
+typedef struct {
+    uint64_t queued_pages;  // Handed to tlb_queue, before merging
+    uint64_t flushed_pages; // Sent as page fences after merging (full flushes not included)
+    uint64_t full_flushes;
+    uint64_t batches;       // tlb_flush calls with something to send
+    uint64_t fences_sent;   // SBI remote fence calls
+    uint64_t ipis_sent;     // Fallback when the firmware has no RFENCE
+    uint64_t lazy_skips;    // Idle harts left to flush when they wake
+    uint64_t local_fences;  // sfence.vma on the flushing hart
+} TlbStats_t;
+
+void tlb_init(void); // Boot hart, before anything is unmapped
+void tlb_queue(struct VmSpace* space, uintptr_t address, size_t size);
+void tlb_flush(struct VmSpace* space); // Returns once no hart can still use what was queued
+
+// tlb_flush in two halves, for callers that must take the batch together with something else
+// (vm_sync, with the tables it covers). freeing_tables fences idle harts too instead of leaving
+// them to flush on wake.
+void tlb_take(struct VmSpace* space, TlbBatch_t* work);
+void tlb_flush_taken(struct VmSpace* space, const TlbBatch_t* work, int freeing_tables);
+
+void tlb_ipi(void);       // Software interrupt, for the no-RFENCE fallback
+void tlb_idle_exit(void); // Idle loop, after leaving sched's idle mask
+void tlb_stats(TlbStats_t* output);
+
+#endif // TLB_H
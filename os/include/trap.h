@@ -0,0 +1,67 @@
+#ifndef TRAP_H
+#define TRAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Saved state, built by trap.s. regs[] is indexed by register number (regs[2] is sp before
+// the trap). Interrupts only fill the caller-saved registers, exceptions fill everything.
+typedef struct {
+    uint64_t regs[32];
+    uint64_t sepc;
+    uint64_t sstatus;
+    uint64_t stval;   // Exceptions only
+    uint64_t scause;  // Exceptions only
+    uint64_t cycles;  // rdcycle at entry
+    uint64_t pad;     // Keeps the frame 16-byte aligned
+} TrapFrame_t;
+
+_Static_assert(sizeof(TrapFrame_t) == 304, "trap.s FRAME_SIZE is out of sync");
+
+#define TRAP_CAUSES 16 // Per kind, both tables cover scause codes 0..15
+
+#define SCAUSE_INTERRUPT (1ull << 63)
+
+// Interrupt causes
+#define IRQ_S_SOFT  1
+#define IRQ_S_TIMER 5
+#define IRQ_S_EXT   9
+
+// Exception causes
+#define EXC_INSTRUCTION_MISALIGNED 0
+#define EXC_INSTRUCTION_FAULT      1
+#define EXC_ILLEGAL_INSTRUCTION    2
+#define EXC_BREAKPOINT             3
+#define EXC_LOAD_MISALIGNED        4
+#define EXC_LOAD_FAULT             5
+#define EXC_STORE_MISALIGNED       6
+#define EXC_STORE_FAULT            7
+#define EXC_ECALL_U                8
+#define EXC_ECALL_S                9
+#define EXC_INSTRUCTION_PAGE_FAULT 12
+#define EXC_LOAD_PAGE_FAULT        13
+#define EXC_STORE_PAGE_FAULT       15
+
+typedef void (*trap_handler_t)(TrapFrame_t* frame);
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_cycles; // Entry to handler return
+    uint64_t worst_cycles;
+} TrapStats_t;
+
+void trap_init(void);       // Once, on the boot hart
+void trap_init_local(void); // Every hart: point stvec at the vector
+
+int trap_register_interrupt(unsigned int cause, trap_handler_t handler);
+int trap_register_exception(unsigned int cause, trap_handler_t handler);
+
+// sie bits, so a subsystem turns on its own source once its handler is in place
+void trap_enable_interrupt(unsigned int cause);
+void trap_disable_interrupt(unsigned int cause);
+
+// Summed over every hart
+void trap_stats(int interrupt, unsigned int cause, TrapStats_t* output);
+const char* trap_cause_name(int interrupt, unsigned int cause);
+
+#endif // TRAP_H
@@ -4,7 +4,7 @@
 #include <stdint.h>
 #include <stddef.h>
 
-static volatile uintptr_t g_uart_base = 0; // Global UART base address
+extern volatile uintptr_t g_uart_base; // Global UART base address, defined in uart.c
 
 // This is a big one:
 // __attribute__((packed)) ensures no padding is added by the compiler, this is necessary
@@ -27,10 +27,43 @@ typedef struct __attribute__((packed)) {
 
 #define UART(base) ((ns16550_8_t*) (uintptr_t) (base)) // Cast base address to struct pointer
 
+// Register bits we care about
+#define UART_IER_ERBFI 0x01 // Received data available interrupt
+#define UART_IER_ETBEI 0x02 // Transmit holding register empty interrupt
+#define UART_IIR_NO_INT 0x01
+#define UART_IIR_ID_MASK 0x0e
+#define UART_IIR_MSR 0x00
+#define UART_IIR_THRE 0x02
+#define UART_IIR_RDA 0x04
+#define UART_IIR_RLS 0x06
+#define UART_IIR_TIMEOUT 0x0c
+#define UART_LSR_DR 0x01   // Data ready
+#define UART_LSR_THRE 0x20 // TX FIFO empty
+#define UART_MCR_OUT2 0x08 // Gates the IRQ line on PC-style boards
+
+#define UART_FIFO_DEPTH 16
+#define UART_TX_RING_SIZE 4096 // Both rings must be powers of two
+#define UART_RX_RING_SIZE 256
+
 void uart_init(uintptr_t base);
 void uart_putc(char c);
 void uart_puts(const char* str);
+void uart_write(const char* data, size_t length);
+void uart_write_binary(const void* data, size_t length);
 char uart_getc(void);
-void uart_gets(char* buffer, size_t max_length);
+int uart_poll(void); // Next byte if there is one, -1 without waiting
+
+// Interrupt-driven mode, the trap path calls uart_irq_handler for the UART's external interrupt
+void uart_enable_interrupts(void);
+void uart_disable_interrupts(void);
+void uart_irq_handler(void* data);
+void uart_flush(void);
+
+// Console lock, per hart recursive. uart_write takes it itself, hold it around several writes
+// that must not be split up; uart_lock_force is for panic, which can't wait on a stuck hart.
+void uart_lock(void);
+void uart_unlock(void);
+void uart_lock_force(void);
+uint32_t uart_irq(void); // Interrupt source from the FDT, 0 if none
 
 #endif // UART_H
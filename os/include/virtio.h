@@ -0,0 +1,156 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <driver.h>
+#include <sync.h>
+
+// virtio over MMIO, legacy (version 1, what QEMU hands out unless told otherwise) and modern
+// (version 2). One driver binds every "virtio,mmio" node, reads the device ID and passes the
+// device to the matching virtio driver. Split virtqueues, with event-idx suppression both ways
+// when the device offers it: we only notify when the device asked to hear about the index we
+// just published, and we ask to be interrupted once about half of what's in flight is done.
+
+#define VIRTIO_MMIO_MAGIC_VALUE     0x000
+#define VIRTIO_MMIO_VERSION         0x004
+#define VIRTIO_MMIO_DEVICE_ID       0x008
+#define VIRTIO_MMIO_VENDOR_ID       0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE 0x028 // Legacy
+#define VIRTIO_MMIO_QUEUE_SEL       0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX   0x034
+#define VIRTIO_MMIO_QUEUE_NUM       0x038
+#define VIRTIO_MMIO_QUEUE_ALIGN     0x03c // Legacy
+#define VIRTIO_MMIO_QUEUE_PFN       0x040 // Legacy
+#define VIRTIO_MMIO_QUEUE_READY     0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY    0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK   0x064
+#define VIRTIO_MMIO_STATUS          0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW  0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH 0x084
+#define VIRTIO_MMIO_QUEUE_AVAIL_LOW 0x090
+#define VIRTIO_MMIO_QUEUE_AVAIL_HIGH 0x094
+#define VIRTIO_MMIO_QUEUE_USED_LOW  0x0a0
+#define VIRTIO_MMIO_QUEUE_USED_HIGH 0x0a4
+#define VIRTIO_MMIO_CONFIG          0x100
+
+#define VIRTIO_MAGIC 0x74726976 // "virt"
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER      2
+#define VIRTIO_STATUS_DRIVER_OK   4
+#define VIRTIO_STATUS_FEATURES_OK 8
+#define VIRTIO_STATUS_FAILED      128
+
+#define VIRTIO_INTERRUPT_USED   1
+#define VIRTIO_INTERRUPT_CONFIG 2
+
+#define VIRTIO_F_RING_EVENT_IDX 29
+#define VIRTIO_F_VERSION_1      32
+
+#define VIRTIO_ID_NET     1
+#define VIRTIO_ID_BLOCK   2
+#define VIRTIO_ID_CONSOLE 3
+
+#define VIRTIO_MAX_DEVICES 8
+
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2 // Device writes this buffer
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+#define VIRTQ_USED_F_NO_NOTIFY 1
+#define VIRTQ_MAX_SIZE 256
+#define VIRTQ_ALIGN 4096 // Legacy layout: the used ring starts on its own page
+
+typedef struct {
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} VirtqDesc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring[]; // size entries, then used_event
+} VirtqAvail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t length;
+} VirtqUsedElem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t index;
+    VirtqUsedElem_t ring[]; // size entries, then avail_event
+} VirtqUsed_t;
+
+typedef struct VirtioDevice VirtioDevice_t;
+
+typedef struct {
+    VirtioDevice_t* device;
+    spinlock_t lock;          // Held around add/kick and get/arm, submitters and the interrupt race otherwise
+    uint16_t index;
+    uint16_t size;
+    volatile VirtqDesc_t* desc;
+    volatile VirtqAvail_t* avail;
+    volatile VirtqUsed_t* used;
+    volatile uint16_t* used_event;  // Past the avail ring, where we want the next interrupt
+    volatile uint16_t* avail_event; // Past the used ring, where the device wants the next notify
+    void* memory;
+    uint16_t free_head;       // Free descriptors are chained through next
+    uint16_t free_count;
+    uint16_t avail_index;     // Next avail slot, published by virtq_kick
+    uint16_t kicked_index;    // What the device has been told about
+    uint16_t last_used;
+    uint16_t inflight;
+    uint64_t notifies;
+    uint64_t suppressed;      // Kicks the device said it didn't need
+    void* tokens[VIRTQ_MAX_SIZE]; // By head descriptor
+} Virtqueue_t;
+
+typedef struct {
+    uint64_t address; // Physical
+    uint32_t length;
+    uint32_t writable;
+} VirtqBuffer_t;
+
+struct VirtioDevice {
+    uintptr_t base;
+    uint32_t version;
+    uint32_t device_id;
+    uint32_t irq;
+    uint64_t features;        // Negotiated
+    const FDTNode_t* node;
+    void (*interrupt)(VirtioDevice_t* device); // Used ring moved, set by the device driver
+    void* driver;
+    uint64_t interrupts;
+};
+
+// Device drivers, virtio.c calls the one matching the device ID
+int virtio_blk_probe(VirtioDevice_t* device);
+int virtio_console_probe(VirtioDevice_t* device);
+
+// Transport. virtio_negotiate offers wanted & what the device has, < 0 if the device balks
+int virtio_negotiate(VirtioDevice_t* device, uint64_t wanted);
+void virtio_ready(VirtioDevice_t* device); // DRIVER_OK, after the queues are set up
+void virtio_fail(VirtioDevice_t* device);
+int virtio_has(const VirtioDevice_t* device, unsigned int feature);
+uint32_t virtio_config_read32(const VirtioDevice_t* device, uint32_t offset);
+uint64_t virtio_config_read64(const VirtioDevice_t* device, uint32_t offset);
+int virtio_enable_interrupt(VirtioDevice_t* device);
+void virtio_disable_interrupt(VirtioDevice_t* device);
+
+// Virtqueues. add/kick/get/arm with queue->lock held.
+int virtq_setup(VirtioDevice_t* device, Virtqueue_t* queue, uint16_t index, uint16_t max_size);
+int virtq_add(Virtqueue_t* queue, const VirtqBuffer_t* buffers, int count, void* token); // Head descriptor, < 0 if full
+int virtq_kick(Virtqueue_t* queue);  // Publishes everything added, 1 if the device had to be notified
+void* virtq_get(Virtqueue_t* queue, uint32_t* length); // Next completed token, NULL when caught up
+int virtq_arm(Virtqueue_t* queue);   // Asks for the next interrupt, 1 if more completed meanwhile (get again)
+
+#endif // VIRTIO_H
@@ -0,0 +1,83 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sync.h>
+#include <tlb.h>
+
+// Sv39 kernel page tables. Everything is mapped at its physical address, so turning paging on
+// changes no pointers: RAM through 1 GiB and 2 MiB leaves wherever alignment allows, the kernel
+// image in 4 KiB pages with per-section permissions, and every MMIO region the FDT lists as
+// device memory. All harts share the one table.
+
+#define VM_LEVELS     3
+#define VM_PTES       512
+#define VM_LEVEL_SIZE(level) (1ull << (12 + 9 * (level))) // 4 KiB, 2 MiB, 1 GiB
+#define VM_VPN(address, level) (((uint64_t) (address) >> (12 + 9 * (level))) & (VM_PTES - 1))
+#define VM_USER_TOP   (1ull << 38) // Lower half of the 39-bit space, the upper half is unused for now
+
+#define PTE_V (1ull << 0)
+#define PTE_R (1ull << 1)
+#define PTE_W (1ull << 2)
+#define PTE_X (1ull << 3)
+#define PTE_U (1ull << 4)
+#define PTE_G (1ull << 5)
+#define PTE_A (1ull << 6)
+#define PTE_D (1ull << 7)
+#define PTE_PBMT_NC (1ull << 61) // Svpbmt: non-cacheable, idempotent
+#define PTE_PBMT_IO (2ull << 61) // Svpbmt: non-cacheable, strongly ordered
+#define PTE_PPN_SHIFT 10
+#define PTE_FLAGS_MASK 0x3ffull
+
+#define SATP_MODE_SV39 (8ull << 60)
+
+// Protections for vm_map
+#define VM_READ   PTE_R
+#define VM_WRITE  PTE_W
+#define VM_EXEC   PTE_X
+#define VM_DEVICE (1ull << 8) // Strongly ordered I/O, turned into PBMT_IO when the hart has Svpbmt
+
+// Biggest leaf vm_map may use
+#define VM_LEAF_4K 0
+#define VM_LEAF_2M 1
+#define VM_LEAF_1G 2
+
+typedef uint64_t pte_t;
+
+typedef struct VmSpace {
+    pte_t* root;
+    uint64_t satp;
+    uint16_t asid;          // 0 is the kernel's, whose mappings are all global
+    volatile uint32_t cpus; // Harts that have had it in satp, by cpu index
+    spinlock_t lock;        // Tables
+    TlbBatch_t batch;       // Invalidations not sent yet
+    pte_t* deferred;        // Unhooked tables a walker may still be in, freed after the next flush
+} VmSpace_t;
+
+extern VmSpace_t vm_kernel; // The only one so far
+
+typedef struct {
+    uint64_t leaves[VM_LEVELS]; // By level, [0] is 4 KiB
+    uint64_t tables;
+} VmStats_t;
+
+int vm_init(void);       // Boot hart, after memory_init: builds the tables and turns paging on
+void vm_init_local(void); // Every other hart, first thing
+
+// Page granular, sizes and addresses are rounded out to pages. Leaves already in the way are
+// replaced, bigger ones split first. Both shoot the range down on every hart before returning.
+int vm_map(uintptr_t virtual_address, uint64_t physical_address, size_t size, uint64_t protection, unsigned int max_leaf);
+int vm_unmap(uintptr_t virtual_address, size_t size);
+
+// Unmap now, shoot down later: the memory mustn't be reused until vm_sync, which sends
+// everything queued since the last one as a single batch
+int vm_unmap_queued(uintptr_t virtual_address, size_t size);
+void vm_sync(void);
+int vm_map_device(uint64_t base, size_t size);
+
+int vm_translate(uintptr_t virtual_address, uint64_t* physical_address, unsigned int* level); // < 0 if unmapped
+int vm_enabled(void);
+void vm_stats(VmStats_t* output);
+
+#endif // VM_H
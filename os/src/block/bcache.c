@@ -0,0 +1,442 @@
+#include <bcache.h>
+#include <page_alloc.h>
+#include <slab.h>
+#include <sched.h>
+#include <sync.h>
+#include <klog.h>
+#include <mini_lib.h>
+
+// One lock over the hash, the clock and every buffer's flags; completions take it from the
+// interrupt, so it's irqsave. A buffer is in the hash exactly when its device is set.
+// Nobody sleeps on a buffer directly: everything waiting for I/O sits on io_wait, which every
+// completion wakes, and rechecks its own buffer.
+
+#define DATA_CHUNK_ORDER 8 // Buffer data comes from the page allocator 1 MiB at a time
+
+typedef struct {
+    BlockDevice_t* device;
+    uint64_t last;   // Last block asked for
+    uint64_t next;   // First block not read ahead yet
+    uint32_t window; // 0 until reads turn sequential
+} Readahead_t;
+
+static Buffer_t* buffers = NULL;
+static uint32_t buffer_count = 0;
+static uint32_t clock_hand = 0;
+static Buffer_t** hash_table = NULL;
+static uint32_t hash_mask = 0;
+static Readahead_t readahead[BLOCK_MAX_DEVICES];
+static BcacheStats_t stats;
+static spinlock_t bcache_lock = SPINLOCK_INIT;
+static WaitQueue_t io_wait = WAIT_QUEUE_INIT;
+
+static inline uint32_t hash_of(const BlockDevice_t* device, uint64_t block) {
+    uint64_t key = (block + (uintptr_t) device) * 0x9e3779b97f4a7c15ull;
+    return (uint32_t) (key >> 32) & hash_mask;
+}
+
+static Buffer_t* lookup(const BlockDevice_t* device, uint64_t block) {
+    for (Buffer_t* buffer = hash_table[hash_of(device, block)]; buffer; buffer = buffer->hash_next) {
+        if (buffer->device == device && buffer->block == block) return buffer;
+    }
+    return NULL;
+}
+
+static void hash_insert(Buffer_t* buffer, BlockDevice_t* device, uint64_t block) {
+    Buffer_t** head = &hash_table[hash_of(device, block)];
+    buffer->device = device;
+    buffer->block = block;
+    buffer->hash_next = *head;
+    *head = buffer;
+}
+
+static void hash_remove(Buffer_t* buffer) {
+    Buffer_t** link = &hash_table[hash_of(buffer->device, buffer->block)];
+    while (*link != buffer) link = &(*link)->hash_next;
+    *link = buffer->hash_next;
+    buffer->hash_next = NULL;
+    buffer->device = NULL;
+}
+
+// CLOCK: sweep from the hand, clearing reference bits, and take the first buffer nobody holds,
+// nobody is doing I/O on and that isn't dirty. Two laps means every candidate had its chance.
+// Reports what was in the way so the caller knows whether writing back would help.
+static Buffer_t* evict(int* dirty_seen, int* busy_seen) {
+    for (uint32_t step = 0; step < 2 * buffer_count; step++) {
+        Buffer_t* buffer = &buffers[clock_hand];
+        clock_hand = clock_hand + 1 == buffer_count ? 0 : clock_hand + 1;
+
+        if (buffer->flags & BUFFER_IO) {
+            *busy_seen = 1;
+            continue;
+        }
+        if (buffer->references) continue;
+        if (buffer->flags & BUFFER_REFERENCED) {
+            buffer->flags &= ~BUFFER_REFERENCED;
+            continue;
+        }
+        if (buffer->flags & BUFFER_DIRTY) {
+            *dirty_seen = 1;
+            continue;
+        }
+
+        if (buffer->device) {
+            if (buffer->flags & BUFFER_READAHEAD) stats.readahead_wasted++;
+            hash_remove(buffer);
+            stats.evictions++;
+        }
+        buffer->flags = 0;
+        return buffer;
+    }
+    return NULL;
+}
+
+static void prepare(Buffer_t* buffer, uint32_t op) {
+    buffer->flags = (buffer->flags & ~BUFFER_ERROR) | BUFFER_IO;
+    buffer->request.op = op;
+    buffer->request.sector = buffer->block * BCACHE_BLOCK_SECTORS;
+    buffer->request.count = BCACHE_BLOCK_SECTORS;
+}
+
+// Interrupt context
+static void io_done(BlockRequest_t* request) {
+    Buffer_t* buffer = (Buffer_t*) request->data;
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    if (request->op == BLOCK_READ) {
+        if (request->status == 0) {
+            buffer->flags |= BUFFER_VALID;
+        } else {
+            buffer->flags |= BUFFER_ERROR;
+            stats.read_errors++;
+        }
+    } else if (request->status < 0) {
+        if (!(buffer->flags & BUFFER_DIRTY)) stats.dirty++;
+        buffer->flags |= BUFFER_DIRTY; // Still only in memory
+        stats.write_errors++;
+    }
+    buffer->flags &= ~BUFFER_IO;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    wake_up(&io_wait, RUNQUEUE_SIZE);
+}
+
+static void wait_io(Buffer_t* buffer) {
+    while (buffer->flags & BUFFER_IO) {
+        wait_prepare(&io_wait);
+        if (buffer->flags & BUFFER_IO) thread_block();
+        wait_finish(&io_wait);
+    }
+}
+
+// Keeps resubmitting what a full queue didn't take, returns how many went out. The rest
+// fail as if the device had failed them, so nothing is left marked in flight.
+static int submit_all(BlockDevice_t* device, BlockRequest_t** requests, int count) {
+    int done = 0;
+    while (done < count) {
+        int queued = block_submit(device, requests + done, count - done);
+        if (queued < 0) break;
+        done += queued;
+        if (done < count) thread_sleep_ms(1);
+    }
+    for (int i = done; i < count; i++) {
+        requests[i]->status = -1;
+        io_done(requests[i]);
+    }
+    return done;
+}
+
+// Decides whether this read should kick off read-ahead, and of which blocks. The window starts
+// at BCACHE_READAHEAD_MIN on the second sequential block and doubles each time the reader
+// gets within half a window of what's been fetched.
+static uint32_t plan_readahead(BlockDevice_t* device, uint64_t block, uint64_t* first) {
+    Readahead_t* state = NULL;
+    for (unsigned int i = 0; i < BLOCK_MAX_DEVICES && !state; i++) {
+        if (readahead[i].device == device || !readahead[i].device) state = &readahead[i];
+    }
+    if (!state) return 0;
+    if (!state->device) {
+        state->device = device;
+        state->last = block;
+        state->next = block + 1;
+        return 0;
+    }
+
+    int sequential = block == state->last + 1;
+    state->last = block;
+    if (!sequential) {
+        state->window = 0;
+        state->next = block + 1;
+        return 0;
+    }
+
+    if (state->next < block + 1) state->next = block + 1;
+    if (state->window == 0) {
+        state->window = BCACHE_READAHEAD_MIN;
+    } else if (state->next > block + state->window / 2) {
+        return 0;
+    } else if (state->window < BCACHE_READAHEAD_MAX) {
+        state->window *= 2;
+    }
+
+    uint64_t end = block + 1 + state->window;
+    uint64_t limit = device->sectors / BCACHE_BLOCK_SECTORS;
+    if (end > limit) end = limit;
+    if (end > state->next + BCACHE_READAHEAD_MAX) end = state->next + BCACHE_READAHEAD_MAX;
+    if (state->next >= end) return 0;
+
+    *first = state->next;
+    state->next = end;
+    return (uint32_t) (end - *first);
+}
+
+Buffer_t* bcache_get(BlockDevice_t* device, uint64_t block) {
+    if (!buffers || (block + 1) * BCACHE_BLOCK_SECTORS > device->sectors) return NULL;
+
+    BlockRequest_t* batch[1 + BCACHE_READAHEAD_MAX];
+    int count = 0;
+
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    stats.lookups++;
+    Buffer_t* buffer = lookup(device, block);
+    if (buffer) {
+        stats.hits++;
+        if (buffer->flags & BUFFER_IO) stats.waits++;
+        if (buffer->flags & BUFFER_READAHEAD) stats.readahead_used++;
+    } else {
+        stats.misses++;
+        for (int attempt = 0; !buffer; attempt++) {
+            int dirty_seen = 0, busy_seen = 0;
+            buffer = evict(&dirty_seen, &busy_seen);
+            if (buffer) break;
+
+            // Everything's pinned, dirty or busy: write back or wait, then look again since
+            // someone may have brought the block in meanwhile
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            if (attempt == 3 || (!dirty_seen && !busy_seen)) return NULL;
+            if (dirty_seen) {
+                stats.evicted_dirty++;
+                bcache_sync(NULL);
+            } else {
+                thread_sleep_ms(1);
+            }
+            flags = spin_lock_irqsave(&bcache_lock);
+            buffer = lookup(device, block);
+        }
+        if (!buffer->device) hash_insert(buffer, device, block);
+    }
+    buffer->flags = (buffer->flags & ~BUFFER_READAHEAD) | BUFFER_REFERENCED;
+    buffer->references++;
+
+    // A fresh buffer, or one whose last read failed or never went out
+    if (!(buffer->flags & (BUFFER_VALID | BUFFER_IO))) {
+        prepare(buffer, BLOCK_READ);
+        batch[count++] = &buffer->request;
+    }
+
+    // Read-ahead rides in the same batch as the read, only into buffers that are free to take
+    uint64_t first = 0;
+    uint32_t ahead = plan_readahead(device, block, &first);
+    for (uint32_t i = 0; i < ahead; i++) {
+        if (lookup(device, first + i)) continue;
+        int dirty_seen = 0, busy_seen = 0;
+        Buffer_t* extra = evict(&dirty_seen, &busy_seen);
+        if (!extra) break;
+        hash_insert(extra, device, first + i);
+        prepare(extra, BLOCK_READ);
+        extra->flags |= BUFFER_READAHEAD;
+        batch[count++] = &extra->request;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    if (count) {
+        int own = batch[0] == &buffer->request;
+        int queued = block_submit(device, batch, count);
+        if (queued < 0) queued = 0;
+        if (own && queued == 0) {
+            submit_all(device, batch, 1);
+            queued = 1;
+        }
+
+        // Read-ahead the queue had no room for isn't worth waiting for, hand the buffers back.
+        // Anyone who found one meanwhile wakes to a buffer that was never read and reads it.
+        flags = spin_lock_irqsave(&bcache_lock);
+        stats.readahead_issued += (uint64_t) (queued - own);
+        for (int i = queued; i < count; i++) {
+            Buffer_t* extra = (Buffer_t*) batch[i]->data;
+            extra->flags &= ~(BUFFER_IO | BUFFER_READAHEAD);
+            if (!extra->references) hash_remove(extra);
+        }
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        if (queued < count) wake_up(&io_wait, RUNQUEUE_SIZE);
+    }
+
+    for (;;) {
+        wait_io(buffer);
+        if (buffer->flags & (BUFFER_VALID | BUFFER_ERROR)) break;
+
+        flags = spin_lock_irqsave(&bcache_lock);
+        int issue = !(buffer->flags & (BUFFER_VALID | BUFFER_IO | BUFFER_ERROR));
+        if (issue) prepare(buffer, BLOCK_READ);
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        if (issue) {
+            BlockRequest_t* request = &buffer->request;
+            submit_all(device, &request, 1);
+        }
+    }
+
+    if (!(buffer->flags & BUFFER_VALID)) {
+        bcache_release(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+void bcache_release(Buffer_t* buffer) {
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    buffer->references--;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+void bcache_mark_dirty(Buffer_t* buffer) {
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    if (!(buffer->flags & BUFFER_DIRTY)) stats.dirty++;
+    buffer->flags |= BUFFER_DIRTY | BUFFER_VALID;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+static void sort_by_block(BlockRequest_t** requests, int count) {
+    for (int i = 1; i < count; i++) {
+        BlockRequest_t* request = requests[i];
+        int j = i;
+        while (j > 0 && requests[j - 1]->sector > request->sector) {
+            requests[j] = requests[j - 1];
+            j--;
+        }
+        requests[j] = request;
+    }
+}
+
+// Writes back in batches of BCACHE_WRITEBACK_BATCH, each in block order so the device sees
+// one ascending run. Buffers with a write already in flight are skipped on the first pass and
+// picked up on the second, once that write is done.
+static int sync_device(BlockDevice_t* device) {
+    BlockRequest_t* batch[BCACHE_WRITEBACK_BATCH];
+    int errors = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        int skipped = 0;
+        uint32_t position = 0;
+        while (position < buffer_count) {
+            int count = 0;
+            uint64_t flags = spin_lock_irqsave(&bcache_lock);
+            for (; position < buffer_count && count < BCACHE_WRITEBACK_BATCH; position++) {
+                Buffer_t* buffer = &buffers[position];
+                if (buffer->device != device || !(buffer->flags & BUFFER_DIRTY)) continue;
+                if (buffer->flags & BUFFER_IO) {
+                    skipped++;
+                    continue;
+                }
+                buffer->flags &= ~BUFFER_DIRTY;
+                stats.dirty--;
+                prepare(buffer, BLOCK_WRITE);
+                batch[count++] = &buffer->request;
+            }
+            if (count) {
+                stats.writebacks += (uint64_t) count;
+                stats.writeback_batches++;
+            }
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            if (!count) break;
+
+            sort_by_block(batch, count);
+            submit_all(device, batch, count);
+            for (int i = 0; i < count; i++) {
+                wait_io((Buffer_t*) batch[i]->data);
+                if (batch[i]->status < 0) errors++;
+            }
+        }
+        if (!skipped) break;
+    }
+
+    if (errors) klog("bcache: %s: %d block%s failed to write back\n", device->name, errors, errors == 1 ? "" : "s");
+    return errors ? -1 : 0;
+}
+
+int bcache_sync(BlockDevice_t* device) {
+    if (!buffers) return 0;
+
+    int rc = 0;
+    for (unsigned int i = 0; i < block_device_count(); i++) {
+        BlockDevice_t* candidate = block_device(i);
+        if (device && candidate != device) continue;
+        if (candidate->read_only) continue;
+        if (sync_device(candidate) < 0) rc = -1;
+    }
+    return rc;
+}
+
+static void flusher_thread(void* arg) {
+    (void) arg;
+    for (;;) {
+        thread_sleep_ms(BCACHE_FLUSH_MS);
+        if (stats.dirty) bcache_sync(NULL);
+    }
+}
+
+int bcache_init(void) {
+    uint32_t count = (uint32_t) (page_total_count() / BCACHE_RAM_SHARE);
+    if (count < BCACHE_MIN_BUFFERS) count = BCACHE_MIN_BUFFERS;
+    if (count > BCACHE_MAX_BUFFERS) count = BCACHE_MAX_BUFFERS;
+
+    uint32_t buckets = 1;
+    while (buckets < count) buckets <<= 1;
+
+    Buffer_t* headers = (Buffer_t*) kmalloc(count * sizeof(Buffer_t));
+    Buffer_t** table = (Buffer_t**) kmalloc(buckets * sizeof(Buffer_t*));
+    if (!headers || !table) {
+        if (headers) kfree(headers);
+        if (table) kfree(table);
+        return -1;
+    }
+    memset(headers, 0, count * sizeof(Buffer_t));
+    memset(table, 0, buckets * sizeof(Buffer_t*));
+
+    // Data in chunks as big as the allocator will give, settling for fewer buffers if RAM is short
+    uint32_t filled = 0;
+    unsigned int order = DATA_CHUNK_ORDER;
+    while (filled < count) {
+        uint8_t* chunk = (uint8_t*) page_alloc(order);
+        if (!chunk) {
+            if (order == 0) break;
+            order--;
+            continue;
+        }
+        for (uint32_t i = 0; i < (1u << order) && filled < count; i++) {
+            Buffer_t* buffer = &headers[filled++];
+            buffer->data = chunk + (size_t) i * BCACHE_BLOCK_SIZE;
+            buffer->request.buffer = buffer->data;
+            buffer->request.done = io_done;
+            buffer->request.data = buffer;
+        }
+    }
+    if (filled == 0) {
+        kfree(headers);
+        kfree(table);
+        return -1;
+    }
+
+    hash_table = table;
+    hash_mask = buckets - 1;
+    buffer_count = filled;
+    stats.buffers = filled;
+    buffers = headers;
+
+    if (!thread_create("bflush", flusher_thread, NULL)) klog("bcache: no flusher thread, write-back only on sync\n");
+    klog("bcache: %u buffers, %u KiB\n", filled, filled * (BCACHE_BLOCK_SIZE / 1024));
+    return 0;
+}
+
+void bcache_stats(BcacheStats_t* output) {
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    *output = stats;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
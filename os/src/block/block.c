@@ -0,0 +1,159 @@
+#include <block.h>
+#include <aio.h>
+#include <klog.h>
+#include <mini_lib.h>
+
+static BlockDevice_t* devices[BLOCK_MAX_DEVICES];
+static unsigned int device_count = 0;
+
+int block_register(BlockDevice_t* device) {
+    if (device_count >= BLOCK_MAX_DEVICES) return -1;
+
+    device->name[0] = 'v';
+    device->name[1] = 'd';
+    device->name[2] = (char) ('a' + device_count);
+    device->name[3] = '\0';
+    device->waiters = (WaitQueue_t) WAIT_QUEUE_INIT;
+    memset(&device->stats, 0, sizeof(device->stats));
+    devices[device_count++] = device;
+
+    klog("block: %s, %lu MiB%s, queue depth %u\n", device->name, (unsigned long) (device->sectors >> 11),
+         device->read_only ? " read-only" : "", device->queue_depth);
+    return 0;
+}
+
+unsigned int block_device_count(void) {
+    return device_count;
+}
+
+BlockDevice_t* block_device(unsigned int index) {
+    return index < device_count ? devices[index] : NULL;
+}
+
+BlockDevice_t* block_find(const char* name) {
+    for (unsigned int i = 0; i < device_count; i++) {
+        if (strcmp(devices[i]->name, name) == 0) return devices[i];
+    }
+    return NULL;
+}
+
+int block_submit(BlockDevice_t* device, BlockRequest_t** requests, int count) {
+    for (int i = 0; i < count; i++) {
+        BlockRequest_t* request = requests[i];
+        if (request->op > BLOCK_FLUSH) return -1;
+        if (request->op != BLOCK_FLUSH && request->sector + request->count > device->sectors) return -1;
+        if (request->op == BLOCK_WRITE && device->read_only) return -1;
+        request->status = BLOCK_PENDING;
+    }
+    return count ? device->submit(device, requests, count) : 0;
+}
+
+void block_complete(BlockDevice_t* device, BlockRequest_t* request, int status) {
+    device->stats.completions++;
+    if (status < 0) {
+        device->stats.errors++;
+    } else if (request->op == BLOCK_READ) {
+        device->stats.bytes_read += (uint64_t) request->count * BLOCK_SECTOR_SIZE;
+    } else if (request->op == BLOCK_WRITE) {
+        device->stats.bytes_written += (uint64_t) request->count * BLOCK_SECTOR_SIZE;
+    }
+
+    // Once status is out a block_rw caller may return and reuse the request's stack, so
+    // nothing may touch the request after it
+    void (*done)(BlockRequest_t* request) = request->done;
+    atomic_store_release32((volatile uint32_t*) &request->status, (uint32_t) status);
+    if (done) {
+        done(request);
+    } else {
+        wake_up(&device->waiters, RUNQUEUE_SIZE); // Every block_rw sleeper rechecks its own
+    }
+}
+
+int block_rw(BlockDevice_t* device, uint32_t op, uint64_t sector, uint32_t count, void* buffer) {
+    BlockRequest_t request;
+    memset(&request, 0, sizeof(request));
+    request.op = op;
+    request.sector = sector;
+    request.count = count;
+    request.buffer = buffer;
+
+    BlockRequest_t* batch[1] = { &request };
+    int queued;
+    while ((queued = block_submit(device, batch, 1)) == 0) thread_sleep_ms(1); // Queue full
+    if (queued < 0) return -1;
+
+    // Sleep on the device's queue rather than one on our stack, a wake can land after we're gone
+    while (atomic_load_acquire32((volatile uint32_t*) &request.status) == BLOCK_PENDING) {
+        wait_prepare(&device->waiters);
+        if (atomic_load_acquire32((volatile uint32_t*) &request.status) == BLOCK_PENDING) thread_block();
+        wait_finish(&device->waiters);
+    }
+    return request.status;
+}
+
+// aio backend: each entry becomes a BlockRequest_t in its AioRequest_t's backend area and a run of them
+// goes to the driver as one batch. Offsets and lengths are in bytes and must be whole sectors.
+
+_Static_assert(sizeof(BlockRequest_t) <= AIO_BACKEND_SIZE, "BlockRequest_t no longer fits in AioRequest_t's backend area");
+
+static AioFile_t aio_files[BLOCK_MAX_DEVICES];
+
+static void aio_done(BlockRequest_t* request) {
+    AioRequest_t* aio = (AioRequest_t*) request->data;
+    aio_complete(aio, request->status < 0 ? AIO_ERROR_IO : (int64_t) aio->sqe.length);
+}
+
+static int aio_valid(BlockDevice_t* device, const AioSqe_t* sqe) {
+    if (sqe->op == AIO_OP_FSYNC) return 1;
+    if (sqe->op != AIO_OP_READ && sqe->op != AIO_OP_WRITE) return 0;
+    if (sqe->length == 0 || (sqe->length | sqe->offset) % BLOCK_SECTOR_SIZE) return 0;
+    if (sqe->op == AIO_OP_WRITE && device->read_only) return 0;
+    if (sqe->offset > UINT64_MAX - sqe->length) return 0; // Would wrap past the end check
+    return (sqe->offset + sqe->length) / BLOCK_SECTOR_SIZE <= device->sectors;
+}
+
+static int block_aio_submit(AioFile_t* file, AioRequest_t** requests, int count) {
+    BlockDevice_t* device = (BlockDevice_t*) file->object;
+    BlockRequest_t* batch[AIO_BATCH_MAX];
+
+    // Up to the first bad one, which fails on its own so the ones after it keep their order
+    int queued = 0;
+    while (queued < count && aio_valid(device, &requests[queued]->sqe)) {
+        AioRequest_t* aio = requests[queued];
+        BlockRequest_t* request = (BlockRequest_t*) aio->backend;
+        memset(request, 0, sizeof(BlockRequest_t));
+        request->op = aio->sqe.op == AIO_OP_READ ? BLOCK_READ : aio->sqe.op == AIO_OP_WRITE ? BLOCK_WRITE : BLOCK_FLUSH;
+        request->sector = aio->sqe.offset / BLOCK_SECTOR_SIZE;
+        request->count = aio->sqe.length / BLOCK_SECTOR_SIZE;
+        request->buffer = aio->sqe.buffer;
+        request->done = aio_done;
+        request->data = aio;
+        batch[queued++] = request;
+    }
+    if (queued == 0) {
+        aio_complete(requests[0], AIO_ERROR_INVALID);
+        return 1;
+    }
+
+    int taken = block_submit(device, batch, queued);
+    if (taken < 0) { // Checked above, shouldn't happen
+        for (int i = 0; i < queued; i++) aio_complete(requests[i], AIO_ERROR_INVALID);
+        return queued;
+    }
+    return taken;
+}
+
+static const AioOps_t block_aio_ops = {
+    .name = "block",
+    .submit = block_aio_submit,
+};
+
+AioFile_t* block_aio(BlockDevice_t* device) {
+    for (unsigned int i = 0; i < device_count; i++) {
+        if (devices[i] == device) {
+            aio_files[i] = (AioFile_t) { &block_aio_ops, device };
+            return &aio_files[i];
+        }
+    }
+    return NULL;
+}
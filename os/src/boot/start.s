@@ -1,16 +1,19 @@
     .section .text.start
     .globl _start
     .type _start,@function
+    .globl _start_secondary
+    .type _start_secondary,@function
     .extern kernel_entry
+    .extern secondary_entry
+    .extern cpus
+
+# Offset of stack_top in PerCpu_t, checked by a static assert in smp.c
+    .equ PERCPU_STACK_TOP, 8
 
 _start:
-    # Place SP just below the DTB (safe and inside RAM on QEMU virt)
-    # I SPENT HOURS CHASING A RANDOM ASSORTMENT OF BUGS BECAUSE OF THIS ;-;
-    mv   t2, a1          # a1 = dtb addr near top-of-RAM
-    li   t1, -8192       # 8 KiB below DTB
-    add  t2, t2, t1
-    andi t2, t2, -16     # keep 16B alignment
-    mv   sp, t2
+    # Boot hart runs on stack slot 0 of the linker's .stack area. It used to sit just below
+    # the DTB, I SPENT HOURS CHASING A RANDOM ASSORTMENT OF BUGS BECAUSE OF THAT ;-;
+    la   sp, __stack_top
 
     # Global pointer because gcc needs it
     .option push
@@ -18,6 +21,9 @@ _start:
     la gp, __global_pointer$
     .option pop
 
+    # tp points at this hart's PerCpu_t, the boot hart is cpus[0]
+    la   tp, cpus
+
     # Zero bss
     la      t0, __bss_start
     la      t1, __bss_end
@@ -28,3 +34,15 @@ _start:
 2:
     # jump to C preserving a0=hartid, a1=dtb
     tail    kernel_entry
+
+# Secondary harts come here from sbi_hart_start with a0 = hartid, a1 = their PerCpu_t
+_start_secondary:
+    mv   tp, a1
+    ld   sp, PERCPU_STACK_TOP(tp)
+
+    .option push
+    .option norelax
+    la gp, __global_pointer$
+    .option pop
+
+    tail    secondary_entry
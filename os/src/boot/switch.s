@@ -0,0 +1,56 @@
+# Kernel thread context switch. Only the callee-saved registers need keeping: everything else
+# is already saved by the C caller of context_switch, or by trap.s when we got here from an
+# interrupt. tp and gp belong to the hart, not the thread. Layout matches ThreadContext_t.
+
+    .equ CONTEXT_RA,  0
+    .equ CONTEXT_SP,  8
+    .equ CONTEXT_S0,  16
+
+    .text
+    .globl context_switch
+    .type context_switch,@function
+    .globl thread_trampoline
+    .type thread_trampoline,@function
+    .extern sched_thread_start
+    .extern thread_exit
+
+# void context_switch(ThreadContext_t* from, ThreadContext_t* to)
+context_switch:
+    sd   ra, CONTEXT_RA(a0)
+    sd   sp, CONTEXT_SP(a0)
+    sd   s0, CONTEXT_S0+0*8(a0)
+    sd   s1, CONTEXT_S0+1*8(a0)
+    sd   s2, CONTEXT_S0+2*8(a0)
+    sd   s3, CONTEXT_S0+3*8(a0)
+    sd   s4, CONTEXT_S0+4*8(a0)
+    sd   s5, CONTEXT_S0+5*8(a0)
+    sd   s6, CONTEXT_S0+6*8(a0)
+    sd   s7, CONTEXT_S0+7*8(a0)
+    sd   s8, CONTEXT_S0+8*8(a0)
+    sd   s9, CONTEXT_S0+9*8(a0)
+    sd   s10, CONTEXT_S0+10*8(a0)
+    sd   s11, CONTEXT_S0+11*8(a0)
+
+    ld   ra, CONTEXT_RA(a1)
+    ld   sp, CONTEXT_SP(a1)
+    ld   s0, CONTEXT_S0+0*8(a1)
+    ld   s1, CONTEXT_S0+1*8(a1)
+    ld   s2, CONTEXT_S0+2*8(a1)
+    ld   s3, CONTEXT_S0+3*8(a1)
+    ld   s4, CONTEXT_S0+4*8(a1)
+    ld   s5, CONTEXT_S0+5*8(a1)
+    ld   s6, CONTEXT_S0+6*8(a1)
+    ld   s7, CONTEXT_S0+7*8(a1)
+    ld   s8, CONTEXT_S0+8*8(a1)
+    ld   s9, CONTEXT_S0+9*8(a1)
+    ld   s10, CONTEXT_S0+10*8(a1)
+    ld   s11, CONTEXT_S0+11*8(a1)
+    ret
+
+# First switch into a new thread lands here, thread_create left entry in s0 and its argument in s1
+thread_trampoline:
+    call sched_thread_start
+    mv   a0, s1
+    jalr s0
+    call thread_exit
+1:  j    1b
@@ -0,0 +1,182 @@
+# Supervisor trap entry. stvec is in vectored mode: exceptions land on entry 0, interrupt
+# cause N on entry N. Interrupts take the fast path (caller-saved registers + sepc/sstatus,
+# the C handler saves the rest if it uses them); exceptions save every register so handlers
+# can inspect or patch the frame. Layout matches TrapFrame_t in trap.h.
+
+    .equ FRAME_SIZE,    304
+    .equ FRAME_SEPC,    256
+    .equ FRAME_SSTATUS, 264
+    .equ FRAME_STVAL,   272
+    .equ FRAME_SCAUSE,  280
+    .equ FRAME_CYCLES,  288
+
+    .macro SAVE_CALLER
+    sd   ra,  1*8(sp)
+    sd   t0,  5*8(sp)
+    sd   t1,  6*8(sp)
+    sd   t2,  7*8(sp)
+    sd   a0, 10*8(sp)
+    sd   a1, 11*8(sp)
+    sd   a2, 12*8(sp)
+    sd   a3, 13*8(sp)
+    sd   a4, 14*8(sp)
+    sd   a5, 15*8(sp)
+    sd   a6, 16*8(sp)
+    sd   a7, 17*8(sp)
+    sd   t3, 28*8(sp)
+    sd   t4, 29*8(sp)
+    sd   t5, 30*8(sp)
+    sd   t6, 31*8(sp)
+    .endm
+
+    .macro RESTORE_CALLER
+    ld   ra,  1*8(sp)
+    ld   t0,  5*8(sp)
+    ld   t1,  6*8(sp)
+    ld   t2,  7*8(sp)
+    ld   a0, 10*8(sp)
+    ld   a1, 11*8(sp)
+    ld   a2, 12*8(sp)
+    ld   a3, 13*8(sp)
+    ld   a4, 14*8(sp)
+    ld   a5, 15*8(sp)
+    ld   a6, 16*8(sp)
+    ld   a7, 17*8(sp)
+    ld   t3, 28*8(sp)
+    ld   t4, 29*8(sp)
+    ld   t5, 30*8(sp)
+    ld   t6, 31*8(sp)
+    .endm
+
+    .macro SAVE_CALLEE
+    sd   gp,  3*8(sp)
+    sd   tp,  4*8(sp)
+    sd   s0,  8*8(sp)
+    sd   s1,  9*8(sp)
+    sd   s2, 18*8(sp)
+    sd   s3, 19*8(sp)
+    sd   s4, 20*8(sp)
+    sd   s5, 21*8(sp)
+    sd   s6, 22*8(sp)
+    sd   s7, 23*8(sp)
+    sd   s8, 24*8(sp)
+    sd   s9, 25*8(sp)
+    sd   s10, 26*8(sp)
+    sd   s11, 27*8(sp)
+    .endm
+
+    # gp and tp are saved for handlers to look at but never restored: tp belongs to the hart,
+    # and a handler that switched threads may have us coming back on a different one
+    .macro RESTORE_CALLEE
+    ld   s0,  8*8(sp)
+    ld   s1,  9*8(sp)
+    ld   s2, 18*8(sp)
+    ld   s3, 19*8(sp)
+    ld   s4, 20*8(sp)
+    ld   s5, 21*8(sp)
+    ld   s6, 22*8(sp)
+    ld   s7, 23*8(sp)
+    ld   s8, 24*8(sp)
+    ld   s9, 25*8(sp)
+    ld   s10, 26*8(sp)
+    ld   s11, 27*8(sp)
+    .endm
+
+    # Fast interrupt entry for one cause: the cause is a constant, no scause decode
+    .macro INTERRUPT_ENTRY cause
+trap_interrupt_\cause:
+    addi sp, sp, -FRAME_SIZE
+    SAVE_CALLER
+    rdcycle t0
+    sd   t0, FRAME_CYCLES(sp)
+    csrr t0, sepc
+    sd   t0, FRAME_SEPC(sp)
+    csrr t0, sstatus
+    sd   t0, FRAME_SSTATUS(sp)
+    mv   a0, sp
+    li   a1, \cause
+    call trap_interrupt
+    j    trap_interrupt_return
+    .endm
+
+    .text
+    .globl trap_vector
+    .type trap_vector,@function
+
+    # Every entry must be exactly 4 bytes, so no compressed jumps in here
+    .balign 256
+trap_vector:
+    .option push
+    .option norvc
+    j    trap_exception      # 0: all exceptions (and user software interrupt, which we never enable)
+    j    trap_interrupt_1    # Supervisor software
+    j    trap_interrupt_2
+    j    trap_interrupt_3
+    j    trap_interrupt_4
+    j    trap_interrupt_5    # Supervisor timer
+    j    trap_interrupt_6
+    j    trap_interrupt_7
+    j    trap_interrupt_8
+    j    trap_interrupt_9    # Supervisor external
+    j    trap_interrupt_10
+    j    trap_interrupt_11
+    j    trap_interrupt_12
+    j    trap_interrupt_13   # Counter overflow (Sscofpmf)
+    j    trap_interrupt_14
+    j    trap_interrupt_15
+    .option pop
+
+    INTERRUPT_ENTRY 1
+    INTERRUPT_ENTRY 2
+    INTERRUPT_ENTRY 3
+    INTERRUPT_ENTRY 4
+    INTERRUPT_ENTRY 5
+    INTERRUPT_ENTRY 6
+    INTERRUPT_ENTRY 7
+    INTERRUPT_ENTRY 8
+    INTERRUPT_ENTRY 9
+    INTERRUPT_ENTRY 10
+    INTERRUPT_ENTRY 11
+    INTERRUPT_ENTRY 12
+    INTERRUPT_ENTRY 13
+    INTERRUPT_ENTRY 14
+    INTERRUPT_ENTRY 15
+
+trap_interrupt_return:
+    ld   t0, FRAME_SEPC(sp)
+    csrw sepc, t0
+    ld   t0, FRAME_SSTATUS(sp)
+    csrw sstatus, t0
+    RESTORE_CALLER
+    addi sp, sp, FRAME_SIZE
+    sret
+
+# Full frame, the handler may read or change any register (and sepc to skip the instruction)
+trap_exception:
+    addi sp, sp, -FRAME_SIZE
+    SAVE_CALLER
+    SAVE_CALLEE
+    rdcycle t0
+    sd   t0, FRAME_CYCLES(sp)
+    addi t0, sp, FRAME_SIZE
+    sd   t0, 2*8(sp)              # sp as it was before the trap
+    csrr t0, sepc
+    sd   t0, FRAME_SEPC(sp)
+    csrr t0, sstatus
+    sd   t0, FRAME_SSTATUS(sp)
+    csrr t0, stval
+    sd   t0, FRAME_STVAL(sp)
+    csrr t0, scause
+    sd   t0, FRAME_SCAUSE(sp)
+
+    mv   a0, sp
+    call trap_exception_dispatch
+
+    ld   t0, FRAME_SEPC(sp)
+    csrw sepc, t0
+    ld   t0, FRAME_SSTATUS(sp)
+    csrw sstatus, t0
+    RESTORE_CALLEE
+    RESTORE_CALLER
+    addi sp, sp, FRAME_SIZE
+    sret
@@ -0,0 +1,156 @@
+#include <driver.h>
+#include <klog.h>
+
+extern const Driver_t __drivers_start[];
+extern const Driver_t __drivers_end[];
+
+#define MATCH_BUCKETS 128 // Power of two
+#define MATCH_MAX     128 // Compatible strings over all drivers
+
+typedef struct {
+    uint32_t hash;
+    int next; // Chain, -1 ends it
+    const char* compatible;
+    const Driver_t* driver;
+} DriverMatch_t;
+
+static DriverMatch_t matches[MATCH_MAX];
+static int match_buckets[MATCH_BUCKETS];
+static int match_count = 0;
+
+static uint32_t string_hash(const char* string) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    while (*string) {
+        hash ^= (unsigned char) *string++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void match_table_build(void) {
+    match_count = 0;
+    for (int i = 0; i < MATCH_BUCKETS; i++) match_buckets[i] = -1;
+
+    for (const Driver_t* driver = __drivers_start; driver < __drivers_end; driver++) {
+        for (const char* const* compatible = driver->compatible; *compatible; compatible++) {
+            if (match_count >= MATCH_MAX) {
+                klog("driver: match table full, %s not registered\n", *compatible);
+                return;
+            }
+
+            DriverMatch_t* match = &matches[match_count];
+            match->hash = string_hash(*compatible);
+            match->compatible = *compatible;
+            match->driver = driver;
+
+            int bucket = (int) (match->hash & (MATCH_BUCKETS - 1));
+            match->next = match_buckets[bucket];
+            match_buckets[bucket] = match_count++;
+        }
+    }
+}
+
+static const DriverMatch_t* match_lookup(const char* compatible) {
+    uint32_t hash = string_hash(compatible);
+    for (int i = match_buckets[hash & (MATCH_BUCKETS - 1)]; i >= 0; i = matches[i].next) {
+        if (matches[i].hash == hash && strcmp(matches[i].compatible, compatible) == 0) return &matches[i];
+    }
+    return NULL;
+}
+
+// interrupt-parent is inherited, so walk up until someone names one
+static const FDTNode_t* interrupt_parent_of(const FDTNode_t* node) {
+    for (const FDTNode_t* n = node; n; n = n->parent) {
+        uint32_t phandle;
+        const FDTProp_t* prop = fdt_node_prop(n, "interrupt-parent");
+        if (prop && fdt_prop_read_u32(prop, &phandle, 0)) return fdt_find_phandle(phandle);
+    }
+    return NULL;
+}
+
+static uint32_t interrupt_cells_of(const FDTNode_t* controller) {
+    uint32_t cells = 1;
+    const FDTProp_t* prop = fdt_node_prop(controller, "#interrupt-cells");
+    if (prop) fdt_prop_read_u32(prop, &cells, 0);
+    return cells ? cells : 1;
+}
+
+// interrupts (with the inherited parent) or interrupts-extended (<phandle specifier...> pairs)
+static void decode_interrupts(const FDTNode_t* node, Device_t* device) {
+    const FDTProp_t* prop = fdt_node_prop(node, "interrupts");
+    if (prop) {
+        device->interrupt_parent = interrupt_parent_of(node);
+        uint32_t cells = interrupt_cells_of(device->interrupt_parent);
+        size_t count = prop->length / (cells * 4u);
+        for (size_t i = 0; i < count && device->irq_count < DEVICE_MAX_IRQS; i++) {
+            fdt_prop_read_u32(prop, &device->irqs[device->irq_count++], i * cells);
+        }
+        return;
+    }
+
+    prop = fdt_node_prop(node, "interrupts-extended");
+    if (!prop) return;
+
+    size_t index = 0;
+    uint32_t phandle;
+    while (device->irq_count < DEVICE_MAX_IRQS && fdt_prop_read_u32(prop, &phandle, index)) {
+        const FDTNode_t* controller = fdt_find_phandle(phandle);
+        if (!controller) return; // Can't know how many cells to skip
+        if (!device->interrupt_parent) device->interrupt_parent = controller;
+
+        uint32_t cells = interrupt_cells_of(controller);
+        if (!fdt_prop_read_u32(prop, &device->irqs[device->irq_count], index + 1)) return;
+        device->irq_count++;
+        index += 1 + cells;
+    }
+}
+
+static int node_enabled(const FDTNode_t* node) {
+    const char* status = fdt_prop_string(fdt_node_prop(node, "status"));
+    return !status || strcmp(status, "okay") == 0 || strcmp(status, "ok") == 0;
+}
+
+int driver_probe_all(void) {
+    match_table_build();
+    if (match_count == 0) return 0;
+
+    int bound = 0;
+    size_t count = fdt_node_count();
+    for (size_t i = 0; i < count; i++) {
+        const FDTNode_t* node = fdt_node_at(i);
+        const FDTProp_t* compatible = fdt_node_prop(node, "compatible");
+        if (!compatible) continue;
+
+        // Entries go from most to least specific, the first one a driver knows wins
+        const DriverMatch_t* match = NULL;
+        const char* string = NULL;
+        size_t cursor = 0;
+        while (!match && fdt_prop_next_string(compatible, &string, &cursor)) {
+            match = match_lookup(string);
+        }
+        if (!match || !node_enabled(node)) continue;
+
+        Device_t device;
+        memset(&device, 0, sizeof(device));
+        device.node = node;
+        device.compatible = match->compatible;
+        int regs = fdt_node_reg(node, device.reg, DEVICE_MAX_REGS);
+        device.reg_count = regs > 0 ? regs : 0;
+        decode_interrupts(node, &device);
+
+        int rc = match->driver->probe(&device);
+        if (rc == DRIVER_NO_DEVICE) continue;
+        if (rc < 0) {
+            klog("driver: %s probe failed for %s (%d)\n", match->driver->name, node->name, rc);
+            continue;
+        }
+        bound++;
+    }
+
+    return bound;
+}
+
+int device_is_compatible(const Device_t* device, const char* compatible) {
+    const FDTProp_t* prop = fdt_node_prop(device->node, "compatible");
+    return prop && fdt_prop_stringlist_contains(prop, compatible);
+}
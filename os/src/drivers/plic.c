@@ -0,0 +1,274 @@
+#include <plic.h>
+#include <driver.h>
+#include <percpu.h>
+#include <trap.h>
+#include <klog.h>
+#include <sync.h>
+
+#define PLIC_NO_CONTEXT 0xffffffffu
+
+typedef struct {
+    uint64_t hart_id;
+    uint32_t context;
+} PlicContext_t;
+
+typedef struct {
+    plic_handler_t handler;
+    void* data;
+    uint32_t priority;
+    uint32_t affinity;
+} PlicSource_t;
+
+static uintptr_t plic_base = 0;
+static uint32_t source_count = 0;
+static PlicSource_t sources[PLIC_MAX_SOURCES];
+
+// S-mode contexts from interrupts-extended by hart id; secondaries look theirs up when they start
+static PlicContext_t hart_contexts[PLIC_MAX_CONTEXTS];
+static uint32_t hart_context_count = 0;
+static uint32_t cpu_contexts[MAX_HARTS];
+static uint32_t thresholds[MAX_HARTS];
+
+// Only touched by the owning hart with interrupts off, so plain counters
+static uint64_t claims[MAX_HARTS][PLIC_MAX_SOURCES];
+static uint64_t spurious[MAX_HARTS];
+
+static spinlock_t enable_lock = SPINLOCK_INIT; // Enable words are read-modify-write, and MMIO takes no AMOs
+
+static inline volatile uint32_t* plic_register(uint32_t offset) {
+    return (volatile uint32_t*) (plic_base + offset);
+}
+
+// interrupts-extended lists one <cpu-intc phandle, cause> pair per context, in context order.
+// A hart's S-mode context is the one whose cause is the supervisor external interrupt.
+static void find_contexts(const FDTNode_t* node) {
+    const FDTProp_t* prop = fdt_node_prop(node, "interrupts-extended");
+    if (!prop) return;
+
+    uint32_t phandle, cause;
+    for (uint32_t context = 0; fdt_prop_read_u32(prop, &cause, context * 2 + 1); context++) {
+        fdt_prop_read_u32(prop, &phandle, context * 2);
+        if (cause != IRQ_S_EXT || hart_context_count >= PLIC_MAX_CONTEXTS) continue;
+
+        const FDTNode_t* controller = fdt_find_phandle(phandle);
+        FDTRegRegion_t reg;
+        if (controller && controller->parent && fdt_node_reg(controller->parent, &reg, 1) == 1) {
+            hart_contexts[hart_context_count].hart_id = reg.base;
+            hart_contexts[hart_context_count].context = context;
+            hart_context_count++;
+        }
+    }
+}
+
+static uint32_t context_for_hart(uint64_t hart_id) {
+    for (uint32_t i = 0; i < hart_context_count; i++) {
+        if (hart_contexts[i].hart_id == hart_id) return hart_contexts[i].context;
+    }
+    return PLIC_NO_CONTEXT;
+}
+
+// Sets or clears source in one context's enable word, call with enable_lock held
+static void context_enable(uint32_t context, uint32_t source, int enable) {
+    volatile uint32_t* word = plic_register(PLIC_ENABLE(context, source));
+    if (enable) {
+        *word |= 1u << (source % 32);
+    } else {
+        *word &= ~(1u << (source % 32));
+    }
+}
+
+// Program every known context to match a source's affinity, call with enable_lock held
+static void route(uint32_t source) {
+    for (unsigned int cpu = 0; cpu < MAX_HARTS; cpu++) {
+        if (cpu_contexts[cpu] == PLIC_NO_CONTEXT) continue;
+        context_enable(cpu_contexts[cpu], source, sources[source].handler && (sources[source].affinity & (1u << cpu)));
+    }
+}
+
+static void plic_interrupt(TrapFrame_t* frame) {
+    (void) frame;
+    unsigned int cpu = cpu_index();
+    volatile uint32_t* claim = plic_register(PLIC_CLAIM(cpu_contexts[cpu]));
+
+    // Claim until it reads 0, several sources may be pending at once. Another hart in the
+    // affinity mask may have beaten us to the first one, that's the 0 on our first read.
+    uint32_t source = *claim;
+    if (source == 0) spurious[cpu]++;
+    while (source != 0) {
+        // Once: plic_disable on another hart can clear it under us
+        plic_handler_t handler = source < source_count ? __atomic_load_n(&sources[source].handler, __ATOMIC_ACQUIRE) : NULL;
+        if (handler) {
+            claims[cpu][source]++;
+            handler(sources[source].data);
+        } else {
+            // Straight to the register, plic_set_priority won't take a source past what the FDT told us about
+            klog("plic: source %u has no handler, masked\n", source);
+            if (source < PLIC_MAX_SOURCES) sources[source].priority = 0;
+            *plic_register(PLIC_PRIORITY(source)) = 0;
+        }
+        *claim = source; // Complete
+        source = *claim;
+    }
+}
+
+static void context_setup(unsigned int cpu, uint32_t context) {
+    cpu_contexts[cpu] = context;
+    thresholds[cpu] = 0;
+    *plic_register(PLIC_THRESHOLD(context)) = 0;
+
+    uint64_t flags = spin_lock_irqsave(&enable_lock);
+    for (uint32_t word = 0; word < (source_count + 31) / 32; word++) *plic_register(PLIC_ENABLE(context, word * 32)) = 0;
+    for (uint32_t source = 1; source < source_count; source++) {
+        if (sources[source].handler && (sources[source].affinity & (1u << cpu))) context_enable(context, source, 1);
+    }
+    spin_unlock_irqrestore(&enable_lock, flags);
+}
+
+static int plic_probe(const Device_t* device) {
+    if (plic_base) return 0; // Only the first one
+    if (device->reg_count == 0) return -1;
+
+    uint32_t ndev = 0;
+    const FDTProp_t* prop = fdt_node_prop(device->node, "riscv,ndev");
+    if (!prop || !fdt_prop_read_u32(prop, &ndev, 0)) return -1;
+
+    find_contexts(device->node);
+    uint32_t context = context_for_hart(cpus[0].hart_id);
+    if (context == PLIC_NO_CONTEXT) {
+        klog("plic: no S-mode context for hart %lu\n", (unsigned long) cpus[0].hart_id);
+        return -1;
+    }
+
+    plic_base = (uintptr_t) device->reg[0].base;
+    source_count = ndev + 1 < PLIC_MAX_SOURCES ? ndev + 1 : PLIC_MAX_SOURCES; // Source 0 doesn't exist
+    for (unsigned int cpu = 0; cpu < MAX_HARTS; cpu++) cpu_contexts[cpu] = PLIC_NO_CONTEXT;
+
+    // Masked unless a driver probed before us already asked for it
+    for (uint32_t source = 1; source < PLIC_MAX_SOURCES; source++) {
+        if (source >= source_count) {
+            sources[source].handler = NULL;
+        } else {
+            *plic_register(PLIC_PRIORITY(source)) = sources[source].handler ? sources[source].priority : 0;
+        }
+    }
+    context_setup(0, context);
+
+    trap_register_interrupt(IRQ_S_EXT, plic_interrupt);
+    trap_enable_interrupt(IRQ_S_EXT);
+    klog("plic: %s at 0x%lx, %u sources, %u hart contexts\n", device->node->name, (unsigned long) plic_base,
+         ndev, hart_context_count);
+    return 0;
+}
+
+DRIVER_REGISTER(plic, plic_probe, "sifive,plic-1.0.0", "riscv,plic0");
+
+int plic_present(void) {
+    return plic_base != 0;
+}
+
+void plic_init_local(void) {
+    if (!plic_base) return;
+    PerCpu_t* cpu = this_cpu();
+    uint32_t context = context_for_hart(cpu->hart_id);
+    if (context == PLIC_NO_CONTEXT) return; // This hart takes no external interrupts
+
+    context_setup(cpu->index, context);
+    trap_enable_interrupt(IRQ_S_EXT);
+}
+
+int plic_enable(uint32_t source, plic_handler_t handler, void* data) {
+    if (source == 0 || source >= (plic_base ? source_count : PLIC_MAX_SOURCES) || !handler) return -1;
+
+    uint64_t flags = spin_lock_irqsave(&enable_lock);
+    sources[source].handler = handler;
+    sources[source].data = data;
+    sources[source].affinity = 1u << 0;
+    sources[source].priority = 1;
+    if (plic_base) {
+        *plic_register(PLIC_PRIORITY(source)) = 1;
+        route(source);
+    }
+    spin_unlock_irqrestore(&enable_lock, flags);
+    return 0;
+}
+
+void plic_disable(uint32_t source) {
+    if (!plic_base || source == 0 || source >= source_count) return;
+
+    uint64_t flags = spin_lock_irqsave(&enable_lock);
+    *plic_register(PLIC_PRIORITY(source)) = 0;
+    sources[source].handler = NULL;
+    sources[source].priority = 0;
+    route(source);
+    spin_unlock_irqrestore(&enable_lock, flags);
+}
+
+int plic_set_priority(uint32_t source, uint32_t priority) {
+    if (!plic_base || source == 0 || source >= source_count || priority > PLIC_MAX_PRIORITY) return -1;
+    sources[source].priority = priority;
+    *plic_register(PLIC_PRIORITY(source)) = priority;
+    return 0;
+}
+
+int plic_set_threshold(unsigned int cpu, uint32_t threshold) {
+    if (!plic_base || cpu >= MAX_HARTS || cpu_contexts[cpu] == PLIC_NO_CONTEXT) return -1;
+    if (threshold > PLIC_MAX_PRIORITY) return -1;
+    thresholds[cpu] = threshold;
+    *plic_register(PLIC_THRESHOLD(cpu_contexts[cpu])) = threshold;
+    return 0;
+}
+
+int plic_set_affinity(uint32_t source, uint32_t cpu_mask) {
+    if (!plic_base || source == 0 || source >= source_count || !sources[source].handler) return -1;
+
+    // Only harts that are up and have a context, and never nobody
+    uint32_t usable = 0;
+    for (unsigned int cpu = 0; cpu < cpu_count() && cpu < MAX_HARTS; cpu++) {
+        if (cpus[cpu].online && cpu_contexts[cpu] != PLIC_NO_CONTEXT) usable |= 1u << cpu;
+    }
+    cpu_mask &= usable;
+    if (!cpu_mask) return -1;
+
+    uint64_t flags = spin_lock_irqsave(&enable_lock);
+    sources[source].affinity = cpu_mask;
+    route(source);
+    spin_unlock_irqrestore(&enable_lock, flags);
+    return 0;
+}
+
+void plic_balance(void) {
+    if (!plic_base) return;
+
+    unsigned int cpu = 0;
+    for (uint32_t source = 1; source < source_count; source++) {
+        if (!sources[source].handler) continue;
+        for (unsigned int tries = 0; tries < cpu_count(); tries++) {
+            unsigned int candidate = (cpu + tries) % cpu_count();
+            if (plic_set_affinity(source, 1u << candidate) == 0) {
+                cpu = candidate + 1;
+                break;
+            }
+        }
+    }
+}
+
+uint32_t plic_source_count(void) {
+    return source_count;
+}
+
+int plic_source_info(uint32_t source, PlicSourceInfo_t* output) {
+    if (source == 0 || source >= source_count || !sources[source].handler) return -1;
+    output->handler = sources[source].handler;
+    output->priority = sources[source].priority;
+    output->affinity = sources[source].affinity;
+    for (unsigned int cpu = 0; cpu < 8; cpu++) output->count[cpu] = cpu < MAX_HARTS ? claims[cpu][source] : 0;
+    return 0;
+}
+
+uint32_t plic_threshold(unsigned int cpu) {
+    return cpu < MAX_HARTS ? thresholds[cpu] : 0;
+}
+
+uint64_t plic_spurious(unsigned int cpu) {
+    return cpu < MAX_HARTS ? spurious[cpu] : 0;
+}
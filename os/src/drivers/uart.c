@@ -1,4 +1,37 @@
 #include <uart.h>
+#include <riscv.h>
+#include <mini_lib.h>
+#include <driver.h>
+#include <klog.h>
+#include <sync.h>
+#include <sched.h>
+
+// Output goes through a TX ring. In polled mode (boot, panic) the ring is drained right away,
+// 16 bytes per THRE wait instead of one. Once interrupts are on, writers only memcpy into the ring
+// and the THRE interrupt refills the FIFO in bursts. Input lands in an RX ring from the RDA interrupt,
+// readers sleep on rx_wait until it does.
+
+volatile uintptr_t g_uart_base = 0;
+
+// Writers from every hart and the THRE interrupt share the TX ring under this lock. kprintf
+// formats outside of it, so harts only serialize on the memcpy into the ring.
+static rlock_t console_lock = RLOCK_INIT;
+
+static char tx_ring[UART_TX_RING_SIZE];
+static volatile uint32_t tx_head = 0; // Next free slot, only writers move it
+static volatile uint32_t tx_tail = 0; // Next byte to send, only the drain side moves it
+
+static char rx_ring[UART_RX_RING_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+static volatile uint32_t rx_dropped = 0;
+static WaitQueue_t rx_wait = WAIT_QUEUE_INIT;
+
+#define UART_POLL_MS 10 // No interrupt route: how often a reader looks at LSR
+
+static volatile int irq_mode = 0;
+static uint32_t fifo_depth = UART_FIFO_DEPTH; // Plain 16550s have a broken FIFO, see ns16550_probe
+static uint32_t irq_number = 0;
 
 void uart_init(uintptr_t base) {
     g_uart_base = base;
@@ -7,51 +40,241 @@ void uart_init(uintptr_t base) {
     uart->FCR = 0x07; // Enable FIFO, clear RX/TX queues
     uart->LCR = 0x03; // 8 bits, no parity, one stop bit
     uart->MCR = 0x03; // RTS/DSR set
+    irq_mode = 0;
+    lock_stats_register("uart", &console_lock.lock.stats);
 }
 
-void uart_putc(char c) {
+void uart_lock(void) {
+    rlock_acquire(&console_lock);
+}
+
+void uart_unlock(void) {
+    rlock_release(&console_lock);
+}
+
+void uart_lock_force(void) {
+    rlock_force(&console_lock);
+}
+
+// Push up to a FIFO's worth of the ring out if the FIFO has drained, returns bytes written
+static uint32_t tx_fill_fifo(ns16550_8_t* uart) {
+    if ((uart->LSR & UART_LSR_THRE) == 0) return 0; // FIFO still busy
+
+    uint32_t pending = tx_head - tx_tail;
+    uint32_t burst = pending < fifo_depth ? pending : fifo_depth;
+    for (uint32_t i = 0; i < burst; i++) {
+        uart->THR = (uint8_t) tx_ring[(tx_tail + i) & (UART_TX_RING_SIZE - 1)];
+    }
+
+    tx_tail += burst;
+    return burst;
+}
+
+// Drain the ring by polling, used when nothing else will (polled mode, full ring, panic)
+static void tx_drain_polled(ns16550_8_t* uart) {
+    while (tx_head != tx_tail) {
+        tx_fill_fifo(uart);
+    }
+}
+
+static void tx_ring_put(ns16550_8_t* uart, const char* data, size_t length) {
+    while (length > 0) {
+        uint32_t space = UART_TX_RING_SIZE - (tx_head - tx_tail);
+        if (space == 0) {
+            tx_fill_fifo(uart); // Ring full, make room the slow way
+            continue;
+        }
+
+        uint32_t offset = tx_head & (UART_TX_RING_SIZE - 1);
+        uint32_t chunk = UART_TX_RING_SIZE - offset; // Up to the wrap point
+        if (chunk > space) chunk = space;
+        if (chunk > length) chunk = (uint32_t) length;
+
+        memcpy(&tx_ring[offset], data, chunk);
+        asm volatile("" ::: "memory"); // Bytes land before the index moves
+        tx_head += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+// Get the ring moving: one burst and THRE interrupts, or drain it now in polled mode
+static void tx_transmit(ns16550_8_t* uart) {
+    if (irq_mode) {
+        // Kick the first burst ourselves, THRE interrupts take it from there
+        tx_fill_fifo(uart);
+        if (tx_head != tx_tail) uart->IER |= UART_IER_ETBEI;
+    } else {
+        tx_drain_polled(uart);
+    }
+}
+
+void uart_write(const char* data, size_t length) {
     ns16550_8_t* uart = UART(g_uart_base);
-    while ((uart->LSR & (1 << 5)) == 0); // Wait for THR empty
-    uart->THR = (uint8_t) c;
+    rlock_acquire(&console_lock);
+
+    // Copy runs between newlines in one go, terminals want "\r\n"
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != '\n') continue;
+        tx_ring_put(uart, &data[start], i - start);
+        tx_ring_put(uart, "\r\n", 2);
+        start = i + 1;
+    }
+    tx_ring_put(uart, &data[start], length - start);
+    tx_transmit(uart);
+
+    rlock_release(&console_lock);
+}
+
+// Same as uart_write but byte-exact, for binary log frames
+void uart_write_binary(const void* data, size_t length) {
+    ns16550_8_t* uart = UART(g_uart_base);
+    rlock_acquire(&console_lock);
+    tx_ring_put(uart, (const char*) data, length);
+    tx_transmit(uart);
+    rlock_release(&console_lock);
+}
+
+void uart_putc(char c) {
+    uart_write(&c, 1);
 }
 
 void uart_puts(const char* str) {
-    while (*str) {
-        if (*str == '\n') {
-            uart_putc('\r'); // Carriage return before newline
+    uart_write(str, strlen(str));
+}
+
+void uart_flush(void) {
+    rlock_acquire(&console_lock);
+    tx_drain_polled(UART(g_uart_base));
+    rlock_release(&console_lock);
+}
+
+static void rx_drain(ns16550_8_t* uart) {
+    while (uart->LSR & UART_LSR_DR) {
+        char c = (char) uart->RBR;
+        if (rx_head - rx_tail < UART_RX_RING_SIZE) {
+            rx_ring[rx_head & (UART_RX_RING_SIZE - 1)] = c;
+            atomic_store_release32(&rx_head, rx_head + 1); // The reader may be on another hart
+        } else {
+            rx_dropped++; // Nobody is reading, drop it
+        }
+    }
+}
+
+void uart_irq_handler(void* data) {
+    (void) data;
+    ns16550_8_t* uart = UART(g_uart_base);
+
+    while (1) {
+        uint8_t iir = uart->IIR;
+        if (iir & UART_IIR_NO_INT) break;
+
+        switch (iir & UART_IIR_ID_MASK) {
+            case UART_IIR_RDA:
+            case UART_IIR_TIMEOUT:
+                rx_drain(uart);
+                wake_up(&rx_wait, 1);
+                break;
+
+            case UART_IIR_THRE:
+                rlock_acquire(&console_lock); // Another hart may be mid-write
+                tx_fill_fifo(uart);
+                if (tx_head == tx_tail) uart->IER &= (uint8_t) ~UART_IER_ETBEI; // Nothing left, stop asking
+                rlock_release(&console_lock);
+                break;
+
+            case UART_IIR_RLS:
+                (void) uart->LSR; // Reading LSR clears line errors
+                break;
+
+            case UART_IIR_MSR:
+            default:
+                (void) uart->MSR;
+                break;
         }
-        uart_putc(*str++);
     }
 }
 
+void uart_enable_interrupts(void) {
+    ns16550_8_t* uart = UART(g_uart_base);
+    rlock_acquire(&console_lock);
+    uart->MCR |= UART_MCR_OUT2;
+    uart->IER = UART_IER_ERBFI | ((tx_head != tx_tail) ? UART_IER_ETBEI : 0);
+    irq_mode = 1;
+    rlock_release(&console_lock);
+}
+
+// Back to polled mode and push out whatever is still queued (panic, shutdown)
+void uart_disable_interrupts(void) {
+    ns16550_8_t* uart = UART(g_uart_base);
+    rlock_acquire(&console_lock);
+    uart->IER = 0x00;
+    irq_mode = 0;
+    tx_drain_polled(uart);
+    rlock_release(&console_lock);
+}
+
 char uart_getc(void) {
     ns16550_8_t* uart = UART(g_uart_base);
-    while ((uart->LSR & 0x01) == 0); // Wait for data available (LSR[0] = 1)
-    return (char) (uart->RBR);
-}
-
-void uart_gets(char* buffer, size_t max_length) {
-    if (max_length == 0) return; // No space to store anything
-
-    size_t i = 0;
-    while (i < (max_length - 1)) {
-        char c = uart_getc();
-
-        if (c == 0x1b) { // Escape character
-            continue; // Ignore for now
-        } else if (c == '\r' || c == '\n') {
-            uart_puts("\r\n"); // Echo newline
-            break; // Stop on enter/return
-        } else if (c == '\b' || c == 127) { // Backspace or DEL
-            if (i > 0) {
-                i--;
-                uart_puts("\b \b"); // Erase character on terminal
-            }
-        } else {
-            uart_putc(c); // Echo
-            buffer[i++] = c;
+
+    if (!irq_mode) {
+        // Wait for data available (LSR[0] = 1), napping between looks once there's a scheduler
+        while ((uart->LSR & UART_LSR_DR) == 0) {
+            if (thread_current()) thread_sleep_ms(UART_POLL_MS);
+        }
+        return (char) (uart->RBR);
+    }
+
+    // Sleep on rx_wait until the RX interrupt puts something in the ring. Queuing before the
+    // check means the wake can't fall in between, even when the interrupt lands on another hart.
+    while (1) {
+        if (atomic_load_acquire32(&rx_head) != rx_tail) {
+            char c = rx_ring[rx_tail & (UART_RX_RING_SIZE - 1)];
+            atomic_store_release32(&rx_tail, rx_tail + 1);
+            return c;
         }
+
+        if (!thread_current()) {
+            // Scheduler isn't up, nobody to switch to: wfi with interrupts off, it still wakes on
+            // the pending interrupt and we take it once they're back on
+            uint64_t flags = irq_save();
+            if (atomic_load_acquire32(&rx_head) == rx_tail) wfi();
+            irq_restore(flags);
+            continue;
+        }
+
+        wait_prepare(&rx_wait);
+        if (atomic_load_acquire32(&rx_head) == rx_tail) thread_block();
+        wait_finish(&rx_wait);
     }
+}
+
+int uart_poll(void) {
+    if (!irq_mode) {
+        ns16550_8_t* uart = UART(g_uart_base);
+        return (uart->LSR & UART_LSR_DR) ? (unsigned char) uart->RBR : -1;
+    }
+
+    if (atomic_load_acquire32(&rx_head) == rx_tail) return -1;
+    char c = rx_ring[rx_tail & (UART_RX_RING_SIZE - 1)];
+    atomic_store_release32(&rx_tail, rx_tail + 1);
+    return (unsigned char) c;
+}
+
+// Only the console UART is driven for now, other 16550s are left alone
+static int ns16550_probe(const Device_t* device) {
+    if (device->reg_count == 0) return -1;
+    if (device->reg[0].base != g_uart_base) return 0;
+
+    if (!device_is_compatible(device, "ns16550a")) fifo_depth = 1;
+    if (device->irq_count > 0) irq_number = device->irqs[0];
+    klog("uart: %s at 0x%llx, irq %u\n", device->node->name, (unsigned long long) device->reg[0].base, irq_number);
+    return 0;
+}
+
+DRIVER_REGISTER(ns16550, ns16550_probe, "ns16550a", "ns16550");
 
-    buffer[i] = '\0'; // Null-terminate the string
+uint32_t uart_irq(void) {
+    return irq_number;
 }
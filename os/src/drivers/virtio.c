@@ -0,0 +1,294 @@
+#include <virtio.h>
+#include <plic.h>
+#include <dma.h>
+#include <klog.h>
+#include <mini_lib.h>
+
+typedef struct {
+    uint32_t device_id;
+    const char* name;
+    int (*probe)(VirtioDevice_t* device);
+} VirtioDriver_t;
+
+static const VirtioDriver_t virtio_drivers[] = {
+    { VIRTIO_ID_BLOCK, "block", virtio_blk_probe },
+    { VIRTIO_ID_CONSOLE, "console", virtio_console_probe },
+};
+
+#define NUM_VIRTIO_DRIVERS (sizeof(virtio_drivers) / sizeof(virtio_drivers[0]))
+
+static VirtioDevice_t devices[VIRTIO_MAX_DEVICES];
+static unsigned int device_count = 0;
+
+// Ring writes have to land before the notify write reaches the device, and a status read has
+// to come before we look at the rings it's telling us about
+static inline void mmio_write32(const VirtioDevice_t* device, uint32_t offset, uint32_t value) {
+    asm volatile("fence w, o" ::: "memory");
+    *(volatile uint32_t*) (device->base + offset) = value;
+}
+
+static inline uint32_t mmio_read32(const VirtioDevice_t* device, uint32_t offset) {
+    uint32_t value = *(volatile uint32_t*) (device->base + offset);
+    asm volatile("fence i, r" ::: "memory");
+    return value;
+}
+
+static void set_status(VirtioDevice_t* device, uint32_t bits) {
+    mmio_write32(device, VIRTIO_MMIO_STATUS, mmio_read32(device, VIRTIO_MMIO_STATUS) | bits);
+}
+
+int virtio_has(const VirtioDevice_t* device, unsigned int feature) {
+    return (device->features >> feature) & 1;
+}
+
+uint32_t virtio_config_read32(const VirtioDevice_t* device, uint32_t offset) {
+    return mmio_read32(device, VIRTIO_MMIO_CONFIG + offset);
+}
+
+// Two halves can tear if the device changes it in between, modern devices bump the generation then
+uint64_t virtio_config_read64(const VirtioDevice_t* device, uint32_t offset) {
+    uint64_t low = virtio_config_read32(device, offset);
+    uint64_t high = virtio_config_read32(device, offset + 4);
+    return low | (high << 32);
+}
+
+int virtio_negotiate(VirtioDevice_t* device, uint64_t wanted) {
+    mmio_write32(device, VIRTIO_MMIO_STATUS, 0); // Reset
+    set_status(device, VIRTIO_STATUS_ACKNOWLEDGE);
+    set_status(device, VIRTIO_STATUS_DRIVER);
+
+    uint64_t offered = 0;
+    for (uint32_t select = 0; select < (device->version == 1 ? 1u : 2u); select++) {
+        mmio_write32(device, VIRTIO_MMIO_DEVICE_FEATURES_SEL, select);
+        offered |= (uint64_t) mmio_read32(device, VIRTIO_MMIO_DEVICE_FEATURES) << (32 * select);
+    }
+
+    if (device->version != 1) wanted |= 1ull << VIRTIO_F_VERSION_1; // Modern devices won't go on without it
+    device->features = offered & wanted;
+    for (uint32_t select = 0; select < (device->version == 1 ? 1u : 2u); select++) {
+        mmio_write32(device, VIRTIO_MMIO_DRIVER_FEATURES_SEL, select);
+        mmio_write32(device, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t) (device->features >> (32 * select)));
+    }
+
+    // Legacy has no FEATURES_OK handshake, it takes what we wrote
+    if (device->version == 1) {
+        mmio_write32(device, VIRTIO_MMIO_GUEST_PAGE_SIZE, VIRTQ_ALIGN);
+        return 0;
+    }
+
+    set_status(device, VIRTIO_STATUS_FEATURES_OK);
+    if (!(mmio_read32(device, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+        virtio_fail(device);
+        return -1;
+    }
+    return 0;
+}
+
+void virtio_ready(VirtioDevice_t* device) {
+    set_status(device, VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(VirtioDevice_t* device) {
+    set_status(device, VIRTIO_STATUS_FAILED);
+}
+
+// Lays out desc, avail and used in one DMA block. Legacy wants used on the next VIRTQ_ALIGN
+// boundary and the whole thing described by one page number; modern takes three addresses.
+int virtq_setup(VirtioDevice_t* device, Virtqueue_t* queue, uint16_t index, uint16_t max_size) {
+    mmio_write32(device, VIRTIO_MMIO_QUEUE_SEL, index);
+    uint32_t device_max = mmio_read32(device, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if (device_max == 0) return -1; // No such queue
+
+    uint16_t size = VIRTQ_MAX_SIZE;
+    if (size > max_size) size = max_size;
+    while (size > device_max) size >>= 1; // Legacy needs a power of two, so stay on one
+
+    size_t desc_bytes = sizeof(VirtqDesc_t) * size;
+    size_t avail_bytes = sizeof(VirtqAvail_t) + sizeof(uint16_t) * (size + 1u);
+    size_t used_offset = (desc_bytes + avail_bytes + VIRTQ_ALIGN - 1) & ~(size_t) (VIRTQ_ALIGN - 1);
+    size_t used_bytes = sizeof(VirtqUsed_t) + sizeof(VirtqUsedElem_t) * size + sizeof(uint16_t);
+
+    uint64_t physical;
+    uint8_t* memory = (uint8_t*) dma_alloc(used_offset + used_bytes, VIRTQ_ALIGN, &physical);
+    if (!memory) return -1;
+
+    memset(queue, 0, sizeof(*queue)); // Unlocked lock included
+    queue->device = device;
+    queue->index = index;
+    queue->size = size;
+    queue->memory = memory;
+    queue->desc = (volatile VirtqDesc_t*) memory;
+    queue->avail = (volatile VirtqAvail_t*) (memory + desc_bytes);
+    queue->used = (volatile VirtqUsed_t*) (memory + used_offset);
+    queue->used_event = &queue->avail->ring[size];
+    queue->avail_event = (volatile uint16_t*) &queue->used->ring[size];
+
+    for (uint16_t i = 0; i < size; i++) queue->desc[i].next = (uint16_t) (i + 1);
+    queue->free_count = size;
+
+    mmio_write32(device, VIRTIO_MMIO_QUEUE_NUM, size);
+    if (device->version == 1) {
+        mmio_write32(device, VIRTIO_MMIO_QUEUE_ALIGN, VIRTQ_ALIGN);
+        mmio_write32(device, VIRTIO_MMIO_QUEUE_PFN, (uint32_t) (physical / VIRTQ_ALIGN));
+    } else {
+        uint64_t avail = physical + desc_bytes;
+        uint64_t used = physical + used_offset;
+        mmio_write32(device, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t) physical);
+        mmio_write32(device, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t) (physical >> 32));
+        mmio_write32(device, VIRTIO_MMIO_QUEUE_AVAIL_LOW, (uint32_t) avail);
+        mmio_write32(device, VIRTIO_MMIO_QUEUE_AVAIL_HIGH, (uint32_t) (avail >> 32));
+        mmio_write32(device, VIRTIO_MMIO_QUEUE_USED_LOW, (uint32_t) used);
+        mmio_write32(device, VIRTIO_MMIO_QUEUE_USED_HIGH, (uint32_t) (used >> 32));
+        mmio_write32(device, VIRTIO_MMIO_QUEUE_READY, 1);
+    }
+    return 0;
+}
+
+int virtq_add(Virtqueue_t* queue, const VirtqBuffer_t* buffers, int count, void* token) {
+    if (count <= 0 || queue->free_count < count) return -1;
+
+    uint16_t head = queue->free_head;
+    uint16_t index = head;
+    for (int i = 0; i < count; i++) {
+        volatile VirtqDesc_t* desc = &queue->desc[index];
+        desc->address = buffers[i].address;
+        desc->length = buffers[i].length;
+        desc->flags = (uint16_t) ((buffers[i].writable ? VIRTQ_DESC_F_WRITE : 0) | (i + 1 < count ? VIRTQ_DESC_F_NEXT : 0));
+        if (i + 1 < count) index = desc->next; // Free list order is chain order, next is already right
+    }
+    queue->free_head = queue->desc[index].next;
+    queue->free_count = (uint16_t) (queue->free_count - count);
+
+    queue->tokens[head] = token;
+    queue->avail->ring[queue->avail_index & (queue->size - 1)] = head;
+    queue->avail_index++;
+    queue->inflight++;
+    return head;
+}
+
+// new - event - 1 < new - old: the device's event index is among the ones we just published
+static inline int need_event(uint16_t event, uint16_t new_index, uint16_t old_index) {
+    return (uint16_t) (new_index - event - 1) < (uint16_t) (new_index - old_index);
+}
+
+int virtq_kick(Virtqueue_t* queue) {
+    uint16_t old_index = queue->kicked_index;
+    uint16_t new_index = queue->avail_index;
+    if (old_index == new_index) return 0;
+
+    asm volatile("fence w, w" ::: "memory"); // Ring entries before the index that publishes them
+    queue->avail->index = new_index;
+    queue->kicked_index = new_index;
+    atomic_fence(); // Index out before we read what the device wants
+
+    int notify;
+    if (virtio_has(queue->device, VIRTIO_F_RING_EVENT_IDX)) {
+        notify = need_event(*queue->avail_event, new_index, old_index);
+    } else {
+        notify = !(queue->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+
+    if (notify) {
+        mmio_write32(queue->device, VIRTIO_MMIO_QUEUE_NOTIFY, queue->index);
+        queue->notifies++;
+    } else {
+        queue->suppressed++;
+    }
+    return notify;
+}
+
+void* virtq_get(Virtqueue_t* queue, uint32_t* length) {
+    if (queue->last_used == queue->used->index) return NULL;
+    asm volatile("fence r, r" ::: "memory"); // Index before the entry it covers
+
+    volatile VirtqUsedElem_t* element = &queue->used->ring[queue->last_used & (queue->size - 1)];
+    uint16_t head = (uint16_t) element->id;
+    if (length) *length = element->length;
+    queue->last_used++;
+
+    // Chain back onto the free list
+    uint16_t last = head;
+    uint16_t count = 1;
+    while (queue->desc[last].flags & VIRTQ_DESC_F_NEXT) {
+        last = queue->desc[last].next;
+        count++;
+    }
+    queue->desc[last].next = queue->free_head;
+    queue->free_head = head;
+    queue->free_count = (uint16_t) (queue->free_count + count);
+    queue->inflight--;
+
+    void* token = queue->tokens[head];
+    queue->tokens[head] = NULL;
+    return token;
+}
+
+// Interrupt coalescing: with event-idx the next interrupt is asked for once about half of
+// what's still in flight has completed, rather than on every single completion
+int virtq_arm(Virtqueue_t* queue) {
+    if (virtio_has(queue->device, VIRTIO_F_RING_EVENT_IDX)) {
+        uint16_t batch = queue->inflight > 1 ? (uint16_t) ((queue->inflight + 1) / 2) : 1;
+        *queue->used_event = (uint16_t) (queue->last_used + batch - 1);
+    } else {
+        queue->avail->flags &= (uint16_t) ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+    atomic_fence(); // The device may have moved on before it saw that
+    return queue->used->index != queue->last_used;
+}
+
+static void virtio_interrupt(void* data) {
+    VirtioDevice_t* device = (VirtioDevice_t*) data;
+    uint32_t status = mmio_read32(device, VIRTIO_MMIO_INTERRUPT_STATUS);
+    mmio_write32(device, VIRTIO_MMIO_INTERRUPT_ACK, status);
+    device->interrupts++;
+
+    if ((status & VIRTIO_INTERRUPT_USED) && device->interrupt) device->interrupt(device);
+}
+
+int virtio_enable_interrupt(VirtioDevice_t* device) {
+    if (!device->irq) return -1;
+    return plic_enable(device->irq, virtio_interrupt, device);
+}
+
+void virtio_disable_interrupt(VirtioDevice_t* device) {
+    if (device->irq) plic_disable(device->irq);
+}
+
+static int virtio_mmio_probe(const Device_t* node) {
+    if (node->reg_count == 0) return -1;
+
+    uintptr_t base = (uintptr_t) node->reg[0].base;
+    if (*(volatile uint32_t*) (base + VIRTIO_MMIO_MAGIC_VALUE) != VIRTIO_MAGIC) return -1;
+    uint32_t device_id = *(volatile uint32_t*) (base + VIRTIO_MMIO_DEVICE_ID);
+    if (device_id == 0) return DRIVER_NO_DEVICE; // QEMU lays out empty slots
+
+    const VirtioDriver_t* driver = NULL;
+    for (size_t i = 0; i < NUM_VIRTIO_DRIVERS; i++) {
+        if (virtio_drivers[i].device_id == device_id) driver = &virtio_drivers[i];
+    }
+    if (!driver) {
+        klog("virtio: %s has device %u, no driver\n", node->node->name, device_id);
+        return DRIVER_NO_DEVICE;
+    }
+    if (device_count >= VIRTIO_MAX_DEVICES) return -1;
+
+    VirtioDevice_t* device = &devices[device_count];
+    memset(device, 0, sizeof(*device));
+    device->base = base;
+    device->version = *(volatile uint32_t*) (base + VIRTIO_MMIO_VERSION);
+    device->device_id = device_id;
+    device->irq = node->irq_count ? node->irqs[0] : 0;
+    device->node = node->node;
+
+    int rc = driver->probe(device);
+    if (rc < 0) {
+        virtio_fail(device);
+        return rc;
+    }
+    device_count++;
+    klog("virtio: %s %s, %s transport, irq %u\n", node->node->name, driver->name,
+         device->version == 1 ? "legacy" : "modern", device->irq);
+    return 0;
+}
+
+DRIVER_REGISTER(virtio_mmio, virtio_mmio_probe, "virtio,mmio");
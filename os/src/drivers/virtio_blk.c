@@ -0,0 +1,167 @@
+#include <virtio.h>
+#include <block.h>
+#include <dma.h>
+#include <slab.h>
+#include <klog.h>
+#include <mini_lib.h>
+
+// virtio-blk: one request queue, three descriptors per request (header, data, status byte).
+// Headers and status bytes live in a DMA array indexed by head descriptor, so submitting
+// allocates nothing. A batch goes into the avail ring and is published with one kick.
+
+#define VIRTIO_BLK_F_RO    5
+#define VIRTIO_BLK_F_FLUSH 9
+
+#define VIRTIO_BLK_T_IN    0
+#define VIRTIO_BLK_T_OUT   1
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTIO_BLK_S_OK 0
+
+#define VIRTIO_BLK_CONFIG_CAPACITY 0x00 // 512 byte sectors
+
+#define VIRTIO_BLK_QUEUE_SIZE 128
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+    uint8_t status;
+} __attribute__((aligned(32))) VirtioBlkSlot_t;
+
+typedef struct {
+    VirtioDevice_t* device;
+    Virtqueue_t queue;
+    BlockDevice_t block;
+    VirtioBlkSlot_t* slots;
+    uint64_t slots_physical;
+    int flush;                 // VIRTIO_BLK_F_FLUSH negotiated, otherwise the device is write-through
+} VirtioBlk_t;
+
+static int virtio_blk_submit(BlockDevice_t* block, BlockRequest_t** requests, int count) {
+    VirtioBlk_t* blk = (VirtioBlk_t*) block->driver;
+    Virtqueue_t* queue = &blk->queue;
+    BlockRequest_t* flushed = NULL;
+    int queued = 0, added = 0;
+
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    for (; queued < count; queued++) {
+        BlockRequest_t* request = requests[queued];
+        if (request->op == BLOCK_FLUSH && !blk->flush) { // Write-through, nothing to flush
+            request->next = flushed;
+            flushed = request;
+            continue;
+        }
+
+        uint16_t head = queue->free_head; // Where virtq_add will put the header
+        if (queue->free_count < 3) break;
+
+        VirtioBlkSlot_t* slot = &blk->slots[head];
+        uint64_t slot_physical = blk->slots_physical + (uint64_t) head * sizeof(VirtioBlkSlot_t);
+        slot->type = request->op == BLOCK_READ ? VIRTIO_BLK_T_IN : request->op == BLOCK_WRITE ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_FLUSH;
+        slot->reserved = 0;
+        slot->sector = request->sector;
+        slot->status = 0xff;
+
+        VirtqBuffer_t buffers[3];
+        int used = 0;
+        buffers[used++] = (VirtqBuffer_t) { slot_physical, 16, 0 };
+        if (request->op != BLOCK_FLUSH) {
+            buffers[used++] = (VirtqBuffer_t) { dma_to_physical(request->buffer), request->count * BLOCK_SECTOR_SIZE,
+                                                request->op == BLOCK_READ };
+        }
+        buffers[used++] = (VirtqBuffer_t) { slot_physical + offsetof(VirtioBlkSlot_t, status), 1, 1 };
+
+        request->tag = head;
+        virtq_add(queue, buffers, used, request);
+        added++;
+    }
+
+    block->stats.requests += (uint64_t) queued;
+    if (added) {
+        block->stats.batches++;
+        block->stats.notifies += (uint64_t) virtq_kick(queue);
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+
+    // Unlocked, done callbacks may submit
+    while (flushed) {
+        BlockRequest_t* request = flushed;
+        flushed = request->next;
+        block_complete(block, request, 0);
+    }
+    return queued;
+}
+
+// Reap everything, re-arm, and go again if more landed meanwhile. Callbacks run after the
+// lock is dropped since they're allowed to submit.
+static void virtio_blk_interrupt(VirtioDevice_t* device) {
+    VirtioBlk_t* blk = (VirtioBlk_t*) device->driver;
+    Virtqueue_t* queue = &blk->queue;
+    BlockRequest_t* done = NULL;
+    BlockRequest_t** tail = &done;
+
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    blk->block.stats.interrupts++;
+    do {
+        BlockRequest_t* request;
+        while ((request = (BlockRequest_t*) virtq_get(queue, NULL)) != NULL) {
+            request->tag = blk->slots[request->tag].status; // The slot is up for reuse once we unlock
+            request->next = NULL;
+            *tail = request;
+            tail = &request->next;
+        }
+    } while (virtq_arm(queue));
+    spin_unlock_irqrestore(&queue->lock, flags);
+
+    while (done) {
+        BlockRequest_t* request = done;
+        done = request->next; // Read before completion hands the request back
+        block_complete(&blk->block, request, request->tag == VIRTIO_BLK_S_OK ? 0 : -1);
+    }
+}
+
+int virtio_blk_probe(VirtioDevice_t* device) {
+    uint64_t wanted = (1ull << VIRTIO_BLK_F_RO) | (1ull << VIRTIO_BLK_F_FLUSH) | (1ull << VIRTIO_F_RING_EVENT_IDX);
+    if (virtio_negotiate(device, wanted) < 0) return -1;
+
+    VirtioBlk_t* blk = (VirtioBlk_t*) kmalloc(sizeof(VirtioBlk_t));
+    if (!blk) return -1;
+    memset(blk, 0, sizeof(*blk));
+    blk->device = device;
+
+    if (virtq_setup(device, &blk->queue, 0, VIRTIO_BLK_QUEUE_SIZE) < 0) {
+        kfree(blk);
+        return -1;
+    }
+    blk->slots = (VirtioBlkSlot_t*) dma_alloc(sizeof(VirtioBlkSlot_t) * blk->queue.size, 0, &blk->slots_physical);
+    device->driver = blk;
+    device->interrupt = virtio_blk_interrupt;
+    if (!blk->slots || virtio_enable_interrupt(device) < 0) {
+        klog("virtio-blk: %s\n", blk->slots ? "no interrupt route" : "out of DMA memory");
+        dma_free(blk->slots);
+        dma_free(blk->queue.memory);
+        kfree(blk);
+        return -1;
+    }
+    virtq_arm(&blk->queue);
+    virtio_ready(device);
+
+    blk->block.sectors = virtio_config_read64(device, VIRTIO_BLK_CONFIG_CAPACITY);
+    blk->block.read_only = (uint32_t) virtio_has(device, VIRTIO_BLK_F_RO);
+    blk->flush = virtio_has(device, VIRTIO_BLK_F_FLUSH);
+    blk->block.queue_depth = blk->queue.size / 3;
+    blk->block.submit = virtio_blk_submit;
+    blk->block.driver = blk;
+    if (block_register(&blk->block) < 0) {
+        // Our caller hands this devices[] slot to the next device, so nothing may point here
+        virtio_disable_interrupt(device);
+        device->interrupt = NULL;
+        device->driver = NULL;
+        dma_free(blk->slots);
+        dma_free(blk->queue.memory);
+        kfree(blk);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,333 @@
+#include <virtio.h>
+#include <console.h>
+#include <dma.h>
+#include <slab.h>
+#include <sched.h>
+#include <timer.h>
+#include <kprintf.h>
+#include <klog.h>
+#include <mini_lib.h>
+
+// virtio-console, port 0 only (no MULTIPORT): receiveq 0, transmitq 1. Output is copied into
+// 4 KiB DMA slots, one descriptor each, so a whole buffer leaves per descriptor instead of a
+// byte per register write. Small writes that arrive while a slot is in flight pile up in the
+// open slot and go out together when the completion interrupt posts it.
+
+#define VIRTIO_CONSOLE_RECEIVEQ  0
+#define VIRTIO_CONSOLE_TRANSMITQ 1
+
+#define VCON_TX_SLOTS   16
+#define VCON_SLOT_SIZE  4096
+#define VCON_RX_BUFFERS 8
+#define VCON_RX_SIZE    64
+#define VCON_RX_RING    256 // Power of two
+#define VCON_STUCK_MS   100 // No slot came back for this long, the device is gone
+
+typedef struct VconSlot {
+    uint8_t* data;
+    uint64_t physical;
+    uint32_t length;
+    struct VconSlot* next; // Free list
+} VconSlot_t;
+
+typedef struct {
+    VirtioDevice_t* device;
+    Virtqueue_t rx;
+    Virtqueue_t tx;
+    VconSlot_t slots[VCON_TX_SLOTS];
+    VconSlot_t* free_slots;
+    VconSlot_t* open;            // Being filled, not on the ring yet
+    uint8_t* slot_memory;
+    uint8_t* rx_memory;
+    uint64_t rx_physical;
+    char rx_ring[VCON_RX_RING];
+    volatile uint32_t rx_head;
+    volatile uint32_t rx_tail;
+    uint64_t rx_dropped;
+    WaitQueue_t rx_wait;
+    volatile int interrupts_seen; // Until then nothing would post the open slot for us
+    volatile int polled;          // Panic: never leave anything for the interrupt
+    uint64_t bytes;
+    uint64_t buffers;             // Slots posted
+    uint64_t coalesced;           // Writes that joined a slot already holding output
+} VirtioConsole_t;
+
+static VirtioConsole_t* console = NULL; // There's only one console
+
+// With tx.lock held
+static void post_open(VirtioConsole_t* vcon) {
+    VconSlot_t* slot = vcon->open;
+    if (!slot) return;
+    VirtqBuffer_t buffer = { slot->physical, slot->length, 0 };
+    virtq_add(&vcon->tx, &buffer, 1, slot); // A descriptor per slot, there's always room
+    vcon->open = NULL;
+    vcon->buffers++;
+}
+
+static void reap_tx(VirtioConsole_t* vcon) {
+    VconSlot_t* slot;
+    while ((slot = (VconSlot_t*) virtq_get(&vcon->tx, NULL)) != NULL) {
+        slot->length = 0;
+        slot->next = vcon->free_slots;
+        vcon->free_slots = slot;
+    }
+}
+
+// Copies as much of data as fits, a run at a time, returns how much of data it took
+static size_t fill(VconSlot_t* slot, const char* data, size_t length, int binary) {
+    size_t taken = 0;
+    while (taken < length) {
+        size_t space = VCON_SLOT_SIZE - slot->length;
+        if (binary) {
+            size_t chunk = length - taken < space ? length - taken : space;
+            memcpy(slot->data + slot->length, data + taken, chunk);
+            slot->length += (uint32_t) chunk;
+            return taken + chunk;
+        }
+
+        size_t run = 0;
+        while (taken + run < length && run < space && data[taken + run] != '\n') run++;
+        memcpy(slot->data + slot->length, data + taken, run);
+        slot->length += (uint32_t) run;
+        taken += run;
+        if (taken == length || run == space) break;
+
+        if (VCON_SLOT_SIZE - slot->length < 2) break; // "\r\n" goes in the next one
+        slot->data[slot->length++] = '\r';
+        slot->data[slot->length++] = '\n';
+        taken++;
+    }
+    return taken;
+}
+
+// Every vector goes into the slots under one hold of the lock and out with one kick
+static int vcon_send(const ConsoleVector_t* vectors, int count, int binary) {
+    VirtioConsole_t* vcon = console;
+    uint64_t deadline = 0;
+
+    uint64_t flags = spin_lock_irqsave(&vcon->tx.lock);
+    for (int i = 0; i < count; i++) {
+        const char* data = (const char*) vectors[i].data;
+        size_t length = vectors[i].length;
+
+        if (vcon->open && length) vcon->coalesced++;
+        while (length) {
+            if (!vcon->open) {
+                reap_tx(vcon); // Not waiting on the interrupt means this works with them off too
+                if (!vcon->free_slots) {
+                    if (!deadline) deadline = clock_now() + clock_ms_to_ticks(VCON_STUCK_MS);
+                    if (clock_now() > deadline) {
+                        spin_unlock_irqrestore(&vcon->tx.lock, flags);
+                        return -1;
+                    }
+                    spin_unlock_irqrestore(&vcon->tx.lock, flags);
+                    cpu_relax();
+                    flags = spin_lock_irqsave(&vcon->tx.lock);
+                    continue;
+                }
+                vcon->open = vcon->free_slots;
+                vcon->free_slots = vcon->open->next;
+            }
+
+            size_t taken = fill(vcon->open, data, length, binary);
+            vcon->bytes += taken;
+            data += taken;
+            length -= taken;
+            if (length) post_open(vcon); // Full
+        }
+    }
+
+    // Something in flight means an interrupt is coming that will post the open slot, so let
+    // more writes join it. Otherwise send it now.
+    if (vcon->tx.inflight == 0 || !vcon->interrupts_seen || vcon->polled) post_open(vcon);
+    virtq_kick(&vcon->tx);
+    spin_unlock_irqrestore(&vcon->tx.lock, flags);
+    return 0;
+}
+
+static int vcon_write(const char* data, size_t length, int binary) {
+    ConsoleVector_t vector = { data, length };
+    return vcon_send(&vector, 1, binary);
+}
+
+static int vcon_writev(const ConsoleVector_t* vectors, int count) {
+    return vcon_send(vectors, count, 0);
+}
+
+// With rx.lock held, returns whether anything came in
+static int reap_rx(VirtioConsole_t* vcon) {
+    int received = 0;
+    uint8_t* buffer;
+    uint32_t length;
+    while ((buffer = (uint8_t*) virtq_get(&vcon->rx, &length)) != NULL) {
+        for (uint32_t i = 0; i < length && i < VCON_RX_SIZE; i++) {
+            if (vcon->rx_head - vcon->rx_tail < VCON_RX_RING) {
+                vcon->rx_ring[vcon->rx_head & (VCON_RX_RING - 1)] = (char) buffer[i];
+                atomic_store_release32(&vcon->rx_head, vcon->rx_head + 1);
+            } else {
+                vcon->rx_dropped++; // Nobody is reading
+            }
+        }
+        received = 1;
+
+        VirtqBuffer_t again = { vcon->rx_physical + (uint64_t) (buffer - vcon->rx_memory), VCON_RX_SIZE, 1 };
+        virtq_add(&vcon->rx, &again, 1, buffer);
+    }
+    if (received) virtq_kick(&vcon->rx);
+    return received;
+}
+
+static void vcon_interrupt(VirtioDevice_t* device) {
+    VirtioConsole_t* vcon = (VirtioConsole_t*) device->driver;
+    vcon->interrupts_seen = 1;
+
+    uint64_t flags = spin_lock_irqsave(&vcon->tx.lock);
+    do {
+        reap_tx(vcon);
+    } while (virtq_arm(&vcon->tx));
+    if (vcon->open) {
+        post_open(vcon);
+        virtq_kick(&vcon->tx);
+    }
+    spin_unlock_irqrestore(&vcon->tx.lock, flags);
+
+    flags = spin_lock_irqsave(&vcon->rx.lock);
+    int received = 0;
+    do {
+        received |= reap_rx(vcon);
+    } while (virtq_arm(&vcon->rx));
+    spin_unlock_irqrestore(&vcon->rx.lock, flags);
+    if (received) wake_up(&vcon->rx_wait, 1);
+}
+
+static int vcon_getc(void) {
+    VirtioConsole_t* vcon = console;
+    while (1) {
+        if (atomic_load_acquire32(&vcon->rx_head) != vcon->rx_tail) {
+            char c = vcon->rx_ring[vcon->rx_tail & (VCON_RX_RING - 1)];
+            atomic_store_release32(&vcon->rx_tail, vcon->rx_tail + 1);
+            return (unsigned char) c;
+        }
+
+        if (!thread_current()) { // No scheduler to sleep in, look at the ring ourselves
+            uint64_t flags = spin_lock_irqsave(&vcon->rx.lock);
+            reap_rx(vcon);
+            spin_unlock_irqrestore(&vcon->rx.lock, flags);
+            continue;
+        }
+
+        wait_prepare(&vcon->rx_wait);
+        if (atomic_load_acquire32(&vcon->rx_head) == vcon->rx_tail) thread_block();
+        wait_finish(&vcon->rx_wait);
+    }
+}
+
+static int vcon_poll(void) {
+    VirtioConsole_t* vcon = console;
+    if (atomic_load_acquire32(&vcon->rx_head) == vcon->rx_tail) return -1;
+    char c = vcon->rx_ring[vcon->rx_tail & (VCON_RX_RING - 1)];
+    atomic_store_release32(&vcon->rx_tail, vcon->rx_tail + 1);
+    return (unsigned char) c;
+}
+
+static void vcon_flush(void) {
+    VirtioConsole_t* vcon = console;
+    uint64_t deadline = clock_now() + clock_ms_to_ticks(VCON_STUCK_MS);
+
+    uint64_t flags = spin_lock_irqsave(&vcon->tx.lock);
+    post_open(vcon);
+    virtq_kick(&vcon->tx);
+    while (vcon->tx.inflight && clock_now() < deadline) {
+        reap_tx(vcon);
+        cpu_relax();
+    }
+    spin_unlock_irqrestore(&vcon->tx.lock, flags);
+}
+
+// Polled from here on. If the lock is held we may be the ones holding it, don't risk it.
+static int vcon_panic(void) {
+    VirtioConsole_t* vcon = console;
+    if (spin_is_locked(&vcon->tx.lock)) return -1;
+    vcon->polled = 1;
+    return 0;
+}
+
+static void vcon_show(void) {
+    VirtioConsole_t* vcon = console;
+    kprintf("virtio-console: %lu bytes in %lu buffers (%lu writes joined one), %lu notifies, %lu skipped, %lu interrupts\n",
+            vcon->bytes, vcon->buffers, vcon->coalesced, vcon->tx.notifies, vcon->tx.suppressed, vcon->device->interrupts);
+    if (vcon->rx_dropped) kprintf("virtio-console: %lu input bytes dropped\n", vcon->rx_dropped);
+}
+
+static const ConsoleDriver_t virtio_console_driver = {
+    .name = "virtio",
+    .write = vcon_write,
+    .writev = vcon_writev,
+    .getc = vcon_getc,
+    .poll = vcon_poll,
+    .flush = vcon_flush,
+    .panic = vcon_panic,
+    .show = vcon_show,
+};
+
+static void vcon_release(VirtioConsole_t* vcon) {
+    dma_free(vcon->slot_memory);
+    dma_free(vcon->rx_memory);
+    dma_free(vcon->rx.memory);
+    dma_free(vcon->tx.memory);
+    kfree(vcon);
+}
+
+int virtio_console_probe(VirtioDevice_t* device) {
+    if (console) {
+        klog("virtio-console: already have one, ignoring %s\n", device->node->name);
+        return -1;
+    }
+    if (virtio_negotiate(device, 1ull << VIRTIO_F_RING_EVENT_IDX) < 0) return -1;
+
+    VirtioConsole_t* vcon = (VirtioConsole_t*) kmalloc(sizeof(VirtioConsole_t));
+    if (!vcon) return -1;
+    memset(vcon, 0, sizeof(*vcon));
+    vcon->device = device;
+    vcon->rx_wait = (WaitQueue_t) WAIT_QUEUE_INIT;
+
+    if (virtq_setup(device, &vcon->rx, VIRTIO_CONSOLE_RECEIVEQ, VCON_RX_BUFFERS) < 0 ||
+        virtq_setup(device, &vcon->tx, VIRTIO_CONSOLE_TRANSMITQ, VCON_TX_SLOTS) < 0) {
+        vcon_release(vcon);
+        return -1;
+    }
+
+    uint64_t slot_physical;
+    vcon->slot_memory = (uint8_t*) dma_alloc(VCON_TX_SLOTS * VCON_SLOT_SIZE, VCON_SLOT_SIZE, &slot_physical);
+    vcon->rx_memory = (uint8_t*) dma_alloc(VCON_RX_BUFFERS * VCON_RX_SIZE, 0, &vcon->rx_physical);
+    device->driver = vcon;
+    device->interrupt = vcon_interrupt;
+    if (!vcon->slot_memory || !vcon->rx_memory || virtio_enable_interrupt(device) < 0) {
+        klog("virtio-console: %s\n", vcon->slot_memory && vcon->rx_memory ? "no interrupt route" : "out of DMA memory");
+        vcon_release(vcon);
+        return -1;
+    }
+
+    // The queue may have come out smaller than asked, only use as many slots as it has descriptors
+    unsigned int slots = vcon->tx.size < VCON_TX_SLOTS ? vcon->tx.size : VCON_TX_SLOTS;
+    for (unsigned int i = 0; i < slots; i++) {
+        VconSlot_t* slot = &vcon->slots[i];
+        slot->data = vcon->slot_memory + (size_t) i * VCON_SLOT_SIZE;
+        slot->physical = slot_physical + (uint64_t) i * VCON_SLOT_SIZE;
+        slot->next = vcon->free_slots;
+        vcon->free_slots = slot;
+    }
+    for (unsigned int i = 0; i < vcon->rx.size && i < VCON_RX_BUFFERS; i++) {
+        VirtqBuffer_t buffer = { vcon->rx_physical + (uint64_t) i * VCON_RX_SIZE, VCON_RX_SIZE, 1 };
+        virtq_add(&vcon->rx, &buffer, 1, vcon->rx_memory + (size_t) i * VCON_RX_SIZE);
+    }
+
+    virtq_arm(&vcon->rx);
+    virtq_arm(&vcon->tx);
+    virtio_ready(device);
+    virtq_kick(&vcon->rx);
+
+    console = vcon;
+    console_register(&virtio_console_driver);
+    return 0;
+}
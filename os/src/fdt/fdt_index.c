@@ -0,0 +1,362 @@
+#include <fdt_index.h>
+
+// Everything lives in .bss, the index is built before the page allocator exists
+static FDTView_t index_view;
+static FDTNode_t nodes[FDT_INDEX_MAX_NODES];
+static FDTProp_t props[FDT_INDEX_MAX_PROPS];
+static size_t node_count = 0;
+static size_t prop_count = 0;
+
+static const FDTNode_t* path_buckets[FDT_PATH_BUCKETS];
+static const FDTNode_t* phandle_buckets[FDT_PHANDLE_BUCKETS];
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME  16777619u
+
+static uint32_t fnv_bytes(uint32_t hash, const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint32_t phandle_bucket(uint32_t phandle) {
+    return (phandle * 2654435761u) >> 26; // Fibonacci hash down to 6 bits
+}
+
+// Hash of parent's path + "/" + name, the same as hashing the full path string in one go
+static uint32_t child_path_hash(const FDTNode_t* parent, const char* name, size_t length) {
+    uint32_t hash = parent->path_hash;
+    if (parent->parent) hash = fnv_bytes(hash, "/", 1); // Root's path already ends in '/'
+    return fnv_bytes(hash, name, length);
+}
+
+int fdt_index_build(const FDTView_t* fdt) {
+    if (!fdt) return -1; // Bad input
+
+    index_view = *fdt;
+    node_count = 0;
+    prop_count = 0;
+    memset(path_buckets, 0, sizeof(path_buckets));
+    memset(phandle_buckets, 0, sizeof(phandle_buckets));
+
+    FDTCursor_t cursor = { .current = fdt->struct_begin, .end = fdt->struct_end };
+    FDTToken_t token;
+    const char* name = NULL;
+    FDTProp_t prop;
+
+    FDTNode_t* current = NULL;
+    FDTNode_t* last_child[FDT_INDEX_MAX_DEPTH + 1]; // Tail of each open node's child list
+
+    while (1) {
+        int rc = fdt_next(&cursor, (FDTView_t*) fdt, &token, &name, &prop);
+        if (rc == 1) break;
+        if (rc < 0) return -2; // Malformed blob
+
+        switch (token) {
+            case FDT_BEGIN_NODE: {
+                if (node_count >= FDT_INDEX_MAX_NODES) return -3; // Arena full
+                unsigned int depth = current ? current->depth + 1u : 0u;
+                if (depth > FDT_INDEX_MAX_DEPTH) return -4; // Too deep
+
+                FDTNode_t* node = &nodes[node_count++];
+                memset(node, 0, sizeof(*node));
+                node->name = name;
+                node->name_length = strlen(name);
+                node->parent = current;
+                node->depth = (uint16_t) depth;
+                node->first_prop = (uint32_t) prop_count;
+
+                if (current) {
+                    node->address_cells = current->child_address_cells;
+                    node->size_cells = current->child_size_cells;
+                    node->path_hash = child_path_hash(current, name, node->name_length);
+
+                    if (current->child) last_child[current->depth]->sibling = node;
+                    else current->child = node;
+                    last_child[current->depth] = node;
+                } else {
+                    node->address_cells = 2; // Reasonable defaults if root omits them (common on some blobs)
+                    node->size_cells = 2;
+                    node->path_hash = fnv_bytes(FNV_OFFSET, "/", 1);
+                }
+                node->child_address_cells = node->address_cells;
+                node->child_size_cells = node->size_cells;
+
+                uint32_t bucket = node->path_hash & (FDT_PATH_BUCKETS - 1);
+                node->path_next = path_buckets[bucket];
+                path_buckets[bucket] = node;
+
+                current = node;
+            } break;
+
+            case FDT_END_NODE:
+                if (!current) return -5; // Unbalanced
+                if (current->phandle) {
+                    uint32_t bucket = phandle_bucket(current->phandle);
+                    current->phandle_next = phandle_buckets[bucket];
+                    phandle_buckets[bucket] = current;
+                }
+                current = (FDTNode_t*) current->parent;
+                break;
+
+            case FDT_PROP: {
+                if (!current) return -5; // Property outside any node
+                if (prop_count >= FDT_INDEX_MAX_PROPS) return -3; // Arena full
+                if (current->first_prop + current->prop_count != prop_count) return -6; // Property after a subnode
+
+                props[prop_count++] = prop;
+                current->prop_count++;
+
+                uint32_t value;
+                if (fdt_prop_is(&prop, "#address-cells")) {
+                    if (fdt_prop_read_u32(&prop, &value, 0)) current->child_address_cells = (uint8_t) value;
+                } else if (fdt_prop_is(&prop, "#size-cells")) {
+                    if (fdt_prop_read_u32(&prop, &value, 0)) current->child_size_cells = (uint8_t) value;
+                } else if (fdt_prop_is(&prop, "phandle") || fdt_prop_is(&prop, "linux,phandle")) {
+                    if (fdt_prop_read_u32(&prop, &value, 0)) current->phandle = value;
+                }
+            } break;
+
+            default: break;
+        }
+    }
+
+    return current ? -5 : 0;
+}
+
+const FDTView_t* fdt_index_view(void) {
+    return &index_view;
+}
+
+size_t fdt_node_count(void) {
+    return node_count;
+}
+
+const FDTNode_t* fdt_node_at(size_t index) {
+    return index < node_count ? &nodes[index] : NULL;
+}
+
+const FDTNode_t* fdt_root(void) {
+    return node_count ? &nodes[0] : NULL;
+}
+
+// Compares a node's full path to path[0..length) by walking up the parents from the last segment
+static int node_path_equals(const FDTNode_t* node, const char* path, size_t length) {
+    while (node->parent) {
+        size_t n = node->name_length;
+        if (length < n + 1) return 0;
+        if (path[length - n - 1] != '/' || memcmp(path + length - n, node->name, n) != 0) return 0;
+        length -= n + 1;
+        node = node->parent;
+    }
+    return length == 0 || (length == 1 && path[0] == '/');
+}
+
+const FDTNode_t* fdt_find_path_length(const char* path, size_t length) {
+    if (!path || length == 0 || path[0] != '/') return NULL; // Only absolute paths
+    while (length > 1 && path[length - 1] == '/') length--; // "/soc/" is "/soc"
+
+    uint32_t hash = fnv_bytes(FNV_OFFSET, path, length);
+    for (const FDTNode_t* node = path_buckets[hash & (FDT_PATH_BUCKETS - 1)]; node; node = node->path_next) {
+        if (node->path_hash == hash && node_path_equals(node, path, length)) return node;
+    }
+    return NULL;
+}
+
+const FDTNode_t* fdt_find_path(const char* path) {
+    if (!path) return NULL;
+    return fdt_find_path_length(path, strlen(path));
+}
+
+const FDTNode_t* fdt_find_phandle(uint32_t phandle) {
+    if (phandle == 0) return NULL;
+    for (const FDTNode_t* node = phandle_buckets[phandle_bucket(phandle)]; node; node = node->phandle_next) {
+        if (node->phandle == phandle) return node;
+    }
+    return NULL;
+}
+
+// Absolute paths go straight to the table, anything else is looked up in /aliases first
+const FDTNode_t* fdt_find_alias(const char* alias) {
+    if (!alias) return NULL;
+    if (alias[0] == '/') return fdt_find_path(alias);
+
+    const FDTProp_t* prop = fdt_node_prop(fdt_find_path("/aliases"), alias);
+    return prop ? fdt_find_path(fdt_prop_string(prop)) : NULL;
+}
+
+int fdt_node_is(const FDTNode_t* node, const char* base_name) {
+    if (!node || !base_name) return 0;
+    size_t length = strlen(base_name);
+    if (node->name_length < length) return 0;
+    if (memcmp(node->name, base_name, length) != 0) return 0;
+    return node->name_length == length || node->name[length] == '@';
+}
+
+const FDTNode_t* fdt_node_child(const FDTNode_t* node, const char* base_name) {
+    if (!node) return NULL;
+    for (const FDTNode_t* child = node->child; child; child = child->sibling) {
+        if (fdt_node_is(child, base_name)) return child;
+    }
+    return NULL;
+}
+
+const FDTProp_t* fdt_node_prop(const FDTNode_t* node, const char* name) {
+    if (!node || !name) return NULL;
+    for (uint32_t i = 0; i < node->prop_count; i++) {
+        const FDTProp_t* prop = &props[node->first_prop + i];
+        if (fdt_prop_is(prop, name)) return prop;
+    }
+    return NULL;
+}
+
+int fdt_node_reg(const FDTNode_t* node, FDTRegRegion_t* output, int max_regions) {
+    const FDTProp_t* reg = fdt_node_prop(node, "reg");
+    if (!reg) return -1; // No reg
+    return fdt_reg_decode(reg, node->address_cells, node->size_cells, output, max_regions);
+}
+
+// Writes the full path into buffer (truncated if needed), returns the untruncated length
+size_t fdt_node_path(const FDTNode_t* node, char* buffer, size_t size) {
+    if (!node) return 0;
+
+    const FDTNode_t* chain[FDT_INDEX_MAX_DEPTH + 1];
+    size_t depth = 0;
+    for (const FDTNode_t* n = node; n->parent; n = n->parent) chain[depth++] = n;
+
+    size_t position = 0;
+    if (depth == 0) {
+        if (size > 1) buffer[0] = '/';
+        position = 1;
+    }
+    while (depth--) {
+        if (position + 1 < size) buffer[position] = '/';
+        position++;
+        for (size_t i = 0; i < chain[depth]->name_length; i++, position++) {
+            if (position + 1 < size) buffer[position] = chain[depth]->name[i];
+        }
+    }
+
+    if (size) buffer[position < size ? position : size - 1] = '\0';
+    return position;
+}
+
+// Resolve /chosen stdout-path (or stdout) through /aliases to the UART node and read its reg
+int fdt_resolve_stdout_uart(uint64_t* base, uint64_t* size, const char** path, const char** compatible) {
+    if (!base || !size || !path || !compatible) return -1; // Bad input
+
+    const FDTNode_t* chosen = fdt_find_path("/chosen");
+    const FDTProp_t* prop = fdt_node_prop(chosen, "stdout-path");
+    if (!prop) prop = fdt_node_prop(chosen, "stdout");
+    const char* raw = fdt_prop_string(prop);
+    if (!raw) return -2; // No stdout in /chosen
+
+    // "serial0:115200n8" -> "serial0"
+    size_t length = 0;
+    while (raw[length] && raw[length] != ':') length++;
+
+    const FDTNode_t* node;
+    if (raw[0] == '/') {
+        node = fdt_find_path_length(raw, length);
+    } else {
+        char alias[64];
+        if (length >= sizeof(alias)) return -3; // No alias is that long
+        memcpy(alias, raw, length);
+        alias[length] = '\0';
+        node = fdt_find_alias(alias);
+    }
+    if (!node) return -3; // Couldn't resolve /chosen stdout path
+
+    FDTRegRegion_t region;
+    if (fdt_node_reg(node, &region, 1) != 1) return -4;
+
+    static char path_buffer[128]; // Handed back to the caller, so it can't live on our stack
+    fdt_node_path(node, path_buffer, sizeof(path_buffer));
+
+    const char* node_compatible = fdt_prop_string(fdt_node_prop(node, "compatible"));
+    *base = region.base;
+    *size = region.size;
+    *path = path_buffer;
+    *compatible = node_compatible ? node_compatible : ""; // May be a stringlist, the first entry is fine
+    return 0;
+}
+
+// reg of every /memory node
+int fdt_memory_regions(FDTRegRegion_t* output, int max_regions) {
+    if (!output || max_regions <= 0) return -1; // Bad input
+
+    int count = 0;
+    for (const FDTNode_t* node = fdt_root() ? fdt_root()->child : NULL; node; node = node->sibling) {
+        if (count >= max_regions) break;
+        if (!fdt_node_is(node, "memory")) continue;
+        int n = fdt_node_reg(node, &output[count], max_regions - count);
+        if (n > 0) count += n;
+    }
+    return count;
+}
+
+// Everything the firmware asked us to stay away from: memreserve entries + /reserved-memory children
+int fdt_reserved_regions(FDTRegRegion_t* output, int max_regions) {
+    if (!output || max_regions <= 0) return -1; // Bad input
+
+    int count = 0;
+    FDTMemReserveEntry_t entry;
+    for (size_t i = 0; count < max_regions && fdt_mem_reserve_entry(&index_view, i, &entry) == 1; i++) {
+        output[count].base = entry.address;
+        output[count].size = entry.size;
+        count++;
+    }
+
+    const FDTNode_t* reserved = fdt_find_path("/reserved-memory");
+    for (const FDTNode_t* node = reserved ? reserved->child : NULL; node && count < max_regions; node = node->sibling) {
+        int n = fdt_node_reg(node, &output[count], max_regions - count);
+        if (n > 0) count += n;
+    }
+
+    return count;
+}
+
+// /chosen linux,initrd-start and -end, either one or two cells each depending on who wrote them
+static int read_chosen_address(const FDTNode_t* chosen, const char* name, uint64_t* output) {
+    const FDTProp_t* prop = fdt_node_prop(chosen, name);
+    if (!prop) return -1;
+    if (prop->length == 4) {
+        *output = read_be32(prop->value);
+    } else if (prop->length == 8) {
+        *output = read_be64(prop->value);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int fdt_initrd(uint64_t* start, uint64_t* end) {
+    if (!start || !end) return -1; // Bad input
+
+    const FDTNode_t* chosen = fdt_find_path("/chosen");
+    if (!chosen) return -2;
+    if (read_chosen_address(chosen, "linux,initrd-start", start) != 0) return -2; // No initrd
+    if (read_chosen_address(chosen, "linux,initrd-end", end) != 0 || *end < *start) return -3;
+    return 0;
+}
+
+// Finds the /cpus/cpu@N node whose reg is hart_id and returns its riscv,isa string and riscv,isa-extensions stringlist
+int fdt_cpu_isa(uint64_t hart_id, const char** isa, const char** extensions, size_t* extensions_length) {
+    if (!isa || !extensions || !extensions_length) return -1; // Bad input
+
+    const FDTNode_t* cpus = fdt_find_path("/cpus");
+    for (const FDTNode_t* node = cpus ? cpus->child : NULL; node; node = node->sibling) {
+        FDTRegRegion_t reg;
+        if (!fdt_node_is(node, "cpu") || fdt_node_reg(node, &reg, 1) != 1 || reg.base != hart_id) continue;
+
+        const FDTProp_t* list = fdt_node_prop(node, "riscv,isa-extensions");
+        *isa = fdt_prop_string(fdt_node_prop(node, "riscv,isa"));
+        *extensions = list ? (const char*) list->value : NULL;
+        *extensions_length = list ? list->length : 0;
+        return (*isa || *extensions) ? 0 : -2;
+    }
+
+    return -4; // No such hart
+}
@@ -0,0 +1,228 @@
+#include <initramfs.h>
+#include <fdt_index.h>
+#include <page_alloc.h>
+#include <vm.h>
+#include <slab.h>
+#include <klog.h>
+#include <mini_lib.h>
+
+// newc header: magic "070701" ("070702" is the same plus a checksum we don't check), then 13
+// fields of 8 hex digits. The name follows the 110 byte header and the data follows the name,
+// each padded to 4 bytes from the start of the archive. "TRAILER!!!" ends it.
+
+#define CPIO_HEADER_SIZE    110
+#define CPIO_FIELDS         13
+#define CPIO_FIELD_MODE     1
+#define CPIO_FIELD_FILESIZE 6
+#define CPIO_FIELD_NAMESIZE 11
+#define CPIO_TRAILER        "TRAILER!!!"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME  16777619u
+
+static uint64_t image_start = 0;
+static uint64_t image_end = 0;
+static InitramfsEntry_t* entries = NULL;
+static size_t entry_count = 0;
+static const InitramfsEntry_t** buckets = NULL;
+static uint32_t bucket_mask = 0;
+
+static uint32_t fnv_bytes(const char* data, size_t length) {
+    uint32_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static int parse_hex(const char* text, uint32_t* output) {
+    uint32_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        char c = text[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = (uint32_t) (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (uint32_t) (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = (uint32_t) (c - 'A' + 10);
+        } else {
+            return -1;
+        }
+        value = (value << 4) | digit;
+    }
+    *output = value;
+    return 0;
+}
+
+static inline uint64_t align4(uint64_t offset) {
+    return (offset + 3) & ~3ull;
+}
+
+// Drops the "./" and "/" archivers put in front, "." (the root itself) comes out empty.
+// Only ever moves forward, so the result is still NUL terminated in the image.
+static const char* normalize(const char* path, size_t* length) {
+    for (;;) {
+        if (*length >= 2 && path[0] == '.' && path[1] == '/') {
+            path += 2;
+            *length -= 2;
+        } else if (*length >= 1 && path[0] == '/') {
+            path++;
+            (*length)--;
+        } else {
+            break;
+        }
+    }
+    if (*length == 1 && path[0] == '.') *length = 0;
+    return path;
+}
+
+// One pass over the archive, filling output if there is one. Returns how many entries it has,
+// < 0 as soon as anything doesn't add up
+static long walk(InitramfsEntry_t* output) {
+    uint64_t size = image_end - image_start;
+    uint64_t offset = 0;
+    long count = 0;
+
+    for (;;) {
+        if (offset + CPIO_HEADER_SIZE > size) return -1;
+        const char* header = (const char*) (uintptr_t) (image_start + offset);
+        if (memcmp(header, "07070", 5) != 0 || (header[5] != '1' && header[5] != '2')) return -1;
+
+        uint32_t fields[CPIO_FIELDS];
+        for (int i = 0; i < CPIO_FIELDS; i++) {
+            if (parse_hex(header + 6 + i * 8, &fields[i]) < 0) return -1;
+        }
+
+        uint64_t name_offset = offset + CPIO_HEADER_SIZE;
+        uint32_t name_size = fields[CPIO_FIELD_NAMESIZE];
+        if (name_size == 0 || name_offset + name_size > size) return -1;
+        const char* name = (const char*) (uintptr_t) (image_start + name_offset);
+        if (name[name_size - 1] != '\0') return -1;
+
+        uint64_t data_offset = align4(name_offset + name_size);
+        uint64_t data_size = fields[CPIO_FIELD_FILESIZE];
+        if (data_offset + data_size > size) return -1;
+        if (strcmp(name, CPIO_TRAILER) == 0) return count;
+
+        size_t length = name_size - 1;
+        const char* path = normalize(name, &length);
+        if (length > 0 && length < INITRAMFS_MAX_PATH) {
+            if (output) {
+                InitramfsEntry_t* entry = &output[count];
+                entry->path = path;
+                entry->path_length = (uint32_t) length;
+                entry->hash = fnv_bytes(path, length);
+                entry->mode = fields[CPIO_FIELD_MODE];
+                entry->data = (const uint8_t*) (uintptr_t) (image_start + data_offset);
+                entry->size = data_size;
+                entry->hash_next = NULL;
+            }
+            count++;
+        }
+
+        offset = align4(data_offset + data_size);
+    }
+}
+
+// The loader can put the image anywhere in RAM, the direct map only starts at the kernel
+static int ensure_mapped(void) {
+    uint64_t start = PAGE_ALIGN_DOWN(image_start);
+    uint64_t end = PAGE_ALIGN_UP(image_end);
+    if (vm_translate((uintptr_t) start, NULL, NULL) == 0 && vm_translate((uintptr_t) (end - 1), NULL, NULL) == 0) return 0;
+    return vm_map((uintptr_t) start, start, end - start, VM_READ, VM_LEAF_2M);
+}
+
+int initramfs_init(void) {
+    uint64_t start = 0, end = 0;
+    if (fdt_initrd(&start, &end) != 0 || end == start) return 0;
+
+    image_start = start;
+    image_end = end;
+    long count = ensure_mapped() == 0 ? walk(NULL) : -1;
+    if (count < 0) {
+        klog("initramfs: 0x%lx-0x%lx isn't a newc cpio archive\n", (unsigned long) start, (unsigned long) end);
+        image_start = image_end = 0;
+        return -1;
+    }
+
+    uint32_t bucket_count = 16;
+    while (bucket_count < (uint32_t) count) bucket_count <<= 1;
+
+    InitramfsEntry_t* table = count ? (InitramfsEntry_t*) kmalloc((size_t) count * sizeof(InitramfsEntry_t)) : NULL;
+    const InitramfsEntry_t** heads = (const InitramfsEntry_t**) kmalloc(bucket_count * sizeof(InitramfsEntry_t*));
+    if ((count && !table) || !heads) {
+        if (table) kfree(table);
+        if (heads) kfree(heads);
+        image_start = image_end = 0;
+        return -1;
+    }
+    memset(heads, 0, bucket_count * sizeof(InitramfsEntry_t*));
+    walk(table);
+
+    // Archive order onto the chain heads, so when a path shows up twice the later one wins like it would unpacked
+    for (long i = 0; i < count; i++) {
+        InitramfsEntry_t* entry = &table[i];
+        const InitramfsEntry_t** head = &heads[entry->hash & (bucket_count - 1)];
+        entry->hash_next = *head;
+        *head = entry;
+    }
+
+    entries = table;
+    entry_count = (size_t) count;
+    buckets = heads;
+    bucket_mask = bucket_count - 1;
+    klog("initramfs: %ld entries, %lu KiB at 0x%lx\n", count, (unsigned long) ((end - start) >> 10), (unsigned long) start);
+    return 0;
+}
+
+const InitramfsEntry_t* initramfs_lookup(const char* path) {
+    if (!buckets || !path) return NULL;
+
+    size_t length = strlen(path);
+    path = normalize(path, &length);
+    uint32_t hash = fnv_bytes(path, length);
+    for (const InitramfsEntry_t* entry = buckets[hash & bucket_mask]; entry; entry = entry->hash_next) {
+        if (entry->hash == hash && entry->path_length == length && memcmp(entry->path, path, length) == 0) return entry;
+    }
+    return NULL;
+}
+
+int initramfs_read(const char* path, const void** data, size_t* size) {
+    const InitramfsEntry_t* entry = initramfs_lookup(path);
+    if (!entry) return -1;
+    if ((entry->mode & INITRAMFS_TYPE_MASK) != INITRAMFS_REGULAR) return -2;
+    *data = entry->data;
+    *size = (size_t) entry->size;
+    return 0;
+}
+
+size_t initramfs_count(void) {
+    return entry_count;
+}
+
+const InitramfsEntry_t* initramfs_entry(size_t index) {
+    return index < entry_count ? &entries[index] : NULL;
+}
+
+int initramfs_in_directory(const InitramfsEntry_t* entry, const char* directory) {
+    size_t length = strlen(directory);
+    directory = normalize(directory, &length);
+    while (length && directory[length - 1] == '/') length--;
+
+    const char* rest = entry->path;
+    if (length) {
+        if (entry->path_length <= length + 1 || memcmp(entry->path, directory, length) != 0 || entry->path[length] != '/') return 0;
+        rest += length + 1;
+    }
+    for (; *rest; rest++) {
+        if (*rest == '/') return 0;
+    }
+    return 1;
+}
+
+void initramfs_image(uint64_t* start, uint64_t* end) {
+    *start = image_start;
+    *end = image_end;
+}
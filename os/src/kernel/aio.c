@@ -0,0 +1,202 @@
+#include <aio.h>
+#include <slab.h>
+#include <atomic.h>
+#include <panic.h>
+#include <mini_lib.h>
+
+// The owner is the only one touching the SQ and cq_head. Completions can come from any hart or
+// interrupt and take the ring's lock to fill the CQ, so the owner only needs an acquire on
+// cq_tail to read what they wrote.
+//
+// The CQ can't overflow: a request only goes out while unreaped plus in flight is below
+// cq_entries. Completing one just moves it from one count to the other, only reaping frees room.
+
+#define AIO_MAX_ENTRIES 4096
+#define AIO_NOBODY_WAITING 0xffffffffu
+
+AioRing_t* aio_ring_create(uint32_t entries) {
+    if (entries == 0 || entries > AIO_MAX_ENTRIES) return NULL;
+    uint32_t size = 2;
+    while (size < entries) size <<= 1;
+
+    AioRing_t* ring = (AioRing_t*) kmalloc(sizeof(AioRing_t));
+    if (!ring) return NULL;
+    memset(ring, 0, sizeof(AioRing_t));
+    ring->sq_entries = size;
+    ring->cq_entries = size * 2; // Room to submit a full SQ while the last one is still unreaped
+    ring->sq = (AioSqe_t*) kmalloc(ring->sq_entries * sizeof(AioSqe_t));
+    ring->cq = (AioCqe_t*) kmalloc(ring->cq_entries * sizeof(AioCqe_t));
+    ring->requests = (AioRequest_t*) kmalloc(ring->cq_entries * sizeof(AioRequest_t));
+    if (!ring->sq || !ring->cq || !ring->requests) {
+        if (ring->sq) kfree(ring->sq);
+        if (ring->cq) kfree(ring->cq);
+        if (ring->requests) kfree(ring->requests);
+        kfree(ring);
+        return NULL;
+    }
+
+    ring->lock = (spinlock_t) SPINLOCK_INIT;
+    ring->waiters = (WaitQueue_t) WAIT_QUEUE_INIT;
+    ring->wake_at = AIO_NOBODY_WAITING;
+    memset(ring->requests, 0, ring->cq_entries * sizeof(AioRequest_t));
+    for (uint32_t i = 0; i < ring->cq_entries; i++) {
+        ring->requests[i].ring = ring;
+        ring->requests[i].next = ring->free_requests;
+        ring->free_requests = &ring->requests[i];
+    }
+    return ring;
+}
+
+void aio_ring_destroy(AioRing_t* ring) {
+    if (!ring) return;
+    if (ring->inflight) panic("aio_ring_destroy: requests still in flight");
+    kfree(ring->requests);
+    kfree(ring->cq);
+    kfree(ring->sq);
+    kfree(ring);
+}
+
+AioSqe_t* aio_get_sqe(AioRing_t* ring) {
+    if (ring->sq_tail - ring->sq_head == ring->sq_entries) return NULL;
+    AioSqe_t* sqe = &ring->sq[ring->sq_tail & (ring->sq_entries - 1)];
+    memset(sqe, 0, sizeof(AioSqe_t));
+    ring->sq_tail++;
+    return sqe;
+}
+
+void aio_complete(AioRequest_t* request, int64_t result) {
+    AioRing_t* ring = request->ring;
+    int wake = 0;
+
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    AioCqe_t* cqe = &ring->cq[ring->cq_tail & (ring->cq_entries - 1)];
+    cqe->user_data = request->sqe.user_data;
+    cqe->result = result;
+    atomic_store_release32(&ring->cq_tail, ring->cq_tail + 1);
+
+    request->next = ring->free_requests;
+    ring->free_requests = request;
+    ring->inflight--;
+    ring->stats.completed++;
+
+    // Only the completion that gets the owner to what it asked for wakes it, the rest of the
+    // batch just lands in the ring
+    if (ring->cq_tail - ring->cq_head >= ring->wake_at) {
+        ring->wake_at = AIO_NOBODY_WAITING;
+        ring->stats.wakeups++;
+        wake = 1;
+    }
+    spin_unlock_irqrestore(&ring->lock, flags);
+
+    if (wake) wake_up(&ring->waiters, 1);
+}
+
+// Entries without a file: NOPs complete straight away, anything else is a mistake
+static int submit_unbound(AioRequest_t** requests, int count) {
+    for (int i = 0; i < count; i++) {
+        aio_complete(requests[i], requests[i]->sqe.op == AIO_OP_NOP ? 0 : AIO_ERROR_INVALID);
+    }
+    return count;
+}
+
+int aio_submit(AioRing_t* ring) {
+    uint32_t mask = ring->sq_entries - 1;
+    AioRequest_t* batch[AIO_BATCH_MAX];
+    int submitted = 0;
+
+    while (ring->sq_head != ring->sq_tail) {
+        // The run of entries for one file goes to its backend in one call
+        AioFile_t* file = ring->sq[ring->sq_head & mask].file;
+        int count = 0;
+
+        uint64_t flags = spin_lock_irqsave(&ring->lock);
+        uint32_t room = ring->cq_entries - ring->inflight - (ring->cq_tail - ring->cq_head);
+        while (count < AIO_BATCH_MAX && (uint32_t) count < room && ring->sq_head + (uint32_t) count != ring->sq_tail) {
+            AioSqe_t* sqe = &ring->sq[(ring->sq_head + (uint32_t) count) & mask];
+            if (sqe->file != file) break;
+
+            AioRequest_t* request = ring->free_requests;
+            ring->free_requests = request->next;
+            request->sqe = *sqe;
+            request->next = NULL;
+            batch[count++] = request;
+        }
+        ring->inflight += (uint32_t) count;
+        spin_unlock_irqrestore(&ring->lock, flags);
+
+        if (count == 0) { // Completion ring full, reap first
+            ring->stats.full++;
+            break;
+        }
+
+        int taken = file ? file->ops->submit(file, batch, count) : submit_unbound(batch, count);
+        ring->stats.batches++;
+        ring->stats.submitted += (uint64_t) taken;
+        ring->sq_head += (uint32_t) taken;
+        submitted += taken;
+
+        if (taken < count) { // Backend full, the rest stay on the SQ for next time
+            flags = spin_lock_irqsave(&ring->lock);
+            for (int i = taken; i < count; i++) {
+                batch[i]->next = ring->free_requests;
+                ring->free_requests = batch[i];
+            }
+            ring->inflight -= (uint32_t) (count - taken);
+            spin_unlock_irqrestore(&ring->lock, flags);
+            ring->stats.full++;
+            break;
+        }
+    }
+    return submitted;
+}
+
+uint32_t aio_ready(const AioRing_t* ring) {
+    return atomic_load_acquire32(&ring->cq_tail) - ring->cq_head;
+}
+
+int aio_wait(AioRing_t* ring, uint32_t min_complete) {
+    for (;;) {
+        // Never wait for more than is ready plus in flight, it isn't coming
+        uint64_t flags = spin_lock_irqsave(&ring->lock);
+        uint32_t ready = ring->cq_tail - ring->cq_head;
+        uint32_t want = min_complete < ready + ring->inflight ? min_complete : ready + ring->inflight;
+        if (ready >= want) {
+            ring->wake_at = AIO_NOBODY_WAITING;
+            spin_unlock_irqrestore(&ring->lock, flags);
+            return (int) ready;
+        }
+        ring->wake_at = want;
+        spin_unlock_irqrestore(&ring->lock, flags);
+
+        // The completer that gets us there puts wake_at back before waking, so if it already has
+        // we don't sleep and if it hasn't yet we're on the queue for it
+        wait_prepare(&ring->waiters);
+        if (atomic_load_acquire32(&ring->wake_at) != AIO_NOBODY_WAITING) {
+            ring->stats.sleeps++;
+            thread_block();
+        }
+        wait_finish(&ring->waiters);
+    }
+}
+
+int aio_enter(AioRing_t* ring, uint32_t min_complete) {
+    ring->stats.enters++;
+    int submitted = aio_submit(ring);
+    if (min_complete) aio_wait(ring, min_complete);
+    return submitted;
+}
+
+int aio_reap(AioRing_t* ring, AioCqe_t* output, int max) {
+    uint32_t mask = ring->cq_entries - 1;
+    uint32_t head = ring->cq_head;
+    uint32_t tail = atomic_load_acquire32(&ring->cq_tail);
+    int count = 0;
+
+    while (head != tail && count < max) {
+        output[count++] = ring->cq[head & mask];
+        head++;
+    }
+    // Release: the slots are only refilled once we're done copying them out
+    atomic_store_release32(&ring->cq_head, head);
+    return count;
+}
@@ -0,0 +1,726 @@
+#include <bench.h>
+#include <mini_lib.h>
+#include <page_alloc.h>
+#include <timer.h>
+#include <sched.h>
+#include <vm.h>
+#include <block.h>
+
+typedef struct {
+    const char* name;
+    const char* description;
+    int (*function)(int argc, char** argv);
+} bench_t;
+
+static int bench_kprintf(int argc, char** argv);
+static int bench_mem(int argc, char** argv);
+static int bench_timer(int argc, char** argv);
+static int bench_sched(int argc, char** argv);
+static int bench_tlb(int argc, char** argv);
+static int bench_shootdown(int argc, char** argv);
+static int bench_blk(int argc, char** argv);
+static int bench_console(int argc, char** argv);
+
+static const bench_t benches[] = {
+    {"kprintf", "Formatter throughput, old per-char kprintf vs buffered ('console' to include the UART)", bench_kprintf},
+    {"mem", "mini_lib size sweep 8B-1MB, byte-at-a-time vs current, aligned and misaligned", bench_mem},
+    {"timer", "Arm and cancel 1024 timers spread over each wheel level, cycles per operation", bench_timer},
+    {"sched", "Fixed work split over 1, 2, 4... threads up to 2x the harts, speedup and steals", bench_sched},
+    {"tlb", "One load per page over 8 MiB through 2 MiB leaves vs a 4 KiB alias, warm and after sfence.vma", bench_tlb},
+    {"shootdown", "Unmap 8-512 pages one at a time, a shootdown each vs one batched vm_sync", bench_shootdown},
+    {"blk", "4 KiB sequential/random reads and writes at queue depth 1-32 ('blk <dev>'), overwrites the disk", bench_blk},
+    {"console", "Bulk output throughput of every console driver ('console <KiB>', default 256)", bench_console},
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+// Shared reporting, ticks are rdtime ticks
+static void bench_report(const char* label, uint64_t calls, uint64_t bytes, uint64_t cycles, uint64_t ticks) {
+    if (ticks == 0) ticks = 1;
+    uint64_t bytes_per_second = (bytes * clock_hz()) / ticks;
+    kprintf("  %-22s %8lu calls %10lu bytes %10lu B/s %8lu cycles/call\n",
+            label, calls, bytes, bytes_per_second, calls ? cycles / calls : 0);
+}
+
+// kprintf benchmark
+// The "legacy" path is the original kprintf: one sink call per character and a 32-bit print_value.
+
+static uint64_t sink_bytes = 0;
+static void (*volatile legacy_putc)(char c); // volatile so the per-char calls stay calls
+
+static void null_putc(char c) {
+    (void) c;
+    sink_bytes++;
+}
+
+// What uart_putc used to do for every single byte
+static void polled_putc(char c) {
+    ns16550_8_t* uart = UART(g_uart_base);
+    if (c == '\n') {
+        while ((uart->LSR & UART_LSR_THRE) == 0);
+        uart->THR = '\r';
+        sink_bytes++;
+    }
+    while ((uart->LSR & UART_LSR_THRE) == 0);
+    uart->THR = (uint8_t) c;
+    sink_bytes++;
+}
+
+static void legacy_puts(const char* str) {
+    while (*str) legacy_putc(*str++);
+}
+
+static void legacy_print_value(int value, int base, int is_signed) {
+    char buffer[32];
+    char* p = &buffer[31];
+    *p = '\0';
+
+    int is_negative = 0;
+    unsigned int uvalue;
+    if (is_signed && value < 0) {
+        is_negative = 1;
+        uvalue = (unsigned int) (-value);
+    } else {
+        uvalue = (unsigned int) value;
+    }
+
+    if (uvalue == 0) {
+        *--p = '0';
+    } else {
+        while (uvalue > 0) {
+            int digit = uvalue % base;
+            *--p = (digit < 10) ? ('0' + digit) : ('a' + (digit - 10));
+            uvalue /= base;
+        }
+    }
+
+    if (is_negative) *--p = '-';
+    legacy_puts(p);
+}
+
+static void legacy_kprintf(const char* format_string, ...) {
+    va_list args;
+    va_start(args, format_string);
+
+    const char* p = format_string;
+    while (*p) {
+        if (*p != '%') {
+            legacy_putc(*p++);
+            continue;
+        }
+
+        p++;
+        switch (*p) {
+            case 'c': legacy_putc((char) va_arg(args, int)); break;
+            case 's': legacy_puts(va_arg(args, const char*)); break;
+            case 'i':
+            case 'd': legacy_print_value(va_arg(args, int), 10, 1); break;
+            case 'u': legacy_print_value(va_arg(args, unsigned int), 10, 0); break;
+            case 'x': legacy_print_value(va_arg(args, unsigned int), 16, 0); break;
+            case '%': legacy_putc('%'); break;
+            default: legacy_putc('%'); legacy_putc(*p); break;
+        }
+        p++;
+    }
+
+    va_end(args);
+}
+
+// Only uses what the old formatter understood so both render the same text
+#define BENCH_FORMAT "bench: hart %d handled irq %u at %x (%s) in %d cycles\n"
+#define BENCH_ARGS(i) 0, (unsigned int) (i), 0x80200000u + (unsigned int) (i), "uart0", -(int) (i)
+
+static int bench_kprintf(int argc, char** argv) {
+    int console = (argc > 2 && strcmp(argv[2], "console") == 0);
+    uint64_t calls = console ? 64 : 20000;
+
+    kprintf("kprintf: %lu calls of \"%s\" into %s\n", calls, "bench: hart ...", console ? "the UART" : "a null sink");
+
+    // Old formatter, one sink call per byte
+    legacy_putc = console ? polled_putc : null_putc;
+    sink_bytes = 0;
+    uint64_t start_cycles = rdcycle();
+    uint64_t start_ticks = rdtime();
+    for (uint64_t i = 0; i < calls; i++) legacy_kprintf(BENCH_FORMAT, BENCH_ARGS(i));
+    uint64_t ticks = rdtime() - start_ticks;
+    uint64_t cycles = rdcycle() - start_cycles;
+    uint64_t legacy_bytes = sink_bytes;
+    uint64_t legacy_ticks = ticks, legacy_cycles = cycles;
+
+    // New formatter, render then one write per call
+    sink_bytes = 0;
+    start_cycles = rdcycle();
+    start_ticks = rdtime();
+    for (uint64_t i = 0; i < calls; i++) {
+        if (console) {
+            kprintf(BENCH_FORMAT, BENCH_ARGS(i));
+        } else {
+            char buffer[128];
+            int length = ksnprintf(buffer, sizeof(buffer), BENCH_FORMAT, BENCH_ARGS(i));
+            sink_bytes += (uint64_t) length; // Stands in for the single console write
+        }
+    }
+    ticks = rdtime() - start_ticks;
+    cycles = rdcycle() - start_cycles;
+    if (console) console_flush();
+
+    bench_report("per-char (old)", calls, legacy_bytes, legacy_cycles, legacy_ticks);
+    bench_report("buffered (new)", calls, console ? legacy_bytes : sink_bytes, cycles, ticks);
+    if (cycles) kprintf("  speedup: %lu.%02lux\n", legacy_cycles / cycles, (legacy_cycles * 100 / cycles) % 100);
+    return 0;
+}
+
+// Memory routine benchmark
+// The "old" routines are the original byte-at-a-time mini_lib loops.
+
+#define MEM_BENCH_MAX (1024u * 1024u)
+#define MEM_BENCH_BYTES (4u * 1024u * 1024u) // Bytes moved per measurement, spread over however many calls
+
+static volatile uint64_t mem_sink; // Keeps results alive
+
+static __attribute__((noinline)) void byte_memcpy(void* dest, const void* src, size_t n) {
+    char* d = (char*) dest;
+    const char* s = (const char*) src;
+    for (size_t i = 0; i < n; i++) d[i] = s[i];
+}
+
+static __attribute__((noinline)) void byte_memset(void* destination, int value, size_t n) {
+    unsigned char* d = (unsigned char*) destination;
+    for (size_t i = 0; i < n; i++) d[i] = (unsigned char) value;
+}
+
+static __attribute__((noinline)) int byte_memcmp(const void* a, const void* b, size_t n) {
+    const unsigned char* x = (const unsigned char*) a;
+    const unsigned char* y = (const unsigned char*) b;
+    for (size_t i = 0; i < n; i++) {
+        if (x[i] != y[i]) return (int) x[i] - (int) y[i];
+    }
+    return 0;
+}
+
+static __attribute__((noinline)) size_t byte_strlen(const char* s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+typedef enum { MEM_COPY, MEM_SET, MEM_CMP, MEM_STRLEN, MEM_OPS } MemOp_t;
+
+static void mem_run(MemOp_t op, int old, unsigned char* dst, unsigned char* src, size_t n) {
+    switch (op) {
+        case MEM_COPY:   if (old) byte_memcpy(dst, src, n); else memcpy(dst, src, n); break;
+        case MEM_SET:    if (old) byte_memset(dst, 0x5a, n); else memset(dst, 0x5a, n); break;
+        case MEM_CMP:    mem_sink += (uint64_t) (old ? byte_memcmp(dst, src, n) : memcmp(dst, src, n)); break;
+        case MEM_STRLEN: mem_sink += old ? byte_strlen((const char*) src) : strlen((const char*) src); break;
+        default: break;
+    }
+}
+
+// Cycles per byte, x100 so we can print two decimals
+static uint64_t mem_measure(MemOp_t op, int old, unsigned char* dst, unsigned char* src, size_t n) {
+    uint64_t calls = MEM_BENCH_BYTES / n;
+    if (calls == 0) calls = 1;
+
+    // Equal buffers make memcmp scan everything, a NUL at n bounds strlen
+    memcpy(dst, src, n);
+    src[n] = '\0';
+
+    uint64_t start = rdcycle();
+    for (uint64_t i = 0; i < calls; i++) mem_run(op, old, dst, src, n);
+    uint64_t cycles = rdcycle() - start;
+
+    src[n] = 'a';
+    return (cycles * 100) / (calls * n);
+}
+
+static int bench_mem(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+
+    unsigned int order = page_order_for(MEM_BENCH_MAX + PAGE_SIZE);
+    unsigned char* dst_base = (unsigned char*) page_alloc(order);
+    unsigned char* src_base = (unsigned char*) page_alloc(order);
+    if (!dst_base || !src_base) {
+        page_free(dst_base);
+        page_free(src_base);
+        kprintf("bench mem: can't get buffers\n");
+        return -1;
+    }
+    memset(src_base, 'a', MEM_BENCH_MAX + PAGE_SIZE);
+
+    static const char* const names[MEM_OPS] = { "memcpy", "memset", "memcmp", "strlen" };
+    kprintf("cycles/byte, old (byte loop) -> new\n");
+    kprintf("%8s %5s", "size", "align");
+    for (int op = 0; op < MEM_OPS; op++) kprintf(" %17s", names[op]);
+    kprintf("\n");
+
+    static const size_t sizes[] = { 8, 64, 512, 4096, 32768, 262144, MEM_BENCH_MAX };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        for (int misaligned = 0; misaligned < 2; misaligned++) {
+            // Misaligned: dest 1 byte in, source 3 bytes in, so they disagree with each other too
+            unsigned char* dst = dst_base + (misaligned ? 1 : 0);
+            unsigned char* src = src_base + (misaligned ? 3 : 0);
+
+            kprintf("%8zu %5s", n, misaligned ? "mis" : "al");
+            for (int op = 0; op < MEM_OPS; op++) {
+                uint64_t old = mem_measure((MemOp_t) op, 1, dst, src, n);
+                uint64_t current = mem_measure((MemOp_t) op, 0, dst, src, n);
+                kprintf("  %3lu.%02lu -> %3lu.%02lu", old / 100, old % 100, current / 100, current % 100);
+            }
+            kprintf("\n");
+        }
+    }
+
+    page_free(dst_base);
+    page_free(src_base);
+    return 0;
+}
+
+// Timer benchmark
+// Every arm and cancel should cost the same whatever the delay or how many timers are pending.
+
+#define TIMER_BENCH_COUNT 1024
+
+static void bench_timer_expired(Timer_t* timer) {
+    (void) timer;
+}
+
+static int bench_timer(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+
+    unsigned int order = page_order_for(TIMER_BENCH_COUNT * sizeof(Timer_t));
+    Timer_t* timers = (Timer_t*) page_alloc(order);
+    if (!timers) {
+        kprintf("bench timer: can't get timers\n");
+        return -1;
+    }
+    for (int i = 0; i < TIMER_BENCH_COUNT; i++) timer_setup(&timers[i], bench_timer_expired, NULL);
+
+    // One delay per wheel level with a ~4 us granule (level 0 is ~1 ms, each level up 64x), then
+    // a day, which is past the wheel's range and gets parked. Spread over an eighth of the delay
+    // so each set stays on its level. Interrupts stay off so the short ones can't fire mid-run.
+    static const uint64_t delays_us[] = { 100, 10000, 1000000, 60000000, 3600000000ull, 86400000000ull };
+    for (size_t d = 0; d < sizeof(delays_us) / sizeof(delays_us[0]); d++) {
+        uint64_t base = clock_us_to_ticks(delays_us[d]);
+        uint64_t spread = base / 8 / TIMER_BENCH_COUNT;
+
+        uint64_t flags = irq_save();
+        uint64_t start_ticks = rdtime();
+        uint64_t start = rdcycle();
+        for (int i = 0; i < TIMER_BENCH_COUNT; i++) timer_arm_after(&timers[i], base + (uint64_t) i * spread);
+        uint64_t arm_cycles = rdcycle() - start;
+        uint64_t arm_ticks = rdtime() - start_ticks;
+
+        start_ticks = rdtime();
+        start = rdcycle();
+        for (int i = TIMER_BENCH_COUNT - 1; i >= 0; i--) timer_cancel(&timers[i]);
+        uint64_t cancel_cycles = rdcycle() - start;
+        uint64_t cancel_ticks = rdtime() - start_ticks;
+        irq_restore(flags);
+
+        kprintf("  +%lu us\n", (unsigned long) delays_us[d]);
+        bench_report("arm", TIMER_BENCH_COUNT, 0, arm_cycles, arm_ticks);
+        bench_report("cancel", TIMER_BENCH_COUNT, 0, cancel_cycles, cancel_ticks);
+    }
+
+    page_free(timers);
+    return 0;
+}
+
+// Scheduler benchmark
+// The same total work each round, spread over more threads. With idle harts stealing, the
+// speedup should track the number of online harts until there are more threads than harts.
+
+#define SCHED_BENCH_WORK (1u << 26) // xorshift rounds in total
+
+typedef struct {
+    uint64_t rounds;
+    volatile uint32_t* done;
+} SchedWork_t;
+
+static void sched_worker(void* arg) {
+    SchedWork_t* work = (SchedWork_t*) arg;
+    uint64_t x = 88172645463325252ull;
+    for (uint64_t i = 0; i < work->rounds; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    mem_sink = x;
+    atomic_fetch_add32(work->done, 1);
+}
+
+static uint64_t sched_steals(void) {
+    uint64_t steals = 0;
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        SchedStats_t stats;
+        sched_stats(i, &stats);
+        steals += stats.steals;
+    }
+    return steals;
+}
+
+static int bench_sched(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+
+    static SchedWork_t work[2 * MAX_HARTS];
+    unsigned int max_threads = 2 * cpu_online_count();
+    uint64_t single = 0;
+
+    kprintf("  %u harts online, %u rounds of work per run\n", cpu_online_count(), SCHED_BENCH_WORK);
+    kprintf("  %7s %12s %14s %8s %8s\n", "threads", "time us", "rounds/s", "speedup", "steals");
+    for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+        volatile uint32_t done = 0;
+        uint64_t steals = sched_steals();
+        uint64_t start = rdtime();
+
+        unsigned int started = 0;
+        for (unsigned int i = 0; i < threads; i++) {
+            work[i].rounds = SCHED_BENCH_WORK / threads;
+            work[i].done = &done;
+            if (thread_create("bench", sched_worker, &work[i])) started++;
+        }
+        while (done < started) thread_sleep_ms(1);
+
+        uint64_t ticks = rdtime() - start;
+        if (ticks == 0) ticks = 1;
+        if (threads == 1) single = ticks;
+        uint64_t rate = (uint64_t) (((unsigned __int128) SCHED_BENCH_WORK * clock_hz()) / ticks);
+        uint64_t speedup = single * 100 / ticks;
+        kprintf("  %7u %12lu %14lu %5lu.%02lu %8lu\n", started, (unsigned long) (clock_ticks_to_ns(ticks) / 1000),
+                rate, speedup / 100, speedup % 100, sched_steals() - steals);
+        if (started < threads) {
+            kprintf("bench sched: only %u of %u threads started\n", started, threads);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// TLB benchmark
+// The same buffer seen twice: through the direct map, where it sits in 2 MiB leaves, and through
+// an alias mapped 4 KiB at a time. One load per page in a scattered order, so each load wants
+// its own translation. "cold" flushes before every pass, so every first touch is a full walk.
+
+#define TLB_BENCH_ORDER  11 // 8 MiB
+#define TLB_BENCH_PAGES  (1u << TLB_BENCH_ORDER)
+#define TLB_BENCH_PASSES 16
+#define TLB_BENCH_ALIAS  0x2000000000ull // 128 GiB, well clear of RAM and MMIO
+
+static uint64_t tlb_pass(volatile const uint8_t* base, int cold) {
+    uint64_t sum = 0;
+    uint64_t start = rdcycle();
+    for (int pass = 0; pass < TLB_BENCH_PASSES; pass++) {
+        if (cold) sfence_vma_all();
+        // An odd stride over a power of two visits every page once per pass, in a jumbled order
+        for (uint32_t i = 0, page = 0; i < TLB_BENCH_PAGES; i++, page = (page + 1031) & (TLB_BENCH_PAGES - 1)) {
+            sum += base[(uint64_t) page * PAGE_SIZE + (i & 63) * 64];
+        }
+    }
+    uint64_t cycles = rdcycle() - start;
+    mem_sink = sum;
+    return cycles / ((uint64_t) TLB_BENCH_PASSES * TLB_BENCH_PAGES);
+}
+
+static int bench_tlb(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+
+    uint8_t* buffer = (uint8_t*) page_alloc(TLB_BENCH_ORDER);
+    if (!buffer) {
+        kprintf("bench tlb: can't get %u pages\n", TLB_BENCH_PAGES);
+        return -1;
+    }
+    memset(buffer, 1, (size_t) TLB_BENCH_PAGES * PAGE_SIZE);
+
+    if (vm_map((uintptr_t) TLB_BENCH_ALIAS, (uint64_t) (uintptr_t) buffer, (size_t) TLB_BENCH_PAGES * PAGE_SIZE,
+               VM_READ | VM_WRITE, VM_LEAF_4K) < 0) {
+        kprintf("bench tlb: can't map the alias\n");
+        page_free(buffer);
+        return -1;
+    }
+
+    unsigned int direct_level = 0;
+    vm_translate((uintptr_t) buffer, NULL, &direct_level);
+
+    // Stay on this hart so every pass sees the same TLB
+    preempt_disable();
+    uint64_t huge_warm = tlb_pass(buffer, 0);
+    uint64_t huge_cold = tlb_pass(buffer, 1);
+    uint64_t small_warm = tlb_pass((const uint8_t*) (uintptr_t) TLB_BENCH_ALIAS, 0);
+    uint64_t small_cold = tlb_pass((const uint8_t*) (uintptr_t) TLB_BENCH_ALIAS, 1);
+    vm_unmap((uintptr_t) TLB_BENCH_ALIAS, (size_t) TLB_BENCH_PAGES * PAGE_SIZE);
+    preempt_enable();
+
+    kprintf("  %u pages x %u passes, direct map leaf %s\n", TLB_BENCH_PAGES, TLB_BENCH_PASSES,
+            direct_level == VM_LEAF_1G ? "1 GiB" : direct_level == VM_LEAF_2M ? "2 MiB" : "4 KiB");
+    kprintf("  %-10s %14s %14s\n", "mapping", "warm cyc/load", "cold cyc/load");
+    kprintf("  %-10s %14lu %14lu\n", "huge", huge_warm, huge_cold);
+    kprintf("  %-10s %14lu %14lu\n", "4k only", small_warm, small_cold);
+
+    page_free(buffer);
+    return 0;
+}
+
+// Shootdown benchmark
+// Pages mapped at the alias and torn down one vm_unmap at a time, which shoots each one down
+// on its own, against vm_unmap_queued for each and a single vm_sync at the end.
+
+static int shootdown_round(uint8_t* buffer, uint32_t pages, int batched) {
+    size_t size = (size_t) pages * PAGE_SIZE;
+    if (vm_map((uintptr_t) TLB_BENCH_ALIAS, (uint64_t) (uintptr_t) buffer, size, VM_READ | VM_WRITE, VM_LEAF_4K) < 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < pages; i++) mem_sink += ((volatile uint8_t*) (uintptr_t) TLB_BENCH_ALIAS)[i * PAGE_SIZE];
+
+    TlbStats_t before, after;
+    tlb_stats(&before);
+    uint64_t start = rdcycle();
+    for (uint32_t i = 0; i < pages; i++) {
+        uintptr_t page = (uintptr_t) TLB_BENCH_ALIAS + i * PAGE_SIZE;
+        if (batched) {
+            vm_unmap_queued(page, PAGE_SIZE);
+        } else {
+            vm_unmap(page, PAGE_SIZE);
+        }
+    }
+    if (batched) vm_sync();
+    uint64_t cycles = rdcycle() - start;
+    tlb_stats(&after);
+
+    kprintf("  %-8s %6u %12lu %8lu %8lu %8lu %8lu\n", batched ? "batched" : "each", pages, cycles / pages,
+            after.fences_sent - before.fences_sent, after.ipis_sent - before.ipis_sent,
+            after.full_flushes - before.full_flushes, after.lazy_skips - before.lazy_skips);
+    return 0;
+}
+
+static int bench_shootdown(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+
+    static const uint32_t counts[] = { 8, 32, 512 };
+    uint8_t* buffer = (uint8_t*) page_alloc(page_order_for(512 * PAGE_SIZE));
+    if (!buffer) {
+        kprintf("bench shootdown: can't get pages\n");
+        return -1;
+    }
+
+    kprintf("  %u harts online, full flush past %u pages\n", cpu_online_count(), TLB_FLUSH_ALL_PAGES);
+    kprintf("  %-8s %6s %12s %8s %8s %8s %8s\n", "unmap", "pages", "cycles/page", "fences", "ipis", "full", "lazy");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        for (int batched = 0; batched <= 1; batched++) {
+            if (shootdown_round(buffer, counts[c], batched) < 0) {
+                kprintf("bench shootdown: can't map the alias\n");
+                page_free(buffer);
+                return -1;
+            }
+        }
+    }
+
+    page_free(buffer);
+    return 0;
+}
+
+// Block benchmark
+// Keeps depth requests in flight: completions go on a done list from the interrupt, the bench
+// thread takes them all back and refills with one block_submit per round.
+
+#define BLK_BENCH_IO      4096
+#define BLK_BENCH_OPS     2048
+#define BLK_BENCH_MAX_QD  32
+#define BLK_BENCH_SPAN_MB 64 // Random offsets stay within this much of the disk
+
+static spinlock_t blk_done_lock = SPINLOCK_INIT;
+static BlockRequest_t* blk_done_list = NULL;
+static WaitQueue_t blk_done_wait = WAIT_QUEUE_INIT;
+
+static void blk_bench_done(BlockRequest_t* request) {
+    uint64_t flags = spin_lock_irqsave(&blk_done_lock);
+    request->next = blk_done_list;
+    blk_done_list = request;
+    spin_unlock_irqrestore(&blk_done_lock, flags);
+    wake_up(&blk_done_wait, 1);
+}
+
+static BlockRequest_t* blk_take_done(void) {
+    uint64_t flags = spin_lock_irqsave(&blk_done_lock);
+    BlockRequest_t* list = blk_done_list;
+    blk_done_list = NULL;
+    spin_unlock_irqrestore(&blk_done_lock, flags);
+    return list;
+}
+
+// Sleeps until something completes, puts it back on free_list, returns how many
+static uint32_t blk_wait_done(BlockRequest_t** free_list, uint32_t* errors) {
+    wait_prepare(&blk_done_wait);
+    if (!blk_done_list) thread_block();
+    wait_finish(&blk_done_wait);
+
+    uint32_t completed = 0;
+    for (BlockRequest_t* request = blk_take_done(); request;) {
+        BlockRequest_t* next = request->next;
+        if (request->status < 0) (*errors)++;
+        request->next = *free_list;
+        *free_list = request;
+        completed++;
+        request = next;
+    }
+    return completed;
+}
+
+static int blk_run(BlockDevice_t* device, BlockRequest_t* requests, uint8_t* buffers, uint32_t op, int random,
+                   unsigned int depth) {
+    uint64_t sectors_per_io = BLK_BENCH_IO / BLOCK_SECTOR_SIZE;
+    uint64_t span = device->sectors / sectors_per_io;
+    if (span > ((uint64_t) BLK_BENCH_SPAN_MB << 20) / BLK_BENCH_IO) span = ((uint64_t) BLK_BENCH_SPAN_MB << 20) / BLK_BENCH_IO;
+
+    BlockRequest_t* free_list = NULL;
+    for (unsigned int i = 0; i < depth; i++) {
+        requests[i].op = op;
+        requests[i].count = (uint32_t) sectors_per_io;
+        requests[i].buffer = buffers + (size_t) i * BLK_BENCH_IO;
+        requests[i].done = blk_bench_done;
+        requests[i].next = free_list;
+        free_list = &requests[i];
+    }
+
+    BlockStats_t before = device->stats;
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    uint32_t issued = 0, completed = 0, errors = 0, position = 0;
+    uint64_t start = rdtime();
+    while (completed < BLK_BENCH_OPS) {
+        BlockRequest_t* batch[BLK_BENCH_MAX_QD];
+        int count = 0;
+        while (free_list && issued + (uint32_t) count < BLK_BENCH_OPS) {
+            BlockRequest_t* request = free_list;
+            free_list = request->next;
+            uint64_t slot = position++ % span;
+            if (random) {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                slot = x % span;
+            }
+            request->sector = slot * sectors_per_io;
+            batch[count++] = request;
+        }
+
+        int queued = count ? block_submit(device, batch, count) : 0;
+        if (queued < 0) { // What's already out still lands on blk_done_list, let it before the next run
+            while (completed < issued) completed += blk_wait_done(&free_list, &errors);
+            return -1;
+        }
+        for (int i = count - 1; i >= queued; i--) { // Didn't fit, back on the list
+            batch[i]->next = free_list;
+            free_list = batch[i];
+        }
+        issued += (uint32_t) queued;
+        completed += blk_wait_done(&free_list, &errors);
+    }
+    uint64_t ticks = rdtime() - start;
+    if (ticks == 0) ticks = 1;
+
+    uint64_t iops = (uint64_t) (((unsigned __int128) BLK_BENCH_OPS * clock_hz()) / ticks);
+    uint64_t kib_per_second = iops * (BLK_BENCH_IO / 1024);
+    uint64_t interrupts = device->stats.interrupts - before.interrupts;
+    uint64_t notifies = device->stats.notifies - before.notifies;
+    kprintf("  %-5s %-6s %5u %10lu %8lu.%02lu %10lu %10lu%s\n", op == BLOCK_READ ? "read" : "write",
+            random ? "random" : "seq", depth, iops, kib_per_second / 1024, (kib_per_second % 1024) * 100 / 1024,
+            interrupts, notifies, errors ? " errors!" : "");
+    return 0;
+}
+
+static int bench_blk(int argc, char** argv) {
+    BlockDevice_t* device = argc > 2 ? block_find(argv[2]) : block_device(0);
+    if (!device) {
+        kprintf("bench blk: no block device (try 'make run-blk')\n");
+        return -1;
+    }
+
+    static BlockRequest_t requests[BLK_BENCH_MAX_QD];
+    uint8_t* buffers = (uint8_t*) page_alloc(page_order_for(BLK_BENCH_MAX_QD * BLK_BENCH_IO));
+    if (!buffers) {
+        kprintf("bench blk: can't get buffers\n");
+        return -1;
+    }
+
+    static const unsigned int depths[] = { 1, 4, 16, 32 };
+    kprintf("  %s, %u x %u B per run, queue depth up to %u\n", device->name, BLK_BENCH_OPS, BLK_BENCH_IO, device->queue_depth);
+    kprintf("  %-5s %-6s %5s %10s %11s %10s %10s\n", "op", "order", "depth", "IOPS", "MiB/s", "irqs", "notifies");
+    int rc = 0;
+    for (uint32_t op = BLOCK_READ; op <= BLOCK_WRITE && rc == 0; op++) {
+        if (op == BLOCK_WRITE && device->read_only) break;
+        for (int random = 0; random <= 1 && rc == 0; random++) {
+            for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]) && rc == 0; d++) {
+                if (depths[d] > device->queue_depth) break;
+                rc = blk_run(device, requests, buffers, op, random, depths[d]);
+            }
+        }
+    }
+
+    page_free(buffers);
+    if (rc < 0) kprintf("bench blk: request rejected\n");
+    return rc;
+}
+
+// Console benchmark
+// Log-sized lines, written and flushed through each registered console driver in turn
+
+#define CONSOLE_BENCH_KIB  256
+#define CONSOLE_BENCH_LINE 64
+
+static int bench_console(int argc, char** argv) {
+    uint32_t kib = CONSOLE_BENCH_KIB;
+    if (argc > 2) {
+        kib = 0;
+        for (const char* p = argv[2]; *p >= '0' && *p <= '9'; p++) kib = kib * 10 + (uint32_t) (*p - '0');
+        if (kib == 0) kib = CONSOLE_BENCH_KIB;
+    }
+
+    char line[CONSOLE_BENCH_LINE];
+    for (int i = 0; i < CONSOLE_BENCH_LINE - 1; i++) line[i] = (char) ('a' + i % 26);
+    line[CONSOLE_BENCH_LINE - 1] = '\n';
+
+    const ConsoleDriver_t* original = console_active();
+    uint64_t lines = ((uint64_t) kib << 10) / CONSOLE_BENCH_LINE;
+    uint64_t results[CONSOLE_MAX_DRIVERS] = { 0 };
+    uint64_t cycles[CONSOLE_MAX_DRIVERS] = { 0 };
+
+    const ConsoleDriver_t* driver;
+    for (unsigned int d = 0; (driver = console_driver(d)) != NULL; d++) {
+        console_select(driver->name);
+        uint64_t start_cycles = rdcycle();
+        uint64_t start = rdtime();
+        for (uint64_t i = 0; i < lines; i++) console_write(line, sizeof(line));
+        console_flush();
+        results[d] = rdtime() - start;
+        cycles[d] = rdcycle() - start_cycles;
+    }
+    console_select(original->name);
+
+    kprintf("\nconsole: %lu lines of %u bytes through each driver\n", lines, CONSOLE_BENCH_LINE);
+    for (unsigned int d = 0; (driver = console_driver(d)) != NULL; d++) {
+        bench_report(driver->name, lines, lines * CONSOLE_BENCH_LINE, cycles[d], results[d]);
+    }
+    return 0;
+}
+
+int bench_main(int argc, char** argv) {
+    if (argc < 2) {
+        kprintf("Usage: bench <name> [options]\n");
+        for (int i = 0; i < (int) NUM_BENCHES; i++) {
+            kprintf("  %s: %s\n", benches[i].name, benches[i].description);
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < (int) NUM_BENCHES; i++) {
+        if (strcmp(argv[1], benches[i].name) == 0) return benches[i].function(argc, argv);
+    }
+
+    kprintf("Unknown benchmark '%s'\n", argv[1]);
+    return -1;
+}
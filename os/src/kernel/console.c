@@ -0,0 +1,315 @@
+#include <console.h>
+#include <uart.h>
+#include <sync.h>
+#include <sched.h>
+#include <klog.h>
+#include <mini_lib.h>
+
+// Every write goes through console_lock and then the active driver, which has whatever locking
+// of its own it needs against its interrupt. The lock is hart-recursive so kprintf can hold it
+// across chunks and a failing driver can still log that it's being dropped.
+
+static int uart_console_write(const char* data, size_t length, int binary) {
+    if (binary) {
+        uart_write_binary(data, length);
+    } else {
+        uart_write(data, length);
+    }
+    return 0;
+}
+
+static int uart_console_getc(void) {
+    return (unsigned char) uart_getc();
+}
+
+static int uart_console_panic(void) {
+    uart_lock_force(); // Whoever had the UART isn't getting it back
+    uart_disable_interrupts(); // Nobody is going to service THRE from here on, poll everything out
+    return 0;
+}
+
+static const ConsoleDriver_t uart_console = {
+    .name = "uart",
+    .write = uart_console_write,
+    .writev = NULL,
+    .getc = uart_console_getc,
+    .poll = uart_poll,
+    .flush = uart_flush,
+    .panic = uart_console_panic,
+    .show = NULL,
+};
+
+static rlock_t lock = RLOCK_INIT;
+static const ConsoleDriver_t* drivers[CONSOLE_MAX_DRIVERS] = { &uart_console };
+static unsigned int driver_count = 1;
+static const ConsoleDriver_t* volatile active = &uart_console;
+static ConsoleStats_t stats;
+
+void console_lock(void) {
+    rlock_acquire(&lock);
+}
+
+void console_unlock(void) {
+    rlock_release(&lock);
+}
+
+// Switch under the lock so a line in progress finishes where it started, and with the old
+// driver drained so nothing it still holds comes out after what the new one writes
+static void switch_to(const ConsoleDriver_t* driver) {
+    rlock_acquire(&lock);
+    if (active != driver) {
+        active->flush();
+        active = driver;
+    }
+    rlock_release(&lock);
+}
+
+void console_register(const ConsoleDriver_t* driver) {
+    rlock_acquire(&lock);
+    if (driver_count < CONSOLE_MAX_DRIVERS) drivers[driver_count++] = driver;
+    rlock_release(&lock);
+
+    klog("console: moving to %s\n", driver->name); // Last line on the old one
+    switch_to(driver);
+}
+
+int console_select(const char* name) {
+    for (unsigned int i = 0; i < driver_count; i++) {
+        if (strcmp(drivers[i]->name, name) == 0) {
+            switch_to(drivers[i]);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const ConsoleDriver_t* console_active(void) {
+    return active;
+}
+
+const ConsoleDriver_t* console_driver(unsigned int index) {
+    return index < driver_count ? drivers[index] : NULL;
+}
+
+static void emit(const char* data, size_t length, int binary) {
+    rlock_acquire(&lock);
+    stats.writes++;
+    stats.bytes += length;
+
+    const ConsoleDriver_t* driver = active;
+    if (driver->write(data, length, binary) < 0) {
+        stats.fallbacks++;
+        active = &uart_console;
+        uart_console_write(data, length, binary);
+        if (driver != &uart_console) klog("console: %s stopped taking output, back on the uart\n", driver->name);
+    }
+    rlock_release(&lock);
+}
+
+void console_write(const char* data, size_t length) {
+    emit(data, length, 0);
+}
+
+void console_write_binary(const void* data, size_t length) {
+    emit((const char*) data, length, 1);
+}
+
+// One hold of the lock so the lot comes out together, and one notify if the driver can batch
+void console_writev(const ConsoleVector_t* vectors, int count) {
+    rlock_acquire(&lock);
+    const ConsoleDriver_t* driver = active;
+    if (!driver->writev) {
+        for (int i = 0; i < count; i++) emit((const char*) vectors[i].data, vectors[i].length, 0);
+        rlock_release(&lock);
+        return;
+    }
+
+    stats.writes += (uint64_t) count;
+    for (int i = 0; i < count; i++) stats.bytes += vectors[i].length;
+    if (driver->writev(vectors, count) < 0) {
+        stats.fallbacks++;
+        active = &uart_console;
+        for (int i = 0; i < count; i++) uart_console_write((const char*) vectors[i].data, vectors[i].length, 0);
+        klog("console: %s stopped taking output, back on the uart\n", driver->name);
+    }
+    rlock_release(&lock);
+}
+
+void console_putc(char c) {
+    emit(&c, 1, 0);
+}
+
+void console_puts(const char* str) {
+    emit(str, strlen(str), 0);
+}
+
+void console_flush(void) {
+    rlock_acquire(&lock);
+    active->flush();
+    rlock_release(&lock);
+}
+
+char console_getc(void) {
+    return (char) active->getc();
+}
+
+int console_poll(void) {
+    return active->poll ? active->poll() : -1;
+}
+
+void console_gets(char* buffer, size_t max_length) {
+    if (max_length == 0) return; // No space to store anything
+
+    size_t i = 0;
+    while (i < (max_length - 1)) {
+        char c = console_getc();
+
+        if (c == 0x1b) { // Escape character
+            continue; // Ignore for now
+        } else if (c == '\r' || c == '\n') {
+            console_puts("\n"); // Echo newline
+            break; // Stop on enter/return
+        } else if (c == '\b' || c == 127) { // Backspace or DEL
+            if (i > 0) {
+                i--;
+                console_puts("\b \b"); // Erase character on terminal
+            }
+        } else {
+            console_putc(c); // Echo
+            buffer[i++] = c;
+        }
+    }
+
+    buffer[i] = '\0'; // Null-terminate the string
+}
+
+// Panic takes what it can get: the active driver if it can still be trusted, the UART if not
+void console_panic(void) {
+    rlock_force(&lock);
+    if (active->panic() < 0) {
+        active = &uart_console;
+        uart_console_panic();
+    }
+}
+
+void console_stats(ConsoleStats_t* output) {
+    rlock_acquire(&lock);
+    *output = stats;
+    rlock_release(&lock);
+}
+
+// aio backend. Writes go out inline, a batch of them as one writev. Reads can take forever, so
+// they queue for a reader thread that sleeps in getc and then takes whatever else is waiting.
+
+static spinlock_t aio_lock = SPINLOCK_INIT;
+static AioRequest_t* volatile aio_reads = NULL;
+static AioRequest_t* aio_reads_tail = NULL;
+static WaitQueue_t aio_read_wait = WAIT_QUEUE_INIT;
+static Thread_t* aio_reader = NULL;
+
+static AioRequest_t* next_read(void) {
+    uint64_t flags = spin_lock_irqsave(&aio_lock);
+    AioRequest_t* request = aio_reads;
+    if (request) {
+        aio_reads = request->next;
+        if (!aio_reads) aio_reads_tail = NULL;
+    }
+    spin_unlock_irqrestore(&aio_lock, flags);
+    return request;
+}
+
+static void aio_reader_thread(void* arg) {
+    (void) arg;
+    for (;;) {
+        AioRequest_t* request;
+        while ((request = next_read()) == NULL) {
+            wait_prepare(&aio_read_wait);
+            if (!aio_reads) thread_block();
+            wait_finish(&aio_read_wait);
+        }
+
+        char* buffer = (char*) request->sqe.buffer;
+        uint32_t length = request->sqe.length;
+        uint32_t received = 0;
+        if (length) {
+            buffer[received++] = console_getc();
+            int c;
+            while (received < length && (c = console_poll()) >= 0) buffer[received++] = (char) c;
+        }
+        aio_complete(request, received);
+    }
+}
+
+static int console_aio_submit(AioFile_t* file, AioRequest_t** requests, int count) {
+    (void) file;
+    ConsoleVector_t vectors[AIO_BATCH_MAX];
+    int writes = 0;
+    int reads = 0;
+
+    for (int i = 0; i < count; i++) {
+        AioRequest_t* request = requests[i];
+        if (request->sqe.op == AIO_OP_WRITE) {
+            vectors[writes++] = (ConsoleVector_t) { request->sqe.buffer, request->sqe.length };
+        } else if (request->sqe.op == AIO_OP_READ) {
+            reads++;
+        }
+    }
+    if (writes) console_writev(vectors, writes);
+
+    if (reads) {
+        // Under the lock or two rings submitting at once both start one. thread_create doesn't sleep.
+        uint64_t flags = spin_lock_irqsave(&aio_lock);
+        if (!aio_reader) {
+            aio_reader = thread_create("aiocon", aio_reader_thread, NULL);
+            if (!aio_reader) klog("console: no reader thread, aio reads fail\n");
+        }
+        spin_unlock_irqrestore(&aio_lock, flags);
+    }
+
+    for (int i = 0; i < count; i++) {
+        AioRequest_t* request = requests[i];
+        switch (request->sqe.op) {
+        case AIO_OP_WRITE:
+            aio_complete(request, request->sqe.length); // Copied out, the buffer is the caller's again
+            break;
+        case AIO_OP_FSYNC:
+            console_flush();
+            aio_complete(request, 0);
+            break;
+        case AIO_OP_READ:
+            if (aio_reader) {
+                uint64_t flags = spin_lock_irqsave(&aio_lock);
+                request->next = NULL;
+                if (aio_reads_tail) {
+                    aio_reads_tail->next = request;
+                } else {
+                    aio_reads = request;
+                }
+                aio_reads_tail = request;
+                spin_unlock_irqrestore(&aio_lock, flags);
+                break;
+            }
+            aio_complete(request, AIO_ERROR_IO);
+            break;
+        case AIO_OP_NOP:
+            aio_complete(request, 0);
+            break;
+        default:
+            aio_complete(request, AIO_ERROR_INVALID);
+            break;
+        }
+    }
+    if (reads && aio_reader) wake_up(&aio_read_wait, 1);
+    return count;
+}
+
+static const AioOps_t console_aio_ops = {
+    .name = "console",
+    .submit = console_aio_submit,
+};
+
+static AioFile_t console_file = { &console_aio_ops, NULL };
+
+AioFile_t* console_aio(void) {
+    return &console_file;
+}
@@ -1,6 +1,73 @@
 #include <init.h>
 
-void init(const void* fdt_blob) {
+extern char __kernel_start[];
+extern char __kernel_end[];
+
+// Seed the page allocator from /memory, minus the kernel, firmware, DTB and every reservation
+static void memory_init(const FDTView_t* view) {
+    FDTRegRegion_t regions[16];
+    int region_count = fdt_memory_regions(regions, 16);
+    if (region_count <= 0) {
+        panic("BOOT: no /memory node in FDT!");
+        return;
+    }
+
+    uint64_t ram_base = regions[0].base;
+    for (int i = 0; i < region_count; i++) {
+        page_alloc_add_region(regions[i].base, regions[i].size);
+        if (regions[i].base < ram_base) ram_base = regions[i].base;
+    }
+
+    uint64_t kernel_start = (uint64_t) (uintptr_t) __kernel_start;
+    uint64_t kernel_end = (uint64_t) (uintptr_t) __kernel_end;
+    page_alloc_reserve(kernel_start, kernel_end - kernel_start);
+
+    // OpenSBI sits below our load address and older builds don't list it in /reserved-memory
+    if (ram_base < kernel_start) {
+        page_alloc_reserve(ram_base, kernel_start - ram_base);
+    }
+
+    uint64_t dtb = (uint64_t) (uintptr_t) view->base;
+    page_alloc_reserve(dtb, view->totalsize);
+
+    // QEMU's -initrd image, initramfs reads it where it lies
+    uint64_t initrd_start = 0, initrd_end = 0;
+    if (fdt_initrd(&initrd_start, &initrd_end) == 0 && initrd_end > initrd_start) {
+        page_alloc_reserve(initrd_start, initrd_end - initrd_start);
+    }
+
+    FDTRegRegion_t reserved[32];
+    int reserved_count = fdt_reserved_regions(reserved, 32);
+    for (int i = 0; i < reserved_count; i++) {
+        page_alloc_reserve(reserved[i].base, reserved[i].size);
+    }
+
+    if (page_alloc_init() != 0) {
+        panic("BOOT: page allocator setup failed!");
+        return;
+    }
+
+    klog("RAM: %zu MiB managed, %zu MiB free\n", page_total_count() >> 8, page_free_count() >> 8);
+}
+
+// Work out what the boot hart implements and switch mini_lib to the matching routines
+static void isa_setup(uintptr_t hart_id) {
+    const char* isa = NULL;
+    const char* extensions = NULL;
+    size_t extensions_length = 0;
+
+    if (fdt_cpu_isa(hart_id, &isa, &extensions, &extensions_length) == 0) {
+        isa_init(isa, extensions, extensions_length);
+    }
+
+    isa_enable_local();
+    mem_select(isa_extensions());
+    klog("ISA: %s, memory routines: %s\n", isa_string(), mem_variant());
+}
+
+void init(uintptr_t hart_id, const void* fdt_blob) {
+    smp_init(hart_id);
+
     // Build a view of the FDT
     FDTView_t view;
     uint32_t totalsize = 0;
@@ -20,13 +87,20 @@ void init(const void* fdt_blob) {
         return;
     }
 
+    if (fdt_index_build(&view) != 0) {
+        g_uart_base = UART_DEFAULT_MAP;
+        uart_init(g_uart_base);
+        panic("BOOT: FDT index build failed!");
+        return;
+    }
+
     // Resolve /chosen -> stdout-path -> UART node
     uint64_t base = 0;
     uint64_t size = 0;
     const char* node_path = NULL;
     const char* compatible = NULL;
 
-    int rc = fdt_resolve_stdout_uart(&view, &base, &size, &node_path, &compatible);
+    int rc = fdt_resolve_stdout_uart(&base, &size, &node_path, &compatible);
     if (rc != 0 || base == 0) {
         // Fallback: common QEMU virt mapping
         g_uart_base = UART_DEFAULT_MAP;
@@ -38,4 +112,35 @@ void init(const void* fdt_blob) {
     // Bring up UART
     g_uart_base   = (uintptr_t) base;
     uart_init(g_uart_base);
+    klog_init();
+    trap_init();
+
+    isa_setup(hart_id);
+    timer_init(); // Wants the ISA for Sstc
+    memory_init(&view);
+    if (vm_init() != 0) {
+        panic("BOOT: page table setup failed!");
+        return;
+    }
+    slab_init();
+    if (dma_init() != 0) klog("dma: no pool, devices that need rings won't come up\n");
+    if (initramfs_init() != 0) klog("initramfs: ignoring the initrd\n");
+    sched_init();
+
+    int devices = driver_probe_all();
+    klog("driver: %d device%s bound\n", devices, devices == 1 ? "" : "s");
+    if (block_device_count() && bcache_init() != 0) klog("bcache: no memory for buffers, block I/O is uncached\n");
+
+    // Console input by interrupt, so the monitor sleeps instead of spinning on LSR
+    if (uart_irq() && plic_present() && plic_enable(uart_irq(), uart_irq_handler, NULL) == 0) {
+        uart_enable_interrupts();
+    } else {
+        klog("uart: no PLIC route for irq %u, input stays polled\n", uart_irq());
+    }
+
+    int online = smp_boot_secondaries();
+    klog("smp: %d of %u harts online\n", online, cpu_count());
+    plic_balance(); // Spread device interrupts now that there's somewhere to spread them
+
+    csr_set(sstatus, SSTATUS_SIE); // Sources are enabled one by one in sie as their handlers appear
 }
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include <isa.h>
+#include <riscv.h>
+
+static uint32_t extension_mask = 0;
+static const char* isa_name = "rv64imac"; // What we were built for, until the FDT says otherwise
+
+typedef struct {
+    const char* name;
+    uint32_t bit;
+} IsaExtensionName_t;
+
+static const IsaExtensionName_t extension_names[] = {
+    { "v",      ISA_EXT_V },
+    { "zbb",    ISA_EXT_ZBB },
+    { "zba",    ISA_EXT_ZBA },
+    { "sstc",   ISA_EXT_SSTC },
+    { "svpbmt", ISA_EXT_SVPBMT },
+};
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char) (c - 'A' + 'a') : c;
+}
+
+// Case-insensitive compare of a length-bounded token against a known name
+static int token_is(const char* token, size_t length, const char* name) {
+    size_t i = 0;
+    for (; i < length && name[i]; i++) {
+        if (lower(token[i]) != name[i]) return 0;
+    }
+    return i == length && name[i] == '\0';
+}
+
+static uint32_t lookup(const char* token, size_t length) {
+    for (size_t i = 0; i < sizeof(extension_names) / sizeof(extension_names[0]); i++) {
+        if (token_is(token, length, extension_names[i].name)) return extension_names[i].bit;
+    }
+    return 0;
+}
+
+// "rv64imafdcvh_zicsr_zbb_sstc": single letters up to the first '_', then '_' separated multi-letter names
+static uint32_t parse_isa_string(const char* isa) {
+    uint32_t mask = 0;
+    const char* p = isa;
+
+    if (lower(p[0]) != 'r' || lower(p[1]) != 'v') return 0;
+    p += 2;
+    while (*p >= '0' && *p <= '9') p++; // XLEN
+
+    for (; *p && *p != '_'; p++) {
+        char c = lower(*p);
+        if (c == 'v') mask |= ISA_EXT_V;
+        if (c == 'b') mask |= ISA_EXT_ZBA | ISA_EXT_ZBB; // B is Zba + Zbb + Zbs
+        if (c == 'z' || c == 's' || c == 'x') break; // Multi-letter without the '_', older QEMU does this
+    }
+
+    while (*p) {
+        while (*p == '_') p++;
+        const char* token = p;
+        while (*p && *p != '_') p++;
+        mask |= lookup(token, (size_t) (p - token));
+    }
+
+    return mask;
+}
+
+static uint32_t parse_extension_list(const char* list, size_t length) {
+    uint32_t mask = 0;
+    size_t offset = 0;
+    while (offset < length) {
+        const char* token = list + offset;
+        size_t token_length = 0;
+        while (offset + token_length < length && token[token_length]) token_length++;
+        mask |= lookup(token, token_length);
+        offset += token_length + 1;
+    }
+    return mask;
+}
+
+void isa_init(const char* isa, const char* extensions, size_t extensions_length) {
+    if (isa) isa_name = isa;
+
+    if (extensions && extensions_length) {
+        extension_mask = parse_extension_list(extensions, extensions_length);
+    } else if (isa) {
+        extension_mask = parse_isa_string(isa);
+    }
+}
+
+int isa_has(uint32_t extension) {
+    return (extension_mask & extension) == extension;
+}
+
+uint32_t isa_extensions(void) {
+    return extension_mask;
+}
+
+const char* isa_string(void) {
+    return isa_name;
+}
+
+void isa_enable_local(void) {
+    if (isa_has(ISA_EXT_V)) {
+        // Initial rather than Dirty; nothing saves vector state across traps, see mem_select in mini_lib.c
+        csr_clear(sstatus, SSTATUS_VS_MASK);
+        csr_set(sstatus, SSTATUS_VS_INITIAL);
+    }
+}
@@ -1,8 +1,14 @@
 #include <kernel.h>
 
+static void monitor_thread(void* arg) {
+    (void) arg;
+    kernel_monitor();
+}
+
 int kernel_main(void) {
      // TetOS IS ALIVE
     kprintf("Baguette crumbs of a new OS...\n");
-    kernel_monitor(); 
+    if (!thread_create("monitor", monitor_thread, NULL)) panic("kernel_main: can't start the monitor");
+    sched_start(); // The boot hart idles from here on, the monitor is just another thread
     return 0;
 }
\ No newline at end of file
@@ -2,6 +2,6 @@
 #include <init.h>
 
 void kernel_entry(uintptr_t hart_id, const void* fdt_blob) {
-    init(fdt_blob);
+    init(hart_id, fdt_blob);
     kernel_main();
 }
\ No newline at end of file
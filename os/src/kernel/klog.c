@@ -0,0 +1,216 @@
+#include <klog.h>
+#include <kprintf.h>
+#include <sync.h>
+#include <mini_lib.h>
+#include <timer.h>
+
+// Each hart appends to its own ring with interrupts off and never waits on anyone, the console
+// only sees records when something calls klog_drain (the monitor before its prompt, the idle loop,
+// or a producer that has crossed the watermark).
+
+static KLogRing_t rings[MAX_HARTS];
+static spinlock_t drain_lock = SPINLOCK_INIT; // Only ever try-locked, a busy drainer means someone else is on it
+
+static uint64_t last_frame_time = 0; // Deferred frames carry timestamp deltas from this
+
+// Claims the next slot of this hart's ring, call with interrupts off
+static KLogRecord_t* record_begin(KLogRing_t* ring, uint64_t index) {
+    KLogRecord_t* record = &ring->records[index & (KLOG_RECORDS - 1)];
+
+    __atomic_store_n(&record->sequence, 2 * index + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // Readers see the odd sequence before any new bytes
+
+    record->timestamp = rdtime();
+    record->hart = (uint8_t) cpu_index();
+    return record;
+}
+
+static void record_commit(KLogRing_t* ring, KLogRecord_t* record, uint64_t index) {
+    __atomic_store_n(&record->sequence, 2 * index + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, index + 1, __ATOMIC_RELEASE);
+}
+
+void klogv(const char* format_string, va_list args) {
+    uint64_t flags = irq_save();
+    KLogRing_t* ring = &rings[cpu_index()];
+    uint64_t index = ring->head;
+    KLogRecord_t* record = record_begin(ring, index);
+
+    int length = kvsnprintf(record->text, sizeof(record->text), format_string, args);
+    if (length >= (int) sizeof(record->text)) {
+        length = sizeof(record->text) - 1;
+        record->text[length - 1] = '\n'; // Truncated, keep the line break
+    }
+    record->length = (uint16_t) length;
+    record->binary = 0;
+
+    record_commit(ring, record, index);
+    irq_restore(flags);
+
+    if (index + 1 - ring->drained >= KLOG_DRAIN_WATERMARK) klog_drain();
+}
+
+static size_t put_varint(uint8_t* output, size_t position, size_t size, uint64_t value) {
+    do {
+        if (position >= size) return size;
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        output[position++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return position;
+}
+
+static inline uint64_t zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+void klog_deferred(uint32_t format_id, const KLogArg_t* args, size_t count) {
+    if (count > KLOG_MAX_ARGS) count = KLOG_MAX_ARGS;
+
+    uint64_t flags = irq_save();
+    KLogRing_t* ring = &rings[cpu_index()];
+    uint64_t index = ring->head;
+    KLogRecord_t* record = record_begin(ring, index);
+
+    // Payload: id, signed mask, arguments. The frame marker and timestamp are added at drain time.
+    uint8_t* payload = (uint8_t*) record->text;
+    size_t size = sizeof(record->text);
+    size_t position = put_varint(payload, 0, size, format_id);
+
+    uint8_t mask = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (args[i].kind == KLOG_ARG_SIGNED) mask |= (uint8_t) (1u << i);
+    }
+    if (position < size) payload[position++] = mask;
+
+    for (size_t i = 0; i < count; i++) {
+        if (args[i].kind == KLOG_ARG_STRING) {
+            const char* string = (const char*) (uintptr_t) args[i].value;
+            if (!string) string = "(null)";
+
+            size_t length = strlen(string);
+            size_t room = size - position;
+            room = room > 2 ? room - 2 : 0; // Length prefix of at most 2 bytes
+            if (length > room) length = room; // Strings get truncated, the frame never does
+            position = put_varint(payload, position, size, length);
+            memcpy(&payload[position], string, length);
+            position += length;
+        } else if (args[i].kind == KLOG_ARG_SIGNED) {
+            position = put_varint(payload, position, size, zigzag((int64_t) args[i].value));
+        } else {
+            position = put_varint(payload, position, size, args[i].value);
+        }
+    }
+
+    record->length = (uint16_t) position;
+    record->binary = 1;
+    record_commit(ring, record, index);
+    irq_restore(flags);
+
+    if (index + 1 - ring->drained >= KLOG_DRAIN_WATERMARK) klog_drain();
+}
+
+void klog_printf(const char* format_string, ...) {
+    va_list args;
+    va_start(args, format_string);
+    klogv(format_string, args);
+    va_end(args);
+}
+
+// Copies record index out of ring, 0 if it was overwritten before or while we read it
+static int record_read(const KLogRing_t* ring, uint64_t index, KLogRecord_t* output) {
+    const KLogRecord_t* record = &ring->records[index & (KLOG_RECORDS - 1)];
+
+    uint64_t before = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+    if (before != 2 * index + 2) return 0;
+
+    output->timestamp = record->timestamp;
+    output->hart = record->hart;
+    output->binary = record->binary;
+    output->length = record->length;
+    if (output->length > KLOG_RECORD_TEXT) output->length = KLOG_RECORD_TEXT;
+    for (uint16_t i = 0; i < output->length; i++) output->text[i] = record->text[i];
+    if (!output->binary) output->text[output->length < KLOG_RECORD_TEXT ? output->length : KLOG_RECORD_TEXT - 1] = '\0';
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&record->sequence, __ATOMIC_RELAXED) == before;
+}
+
+static void record_print(const KLogRecord_t* record) {
+    if (record->binary) {
+        uint8_t frame[KLOG_RECORD_TEXT + 12];
+        size_t position = 0;
+        frame[position++] = 0x00; // Text never contains NUL, the decoder syncs on it
+        position = put_varint(frame, position, sizeof(frame), zigzag((int64_t) (record->timestamp - last_frame_time)));
+        last_frame_time = record->timestamp;
+        memcpy(&frame[position], record->text, record->length);
+        console_write_binary(frame, position + record->length);
+        return;
+    }
+
+    uint64_t hz = clock_hz();
+    uint64_t seconds = record->timestamp / hz;
+    uint64_t micros = (record->timestamp % hz) * 1000000ull / hz;
+    kprintf("[%5lu.%06lu] %s", seconds, micros, record->text);
+}
+
+// K-way merge of per-hart rings from each ring's cursor, oldest timestamp first
+static void merge_print(uint64_t cursors[MAX_HARTS], int advance_drained) {
+    KLogRecord_t record;
+
+    while (1) {
+        int oldest = -1;
+        uint64_t oldest_time = 0;
+
+        for (int hart = 0; hart < MAX_HARTS; hart++) {
+            KLogRing_t* ring = &rings[hart];
+            uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+            // Skip whatever the producer has lapped us on
+            if (head - cursors[hart] > KLOG_RECORDS) {
+                if (advance_drained) ring->dropped += head - KLOG_RECORDS - cursors[hart];
+                cursors[hart] = head - KLOG_RECORDS;
+            }
+
+            while (cursors[hart] < head && !record_read(ring, cursors[hart], &record)) {
+                if (advance_drained) ring->dropped++;
+                cursors[hart]++;
+            }
+            if (cursors[hart] >= head) continue;
+
+            if (oldest < 0 || record.timestamp < oldest_time) {
+                oldest = hart;
+                oldest_time = record.timestamp;
+            }
+        }
+
+        if (oldest < 0) break;
+        if (record_read(&rings[oldest], cursors[oldest], &record)) record_print(&record);
+        cursors[oldest]++;
+        if (advance_drained) __atomic_store_n(&rings[oldest].drained, cursors[oldest], __ATOMIC_RELEASE);
+    }
+}
+
+void klog_init(void) {
+    lock_stats_register("klog-drain", &drain_lock.stats);
+}
+
+void klog_drain(void) {
+    if (!spin_trylock(&drain_lock)) return; // Someone is already draining
+
+    uint64_t cursors[MAX_HARTS];
+    for (int hart = 0; hart < MAX_HARTS; hart++) cursors[hart] = rings[hart].drained;
+    merge_print(cursors, 1);
+
+    spin_unlock(&drain_lock);
+}
+
+void klog_replay(void) {
+    uint64_t cursors[MAX_HARTS];
+    for (int hart = 0; hart < MAX_HARTS; hart++) {
+        uint64_t head = rings[hart].head;
+        cursors[hart] = head > KLOG_RECORDS ? head - KLOG_RECORDS : 0;
+    }
+
+    merge_print(cursors, 0);
+}
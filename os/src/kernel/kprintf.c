@@ -1,96 +1,301 @@
 #include <kprintf.h>
 
-static void print_value(int value, int base, int is_signed) {
-    char buffer[32]; // Enough for 32-bit binary representation + sign + null
-    char* p = &buffer[31]; // Reverse fill from the end
-    *p = '\0';
-
-    int is_negative = 0;
-    unsigned int uvalue;
-
-    // Handle negative numbers for signed decimal
-    if (is_signed && value < 0) {
-        is_negative = 1;
-        uvalue = (unsigned int) (-value);
-    } else {
-        uvalue = (unsigned int) value;
-    }
+// Everything is rendered into a buffer first and handed to the console with a single console_write,
+// instead of one putc per character. Formatting happens outside the console lock; output
+// longer than the buffer takes the lock at the first flush and keeps it so lines from other harts
+// can't land in the middle.
+
+#define KPRINTF_BUFFER_SIZE 256 // Longer output is flushed in chunks of this size
+
+#define FLAG_LEFT  (1 << 0) // '-'
+#define FLAG_ZERO  (1 << 1) // '0'
+#define FLAG_PLUS  (1 << 2) // '+'
+#define FLAG_SPACE (1 << 3) // ' '
+#define FLAG_UPPER (1 << 4) // %X
+
+typedef struct {
+    char* buffer;
+    size_t size;
+    size_t length; // Bytes currently in buffer
+    size_t total;  // Bytes the whole output would take
+    int flush;     // Flush to the console when full (kprintf) instead of truncating (ksnprintf)
+    int locked;    // Holding the console lock across chunks
+} PrintBuffer_t;
 
-    // Convert number to string in reverse order
-    if (uvalue == 0) {
-        *--p = '0';
-    } else {
-        while (uvalue > 0) {
-            int digit = uvalue % base;
-            *--p = (digit < 10) ? ('0' + digit) : ('a' + (digit - 10)); // Decode hex digits
-            uvalue /= base; // Unsigned division
+static void put_char(PrintBuffer_t* out, char c) {
+    out->total++;
+
+    if (out->flush) {
+        if (out->length == out->size) {
+            if (!out->locked) {
+                console_lock();
+                out->locked = 1;
+            }
+            console_write(out->buffer, out->length);
+            out->length = 0;
         }
+        out->buffer[out->length++] = c;
+    } else if (out->length + 1 < out->size) {
+        out->buffer[out->length++] = c; // Keep the last byte for the terminator
+    }
+}
+
+static void put_repeat(PrintBuffer_t* out, char c, int count) {
+    for (int i = 0; i < count; i++) put_char(out, c);
+}
+
+static void put_string(PrintBuffer_t* out, const char* str, int width, int precision, int flags) {
+    if (!str) str = "(null)";
+
+    int length = 0;
+    while (str[length] && (precision < 0 || length < precision)) length++;
+
+    if (!(flags & FLAG_LEFT)) put_repeat(out, ' ', width - length);
+    for (int i = 0; i < length; i++) put_char(out, str[i]);
+    if (flags & FLAG_LEFT) put_repeat(out, ' ', width - length);
+}
+
+// precision is the minimum digit count like printf's, -1 if none was given
+static void print_value(PrintBuffer_t* out, uint64_t value, unsigned int base, int negative, int width, int precision,
+                        int flags) {
+    char buffer[24]; // 2^64 is 20 decimal digits, 16 hex
+    char* end = &buffer[sizeof(buffer)];
+    char* p = end; // Reverse fill from the end
+    const char* digits = (flags & FLAG_UPPER) ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    // Convert number to string in reverse order. "%.0d" of 0 prints no digits at all.
+    if (value || precision != 0) {
+        do {
+            *--p = digits[value % base];
+            value /= base;
+        } while (value);
     }
 
-    // Add negative sign if needed
-    if (is_negative) {
-        *--p = '-';
+    int zeros = 0;
+    if (precision >= 0) {
+        if (precision > (int) (end - p)) zeros = precision - (int) (end - p);
+        flags &= ~FLAG_ZERO; // A precision turns '0' padding off
     }
 
-    uart_puts(p);
+    int length = (int) (end - p) + zeros;
+    char sign = 0;
+    if (negative) {
+        sign = '-';
+    } else if (flags & FLAG_PLUS) {
+        sign = '+';
+    } else if (flags & FLAG_SPACE) {
+        sign = ' ';
+    }
+    if (sign) length++;
+
+    int padding = width - length;
+    if (!(flags & (FLAG_LEFT | FLAG_ZERO))) put_repeat(out, ' ', padding);
+    if (sign) put_char(out, sign);
+    if ((flags & FLAG_ZERO) && !(flags & FLAG_LEFT)) put_repeat(out, '0', padding);
+    put_repeat(out, '0', zeros);
+    while (p < end) put_char(out, *p++);
+    if (flags & FLAG_LEFT) put_repeat(out, ' ', padding);
 }
 
-void kprintf(const char* format_string, ...) {
-    // va_list handles variable arguments
-    // va_start initializes it
-    va_list args;
-    va_start(args, format_string);
+// Integer argument sizes, from the h/hh/l/ll/z/t/j length modifiers
+typedef enum {
+    LENGTH_CHAR,
+    LENGTH_SHORT,
+    LENGTH_INT,
+    LENGTH_LONG,
+    LENGTH_LONG_LONG,
+    LENGTH_SIZE,
+} PrintLength_t;
 
+static uint64_t read_unsigned(va_list* args, PrintLength_t length) {
+    switch (length) {
+        case LENGTH_CHAR:      return (unsigned char) va_arg(*args, unsigned int);
+        case LENGTH_SHORT:     return (unsigned short) va_arg(*args, unsigned int);
+        case LENGTH_LONG:      return va_arg(*args, unsigned long);
+        case LENGTH_LONG_LONG: return va_arg(*args, unsigned long long);
+        case LENGTH_SIZE:      return va_arg(*args, size_t);
+        case LENGTH_INT:
+        default:               return va_arg(*args, unsigned int);
+    }
+}
+
+static int64_t read_signed(va_list* args, PrintLength_t length) {
+    switch (length) {
+        case LENGTH_CHAR:      return (signed char) va_arg(*args, int);
+        case LENGTH_SHORT:     return (short) va_arg(*args, int);
+        case LENGTH_LONG:      return va_arg(*args, long);
+        case LENGTH_LONG_LONG: return va_arg(*args, long long);
+        case LENGTH_SIZE:      return (int64_t) va_arg(*args, size_t);
+        case LENGTH_INT:
+        default:               return va_arg(*args, int);
+    }
+}
+
+static void format(PrintBuffer_t* out, const char* format_string, va_list* args) {
     const char* p = format_string;
     while (*p) {
         // Need not apply
         if (*p != '%') {
-            uart_putc(*p++);
+            put_char(out, *p++);
             continue;
         }
 
         p++; // Skip '%'
+
+        int flags = 0;
+        while (1) {
+            if (*p == '-') flags |= FLAG_LEFT;
+            else if (*p == '0') flags |= FLAG_ZERO;
+            else if (*p == '+') flags |= FLAG_PLUS;
+            else if (*p == ' ') flags |= FLAG_SPACE;
+            else break;
+            p++;
+        }
+
+        int width = 0;
+        if (*p == '*') {
+            width = va_arg(*args, int);
+            if (width < 0) {
+                flags |= FLAG_LEFT;
+                width = -width;
+            }
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') width = width * 10 + (*p++ - '0');
+        }
+
+        int precision = -1;
+        if (*p == '.') {
+            p++;
+            precision = 0;
+            if (*p == '*') {
+                precision = va_arg(*args, int);
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9') precision = precision * 10 + (*p++ - '0');
+            }
+        }
+
+        PrintLength_t length = LENGTH_INT;
+        if (*p == 'h') {
+            p++;
+            length = LENGTH_SHORT;
+            if (*p == 'h') {
+                p++;
+                length = LENGTH_CHAR;
+            }
+        } else if (*p == 'l') {
+            p++;
+            length = LENGTH_LONG;
+            if (*p == 'l') {
+                p++;
+                length = LENGTH_LONG_LONG;
+            }
+        } else if (*p == 'z' || *p == 't' || *p == 'j') {
+            p++;
+            length = LENGTH_SIZE; // All 64 bits on rv64
+        }
+
         switch (*p) {
             case 'c': {
                 // va_arg reads the next argument of the given type
-                char c = (char) va_arg(args, int); // char promoted to int, congratulations char o7
-                uart_putc(c);
+                char c = (char) va_arg(*args, int); // char promoted to int, congratulations char o7
+                if (!(flags & FLAG_LEFT)) put_repeat(out, ' ', width - 1);
+                put_char(out, c);
+                if (flags & FLAG_LEFT) put_repeat(out, ' ', width - 1);
                 break;
             } // char
             case 's': {
-                const char* str = va_arg(args, const char*);
-                uart_puts(str);
+                put_string(out, va_arg(*args, const char*), width, precision, flags);
                 break;
             } // char*
             case 'i': // Also decimal because why not
-            case 'd':{
-                int value = va_arg(args, int);
-                print_value(value, 10, 1);
+            case 'd': {
+                int64_t value = read_signed(args, length);
+                uint64_t magnitude = (value < 0) ? (uint64_t) 0 - (uint64_t) value : (uint64_t) value;
+                print_value(out, magnitude, 10, value < 0, width, precision, flags);
                 break;
             } // decimal
             case 'u': {
-                unsigned int uvalue = va_arg(args, unsigned int);
-                print_value(uvalue, 10, 0);
+                print_value(out, read_unsigned(args, length), 10, 0, width, precision, flags);
                 break;
             } // unsigned decimal
+            case 'X':
+                flags |= FLAG_UPPER;
+                // fall through
             case 'x': {
-                unsigned int hex = va_arg(args, unsigned int);
-                print_value(hex, 16, 0);
+                print_value(out, read_unsigned(args, length), 16, 0, width, precision, flags);
                 break;
             } // hex
+            case 'o': {
+                print_value(out, read_unsigned(args, length), 8, 0, width, precision, flags);
+                break;
+            } // octal
+            case 'p': {
+                uintptr_t pointer = (uintptr_t) va_arg(*args, void*);
+                put_char(out, '0');
+                put_char(out, 'x');
+                print_value(out, pointer, 16, 0, 16, -1, FLAG_ZERO);
+                break;
+            } // pointer, always full width
             case '%': {
-                uart_putc('%');
+                put_char(out, '%');
                 break;
             } // It's just a percent sign
+            case '\0': {
+                put_char(out, '%');
+                return;
+            } // Format string ended on a '%'
             default: {
-                uart_putc('%');
-                uart_putc(*p);
+                put_char(out, '%');
+                put_char(out, *p);
                 break;
-            } // Not s,i,d,u,x,c,%
+            } // Not something we know
         }
         p++; // Move past format specifier
     }
+}
+
+int kvsnprintf(char* buffer, size_t size, const char* format_string, va_list args) {
+    PrintBuffer_t out = { .buffer = buffer, .size = size, .length = 0, .total = 0, .flush = 0, .locked = 0 };
+
+    va_list copy;
+    va_copy(copy, args);
+    format(&out, format_string, &copy);
+    va_end(copy);
+
+    if (size > 0) buffer[out.length] = '\0';
+    return (int) out.total;
+}
+
+int ksnprintf(char* buffer, size_t size, const char* format_string, ...) {
+    va_list args;
+    va_start(args, format_string);
+    int length = kvsnprintf(buffer, size, format_string, args);
+    va_end(args);
+    return length;
+}
+
+void kvprintf(const char* format_string, va_list args) {
+    char buffer[KPRINTF_BUFFER_SIZE];
+    PrintBuffer_t out = { .buffer = buffer, .size = sizeof(buffer), .length = 0, .total = 0, .flush = 1, .locked = 0 };
+
+    va_list copy;
+    va_copy(copy, args);
+    format(&out, format_string, &copy);
+    va_end(copy);
+
+    if (out.length) console_write(buffer, out.length); // One write for the whole line
+    if (out.locked) console_unlock();
+}
+
+void kprintf(const char* format_string, ...) {
+    // va_list handles variable arguments
+    // va_start initializes it
+    va_list args;
+    va_start(args, format_string);
+    kvprintf(format_string, args);
 
     // clean up
     va_end(args);
-}
\ No newline at end of file
+}
@@ -11,12 +11,46 @@ typedef struct {
 static int command_help();
 static int command_echo(int argc, char** argv);
 static int command_panic();
+static int command_mem();
+static int command_slabinfo();
+static int command_bench(int argc, char** argv);
+static int command_dmesg();
+static int command_cpus();
+static int command_locks();
+static int command_traps(int argc, char** argv);
+static int command_timers(int argc, char** argv);
+static int command_threads();
+static int command_tlb();
+static int command_irq(int argc, char** argv);
+static int command_blk();
+static int command_ls(int argc, char** argv);
+static int command_cat(int argc, char** argv);
+static int command_console(int argc, char** argv);
+static int command_bcache(int argc, char** argv);
+static int command_aio(int argc, char** argv);
 static int tokenize(char *input, char** argv, int max_args);
 
 static const command_t commands[] = {
     {"help", "Display this help message", command_help},
     {"echo", "Echo the input arguments", command_echo},
     {"panic", "Trigger a kernel panic", command_panic},
+    {"mem", "Show page allocator and DMA pool free lists", command_mem},
+    {"slabinfo", "Show object cache statistics", command_slabinfo},
+    {"bench", "Run a benchmark ('bench' lists them)", command_bench},
+    {"dmesg", "Show the recent kernel log", command_dmesg},
+    {"cpus", "List harts and whether they came up", command_cpus},
+    {"locks", "Show lock contention statistics", command_locks},
+    {"traps", "Show trap counts and handler latency ('traps ebreak' to test)", command_traps},
+    {"timers", "Show timer wheels ('timers sleep <ms>' to test one)", command_timers},
+    {"threads", "List threads and per-hart scheduler counters", command_threads},
+    {"tlb", "Show page table leaves and TLB shootdown counters", command_tlb},
+    {"irq", "Show PLIC sources ('irq <source> <cpu mask|prio n>', 'irq balance')", command_irq},
+    {"blk", "List block devices and their request counters", command_blk},
+    {"ls", "List an initramfs directory", command_ls},
+    {"cat", "Print a file from the initramfs", command_cat},
+    {"console", "Show console drivers and counters ('console <driver>' to switch)", command_console},
+    {"bcache", "Show buffer cache hit, eviction and read-ahead counters ('bcache sync', 'bcache read <dev> <block> <n>')", command_bcache},
+    {"aio", "Show the monitor's aio ring ('aio read <dev> <pages>' keeps 16 reads in flight)", command_aio},
 };
 
 #define NUM_COMMANDS (sizeof(commands) / sizeof(commands[0]))
@@ -45,6 +79,404 @@ static int command_panic() {
     return 0; // Unreachable
 }
 
+static int command_mem() {
+    kprintf("Pages: %zu free / %zu total\n", page_free_count(), page_total_count());
+    for (unsigned int order = 0; order < PAGE_MAX_ORDER; order++) {
+        size_t blocks = page_free_blocks(order);
+        if (blocks) kprintf("  order %2u (%6u KiB): %zu free\n", order, 4u << order, blocks);
+    }
+
+    DmaStats_t dma;
+    dma_stats(&dma);
+    if (!dma.size) return 0;
+    kprintf("DMA: %lu / %lu KiB used (peak %lu), %lu allocs, %lu frees, %lu failed\n", dma.used >> 10, dma.size >> 10,
+            dma.peak >> 10, dma.allocs, dma.frees, dma.failures);
+    for (unsigned int order = 0; order < DMA_MAX_ORDER; order++) {
+        if (dma.free_blocks[order]) kprintf("  order %2u (%7lu B): %zu free\n", order, (unsigned long) (DMA_GRANULE << order), dma.free_blocks[order]);
+    }
+    return 0;
+}
+
+static int command_slabinfo() {
+    kprintf("%-16s %6s %6s %15s %7s %10s %8s\n", "cache", "size", "slabs", "active/total", "cached", "hits", "misses");
+    for (SlabCache_t* cache = slab_cache_first(); cache; cache = cache->next) {
+        SlabStats_t stats;
+        slab_cache_stats(cache, &stats);
+        kprintf("%-16s %6zu %6zu %7zu/%-7zu %7zu %10lu %8lu\n", cache->name, cache->object_size,
+                stats.slabs, stats.active, stats.total, stats.cached, stats.hits, stats.misses);
+    }
+    return 0;
+}
+
+static int command_bench(int argc, char** argv) {
+    return bench_main(argc, argv);
+}
+
+static int command_dmesg() {
+    klog_replay();
+    return 0;
+}
+
+static int command_cpus() {
+    kprintf("%-4s %-6s %-8s %s\n", "cpu", "hart", "state", "up at (ticks)");
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        kprintf("%-4u %-6lu %-8s %lu%s\n", i, (unsigned long) cpus[i].hart_id,
+                cpus[i].online ? "online" : "offline", (unsigned long) cpus[i].started_at,
+                i == cpu_index() ? " *" : "");
+    }
+    return 0;
+}
+
+static int command_locks() {
+    kprintf("%-16s %12s %10s %14s %10s\n", "lock", "acquired", "contended", "spin cycles", "avg spin");
+    for (int i = 0; i < lock_stats_count(); i++) {
+        LockStats_t stats;
+        const char* name = lock_stats_get(i, &stats);
+        if (!name) continue;
+        kprintf("%-16s %12lu %10lu %14lu %10lu\n", name, stats.acquisitions, stats.contended,
+                stats.spin_cycles, stats.contended ? stats.spin_cycles / stats.contended : 0ul);
+    }
+    return 0;
+}
+
+static int command_traps(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "ebreak") == 0) {
+        asm volatile("ebreak");
+        kprintf("Back from ebreak\n");
+    }
+
+    kprintf("%-10s %-18s %10s %10s %10s\n", "kind", "cause", "count", "avg cyc", "worst cyc");
+    for (int interrupt = 1; interrupt >= 0; interrupt--) {
+        for (unsigned int cause = 0; cause < TRAP_CAUSES; cause++) {
+            TrapStats_t stats;
+            trap_stats(interrupt, cause, &stats);
+            if (stats.count == 0) continue;
+            kprintf("%-10s %-18s %10lu %10lu %10lu\n", interrupt ? "interrupt" : "exception",
+                    trap_cause_name(interrupt, cause), stats.count,
+                    stats.total_cycles / stats.count, stats.worst_cycles);
+        }
+    }
+    return 0;
+}
+
+static int command_timers(int argc, char** argv) {
+    if (argc > 2 && strcmp(argv[1], "sleep") == 0) {
+        uint64_t ms = 0;
+        for (const char* p = argv[2]; *p >= '0' && *p <= '9'; p++) ms = ms * 10 + (uint64_t) (*p - '0');
+
+        uint64_t start = clock_now();
+        thread_sleep_ms(ms);
+        kprintf("Slept %lu us\n", (unsigned long) (clock_ticks_to_ns(clock_now() - start) / 1000));
+    }
+
+    kprintf("%-4s %8s %10s %10s %10s %20s\n", "cpu", "pending", "fired", "cascaded", "irqs", "next deadline");
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        const TimerWheel_t* wheel = timer_wheel(i);
+        kprintf("%-4u %8lu %10lu %10lu %10lu ", i, wheel->pending, wheel->fired, wheel->cascaded, wheel->interrupts);
+        if (wheel->deadline == UINT64_MAX) {
+            kprintf("%20s\n", "none");
+        } else {
+            kprintf("%20lu\n", (unsigned long) wheel->deadline);
+        }
+    }
+    return 0;
+}
+
+#define THREADS_SHOWN 64
+
+static int command_threads() {
+    static ThreadInfo_t threads[THREADS_SHOWN]; // Too big for the monitor's stack
+    int count = thread_list(threads, THREADS_SHOWN);
+
+    kprintf("%-5s %-16s %-9s %-4s %10s %12s\n", "id", "name", "state", "cpu", "switches", "runtime us");
+    for (int i = count - 1; i >= 0; i--) { // List is newest first
+        const ThreadInfo_t* thread = &threads[i];
+        kprintf("%-5u %-16s %-9s %-4u %10lu %12lu\n", thread->id, thread->name, thread_state_name(thread->state),
+                thread->cpu, thread->switches, (unsigned long) (clock_ticks_to_ns(thread->runtime) / 1000));
+    }
+
+    kprintf("\n%-4s %10s %10s %10s %8s %8s %8s %10s\n", "cpu", "switches", "avg cyc", "worst cyc", "preempt", "steals", "races", "wfi ms");
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        SchedStats_t stats;
+        sched_stats(i, &stats);
+        kprintf("%-4u %10lu %10lu %10lu %8lu %8lu %8lu %10lu\n", i, stats.switches,
+                stats.switches ? stats.switch_cycles / stats.switches : 0ul, stats.worst_switch,
+                stats.preemptions, stats.steals, stats.steal_races,
+                (unsigned long) (clock_ticks_to_ns(stats.wfi_ticks) / 1000000));
+    }
+    return 0;
+}
+
+static uint32_t parse_number(const char* text) {
+    uint32_t value = 0;
+    for (const char* p = text; *p >= '0' && *p <= '9'; p++) value = value * 10 + (uint32_t) (*p - '0');
+    return value;
+}
+
+static int command_irq(int argc, char** argv) {
+    if (!plic_present()) {
+        kprintf("No PLIC\n");
+        return -1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "balance") == 0) {
+        plic_balance();
+    } else if (argc > 3 && strcmp(argv[2], "prio") == 0) {
+        if (plic_set_priority(parse_number(argv[1]), parse_number(argv[3])) < 0) kprintf("Bad source or priority\n");
+    } else if (argc > 2) {
+        if (plic_set_affinity(parse_number(argv[1]), parse_number(argv[2])) < 0) kprintf("Bad source or no online hart in mask\n");
+    }
+
+    kprintf("%-6s %-4s %-8s", "source", "prio", "affinity");
+    for (unsigned int i = 0; i < cpu_count() && i < 8; i++) kprintf(" %8s%u", "cpu", i);
+    kprintf("\n");
+
+    for (uint32_t source = 1; source < plic_source_count(); source++) {
+        PlicSourceInfo_t info;
+        if (plic_source_info(source, &info) < 0) continue;
+        kprintf("%-6u %-4u 0x%-6x", source, info.priority, info.affinity);
+        for (unsigned int i = 0; i < cpu_count() && i < 8; i++) kprintf(" %9lu", info.count[i]);
+        kprintf("\n");
+    }
+
+    kprintf("%-6s %-4s %-8s", "", "", "spurious");
+    for (unsigned int i = 0; i < cpu_count() && i < 8; i++) kprintf(" %9lu", plic_spurious(i));
+    kprintf("\n%-6s %-4s %-8s", "", "", "thresh");
+    for (unsigned int i = 0; i < cpu_count() && i < 8; i++) kprintf(" %9u", plic_threshold(i));
+    kprintf("\n");
+    return 0;
+}
+
+static int command_tlb() {
+    VmStats_t vm;
+    TlbStats_t tlb;
+    vm_stats(&vm);
+    tlb_stats(&tlb);
+
+    kprintf("Leaves: %lu x 1G, %lu x 2M, %lu x 4K in %lu tables\n", vm.leaves[2], vm.leaves[1], vm.leaves[0], vm.tables);
+    kprintf("Pages queued %lu, flushed page by page %lu, full flushes %lu in %lu batches\n",
+            tlb.queued_pages, tlb.flushed_pages, tlb.full_flushes, tlb.batches);
+    kprintf("Remote fences %lu, fallback IPIs %lu, idle harts skipped %lu, local fences %lu\n",
+            tlb.fences_sent, tlb.ipis_sent, tlb.lazy_skips, tlb.local_fences);
+    return 0;
+}
+
+static int command_blk() {
+    if (block_device_count() == 0) {
+        kprintf("No block devices\n");
+        return 0;
+    }
+
+    kprintf("%-5s %10s %3s %5s %10s %9s %9s %10s %7s %10s %10s\n", "dev", "MiB", "ro", "depth", "requests",
+            "batches", "notifies", "irqs", "errors", "KiB read", "KiB write");
+    for (unsigned int i = 0; i < block_device_count(); i++) {
+        const BlockDevice_t* device = block_device(i);
+        const BlockStats_t* stats = &device->stats;
+        kprintf("%-5s %10lu %3s %5u %10lu %9lu %9lu %10lu %7lu %10lu %10lu\n", device->name,
+                (unsigned long) (device->sectors * BLOCK_SECTOR_SIZE >> 20), device->read_only ? "yes" : "no",
+                device->queue_depth, stats->requests, stats->batches, stats->notifies, stats->interrupts,
+                stats->errors, stats->bytes_read >> 10, stats->bytes_written >> 10);
+    }
+    return 0;
+}
+
+// Percent with one decimal, without floating point
+static void print_ratio(const char* label, uint64_t part, uint64_t whole) {
+    uint64_t permille = whole ? part * 1000 / whole : 0;
+    kprintf("%s %lu.%lu%%", label, permille / 10, permille % 10);
+}
+
+static int command_bcache(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "sync") == 0) {
+        if (bcache_sync(NULL) < 0) kprintf("Some blocks failed to write back\n");
+    } else if (argc > 4 && strcmp(argv[1], "read") == 0) {
+        BlockDevice_t* device = block_find(argv[2]);
+        if (!device) {
+            kprintf("No device %s\n", argv[2]);
+            return -1;
+        }
+
+        uint32_t first = parse_number(argv[3]), count = parse_number(argv[4]);
+        uint64_t start = clock_now();
+        for (uint32_t i = 0; i < count; i++) {
+            Buffer_t* buffer = bcache_get(device, first + i);
+            if (!buffer) {
+                kprintf("Read of block %u failed\n", first + i);
+                break;
+            }
+            bcache_release(buffer);
+        }
+        kprintf("%u blocks in %lu us\n", count, (unsigned long) (clock_ticks_to_ns(clock_now() - start) / 1000));
+    }
+
+    BcacheStats_t stats;
+    bcache_stats(&stats);
+    if (stats.buffers == 0) {
+        kprintf("No buffer cache\n");
+        return 0;
+    }
+
+    kprintf("%u buffers of %u B, %u dirty\n", stats.buffers, BCACHE_BLOCK_SIZE, stats.dirty);
+    kprintf("Lookups %lu: hits %lu, misses %lu, waited on a read %lu,", stats.lookups, stats.hits, stats.misses, stats.waits);
+    print_ratio(" hit ratio", stats.hits, stats.lookups);
+    kprintf("\nEvictions %lu, of which needed write-back first %lu\n", stats.evictions, stats.evicted_dirty);
+    kprintf("Read-ahead %lu blocks: used %lu, evicted unused %lu,", stats.readahead_issued, stats.readahead_used,
+            stats.readahead_wasted);
+    print_ratio(" useful", stats.readahead_used, stats.readahead_issued);
+    kprintf("\nWritten back %lu blocks in %lu batches, errors %lu read / %lu write\n", stats.writebacks,
+            stats.writeback_batches, stats.read_errors, stats.write_errors);
+    return 0;
+}
+
+static int command_ls(int argc, char** argv) {
+    uint64_t start, end;
+    initramfs_image(&start, &end);
+    if (start == end) {
+        kprintf("No initramfs (boot with 'make run-initrd')\n");
+        return -1;
+    }
+
+    const char* directory = argc > 1 ? argv[1] : "/";
+    const InitramfsEntry_t* self = initramfs_lookup(directory);
+    if (self && (self->mode & INITRAMFS_TYPE_MASK) != INITRAMFS_DIRECTORY) {
+        kprintf("%-6o %10lu %s\n", self->mode, self->size, self->path);
+        return 0;
+    }
+
+    int shown = 0;
+    for (size_t i = 0; i < initramfs_count(); i++) {
+        const InitramfsEntry_t* entry = initramfs_entry(i);
+        if (!initramfs_in_directory(entry, directory)) continue;
+        if (initramfs_lookup(entry->path) != entry) continue; // Replaced further on in the archive
+        uint32_t type = entry->mode & INITRAMFS_TYPE_MASK;
+        kprintf("%-6o %10lu %s%s\n", entry->mode, entry->size, entry->path, type == INITRAMFS_DIRECTORY ? "/" : "");
+        shown++;
+    }
+    if (!shown && !self) kprintf("No such directory: %s\n", directory);
+    return 0;
+}
+
+static int command_cat(int argc, char** argv) {
+    if (argc < 2) {
+        kprintf("Usage: cat <path>\n");
+        return -1;
+    }
+
+    const void* data;
+    size_t size;
+    int rc = initramfs_read(argv[1], &data, &size);
+    if (rc < 0) {
+        kprintf(rc == -1 ? "No such file: %s\n" : "Not a regular file: %s\n", argv[1]);
+        return -1;
+    }
+    console_write((const char*) data, size); // Straight out of the image
+    return 0;
+}
+
+static int command_console(int argc, char** argv) {
+    if (argc > 1 && console_select(argv[1]) < 0) kprintf("No console driver %s\n", argv[1]);
+
+    ConsoleStats_t stats;
+    console_stats(&stats);
+    const ConsoleDriver_t* active = console_active();
+    kprintf("Console: %s (drivers:", active->name);
+    const ConsoleDriver_t* driver;
+    for (unsigned int i = 0; (driver = console_driver(i)) != NULL; i++) kprintf(" %s", driver->name);
+    kprintf(")\n%lu writes, %lu bytes, %lu fell back to the uart\n", stats.writes, stats.bytes, stats.fallbacks);
+    for (unsigned int i = 0; (driver = console_driver(i)) != NULL; i++) {
+        if (driver->show) driver->show();
+    }
+    return 0;
+}
+
+#define AIO_READ_DEPTH 16
+#define AIO_STALL_MS 1000 // Nothing in flight and the device still won't take more, give up
+
+// Monitor input rides on its own ring, this is the one we show
+static AioRing_t* input_ring = NULL;
+
+static void print_ring(const char* label, const AioRing_t* ring) {
+    const AioStats_t* stats = &ring->stats;
+    kprintf("%s: %lu submitted in %lu batches, %lu completed, %lu enters (%lu slept, %lu wakeups), %lu cut short\n",
+            label, stats->submitted, stats->batches, stats->completed, stats->enters, stats->sleeps, stats->wakeups, stats->full);
+}
+
+// Keeps AIO_READ_DEPTH page reads in flight, a completion's user_data is the buffer slot it used
+static int aio_read_blocks(BlockDevice_t* device, uint32_t count) {
+    uint64_t blocks = device->sectors * BLOCK_SECTOR_SIZE / PAGE_SIZE;
+    AioRing_t* ring = aio_ring_create(AIO_READ_DEPTH);
+    uint8_t* buffers = (uint8_t*) page_alloc(page_order_for(AIO_READ_DEPTH * PAGE_SIZE));
+    if (!ring || !buffers || blocks == 0) {
+        kprintf(blocks ? "Out of memory\n" : "Device smaller than a page\n");
+        aio_ring_destroy(ring);
+        if (buffers) page_free(buffers);
+        return -1;
+    }
+
+    uint32_t free_slots[AIO_READ_DEPTH];
+    uint32_t free_count = AIO_READ_DEPTH;
+    for (uint32_t i = 0; i < AIO_READ_DEPTH; i++) free_slots[i] = i;
+
+    AioFile_t* file = block_aio(device);
+    uint32_t issued = 0, completed = 0, errors = 0, stalled = 0;
+    uint64_t start = clock_now();
+    while (completed < count) {
+        while (issued < count && free_count) {
+            AioSqe_t* sqe = aio_get_sqe(ring);
+            if (!sqe) break; // SQ still holds ones the device didn't take
+            uint32_t slot = free_slots[--free_count];
+            sqe->op = AIO_OP_READ;
+            sqe->file = file;
+            sqe->buffer = buffers + (size_t) slot * PAGE_SIZE;
+            sqe->length = PAGE_SIZE;
+            sqe->offset = (issued % blocks) * PAGE_SIZE;
+            sqe->user_data = slot;
+            issued++;
+        }
+        aio_enter(ring, 1);
+
+        AioCqe_t completions[AIO_READ_DEPTH];
+        int reaped = aio_reap(ring, completions, AIO_READ_DEPTH);
+        for (int i = 0; i < reaped; i++) {
+            if (completions[i].result < 0) errors++;
+            free_slots[free_count++] = (uint32_t) completions[i].user_data;
+        }
+        completed += (uint32_t) reaped;
+
+        // aio_enter doesn't wait with nothing in flight, so don't spin on a device that took nothing
+        if (reaped == 0 && ring->inflight == 0) {
+            if (++stalled == AIO_STALL_MS) {
+                kprintf("Device stopped taking requests after %u pages\n", completed);
+                errors++;
+                break;
+            }
+            thread_sleep_ms(1);
+        } else {
+            stalled = 0;
+        }
+    }
+
+    kprintf("%u pages in %lu us, %u errors\n", completed, (unsigned long) (clock_ticks_to_ns(clock_now() - start) / 1000), errors);
+    print_ring("Ring", ring);
+    aio_ring_destroy(ring);
+    page_free(buffers);
+    return errors ? -1 : 0;
+}
+
+static int command_aio(int argc, char** argv) {
+    if (argc > 3 && strcmp(argv[1], "read") == 0) {
+        BlockDevice_t* device = block_find(argv[2]);
+        if (!device) {
+            kprintf("No device %s\n", argv[2]);
+            return -1;
+        }
+        return aio_read_blocks(device, parse_number(argv[3]));
+    }
+
+    if (input_ring) print_ring("Monitor input", input_ring);
+    return 0;
+}
+
 static int tokenize(char *input, char** argv, int max_args) {
     int argc = 0;
     
@@ -73,13 +505,105 @@ static int tokenize(char *input, char** argv, int max_args) {
     return argc;
 }
 
+#define INPUT_RING_ENTRIES 8
+#define INPUT_READ_SIZE    64
+#define INPUT_READ 1 // user_data
+#define INPUT_ECHO 2
+
+static char input_chunk[INPUT_READ_SIZE];
+static char input_pending[INPUT_READ_SIZE]; // Typed past the end of the last line
+static size_t input_pending_length = 0;
+static char input_echo[INPUT_READ_SIZE * 3]; // "\b \b" is the most a byte echoes
+
+// console_gets on the input ring: the echo for what just came in and the read for what comes
+// next go to the console in one submit, and we only wake when input arrives
+static void monitor_gets(char* input, size_t size) {
+    if (!input_ring) input_ring = aio_ring_create(INPUT_RING_ENTRIES);
+    if (!input_ring || size == 0) {
+        console_gets(input, size);
+        return;
+    }
+
+    size_t length = 0;
+    size_t available = input_pending_length;
+    memcpy(input_chunk, input_pending, input_pending_length);
+    input_pending_length = 0;
+
+    for (;;) {
+        size_t used = 0, echo_length = 0;
+        int done = 0;
+        while (used < available && !done) {
+            char c = input_chunk[used++];
+            if (c == 0x1b) { // Escape character
+                continue; // Ignore for now
+            } else if (c == '\r' || c == '\n') {
+                input_echo[echo_length++] = '\n';
+                done = 1;
+            } else if (c == '\b' || c == 127) { // Backspace or DEL
+                if (length > 0) {
+                    length--;
+                    memcpy(input_echo + echo_length, "\b \b", 3);
+                    echo_length += 3;
+                }
+            } else if (length < size - 1) {
+                input_echo[echo_length++] = c;
+                input[length++] = c;
+            }
+        }
+        if (done) {
+            input_pending_length = available - used;
+            memcpy(input_pending, input_chunk + used, input_pending_length);
+        }
+
+        uint32_t queued = 0;
+        AioSqe_t* sqe;
+        if (echo_length) {
+            sqe = aio_get_sqe(input_ring);
+            sqe->op = AIO_OP_WRITE;
+            sqe->file = console_aio();
+            sqe->buffer = input_echo;
+            sqe->length = (uint32_t) echo_length;
+            sqe->user_data = INPUT_ECHO;
+            queued++;
+        }
+        if (!done) {
+            sqe = aio_get_sqe(input_ring);
+            sqe->op = AIO_OP_READ;
+            sqe->file = console_aio();
+            sqe->buffer = input_chunk;
+            sqe->length = INPUT_READ_SIZE;
+            sqe->user_data = INPUT_READ;
+            queued++;
+        }
+        if (queued) aio_enter(input_ring, queued);
+
+        AioCqe_t completions[INPUT_RING_ENTRIES];
+        int reaped = aio_reap(input_ring, completions, INPUT_RING_ENTRIES);
+        int64_t received = 0;
+        for (int i = 0; i < reaped; i++) {
+            if (completions[i].user_data == INPUT_READ) received = completions[i].result;
+        }
+        if (done) break;
+
+        if (received < 0) { // No reader, finish the line the old way
+            input[length] = '\0';
+            console_gets(input + length, size - length);
+            return;
+        }
+        available = (size_t) received;
+    }
+
+    input[length] = '\0';
+}
+
 void kernel_monitor() {
     char input[MAX_INPUT_LENGTH];
     char* argv[MAX_COMMAND_ARGS];
 
     while (1) {
+        klog_drain(); // We're about to sit waiting on a human, good time to catch up on the log
         kprintf("tetos> ");
-        uart_gets(input, sizeof(input));
+        monitor_gets(input, sizeof(input));
 
         // Tokenize input
         int argc = tokenize(input, argv, MAX_COMMAND_ARGS);
@@ -1,10 +1,14 @@
 #include <panic.h>
 
 void _panic(const char* msg, const char* file, int line, const char* func) {
+    console_panic(); // Whoever had the console isn't getting it back, output is polled from here on
     kprintf("\n*** KERNEL PANIC ***\n");
     kprintf("Message: %s\n", msg);
     kprintf("Location: %s:%d\n", file, line);
     kprintf("Function: %s\n", func);
 
+    kprintf("\n--- Recent kernel log ---\n");
+    klog_replay();
+
     sbi_system_shutdown(); // We can do this now!
 }
\ No newline at end of file
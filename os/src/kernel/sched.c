@@ -0,0 +1,526 @@
+#include <sched.h>
+#include <slab.h>
+#include <page_alloc.h>
+#include <mini_lib.h>
+#include <panic.h>
+#include <klog.h>
+#include <sbi.h>
+#include <trap.h>
+#include <tlb.h>
+
+void context_switch(ThreadContext_t* from, ThreadContext_t* to);
+void thread_trampoline(void);
+
+_Static_assert(offsetof(Thread_t, context) == 0, "switch.s takes the thread as its context");
+_Static_assert(offsetof(ThreadContext_t, s) == 16, "switch.s CONTEXT_S0 is out of sync");
+
+// top and bottom sit on their own lines: thieves hammer top, only the owner writes bottom
+typedef struct {
+    volatile uint64_t top __attribute__((aligned(64)));
+    volatile uint64_t bottom __attribute__((aligned(64)));
+    Thread_t* volatile slots[RUNQUEUE_SIZE];
+    Thread_t* volatile inbox;  // Wakeups from other harts, pushed with a CAS, taken all at once
+    Thread_t idle;             // Wraps the hart's boot context
+    Thread_t* previous;        // Thread we just switched away from, finish_switch tidies it up
+    uint64_t switch_start;
+    Timer_t slice;
+    volatile uint32_t ready;
+    SchedStats_t stats;
+} __attribute__((aligned(64))) RunQueue_t;
+
+static RunQueue_t runqueues[MAX_HARTS];
+
+static SlabCache_t* thread_cache = NULL;
+static Thread_t* all_threads = NULL;
+static spinlock_t threads_lock = SPINLOCK_INIT;
+static volatile uint32_t next_thread_id = 1;
+static uint64_t slice_ticks = 0;
+static volatile uint32_t idle_mask = 0; // Harts asleep in wfi, by cpu index
+static int have_ipi = 0;
+
+static const char* const state_names[] = { "runnable", "running", "blocked", "dead" };
+
+// ---- Run queue ----
+
+// Owner only, interrupts off
+static int runqueue_push(RunQueue_t* queue, Thread_t* thread) {
+    uint64_t bottom = queue->bottom;
+    uint64_t top = atomic_load_acquire64(&queue->top);
+    if (bottom - top >= RUNQUEUE_SIZE) return -1;
+
+    queue->slots[bottom & (RUNQUEUE_SIZE - 1)] = thread;
+    atomic_store_release64(&queue->bottom, bottom + 1); // Slot is visible before the thread is
+    return 0;
+}
+
+// Anyone: owner picking its next thread or a thief. top only grows, so the CAS can't suffer ABA
+static Thread_t* runqueue_take(RunQueue_t* queue, int* raced) {
+    while (1) {
+        uint64_t top = atomic_load_acquire64(&queue->top);
+        atomic_fence();
+        uint64_t bottom = atomic_load_acquire64(&queue->bottom);
+        if (top >= bottom) return NULL;
+
+        Thread_t* thread = queue->slots[top & (RUNQUEUE_SIZE - 1)];
+        if (atomic_cas64(&queue->top, top, top + 1) == top) return thread;
+        if (raced) (*raced)++;
+    }
+}
+
+static void inbox_push(RunQueue_t* queue, Thread_t* thread) {
+    Thread_t* head;
+    do {
+        head = queue->inbox;
+        thread->inbox_next = head;
+    } while (atomic_cas_pointer((void* volatile*) &queue->inbox, head, thread) != head);
+}
+
+// Inbox is a stack, so reverse it to keep wakeups in the order they came
+static void inbox_drain(RunQueue_t* queue) {
+    if (!queue->inbox) return;
+    Thread_t* list = (Thread_t*) atomic_swap_pointer((void* volatile*) &queue->inbox, NULL);
+
+    Thread_t* reversed = NULL;
+    while (list) {
+        Thread_t* next = list->inbox_next;
+        list->inbox_next = reversed;
+        reversed = list;
+        list = next;
+    }
+
+    while (reversed) {
+        Thread_t* next = reversed->inbox_next;
+        if (runqueue_push(queue, reversed) != 0) panic("sched: run queue full");
+        reversed = next;
+    }
+}
+
+static Thread_t* steal(unsigned int self, SchedStats_t* stats) {
+    unsigned int count = cpu_count();
+    for (unsigned int i = 1; i < count; i++) {
+        RunQueue_t* victim = &runqueues[(self + i) % count];
+        if (!victim->ready) continue;
+
+        int raced = 0;
+        Thread_t* thread = runqueue_take(victim, &raced);
+        stats->steal_races += (uint64_t) raced;
+        if (thread) {
+            stats->steals++;
+            return thread;
+        }
+    }
+    return NULL;
+}
+
+// ---- Idle harts ----
+
+static void send_ipi(unsigned int cpu) {
+    if (have_ipi) sbi_send_ipi(1, cpus[cpu].hart_id);
+}
+
+// New work on our queue: wake one sleeping hart so it can come and steal it
+static void kick_idle(unsigned int self) {
+    atomic_fence(); // The push is visible before we look at who's asleep, see idle_loop
+    uint32_t mask = atomic_load_acquire32(&idle_mask) & ~(1u << self);
+    if (!mask) return;
+
+    unsigned int cpu = 0;
+    while (!(mask & (1u << cpu))) cpu++;
+    send_ipi(cpu);
+}
+
+// Anything for this hart to run or steal? Only reads, no CAS
+static int work_visible(unsigned int self) {
+    if (runqueues[self].inbox) return 1;
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        RunQueue_t* queue = &runqueues[i];
+        if (queue->ready && atomic_load_acquire64(&queue->top) < atomic_load_acquire64(&queue->bottom)) return 1;
+    }
+    return 0;
+}
+
+// IPI: gets us out of wfi and through schedule, or it's a TLB shootdown without RFENCE
+static void ipi_handler(TrapFrame_t* frame) {
+    (void) frame;
+    csr_clear(sip, 1ull << IRQ_S_SOFT);
+    tlb_ipi();
+    this_cpu()->need_resched = 1;
+}
+
+// ---- Switching ----
+
+// Runs on the new thread's stack right after every switch, including a new thread's first one
+static void finish_switch(void) {
+    PerCpu_t* cpu = this_cpu();
+    RunQueue_t* queue = &runqueues[cpu->index];
+    Thread_t* previous = queue->previous;
+    Thread_t* current = cpu->current;
+
+    uint64_t cycles = rdcycle() - queue->switch_start;
+    queue->stats.switches++;
+    queue->stats.switch_cycles += cycles;
+    if (cycles > queue->stats.worst_switch) queue->stats.worst_switch = cycles;
+
+    uint32_t dead = previous->state == THREAD_DEAD;
+    atomic_store_release32(&previous->on_cpu, 0); // Its registers are saved, others may run it now
+    if (dead) {
+        uint64_t flags = spin_lock_irqsave(&threads_lock);
+        if (previous->all_prev) {
+            previous->all_prev->all_next = previous->all_next;
+        } else {
+            all_threads = previous->all_next;
+        }
+        if (previous->all_next) previous->all_next->all_prev = previous->all_prev;
+        spin_unlock_irqrestore(&threads_lock, flags);
+
+        page_free(previous->stack);
+        slab_free(thread_cache, previous);
+    }
+
+    // Only real threads get a slice, an idle hart has no timer ticking at all
+    if (current->flags & THREAD_IDLE) {
+        timer_cancel(&queue->slice);
+    } else {
+        timer_arm_after(&queue->slice, slice_ticks);
+    }
+}
+
+// Call with interrupts off. Returns once this thread is picked again (straight away if nothing
+// else wants the hart). preempted only matters for the stats.
+static void schedule(int preempted) {
+    PerCpu_t* cpu = this_cpu();
+    RunQueue_t* queue = &runqueues[cpu->index];
+    Thread_t* previous = cpu->current;
+    uint64_t start = rdcycle();
+
+    cpu->need_resched = 0;
+    inbox_drain(queue);
+
+    // Still runnable: back of our own queue. Blocked or dead threads stay off every queue
+    if (previous->state == THREAD_RUNNING && !(previous->flags & THREAD_IDLE)) {
+        previous->state = THREAD_RUNNABLE;
+        if (runqueue_push(queue, previous) != 0) panic("sched: run queue full");
+    }
+
+    Thread_t* next = runqueue_take(queue, NULL);
+    if (!next) next = steal(cpu->index, &queue->stats);
+    if (!next) next = &queue->idle;
+
+    if (next == previous) {
+        previous->state = THREAD_RUNNING;
+        // Nobody else wanted the hart, but someone may turn up later: keep a slice running
+        if (!(previous->flags & THREAD_IDLE) && !timer_pending(&queue->slice)) {
+            timer_arm_after(&queue->slice, slice_ticks);
+        }
+        return;
+    }
+
+    // A thread just woken or stolen may still be on its way out of another hart's context_switch
+    while (atomic_load_acquire32(&next->on_cpu)) cpu_relax();
+
+    uint64_t now = rdtime();
+    previous->runtime += now - previous->last_start;
+    if (previous->flags & THREAD_IDLE) queue->stats.idle_ticks += now - previous->last_start;
+    next->last_start = now;
+    next->on_cpu = 1;
+    next->state = THREAD_RUNNING;
+    next->cpu = cpu->index;
+    next->switches++;
+
+    if (preempted && !(previous->flags & THREAD_IDLE)) queue->stats.preemptions++;
+    cpu->current = next;
+    queue->previous = previous;
+    queue->switch_start = start;
+    context_switch(&previous->context, &next->context);
+
+    // Back, possibly on another hart
+    finish_switch();
+}
+
+void sched_thread_start(void) {
+    finish_switch();
+    csr_set(sstatus, SSTATUS_SIE);
+}
+
+// ---- Preemption ----
+
+// The slice only asks, the switch happens on the way out of the interrupt
+static void slice_expired(Timer_t* timer) {
+    (void) timer;
+    this_cpu()->need_resched = 1;
+}
+
+void sched_irq_exit(void) {
+    PerCpu_t* cpu = this_cpu();
+    if (!cpu->need_resched || !cpu->current) return;
+    if (cpu->preempt_count) {
+        // Can't switch now, ask again after another slice
+        timer_arm_after(&runqueues[cpu->index].slice, slice_ticks);
+        return;
+    }
+
+    schedule(1);
+}
+
+// ---- Threads ----
+
+static void thread_link(Thread_t* thread) {
+    uint64_t flags = spin_lock_irqsave(&threads_lock);
+    thread->all_prev = NULL;
+    thread->all_next = all_threads;
+    if (all_threads) all_threads->all_prev = thread;
+    all_threads = thread;
+    spin_unlock_irqrestore(&threads_lock, flags);
+}
+
+static void thread_name(Thread_t* thread, const char* name) {
+    size_t length = strlen(name);
+    if (length >= THREAD_NAME_LENGTH) length = THREAD_NAME_LENGTH - 1;
+    memcpy(thread->name, name, length);
+    thread->name[length] = '\0';
+}
+
+Thread_t* thread_create(const char* name, thread_function_t function, void* arg) {
+    Thread_t* thread = (Thread_t*) slab_alloc(thread_cache);
+    if (!thread) return NULL;
+    memset(thread, 0, sizeof(*thread));
+
+    thread->stack = page_alloc(THREAD_STACK_ORDER);
+    if (!thread->stack) {
+        slab_free(thread_cache, thread);
+        return NULL;
+    }
+
+    thread->context.ra = (uintptr_t) thread_trampoline;
+    thread->context.sp = (uintptr_t) thread->stack + THREAD_STACK_SIZE;
+    thread->context.s[0] = (uintptr_t) function;
+    thread->context.s[1] = (uintptr_t) arg;
+    thread->id = atomic_fetch_add32(&next_thread_id, 1);
+    thread->state = THREAD_RUNNABLE;
+    thread_name(thread, name);
+    thread_link(thread);
+
+    // Starts on the creating hart, idle harts will steal it if this one is busy
+    uint64_t flags = irq_save();
+    thread->cpu = cpu_index();
+    if (runqueue_push(&runqueues[thread->cpu], thread) != 0) panic("sched: run queue full");
+    kick_idle(thread->cpu);
+    irq_restore(flags);
+    return thread;
+}
+
+void thread_exit(void) {
+    irq_save();
+    thread_current()->state = THREAD_DEAD;
+    schedule(0);
+    panic("thread_exit: dead thread was scheduled");
+    while (1);
+}
+
+void thread_yield(void) {
+    uint64_t flags = irq_save();
+    schedule(0);
+    irq_restore(flags);
+}
+
+void thread_block(void) {
+    uint64_t flags = irq_save();
+    schedule(0);
+    irq_restore(flags);
+}
+
+int thread_wake(Thread_t* thread) {
+    if (atomic_cas32(&thread->state, THREAD_BLOCKED, THREAD_RUNNABLE) != THREAD_BLOCKED) return 0;
+
+    uint64_t flags = irq_save();
+    PerCpu_t* cpu = this_cpu();
+    if (thread->cpu == cpu->index) {
+        if (runqueue_push(&runqueues[cpu->index], thread) != 0) panic("sched: run queue full");
+        if (cpu->current && (cpu->current->flags & THREAD_IDLE)) {
+            cpu->need_resched = 1;
+        } else {
+            kick_idle(cpu->index);
+        }
+    } else {
+        // Its own hart drains the inbox next time it schedules, now if it's asleep
+        unsigned int target = thread->cpu;
+        inbox_push(&runqueues[target], thread);
+        atomic_fence();
+        if (atomic_load_acquire32(&idle_mask) & (1u << target)) send_ipi(target);
+    }
+    irq_restore(flags);
+    return 1;
+}
+
+static void sleep_expired(Timer_t* timer) {
+    thread_wake((Thread_t*) timer->data);
+}
+
+void thread_sleep_ms(uint64_t ms) {
+    Timer_t timer;
+    uint64_t flags = irq_save(); // The timer can't fire on this hart before we're off it
+    Thread_t* self = thread_current();
+    timer_setup(&timer, sleep_expired, self);
+    self->state = THREAD_BLOCKED;
+    timer_arm_after(&timer, clock_ms_to_ticks(ms));
+    schedule(0);
+    irq_restore(flags);
+    timer_cancel(&timer); // Woken by someone else first, the timer lives on our stack
+}
+
+// ---- Wait queues ----
+
+void wait_prepare(WaitQueue_t* queue) {
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    Thread_t* self = thread_current();
+    self->state = THREAD_BLOCKED;
+    self->waiting_on = queue;
+    self->wait_next = NULL;
+    if (queue->tail) {
+        queue->tail->wait_next = self;
+    } else {
+        queue->head = self;
+    }
+    queue->tail = self;
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+void wait_finish(WaitQueue_t* queue) {
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    Thread_t* self = thread_current();
+    if (self->waiting_on == queue) {
+        // Never blocked (condition was already true) or woken by someone other than wake_up
+        Thread_t* previous = NULL;
+        for (Thread_t* thread = queue->head; thread && thread != self; thread = thread->wait_next) previous = thread;
+        if (previous) {
+            previous->wait_next = self->wait_next;
+        } else {
+            queue->head = self->wait_next;
+        }
+        if (queue->tail == self) queue->tail = previous;
+        self->waiting_on = NULL;
+    }
+    int woken = atomic_cas32(&self->state, THREAD_BLOCKED, THREAD_RUNNING) != THREAD_BLOCKED;
+    spin_unlock_irqrestore(&queue->lock, flags);
+
+    // Still RUNNABLE means a wake queued us while we were running, give that entry its turn
+    // before anything could queue us a second time
+    if (woken && self->state == THREAD_RUNNABLE) thread_block();
+}
+
+int wake_up(WaitQueue_t* queue, int count) {
+    int woken = 0;
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    while (queue->head && woken < count) {
+        Thread_t* thread = queue->head;
+        queue->head = thread->wait_next;
+        if (!queue->head) queue->tail = NULL;
+        thread->wait_next = NULL;
+        thread->waiting_on = NULL;
+        woken += thread_wake(thread);
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+    return woken;
+}
+
+// ---- Setup ----
+
+void sched_init(void) {
+    thread_cache = slab_cache_create("thread", sizeof(Thread_t), 64, 0);
+    if (!thread_cache) {
+        panic("sched_init: can't create thread cache");
+        return;
+    }
+    slice_ticks = clock_ms_to_ticks(SCHED_SLICE_MS);
+    lock_stats_register("threads", &threads_lock.stats);
+
+    have_ipi = sbi_probe_extension(SBI_EID_IPI) != 0;
+    trap_register_interrupt(IRQ_S_SOFT, ipi_handler);
+    if (!have_ipi) klog("sched: no SBI IPI, sleeping harts only wake for their own interrupts\n");
+}
+
+// Idle: look for work (ours, the inbox, then other harts'), otherwise wfi until an interrupt.
+// We publish ourselves in idle_mask before the last look, and whoever queues work publishes it
+// before reading the mask, so one of us always sees the other: no wakeup gets lost.
+static void idle_loop(void) {
+    uint32_t self = cpu_index();
+    while (1) {
+        klog_drain();
+
+        uint64_t flags = irq_save();
+        schedule(0);
+
+        atomic_fetch_or32(&idle_mask, 1u << self);
+        if (!work_visible(self) && !this_cpu()->need_resched) {
+            uint64_t start = rdtime();
+            wfi(); // Interrupts are off but a pending one still ends it, we take it below
+            runqueues[self].stats.wfi_ticks += rdtime() - start;
+        }
+        atomic_fetch_and32(&idle_mask, ~(1u << self));
+        tlb_idle_exit(); // Flushes we slept through
+        irq_restore(flags);
+    }
+}
+
+void sched_start(void) {
+    uint64_t flags = irq_save();
+    PerCpu_t* cpu = this_cpu();
+    RunQueue_t* queue = &runqueues[cpu->index];
+
+    Thread_t* idle = &queue->idle;
+    memset(idle, 0, sizeof(*idle));
+    char name[THREAD_NAME_LENGTH] = "idle/";
+    name[5] = (char) ('0' + cpu->index % 10);
+    thread_name(idle, name);
+    idle->flags = THREAD_IDLE;
+    idle->state = THREAD_RUNNING;
+    idle->on_cpu = 1;
+    idle->cpu = cpu->index;
+    idle->last_start = rdtime();
+    thread_link(idle);
+
+    timer_setup(&queue->slice, slice_expired, NULL);
+    cpu->current = idle;
+    atomic_store_release32(&queue->ready, 1);
+    irq_restore(flags);
+
+    trap_enable_interrupt(IRQ_S_SOFT);
+    csr_set(sstatus, SSTATUS_SIE);
+    idle_loop();
+    while (1);
+}
+
+// ---- Stats ----
+
+uint32_t sched_idle_mask(void) {
+    return atomic_load_acquire32(&idle_mask);
+}
+
+void sched_stats(unsigned int cpu, SchedStats_t* output) {
+    if (cpu >= MAX_HARTS) {
+        memset(output, 0, sizeof(*output));
+        return;
+    }
+    *output = runqueues[cpu].stats;
+}
+
+int thread_list(ThreadInfo_t* output, int max) {
+    int count = 0;
+    uint64_t flags = spin_lock_irqsave(&threads_lock);
+    for (Thread_t* thread = all_threads; thread && count < max; thread = thread->all_next) {
+        ThreadInfo_t* info = &output[count++];
+        info->id = thread->id;
+        info->cpu = thread->cpu;
+        info->state = thread->state;
+        info->flags = thread->flags;
+        info->switches = thread->switches;
+        info->runtime = thread->runtime;
+        memcpy(info->name, thread->name, THREAD_NAME_LENGTH);
+    }
+    spin_unlock_irqrestore(&threads_lock, flags);
+    return count;
+}
+
+const char* thread_state_name(uint32_t state) {
+    return state < sizeof(state_names) / sizeof(state_names[0]) ? state_names[state] : "?";
+}
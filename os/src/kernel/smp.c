@@ -0,0 +1,114 @@
+#include <percpu.h>
+#include <fdt_index.h>
+#include <sbi.h>
+#include <isa.h>
+#include <klog.h>
+#include <trap.h>
+#include <timer.h>
+#include <sched.h>
+#include <plic.h>
+#include <vm.h>
+
+PerCpu_t cpus[MAX_HARTS];
+static unsigned int cpu_total = 1;
+static volatile uint32_t online_count = 1;
+
+extern char __stacks_start[];
+extern char _start_secondary[];
+
+_Static_assert(offsetof(PerCpu_t, index) == 0, "cpu_index() loads the index from 0(tp)");
+_Static_assert(offsetof(PerCpu_t, stack_top) == 8, "start.s PERCPU_STACK_TOP is out of sync");
+_Static_assert(MAX_HARTS * KERNEL_STACK_SIZE == 8 * 0x4000, "linker.ld .stack size is out of sync");
+_Static_assert(KERNEL_STACK_SIZE == 0x4000, "linker.ld __stack_top is out of sync");
+
+#define SMP_START_TIMEOUT_MS 100 // For every hart to report in
+
+static uintptr_t stack_top_for(unsigned int index) {
+    return (uintptr_t) __stacks_start + (uintptr_t) (index + 1) * KERNEL_STACK_SIZE;
+}
+
+void smp_init(uint64_t boot_hart_id) {
+    PerCpu_t* cpu = &cpus[0];
+    cpu->index = 0;
+    cpu->hart_id = boot_hart_id;
+    cpu->stack_top = stack_top_for(0);
+    cpu->started_at = rdtime();
+    cpu->online = 1;
+}
+
+// Secondary harts land here from _start_secondary with sp and tp set up
+void secondary_entry(uint64_t hart_id, PerCpu_t* cpu) {
+    vm_init_local(); // Identity mapped, so nothing moves under us
+    isa_enable_local();
+    trap_init_local();
+    timer_init_local();
+    plic_init_local(); // Takes its share of device interrupts once plic_balance runs
+    cpu->started_at = rdtime();
+    __atomic_store_n(&cpu->online, 1u, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&online_count, 1u, __ATOMIC_RELAXED);
+    klog("smp: cpu %u (hart %lu) alive\n", cpu->index, (unsigned long) hart_id);
+
+    sched_start(); // Becomes this hart's idle thread, steals work from the others
+}
+
+static int cpu_node_enabled(const FDTNode_t* node) {
+    const char* status = fdt_prop_string(fdt_node_prop(node, "status"));
+    return !status || strcmp(status, "okay") == 0 || strcmp(status, "ok") == 0;
+}
+
+int smp_boot_secondaries(void) {
+    if (!sbi_probe_extension(SBI_EID_HSM)) {
+        klog("smp: firmware has no HSM, staying on one hart\n");
+        return 1;
+    }
+
+    // Hand out logical indices in /cpus order and start everyone before waiting on anyone
+    const FDTNode_t* node_cpus = fdt_find_path("/cpus");
+    for (const FDTNode_t* node = node_cpus ? node_cpus->child : NULL; node; node = node->sibling) {
+        FDTRegRegion_t reg;
+        if (!fdt_node_is(node, "cpu") || !cpu_node_enabled(node)) continue;
+        if (fdt_node_reg(node, &reg, 1) != 1 || reg.base == cpus[0].hart_id) continue;
+
+        if (cpu_total >= MAX_HARTS) {
+            klog("smp: more than %u harts, ignoring hart %lu\n", MAX_HARTS, (unsigned long) reg.base);
+            continue;
+        }
+
+        if (sbi_hart_get_status(reg.base) != SBI_HSM_STOPPED) continue; // Not ours to start
+
+        PerCpu_t* cpu = &cpus[cpu_total];
+        cpu->index = cpu_total;
+        cpu->hart_id = reg.base;
+        cpu->stack_top = stack_top_for(cpu_total);
+        cpu->online = 0;
+        __atomic_thread_fence(__ATOMIC_RELEASE); // The hart reads its entry as soon as it starts
+
+        long error = sbi_hart_start(reg.base, (uintptr_t) _start_secondary, (uintptr_t) cpu);
+        if (error) {
+            klog("smp: hart %lu failed to start (%ld)\n", (unsigned long) reg.base, error);
+            continue;
+        }
+        cpu_total++;
+    }
+
+    uint64_t deadline = rdtime() + clock_ms_to_ticks(SMP_START_TIMEOUT_MS);
+    while (__atomic_load_n(&online_count, __ATOMIC_ACQUIRE) < cpu_total && rdtime() < deadline) {
+        cpu_relax();
+    }
+
+    for (unsigned int i = 1; i < cpu_total; i++) {
+        if (!__atomic_load_n(&cpus[i].online, __ATOMIC_ACQUIRE)) {
+            klog("smp: cpu %u (hart %lu) never reported in\n", i, (unsigned long) cpus[i].hart_id);
+        }
+    }
+
+    return (int) online_count;
+}
+
+unsigned int cpu_count(void) {
+    return cpu_total;
+}
+
+unsigned int cpu_online_count(void) {
+    return online_count;
+}
@@ -0,0 +1,132 @@
+#include <sync.h>
+#include <percpu.h>
+
+typedef struct {
+    const char* name;
+    const LockStats_t* stats;
+} LockStatsEntry_t;
+
+static LockStatsEntry_t registered[LOCK_STATS_MAX];
+static volatile uint32_t registered_count = 0;
+
+void lock_stats_register(const char* name, const LockStats_t* stats) {
+    uint32_t index = atomic_fetch_add32(&registered_count, 1);
+    if (index >= LOCK_STATS_MAX) {
+        registered_count = LOCK_STATS_MAX;
+        return; // Table full, the lock still works, we just can't show it
+    }
+    registered[index].name = name;
+    registered[index].stats = stats;
+}
+
+int lock_stats_count(void) {
+    return (int) registered_count;
+}
+
+// Snapshot of one entry; racy against the holder but every field is a single word
+const char* lock_stats_get(int index, LockStats_t* output) {
+    if (index < 0 || index >= (int) registered_count) return NULL;
+    *output = *registered[index].stats;
+    return registered[index].name;
+}
+
+// MCS: swap ourselves in as the tail, then spin on our own node until the previous holder hands over
+void mcs_lock(mcs_lock_t* lock, McsNode_t* node) {
+    node->next = NULL;
+    node->locked = 1;
+
+    McsNode_t* previous = atomic_swap_pointer((void* volatile*) &lock->tail, node);
+    uint64_t waited = 0;
+    if (previous) {
+        uint64_t start = rdcycle();
+        previous->next = node;
+        while (atomic_load_acquire32(&node->locked)) cpu_relax();
+        waited = rdcycle() - start;
+        if (waited == 0) waited = 1;
+    }
+    lock_stats_record(&lock->stats, waited);
+}
+
+void mcs_unlock(mcs_lock_t* lock, McsNode_t* node) {
+    if (!node->next) {
+        // Nobody visible behind us, try to swing tail back to empty
+        if (atomic_cas_pointer((void* volatile*) &lock->tail, node, NULL) == node) return;
+        while (!node->next) cpu_relax(); // Someone swapped in but hasn't linked up yet
+    }
+    atomic_store_release32(&node->next->locked, 0);
+}
+
+void read_lock(rwlock_t* lock) {
+    while (1) {
+        uint32_t state = atomic_load_acquire32(&lock->state);
+        if (!(state & (RWLOCK_WRITER | RWLOCK_WAITING))) {
+            if (atomic_cas32(&lock->state, state, state + 1) == state) return;
+            continue;
+        }
+        cpu_relax();
+    }
+}
+
+void read_unlock(rwlock_t* lock) {
+    atomic_fetch_add32(&lock->state, (uint32_t) -1);
+}
+
+void write_lock(rwlock_t* lock) {
+    uint64_t start = 0;
+    while (1) {
+        uint32_t state = atomic_load_acquire32(&lock->state);
+        if ((state & ~RWLOCK_WAITING) == 0) {
+            // Free: take it, and WAITING goes with it (another queued writer sets it again)
+            if (atomic_cas32(&lock->state, state, RWLOCK_WRITER) == state) break;
+            continue;
+        }
+        if (!start) start = rdcycle();
+        if (!(state & RWLOCK_WAITING)) atomic_fetch_or32(&lock->state, RWLOCK_WAITING);
+        cpu_relax();
+    }
+    lock_stats_record(&lock->stats, start ? (rdcycle() - start) | 1 : 0);
+}
+
+void write_unlock(rwlock_t* lock) {
+    atomic_fetch_and32(&lock->state, ~RWLOCK_WRITER); // Keeps WAITING for the next writer
+}
+
+void rlock_acquire(rlock_t* lock) {
+    uint64_t flags = irq_save();
+    uint32_t self = cpu_index();
+
+    // Only we ever store our own index, so seeing it means we already hold the lock
+    if (lock->owner == self) {
+        lock->depth++;
+        return;
+    }
+
+    spin_lock(&lock->lock);
+    lock->owner = self;
+    lock->depth = 1;
+    lock->flags = flags;
+}
+
+void rlock_release(rlock_t* lock) {
+    if (--lock->depth > 0) return;
+
+    uint64_t flags = lock->flags;
+    lock->owner = RLOCK_NO_OWNER;
+    spin_unlock(&lock->lock);
+    irq_restore(flags);
+}
+
+// The holder may be dead or spinning on something we'll never release, make the lock ours
+void rlock_force(rlock_t* lock) {
+    uint64_t flags = irq_save();
+    uint32_t self = cpu_index();
+    if (lock->owner == self) {
+        lock->depth++;
+        return;
+    }
+
+    spin_trylock(&lock->lock); // If someone holds it we just carry on as if we did
+    lock->owner = self;
+    lock->depth = 1;
+    lock->flags = flags;
+}
@@ -0,0 +1,362 @@
+#include <timer.h>
+#include <percpu.h>
+#include <fdt_index.h>
+#include <trap.h>
+#include <isa.h>
+#include <sbi.h>
+#include <klog.h>
+#include <mini_lib.h>
+
+static uint64_t timebase_hz = TIMEBASE_DEFAULT_HZ;
+static uint64_t ns_mult = 0; // ns = (ticks * ns_mult) >> 32
+
+// A granule is 2^granule_shift ticks, picked so it's about 4 us whatever the timebase
+static unsigned int granule_shift = 0;
+
+static TimerWheel_t wheels[MAX_HARTS];
+
+// ---- Clock ----
+
+void clock_init(void) {
+    const FDTProp_t* prop = fdt_node_prop(fdt_find_path("/cpus"), "timebase-frequency");
+    if (prop && prop->length == 8) {
+        timebase_hz = read_be64(prop->value);
+    } else if (prop && prop->length == 4) {
+        timebase_hz = read_be32(prop->value);
+    }
+    if (timebase_hz == 0) timebase_hz = TIMEBASE_DEFAULT_HZ;
+
+    ns_mult = (1000000000ull << 32) / timebase_hz;
+
+    granule_shift = 0;
+    while ((timebase_hz >> (granule_shift + 1)) >= 250000u) granule_shift++;
+}
+
+uint64_t clock_hz(void) {
+    return timebase_hz;
+}
+
+uint64_t clock_ticks_to_ns(uint64_t ticks) {
+    return (uint64_t) (((unsigned __int128) ticks * ns_mult) >> 32);
+}
+
+uint64_t clock_us_to_ticks(uint64_t us) {
+    return (uint64_t) (((unsigned __int128) us * timebase_hz) / 1000000u);
+}
+
+uint64_t clock_ms_to_ticks(uint64_t ms) {
+    return (uint64_t) (((unsigned __int128) ms * timebase_hz) / 1000u);
+}
+
+static void clock_program(uint64_t deadline) {
+    if (isa_has(ISA_EXT_SSTC)) {
+        csr_write(0x14d, deadline); // stimecmp, older assemblers don't know the name
+    } else {
+        sbi_set_timer(deadline);
+    }
+}
+
+// ---- Bit helpers (no Zbb to lean on, and no libgcc for __builtin_ctz) ----
+
+static unsigned int ctz64(uint64_t value) {
+    static const uint8_t table[64] = {
+         0,  1, 56,  2, 57, 49, 28,  3, 61, 58, 42, 50, 38, 29, 17,  4,
+        62, 47, 59, 36, 45, 43, 51, 22, 53, 39, 33, 30, 24, 18, 12,  5,
+        63, 55, 48, 27, 60, 41, 37, 16, 46, 35, 44, 21, 52, 32, 23, 11,
+        54, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6,
+    };
+    return table[((value & -value) * 0x03f79d71b4ca8b09ull) >> 58]; // De Bruijn, value != 0
+}
+
+// First set bit at or after from in bits [0, count) of bitmap, or -1
+static int next_set(const uint64_t* bitmap, unsigned int from, unsigned int count) {
+    while (from < count) {
+        uint64_t word = bitmap[from / 64] >> (from % 64);
+        if (word) return (int) (from + ctz64(word));
+        from = (from | 63u) + 1;
+    }
+    return -1;
+}
+
+// ---- Wheel ----
+
+static const unsigned int level_shift[TIMER_LEVELS] = { 0, 8, 14, 20, 26 };
+static const unsigned int level_base[TIMER_LEVELS] = { 0, 256, 320, 384, 448 };
+
+static inline unsigned int level_bits(unsigned int level) {
+    return level ? TIMER_LN_BITS : TIMER_L0_BITS;
+}
+
+static uint64_t granule_of(uint64_t ticks) {
+    uint64_t round = (1ull << granule_shift) - 1;
+    if (ticks > UINT64_MAX - round) return UINT64_MAX >> granule_shift;
+    return (ticks + round) >> granule_shift; // Round up, never fire early
+}
+
+static unsigned int slot_for(const TimerWheel_t* wheel, uint64_t granule) {
+    if (granule < wheel->now) granule = wheel->now; // Already due, next processed granule takes it
+    uint64_t delta = granule - wheel->now;
+    if (delta >= (1ull << TIMER_RANGE_BITS)) {
+        granule = wheel->now + (1ull << TIMER_RANGE_BITS) - 1; // Park it at the far end, it cascades again
+        delta = granule - wheel->now;
+    }
+
+    unsigned int level = 0;
+    while (level + 1 < TIMER_LEVELS && delta >= (1ull << level_shift[level + 1])) level++;
+    unsigned int mask = (1u << level_bits(level)) - 1;
+    return level_base[level] + ((granule >> level_shift[level]) & mask);
+}
+
+static void slot_insert(TimerWheel_t* wheel, Timer_t* timer) {
+    unsigned int slot = slot_for(wheel, granule_of(timer->expires));
+    timer->prev = NULL;
+    timer->next = wheel->slots[slot];
+    if (timer->next) timer->next->prev = timer;
+    wheel->slots[slot] = timer;
+    wheel->bitmap[slot / 64] |= 1ull << (slot % 64);
+    timer->slot = (uint16_t) slot;
+    timer->wheel = wheel;
+}
+
+static void slot_remove(TimerWheel_t* wheel, Timer_t* timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else if (timer->slot == TIMER_SLOT_EXPIRED) {
+        wheel->expired = timer->next;
+    } else {
+        unsigned int slot = timer->slot;
+        wheel->slots[slot] = timer->next;
+        if (!timer->next) wheel->bitmap[slot / 64] &= ~(1ull << (slot % 64));
+    }
+    if (timer->next) timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    __atomic_store_n(&timer->wheel, NULL, __ATOMIC_RELEASE); // Publishes wheel->running along with it
+}
+
+static Timer_t* slot_take(TimerWheel_t* wheel, unsigned int slot) {
+    Timer_t* list = wheel->slots[slot];
+    wheel->slots[slot] = NULL;
+    wheel->bitmap[slot / 64] &= ~(1ull << (slot % 64));
+    return list;
+}
+
+// Earliest granule >= now where a level 0 slot expires or a higher slot cascades, UINT64_MAX if idle
+static uint64_t next_event(const TimerWheel_t* wheel) {
+    uint64_t best = UINT64_MAX;
+
+    for (unsigned int level = 0; level < TIMER_LEVELS; level++) {
+        unsigned int bits = level_bits(level);
+        unsigned int slots = 1u << bits;
+        unsigned int shift = level_shift[level];
+        const uint64_t* bitmap = &wheel->bitmap[level_base[level] / 64];
+
+        uint64_t rotation = (uint64_t) slots << shift;
+        uint64_t base = wheel->now & ~(rotation - 1);
+        unsigned int current = (unsigned int) ((wheel->now >> shift) & (slots - 1));
+
+        int slot = next_set(bitmap, current, slots);
+        uint64_t when = UINT64_MAX;
+        if (slot >= 0) {
+            when = base | ((uint64_t) slot << shift);
+            if (when < wheel->now) { // Current slot but we're past its start, that's next rotation
+                int later = next_set(bitmap, current + 1, slots);
+                when = (later >= 0) ? (base | ((uint64_t) later << shift)) : UINT64_MAX;
+                slot = later;
+            }
+        }
+        if (slot < 0) {
+            int wrapped = next_set(bitmap, 0, current + 1);
+            if (wrapped >= 0) when = base + rotation + ((uint64_t) wrapped << shift);
+        }
+
+        if (when < best) best = when;
+    }
+
+    return best;
+}
+
+static void cascade(TimerWheel_t* wheel, unsigned int level, unsigned int index) {
+    Timer_t* timer = slot_take(wheel, level_base[level] + index);
+    while (timer) {
+        Timer_t* next = timer->next;
+        slot_insert(wheel, timer);
+        wheel->cascaded++;
+        timer = next;
+    }
+}
+
+// Process every granule up to and including target, expired timers go on wheel->expired
+static void wheel_advance(TimerWheel_t* wheel, uint64_t target) {
+    while (wheel->now <= target) {
+        uint64_t next = next_event(wheel);
+        if (next > target) {
+            wheel->now = target + 1;
+            break;
+        }
+        wheel->now = next; // Everything in between is empty
+
+        unsigned int index = (unsigned int) (wheel->now & (TIMER_L0_SLOTS - 1));
+        if (index == 0) {
+            // Crossed into a new level 0 rotation, pull the matching slot of each level down
+            for (unsigned int level = 1; level < TIMER_LEVELS; level++) {
+                unsigned int slot = (unsigned int) ((wheel->now >> level_shift[level]) & (TIMER_LN_SLOTS - 1));
+                cascade(wheel, level, slot);
+                if (slot != 0) break;
+            }
+        }
+
+        Timer_t* timer = slot_take(wheel, index);
+        while (timer) {
+            Timer_t* next = timer->next;
+            if (granule_of(timer->expires) > wheel->now) {
+                slot_insert(wheel, timer); // Parked past the wheel's range, not due yet
+            } else {
+                // Still ours until it runs, so cancel and arm can take it back off
+                timer->prev = NULL;
+                timer->next = wheel->expired;
+                if (timer->next) timer->next->prev = timer;
+                wheel->expired = timer;
+                timer->slot = TIMER_SLOT_EXPIRED;
+                wheel->pending--;
+            }
+            timer = next;
+        }
+        wheel->now++;
+    }
+}
+
+// Point the hardware at the next thing this wheel has to do, call with the lock held
+static void wheel_program(TimerWheel_t* wheel) {
+    uint64_t next = next_event(wheel);
+    uint64_t deadline = (next == UINT64_MAX || next > (UINT64_MAX >> granule_shift)) ? UINT64_MAX : next << granule_shift;
+    if (deadline != wheel->deadline) {
+        wheel->deadline = deadline;
+        clock_program(deadline);
+    }
+}
+
+static void timer_interrupt(TrapFrame_t* frame) {
+    (void) frame;
+    TimerWheel_t* wheel = &wheels[cpu_index()];
+
+    spin_lock(&wheel->lock);
+    wheel->interrupts++;
+    wheel->deadline = 0; // Has fired, and stays pending until rewritten, so wheel_program must write something
+    wheel_advance(wheel, clock_now() >> granule_shift);
+
+    // One at a time off the list under the lock: a callback (ours or another hart's) may cancel or
+    // re-arm any timer still on it. Newest first, doesn't matter, they're all due.
+    Timer_t* timer;
+    while ((timer = wheel->expired) != NULL) {
+        wheel->running = timer; // Before it looks idle to timer_cancel
+        slot_remove(wheel, timer);
+        wheel->fired++;
+        spin_unlock(&wheel->lock);
+        timer->function(timer);
+        spin_lock(&wheel->lock);
+        __atomic_store_n(&wheel->running, NULL, __ATOMIC_RELEASE);
+    }
+
+    wheel_program(wheel);
+    spin_unlock(&wheel->lock);
+}
+
+void timer_init(void) {
+    clock_init();
+    trap_register_interrupt(IRQ_S_TIMER, timer_interrupt);
+    timer_init_local();
+    klog("timer: timebase %lu Hz, granule %lu ns, %s\n", (unsigned long) timebase_hz,
+         (unsigned long) clock_ticks_to_ns(1ull << granule_shift), isa_has(ISA_EXT_SSTC) ? "stimecmp" : "SBI set_timer");
+}
+
+void timer_init_local(void) {
+    TimerWheel_t* wheel = &wheels[cpu_index()];
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = clock_now() >> granule_shift;
+    wheel->deadline = UINT64_MAX;
+    clock_program(UINT64_MAX); // Nothing pending
+    trap_enable_interrupt(IRQ_S_TIMER);
+}
+
+void timer_setup(Timer_t* timer, timer_function_t function, void* data) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->function = function;
+    timer->data = data;
+    timer->wheel = NULL;
+    timer->slot = 0;
+}
+
+// Off whichever wheel it's on, call with that wheel's lock held
+static void wheel_detach(TimerWheel_t* wheel, Timer_t* timer) {
+    if (timer->slot != TIMER_SLOT_EXPIRED) wheel->pending--; // Expired ones were already taken off the count
+    slot_remove(wheel, timer);
+    // Leave the hardware alone, an early wakeup with nothing due is cheaper than reprogramming
+}
+
+static int timer_detach(Timer_t* timer) {
+    while (1) {
+        TimerWheel_t* wheel = __atomic_load_n(&timer->wheel, __ATOMIC_ACQUIRE);
+        if (!wheel) return 0;
+
+        uint64_t flags = spin_lock_irqsave(&wheel->lock);
+        if (timer->wheel != wheel) { // Fired or moved while we took the lock
+            spin_unlock_irqrestore(&wheel->lock, flags);
+            continue;
+        }
+        wheel_detach(wheel, timer);
+        spin_unlock_irqrestore(&wheel->lock, flags);
+        return 1;
+    }
+}
+
+// Like del_timer_sync: off the wheel isn't enough when the caller is about to free it (a sleeper's
+// stack), another hart may be inside its function. Not ours, ours can't be interrupted mid-callback
+// unless we're the callback.
+int timer_cancel(Timer_t* timer) {
+    int pending = timer_detach(timer);
+
+    uint64_t flags = irq_save(); // cpu_index() has to stay true while we look
+    unsigned int self = cpu_index();
+    for (unsigned int cpu = 0; cpu < MAX_HARTS; cpu++) {
+        if (cpu == self) continue;
+        while (__atomic_load_n(&wheels[cpu].running, __ATOMIC_ACQUIRE) == timer) cpu_relax();
+    }
+    irq_restore(flags);
+    return pending;
+}
+
+void timer_arm(Timer_t* timer, uint64_t expires) {
+    uint64_t flags = irq_save(); // Before cpu_index(), a preempted thread may come back on another hart
+    TimerWheel_t* wheel = &wheels[cpu_index()];
+    spin_lock(&wheel->lock);
+    // Claiming it is a CAS from NULL, so two harts arming it at once can't both insert it. Whoever
+    // loses takes it off the winner's wheel and goes again: last arm wins.
+    while (1) {
+        if (timer->wheel == wheel) wheel_detach(wheel, timer);
+        TimerWheel_t* expected = NULL;
+        if (__atomic_compare_exchange_n(&timer->wheel, &expected, wheel, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+        spin_unlock(&wheel->lock);
+        timer_detach(timer);
+        spin_lock(&wheel->lock);
+    }
+    timer->expires = expires;
+    slot_insert(wheel, timer);
+    wheel->pending++;
+    if ((granule_of(expires) << granule_shift) < wheel->deadline) wheel_program(wheel);
+    spin_unlock_irqrestore(&wheel->lock, flags);
+}
+
+void timer_arm_after(Timer_t* timer, uint64_t ticks) {
+    timer_arm(timer, clock_now() + ticks);
+}
+
+int timer_pending(const Timer_t* timer) {
+    return __atomic_load_n(&timer->wheel, __ATOMIC_ACQUIRE) != NULL;
+}
+
+const TimerWheel_t* timer_wheel(unsigned int cpu) {
+    return cpu < MAX_HARTS ? &wheels[cpu] : NULL;
+}
@@ -0,0 +1,125 @@
+#include <trap.h>
+#include <riscv.h>
+#include <percpu.h>
+#include <panic.h>
+#include <klog.h>
+#include <sched.h>
+
+extern char trap_vector[];
+
+#define STVEC_VECTORED 1u
+
+static trap_handler_t interrupt_handlers[TRAP_CAUSES];
+static trap_handler_t exception_handlers[TRAP_CAUSES];
+
+// Per hart so the counters never share a line between harts, only ever touched with interrupts off
+static TrapStats_t stats[MAX_HARTS][2][TRAP_CAUSES];
+
+static const char* const interrupt_names[TRAP_CAUSES] = {
+    [IRQ_S_SOFT] = "s-software", [IRQ_S_TIMER] = "s-timer", [IRQ_S_EXT] = "s-external", [13] = "counter-overflow",
+};
+
+static const char* const exception_names[TRAP_CAUSES] = {
+    [EXC_INSTRUCTION_MISALIGNED] = "insn-misaligned", [EXC_INSTRUCTION_FAULT] = "insn-fault",
+    [EXC_ILLEGAL_INSTRUCTION] = "illegal-insn", [EXC_BREAKPOINT] = "breakpoint",
+    [EXC_LOAD_MISALIGNED] = "load-misaligned", [EXC_LOAD_FAULT] = "load-fault",
+    [EXC_STORE_MISALIGNED] = "store-misaligned", [EXC_STORE_FAULT] = "store-fault",
+    [EXC_ECALL_U] = "ecall-u", [EXC_ECALL_S] = "ecall-s",
+    [EXC_INSTRUCTION_PAGE_FAULT] = "insn-page-fault", [EXC_LOAD_PAGE_FAULT] = "load-page-fault",
+    [EXC_STORE_PAGE_FAULT] = "store-page-fault",
+};
+
+static void record(int interrupt, unsigned int cause, const TrapFrame_t* frame) {
+    TrapStats_t* entry = &stats[cpu_index()][interrupt][cause];
+    uint64_t cycles = rdcycle() - frame->cycles;
+    entry->count++;
+    entry->total_cycles += cycles;
+    if (cycles > entry->worst_cycles) entry->worst_cycles = cycles;
+}
+
+// ebreak: note it and step over, handy for checking the exception path from the monitor
+static void breakpoint_handler(TrapFrame_t* frame) {
+    uint16_t instruction = *(const uint16_t*) (uintptr_t) frame->sepc;
+    klog("trap: breakpoint at 0x%lx\n", (unsigned long) frame->sepc);
+    frame->sepc += ((instruction & 3) == 3) ? 4 : 2; // c.ebreak is 2 bytes
+}
+
+void trap_init(void) {
+    trap_register_exception(EXC_BREAKPOINT, breakpoint_handler);
+    trap_init_local();
+}
+
+void trap_init_local(void) {
+    csr_write(stvec, (uintptr_t) trap_vector | STVEC_VECTORED);
+}
+
+int trap_register_interrupt(unsigned int cause, trap_handler_t handler) {
+    if (cause >= TRAP_CAUSES) return -1;
+    interrupt_handlers[cause] = handler;
+    return 0;
+}
+
+int trap_register_exception(unsigned int cause, trap_handler_t handler) {
+    if (cause >= TRAP_CAUSES) return -1;
+    exception_handlers[cause] = handler;
+    return 0;
+}
+
+void trap_enable_interrupt(unsigned int cause) {
+    csr_set(sie, 1ull << cause);
+}
+
+void trap_disable_interrupt(unsigned int cause) {
+    csr_clear(sie, 1ull << cause);
+}
+
+// From the vector's fast path, cause comes from which entry fired
+void trap_interrupt(TrapFrame_t* frame, unsigned int cause) {
+    trap_handler_t handler = interrupt_handlers[cause];
+    if (handler) {
+        handler(frame);
+    } else {
+        // Nobody wants it, mask it on this hart so it can't storm
+        trap_disable_interrupt(cause);
+        klog("trap: unhandled interrupt %u on cpu %u, masked\n", cause, cpu_index());
+    }
+    record(1, cause, frame);
+    sched_irq_exit(); // May switch threads, we come back here when this one runs again
+}
+
+void trap_exception_dispatch(TrapFrame_t* frame) {
+    unsigned int cause = (unsigned int) frame->scause;
+    trap_handler_t handler = cause < TRAP_CAUSES ? exception_handlers[cause] : NULL;
+    if (!handler) {
+        kprintf("\nUnhandled exception %s (scause %lu) on cpu %u\n",
+                trap_cause_name(0, cause), (unsigned long) frame->scause, cpu_index());
+        kprintf("sepc 0x%016lx stval 0x%016lx sstatus 0x%016lx\n",
+                (unsigned long) frame->sepc, (unsigned long) frame->stval, (unsigned long) frame->sstatus);
+        kprintf("ra   0x%016lx sp    0x%016lx\n", (unsigned long) frame->regs[1], (unsigned long) frame->regs[2]);
+        panic("Unhandled exception");
+        return;
+    }
+
+    handler(frame);
+    record(0, cause, frame);
+}
+
+void trap_stats(int interrupt, unsigned int cause, TrapStats_t* output) {
+    output->count = 0;
+    output->total_cycles = 0;
+    output->worst_cycles = 0;
+    if (cause >= TRAP_CAUSES) return;
+
+    for (int hart = 0; hart < MAX_HARTS; hart++) {
+        const TrapStats_t* entry = &stats[hart][interrupt ? 1 : 0][cause];
+        output->count += entry->count;
+        output->total_cycles += entry->total_cycles;
+        if (entry->worst_cycles > output->worst_cycles) output->worst_cycles = entry->worst_cycles;
+    }
+}
+
+const char* trap_cause_name(int interrupt, unsigned int cause) {
+    const char* name = NULL;
+    if (cause < TRAP_CAUSES) name = interrupt ? interrupt_names[cause] : exception_names[cause];
+    return name ? name : "reserved";
+}
@@ -0,0 +1,86 @@
+# Vector (RVV 1.0) memory routines, picked at boot by mem_select in mini_lib.c.
+# The kernel is built for rv64imac, so V is only enabled for this file. Callers
+# keep interrupts off around these since nothing saves the vector registers.
+# Everything is strip-mined with vsetvli over e8/m8 groups (8 registers per operand).
+
+    .option push
+    .option arch, +v
+    .text
+
+# void* memcpy_rvv(void* dest, const void* src, size_t n)
+    .globl memcpy_rvv
+    .type memcpy_rvv,@function
+memcpy_rvv:
+    mv      a3, a0              # Keep dest for the return value
+1:
+    vsetvli t0, a2, e8, m8, ta, ma
+    vle8.v  v0, (a1)
+    add     a1, a1, t0
+    sub     a2, a2, t0
+    vse8.v  v0, (a3)
+    add     a3, a3, t0
+    bnez    a2, 1b
+    ret
+
+# void* memset_rvv(void* dest, int value, size_t n)
+    .globl memset_rvv
+    .type memset_rvv,@function
+memset_rvv:
+    mv      a3, a0
+    vsetvli t0, zero, e8, m8, ta, ma
+    vmv.v.x v0, a1              # Splat once over the whole group
+1:
+    vsetvli t0, a2, e8, m8, ta, ma
+    vse8.v  v0, (a3)
+    add     a3, a3, t0
+    sub     a2, a2, t0
+    bnez    a2, 1b
+    ret
+
+# size_t strlen_rvv(const char* s)
+# Fault-only-first loads stop at the end of mapped memory instead of trapping
+    .globl strlen_rvv
+    .type strlen_rvv,@function
+strlen_rvv:
+    mv      a3, a0
+1:
+    vsetvli a1, zero, e8, m8, ta, ma
+    vle8ff.v v8, (a3)
+    csrr    a1, vl              # How many bytes the load actually got
+    vmseq.vi v0, v8, 0
+    vfirst.m a2, v0             # Index of the first NUL or -1
+    add     a3, a3, a1
+    bltz    a2, 1b
+    add     a0, a0, a1          # start + last chunk length
+    add     a3, a3, a2          # end of string
+    sub     a0, a3, a0
+    ret
+
+# int memcmp_rvv(const void* a, const void* b, size_t n)
+    .globl memcmp_rvv
+    .type memcmp_rvv,@function
+memcmp_rvv:
+1:
+    beqz    a2, 3f
+    vsetvli t0, a2, e8, m8, ta, ma
+    vle8.v  v8, (a0)
+    vle8.v  v16, (a1)
+    vmsne.vv v0, v8, v16
+    vfirst.m t1, v0
+    bgez    t1, 2f
+    add     a0, a0, t0
+    add     a1, a1, t0
+    sub     a2, a2, t0
+    j       1b
+2:
+    add     a0, a0, t1
+    add     a1, a1, t1
+    lbu     t2, 0(a0)
+    lbu     t3, 0(a1)
+    sub     a0, t2, t3
+    ret
+3:
+    li      a0, 0
+    ret
+
+    .option pop
@@ -0,0 +1,78 @@
+# Zbb word-at-a-time string routines, picked at boot by mem_select in mini_lib.c.
+# orc.b turns every non-zero byte into 0xff, so a word with a NUL is simply != -1,
+# and rev8 puts a word in memory order so one unsigned compare settles memcmp.
+
+    .option push
+    .option arch, +zbb
+    .text
+
+# size_t strlen_zbb(const char* s)
+    .globl strlen_zbb
+    .type strlen_zbb,@function
+strlen_zbb:
+    mv      a1, a0
+1:
+    andi    t0, a1, 7           # Bytes until aligned, aligned loads never cross a page
+    beqz    t0, 2f
+    lbu     t1, 0(a1)
+    beqz    t1, 4f
+    addi    a1, a1, 1
+    j       1b
+2:
+    li      t2, -1
+3:
+    ld      t1, 0(a1)
+    orc.b   t1, t1
+    bne     t1, t2, 5f
+    addi    a1, a1, 8
+    j       3b
+5:
+    not     t1, t1              # NUL bytes are now 0xff
+    ctz     t1, t1              # Little endian: the lowest set bit is the first NUL
+    srli    t1, t1, 3
+    add     a1, a1, t1
+4:
+    sub     a0, a1, a0
+    ret
+
+# int memcmp_zbb(const void* a, const void* b, size_t n)
+    .globl memcmp_zbb
+    .type memcmp_zbb,@function
+memcmp_zbb:
+    or      t0, a0, a1
+    andi    t0, t0, 7
+    bnez    t0, 4f              # Only words when both sides are aligned
+    li      t3, 8
+1:
+    bltu    a2, t3, 4f
+    ld      t1, 0(a0)
+    ld      t2, 0(a1)
+    bne     t1, t2, 2f
+    addi    a0, a0, 8
+    addi    a1, a1, 8
+    addi    a2, a2, -8
+    j       1b
+2:
+    rev8    t1, t1
+    rev8    t2, t2
+    sltu    a0, t1, t2
+    sltu    t3, t2, t1
+    sub     a0, t3, a0          # -1, 0 or 1
+    ret
+4:
+    beqz    a2, 6f
+    lbu     t1, 0(a0)
+    lbu     t2, 0(a1)
+    bne     t1, t2, 5f
+    addi    a0, a0, 1
+    addi    a1, a1, 1
+    addi    a2, a2, -1
+    j       4b
+5:
+    sub     a0, t1, t2
+    ret
+6:
+    li      a0, 0
+    ret
+
+    .option pop
@@ -1,16 +1,175 @@
 #include <mini_lib.h>
+#include <riscv.h>
+
+// Word-at-a-time versions: align the head with byte ops, move 8-byte words (unrolled 4x),
+// then mop up the tail. Aligned word loads never cross a page, so reading a whole word
+// around a string's terminator is safe.
+
+typedef uint64_t __attribute__((may_alias)) word_t; // Lets us read char buffers as words legally
+
+#define WORD_SIZE 8u
+#define WORD_MASK (WORD_SIZE - 1)
+#define ONES  0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+// Non-zero iff some byte of x is 0 (the classic "has zero byte" trick)
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
+#define SMALL_COPY 16u // Below this the setup isn't worth it
+
+// Vector and Zbb variants live in mem_rvv.s / mem_zbb.s and are only called once mem_select
+// has seen the extension in the FDT. Small calls stay on the scalar code, the setup isn't free.
+void* memcpy_rvv(void* dest, const void* src, size_t n);
+void* memset_rvv(void* dest, int value, size_t n);
+size_t strlen_rvv(const char* s);
+int memcmp_rvv(const void* a, const void* b, size_t n);
+size_t strlen_zbb(const char* s);
+int memcmp_zbb(const void* a, const void* b, size_t n);
+
+#define VECTOR_MIN   256u          // Below this the scalar word loop wins
+#define VECTOR_CHUNK (64u * 1024u) // Longest stretch we keep interrupts off for
+
+static int use_vector = 0;
+static int use_zbb = 0;
+
+static inline int is_aligned(const void* pointer) {
+    return ((uintptr_t) pointer & WORD_MASK) == 0;
+}
+
+// Copies n bytes to a word-aligned d from a src with any alignment
+static void copy_words_forward(unsigned char* d, const unsigned char* s, size_t n) {
+    size_t words = n / WORD_SIZE;
+    unsigned int offset = (uintptr_t) s & WORD_MASK;
+
+    if (offset == 0) {
+        word_t* dw = (word_t*) d;
+        const word_t* sw = (const word_t*) s;
+        while (words >= 4) {
+            word_t a = sw[0], b = sw[1], c = sw[2], e = sw[3];
+            dw[0] = a;
+            dw[1] = b;
+            dw[2] = c;
+            dw[3] = e;
+            dw += 4;
+            sw += 4;
+            words -= 4;
+        }
+        while (words--) *dw++ = *sw++;
+    } else {
+        // Source is misaligned relative to dest: load aligned words and stitch neighbours together
+        unsigned int right = offset * 8u;
+        unsigned int left = 64u - right;
+        word_t* dw = (word_t*) d;
+        const word_t* sw = (const word_t*) (s - offset);
+        uint64_t current = *sw++;
+        while (words--) {
+            uint64_t next = *sw++;
+            *dw++ = (current >> right) | (next << left);
+            current = next;
+        }
+    }
+
+    size_t done = n & ~(size_t) WORD_MASK;
+    for (size_t i = done; i < n; i++) d[i] = s[i];
+}
+
+// Nothing saves v0-v31 across a trap, so vector code runs with interrupts off, a chunk at a time
+static void memcpy_vector(unsigned char* d, const unsigned char* s, size_t n) {
+    while (n) {
+        size_t chunk = n < VECTOR_CHUNK ? n : VECTOR_CHUNK;
+        uint64_t flags = irq_save();
+        memcpy_rvv(d, s, chunk);
+        irq_restore(flags);
+        d += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+static void memset_vector(unsigned char* d, int value, size_t n) {
+    while (n) {
+        size_t chunk = n < VECTOR_CHUNK ? n : VECTOR_CHUNK;
+        uint64_t flags = irq_save();
+        memset_rvv(d, value, chunk);
+        irq_restore(flags);
+        d += chunk;
+        n -= chunk;
+    }
+}
+
+static int memcmp_vector(const unsigned char* x, const unsigned char* y, size_t n) {
+    while (n) {
+        size_t chunk = n < VECTOR_CHUNK ? n : VECTOR_CHUNK;
+        uint64_t flags = irq_save();
+        int result = memcmp_rvv(x, y, chunk);
+        irq_restore(flags);
+        if (result) return result;
+        x += chunk;
+        y += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+void mem_select(uint32_t extensions) {
+    use_vector = (extensions & ISA_EXT_V) != 0;
+    use_zbb = (extensions & ISA_EXT_ZBB) != 0;
+}
+
+const char* mem_variant(void) {
+    if (use_vector && use_zbb) return "rvv+zbb";
+    if (use_vector) return "rvv";
+    if (use_zbb) return "zbb";
+    return "scalar";
+}
 
 void* memcpy(void* dest, const void* src, size_t n) {
-    char *d = (char*) dest;
-    const char *s = (const char*) src;
-    for (size_t i = 0; i < n; i++) {
-        d[i] = s[i];
+    unsigned char* d = (unsigned char*) dest;
+    const unsigned char* s = (const unsigned char*) src;
+
+    if (use_vector && n >= VECTOR_MIN) {
+        memcpy_vector(d, s, n);
+        return dest;
+    }
+
+    if (n < SMALL_COPY) {
+        for (size_t i = 0; i < n; i++) d[i] = s[i];
+        return dest;
     }
 
+    // Byte copy until dest is aligned, then words
+    while (!is_aligned(d)) {
+        *d++ = *s++;
+        n--;
+    }
+
+    copy_words_forward(d, s, n);
     return dest;
 }
 
 int strcmp(const char* s1, const char* s2) {
+    // Word compare only works when both strings share an alignment
+    if (((uintptr_t) s1 & WORD_MASK) == ((uintptr_t) s2 & WORD_MASK)) {
+        while (!is_aligned(s1)) {
+            if (*s1 == '\0' || *s1 != *s2) {
+                return *(const unsigned char*) s1 - *(const unsigned char*) s2;
+            }
+            s1++;
+            s2++;
+        }
+
+        const word_t* w1 = (const word_t*) s1;
+        const word_t* w2 = (const word_t*) s2;
+        while (*w1 == *w2 && !HAS_ZERO(*w1)) {
+            w1++;
+            w2++;
+        }
+
+        // The difference or terminator is in this word, let the byte loop find it
+        s1 = (const char*) w1;
+        s2 = (const char*) w2;
+    }
+
     while (*s1 && (*s1 == *s2)) {
         s1++;
         s2++;
@@ -20,15 +179,51 @@ int strcmp(const char* s1, const char* s2) {
 }
 
 size_t strlen(const char* s) {
-    size_t n = 0;
-    while (s[n]) n++;
+    if (use_zbb) return strlen_zbb(s); // No vector state to guard, so preferred over strlen_rvv
+    if (use_vector) {
+        uint64_t flags = irq_save();
+        size_t length = strlen_rvv(s);
+        irq_restore(flags);
+        return length;
+    }
 
-    return n;
+    const char* p = s;
+    while (!is_aligned(p)) {
+        if (*p == '\0') return (size_t) (p - s);
+        p++;
+    }
+
+    const word_t* w = (const word_t*) p;
+    while (!HAS_ZERO(*w)) w++;
+
+    p = (const char*) w;
+    while (*p) p++;
+    return (size_t) (p - s);
 }
 
 int memcmp(const void* a, const void* b, size_t n) {
     const unsigned char* x = (const unsigned char*) a;
     const unsigned char* y = (const unsigned char*) b;
+
+    if (use_vector && n >= VECTOR_MIN) return memcmp_vector(x, y, n);
+    if (use_zbb && n >= SMALL_COPY) return memcmp_zbb(x, y, n);
+
+    if (n >= SMALL_COPY && ((uintptr_t) x & WORD_MASK) == ((uintptr_t) y & WORD_MASK)) {
+        while (!is_aligned(x)) {
+            if (*x != *y) return (int) *x - (int) *y;
+            x++;
+            y++;
+            n--;
+        }
+
+        // Skip equal words, the first different one is settled byte by byte below
+        while (n >= WORD_SIZE && *(const word_t*) x == *(const word_t*) y) {
+            x += WORD_SIZE;
+            y += WORD_SIZE;
+            n -= WORD_SIZE;
+        }
+    }
+
     for (size_t i = 0; i < n; i++) {
         if (x[i] != y[i]) return (int) x[i] - (int) y[i];
     }
@@ -39,6 +234,35 @@ int memcmp(const void* a, const void* b, size_t n) {
 void* memset(void* destination, int value, size_t n) {
     unsigned char* d = (unsigned char*) destination;
     unsigned char v = (unsigned char) value;
+
+    if (use_vector && n >= VECTOR_MIN) {
+        memset_vector(d, v, n);
+        return destination;
+    }
+
+    if (n >= SMALL_COPY) {
+        while (!is_aligned(d)) {
+            *d++ = v;
+            n--;
+        }
+
+        uint64_t splat = ONES * v;
+        word_t* w = (word_t*) d;
+        size_t words = n / WORD_SIZE;
+        while (words >= 4) {
+            w[0] = splat;
+            w[1] = splat;
+            w[2] = splat;
+            w[3] = splat;
+            w += 4;
+            words -= 4;
+        }
+        while (words--) *w++ = splat;
+
+        d = (unsigned char*) w;
+        n &= WORD_MASK;
+    }
+
     for (size_t i = 0; i < n; i++) {
         d[i] = v;
     }
@@ -52,16 +276,27 @@ void* memmove(void* destination, const void* source, size_t n) {
 
     if (dest == src || n == 0) return destination;
 
-    if (dest < src) {
-        for (size_t i = 0; i < n; i++) {
-            dest[i] = src[i];
+    // Forward copies are safe whenever dest is below src (every word is loaded before it can be overwritten)
+    if (dest < src || dest >= src + n) {
+        return memcpy(destination, source, n);
+    }
+
+    // Overlapping with dest above src: copy from the end
+    if (((uintptr_t) dest & WORD_MASK) == ((uintptr_t) src & WORD_MASK) && n >= SMALL_COPY) {
+        while (!is_aligned(dest + n)) {
+            n--;
+            dest[n] = src[n];
         }
-    } else if (dest > src) {
-        for (size_t i = n; i != 0; i--) {
-            dest[i - 1] = src[i - 1];
+
+        while (n >= WORD_SIZE) {
+            n -= WORD_SIZE;
+            *(word_t*) (dest + n) = *(const word_t*) (src + n);
         }
     }
 
+    for (size_t i = n; i != 0; i--) {
+        dest[i - 1] = src[i - 1];
+    }
+
     return destination;
 }
-
@@ -0,0 +1,199 @@
+#include <dma.h>
+#include <page_alloc.h>
+#include <fdt_index.h>
+#include <klog.h>
+#include <panic.h>
+#include <sync.h>
+#include <mini_lib.h>
+
+// Same scheme as page_alloc: a metadata byte per granule marks block heads and their order,
+// free blocks sit on per-order lists threaded through the blocks themselves. Buddies are
+// found relative to span_base, aligned to the biggest block so blocks are aligned physically.
+
+#define META_FREE  0x40
+#define META_USED  0x80
+#define META_ORDER 0x1f
+
+typedef struct DmaBlock {
+    struct DmaBlock* next;
+    struct DmaBlock* prev;
+} DmaBlock_t;
+
+static uint64_t pool_base = 0;
+static uint64_t pool_end = 0;
+static uint64_t span_base = 0;
+static size_t span_granules = 0;
+static unsigned int max_order = 0; // Biggest order the pool can hold, exclusive
+static uint8_t* meta = NULL;
+static DmaBlock_t* free_lists[DMA_MAX_ORDER];
+static DmaStats_t stats;
+static spinlock_t dma_lock = SPINLOCK_INIT; // Drivers free from their interrupt handlers
+
+// RAM is identity mapped, if that ever changes these are the two places to fix
+static inline void* granule_to_address(size_t granule) {
+    return (void*) (uintptr_t) (span_base + ((uint64_t) granule << DMA_GRANULE_SHIFT));
+}
+
+static inline size_t address_to_granule(uint64_t address) {
+    return (size_t) ((address - span_base) >> DMA_GRANULE_SHIFT);
+}
+
+static void list_push(unsigned int order, size_t granule) {
+    DmaBlock_t* block = (DmaBlock_t*) granule_to_address(granule);
+    block->prev = NULL;
+    block->next = free_lists[order];
+    if (block->next) block->next->prev = block;
+    free_lists[order] = block;
+
+    meta[granule] = META_FREE | order;
+    stats.free_blocks[order]++;
+}
+
+static void list_remove(unsigned int order, size_t granule) {
+    DmaBlock_t* block = (DmaBlock_t*) granule_to_address(granule);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+    }
+    if (block->next) block->next->prev = block->prev;
+
+    meta[granule] = 0;
+    stats.free_blocks[order]--;
+}
+
+// A shared-dma-pool under /reserved-memory, memory_init has already kept the page allocator off it
+static int find_pool(uint64_t* base, uint64_t* size) {
+    const FDTNode_t* reserved = fdt_find_path("/reserved-memory");
+    for (const FDTNode_t* node = reserved ? reserved->child : NULL; node; node = node->sibling) {
+        FDTRegRegion_t reg;
+        const FDTProp_t* compatible = fdt_node_prop(node, "compatible");
+        if (!compatible || !fdt_prop_stringlist_contains(compatible, "shared-dma-pool")) continue;
+        if (fdt_node_reg(node, &reg, 1) != 1 || reg.size < PAGE_SIZE) continue;
+
+        *base = reg.base;
+        *size = reg.size;
+        return 0;
+    }
+    return -1;
+}
+
+int dma_init(void) {
+    uint64_t base, size;
+    const char* source = "shared-dma-pool";
+    if (find_pool(&base, &size) != 0) {
+        void* block = page_alloc(DMA_POOL_ORDER);
+        if (!block) return -1;
+        base = (uint64_t) (uintptr_t) block;
+        size = PAGE_SIZE << DMA_POOL_ORDER;
+        source = "RAM";
+    }
+
+    // Biggest power of two block the pool holds, capped at what the metadata byte can say
+    max_order = 0;
+    while (max_order < DMA_MAX_ORDER && (DMA_GRANULE << max_order) <= size) max_order++;
+    uint64_t max_block = DMA_GRANULE << (max_order - 1);
+
+    pool_base = base;
+    pool_end = base + size;
+    span_base = base & ~(max_block - 1);
+    span_granules = (size_t) ((pool_end - span_base) >> DMA_GRANULE_SHIFT);
+
+    meta = (uint8_t*) page_alloc(page_order_for(span_granules));
+    if (!meta) return -1;
+    memset(meta, 0, span_granules);
+
+    // Seed the largest naturally aligned blocks that fit, like page_alloc does
+    size_t granule = address_to_granule((pool_base + DMA_GRANULE - 1) & ~(DMA_GRANULE - 1));
+    size_t last = address_to_granule(pool_end);
+    while (granule < last) {
+        unsigned int order = max_order - 1;
+        while (order > 0 && ((granule & (((size_t) 1 << order) - 1)) != 0 || granule + ((size_t) 1 << order) > last)) {
+            order--;
+        }
+        list_push(order, granule);
+        granule += (size_t) 1 << order;
+    }
+
+    stats.base = pool_base;
+    stats.size = size;
+    klog("dma: %lu KiB pool at 0x%lx from %s\n", (unsigned long) (size >> 10), (unsigned long) pool_base, source);
+    return 0;
+}
+
+void* dma_alloc(size_t size, size_t align, uint64_t* physical) {
+    if (size < align) size = align;
+    unsigned int order = 0;
+    while (order < max_order && (DMA_GRANULE << order) < size) order++;
+
+    uint64_t flags = spin_lock_irqsave(&dma_lock);
+    unsigned int current = order;
+    while (current < max_order && !free_lists[current]) current++;
+    if (!meta || current >= max_order) {
+        stats.failures++;
+        spin_unlock_irqrestore(&dma_lock, flags);
+        return NULL;
+    }
+
+    size_t granule = address_to_granule((uint64_t) (uintptr_t) free_lists[current]);
+    list_remove(current, granule);
+    while (current > order) {
+        current--;
+        list_push(current, granule + ((size_t) 1 << current));
+    }
+    meta[granule] = META_USED | order;
+
+    stats.allocs++;
+    stats.used += DMA_GRANULE << order;
+    if (stats.used > stats.peak) stats.peak = stats.used;
+    spin_unlock_irqrestore(&dma_lock, flags);
+
+    void* address = granule_to_address(granule);
+    memset(address, 0, DMA_GRANULE << order);
+    if (physical) *physical = dma_to_physical(address);
+    return address;
+}
+
+void dma_free(void* address) {
+    if (!address) return;
+
+    uint64_t physical = dma_to_physical(address);
+    size_t granule = address_to_granule(physical);
+    uint64_t flags = spin_lock_irqsave(&dma_lock);
+    if (physical < pool_base || physical >= pool_end || (meta[granule] & META_USED) == 0) { // Under the lock, see page_free
+        spin_unlock_irqrestore(&dma_lock, flags);
+        panic("dma_free: address is not an allocated block");
+        return;
+    }
+
+    unsigned int order = meta[granule] & META_ORDER;
+    meta[granule] = 0;
+    stats.frees++;
+    stats.used -= DMA_GRANULE << order;
+
+    while (order < max_order - 1) {
+        size_t buddy = granule ^ ((size_t) 1 << order);
+        if (buddy >= span_granules || meta[buddy] != (META_FREE | order)) break;
+
+        list_remove(order, buddy);
+        granule &= ~((size_t) 1 << order);
+        order++;
+    }
+
+    list_push(order, granule);
+    spin_unlock_irqrestore(&dma_lock, flags);
+}
+
+uint64_t dma_to_physical(const void* address) {
+    return (uint64_t) (uintptr_t) address;
+}
+
+void* dma_to_virtual(uint64_t physical) {
+    return (void*) (uintptr_t) physical;
+}
+
+void dma_stats(DmaStats_t* output) {
+    uint64_t flags = spin_lock_irqsave(&dma_lock);
+    *output = stats;
+    spin_unlock_irqrestore(&dma_lock, flags);
+}
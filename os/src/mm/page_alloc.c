@@ -0,0 +1,278 @@
+#include <page_alloc.h>
+#include <mini_lib.h>
+#include <panic.h>
+#include <sync.h>
+
+// Buddy allocator over every page of RAM the FDT told us about.
+// One metadata byte per page frame says whether that frame heads a free or allocated block and its order.
+// Free blocks are kept on per-order doubly linked lists stored inside the free pages themselves,
+// so finding, splitting and merging a buddy is O(1) per order and O(log n) overall.
+
+#define MAX_REGIONS 16
+#define MAX_RESERVES 32
+
+#define META_FREE 0x40  // Head of a free block
+#define META_USED 0x80  // Head of an allocated block
+#define META_ORDER 0x1f // Low bits hold the order of the block
+
+typedef struct FreeBlock {
+    struct FreeBlock* next;
+    struct FreeBlock* prev;
+} FreeBlock_t;
+
+typedef struct {
+    uint64_t base;
+    uint64_t end;
+} PhysRange_t;
+
+static PhysRange_t regions[MAX_REGIONS];
+static int region_count = 0;
+static PhysRange_t reserves[MAX_RESERVES];
+static int reserve_count = 0;
+
+static uint64_t span_base = 0;   // Physical address of pfn 0, aligned to the biggest block
+static size_t span_pages = 0;    // Pages covered by meta[]
+static uint8_t* meta = NULL;
+static FreeBlock_t* free_lists[PAGE_MAX_ORDER];
+static size_t free_blocks[PAGE_MAX_ORDER];
+static size_t free_pages = 0;
+static size_t total_pages = 0;
+static mcs_lock_t page_lock = MCS_LOCK_INIT; // Every hart comes here for pages, so waiters queue instead of hammering one line
+
+static void range_add(PhysRange_t* ranges, int* count, int max, uint64_t base, uint64_t size) {
+    if (size == 0) return;
+    if (*count >= max) {
+        panic("page_alloc: too many ranges");
+        return;
+    }
+
+    // Keep the list sorted by base, it's tiny so insertion sort is fine
+    int i = *count;
+    while (i > 0 && ranges[i - 1].base > base) {
+        ranges[i] = ranges[i - 1];
+        i--;
+    }
+
+    ranges[i].base = base;
+    ranges[i].end = base + size;
+    (*count)++;
+}
+
+void page_alloc_add_region(uint64_t base, uint64_t size) {
+    range_add(regions, &region_count, MAX_REGIONS, base, size);
+}
+
+void page_alloc_reserve(uint64_t base, uint64_t size) {
+    range_add(reserves, &reserve_count, MAX_RESERVES, base, size);
+}
+
+// Calls function on every page-aligned piece of RAM not covered by a reserve
+static void for_each_free_range(void (*function)(uint64_t base, uint64_t end, void* context), void* context) {
+    for (int r = 0; r < region_count; r++) {
+        uint64_t cursor = regions[r].base;
+        uint64_t end = regions[r].end;
+
+        for (int i = 0; i < reserve_count && cursor < end; i++) {
+            if (reserves[i].end <= cursor) continue;
+            if (reserves[i].base >= end) break;
+
+            uint64_t piece_base = PAGE_ALIGN_UP(cursor);
+            uint64_t piece_end = PAGE_ALIGN_DOWN(reserves[i].base);
+            if (piece_end > piece_base) function(piece_base, piece_end, context);
+
+            if (reserves[i].end > cursor) cursor = reserves[i].end;
+        }
+
+        uint64_t piece_base = PAGE_ALIGN_UP(cursor);
+        uint64_t piece_end = PAGE_ALIGN_DOWN(end);
+        if (piece_end > piece_base) function(piece_base, piece_end, context);
+    }
+}
+
+static inline void* pfn_to_address(size_t pfn) {
+    return (void*) (uintptr_t) (span_base + ((uint64_t) pfn << PAGE_SHIFT));
+}
+
+static inline size_t address_to_pfn(const void* address) {
+    return (size_t) (((uint64_t) (uintptr_t) address - span_base) >> PAGE_SHIFT);
+}
+
+static void list_push(unsigned int order, size_t pfn) {
+    FreeBlock_t* block = (FreeBlock_t*) pfn_to_address(pfn);
+    block->prev = NULL;
+    block->next = free_lists[order];
+    if (block->next) block->next->prev = block;
+    free_lists[order] = block;
+
+    meta[pfn] = META_FREE | order;
+    free_blocks[order]++;
+    free_pages += (size_t) 1 << order;
+}
+
+static void list_remove(unsigned int order, size_t pfn) {
+    FreeBlock_t* block = (FreeBlock_t*) pfn_to_address(pfn);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+    }
+    if (block->next) block->next->prev = block->prev;
+
+    meta[pfn] = 0;
+    free_blocks[order]--;
+    free_pages -= (size_t) 1 << order;
+}
+
+// Hands a free range to the lists as the largest naturally aligned blocks that fit
+static void seed_range(uint64_t base, uint64_t end, void* context) {
+    (void) context;
+    size_t pfn = address_to_pfn((void*) (uintptr_t) base);
+    size_t last = address_to_pfn((void*) (uintptr_t) end);
+
+    while (pfn < last) {
+        unsigned int order = PAGE_MAX_ORDER - 1;
+        while (order > 0 && ((pfn & (((size_t) 1 << order) - 1)) != 0 || pfn + ((size_t) 1 << order) > last)) {
+            order--;
+        }
+
+        list_push(order, pfn);
+        total_pages += (size_t) 1 << order;
+        pfn += (size_t) 1 << order;
+    }
+}
+
+typedef struct {
+    uint64_t needed;
+    uint64_t found;
+} MetaSearch_t;
+
+static void find_meta_home(uint64_t base, uint64_t end, void* context) {
+    MetaSearch_t* search = (MetaSearch_t*) context;
+    if (search->found == 0 && end - base >= search->needed) search->found = base;
+}
+
+int page_alloc_init(void) {
+    if (region_count == 0) return -1; // No RAM described
+
+    // Buddies are computed relative to span_base, so align it to the largest block
+    // to keep every block naturally aligned in physical memory too.
+    uint64_t max_block = PAGE_SIZE << (PAGE_MAX_ORDER - 1);
+    uint64_t highest = 0;
+    for (int i = 0; i < region_count; i++) {
+        if (regions[i].end > highest) highest = regions[i].end;
+    }
+
+    span_base = regions[0].base & ~(max_block - 1);
+    span_pages = (size_t) ((PAGE_ALIGN_DOWN(highest) - span_base) >> PAGE_SHIFT);
+
+    // The metadata lives in the first free range big enough to hold it
+    MetaSearch_t search = { .needed = PAGE_ALIGN_UP(span_pages), .found = 0 };
+    for_each_free_range(find_meta_home, &search);
+    if (search.found == 0) return -2; // No room for the page array
+
+    meta = (uint8_t*) (uintptr_t) search.found;
+    page_alloc_reserve(search.found, search.needed);
+    memset(meta, 0, span_pages);
+
+    for (int i = 0; i < PAGE_MAX_ORDER; i++) {
+        free_lists[i] = NULL;
+        free_blocks[i] = 0;
+    }
+
+    free_pages = 0;
+    total_pages = 0;
+    for_each_free_range(seed_range, NULL);
+
+    lock_stats_register("page_alloc", &page_lock.stats);
+    return 0;
+}
+
+void* page_alloc(unsigned int order) {
+    if (order >= PAGE_MAX_ORDER) return NULL;
+
+    McsNode_t node;
+    uint64_t flags = mcs_lock_irqsave(&page_lock, &node);
+    unsigned int current = order;
+    while (current < PAGE_MAX_ORDER && !free_lists[current]) current++;
+    if (current == PAGE_MAX_ORDER) {
+        mcs_unlock_irqrestore(&page_lock, &node, flags);
+        return NULL; // Out of memory
+    }
+
+    size_t pfn = address_to_pfn(free_lists[current]);
+    list_remove(current, pfn);
+
+    // Split down, giving the upper halves back
+    while (current > order) {
+        current--;
+        list_push(current, pfn + ((size_t) 1 << current));
+    }
+
+    meta[pfn] = META_USED | order;
+    mcs_unlock_irqrestore(&page_lock, &node, flags);
+    return pfn_to_address(pfn);
+}
+
+void page_free(void* address) {
+    if (!address) return;
+
+    size_t pfn = address_to_pfn(address);
+    McsNode_t node;
+    uint64_t flags = mcs_lock_irqsave(&page_lock, &node);
+    if (pfn >= span_pages || (meta[pfn] & META_USED) == 0) { // Under the lock, or two frees of one block both get past it
+        mcs_unlock_irqrestore(&page_lock, &node, flags);
+        panic("page_free: address is not an allocated block");
+        return;
+    }
+
+    unsigned int order = meta[pfn] & META_ORDER;
+    meta[pfn] = 0;
+
+    // Merge with the buddy for as long as it's a free block of the same order
+    while (order < PAGE_MAX_ORDER - 1) {
+        size_t buddy = pfn ^ ((size_t) 1 << order);
+        if (buddy >= span_pages || meta[buddy] != (META_FREE | order)) break;
+
+        list_remove(order, buddy);
+        pfn &= ~((size_t) 1 << order);
+        order++;
+    }
+
+    list_push(order, pfn);
+    mcs_unlock_irqrestore(&page_lock, &node, flags);
+}
+
+// Start of the allocated block containing address, or NULL if it isn't inside one
+void* page_block_start(const void* address) {
+    size_t pfn = address_to_pfn(address);
+    if (pfn >= span_pages) return NULL;
+
+    // The head is the first allocated frame at or below pfn, at increasing alignment, whose block is big enough
+    for (unsigned int order = 0; order < PAGE_MAX_ORDER; order++) {
+        size_t head = pfn & ~(((size_t) 1 << order) - 1);
+        uint8_t m = meta[head];
+        if ((m & META_USED) && (m & META_ORDER) >= order) return pfn_to_address(head);
+        if (m & META_FREE) return NULL;
+    }
+
+    return NULL;
+}
+
+// Smallest order whose block holds bytes
+unsigned int page_order_for(size_t bytes) {
+    unsigned int order = 0;
+    while (order < PAGE_MAX_ORDER && (PAGE_SIZE << order) < bytes) order++;
+    return order;
+}
+
+size_t page_free_count(void) {
+    return free_pages;
+}
+
+size_t page_total_count(void) {
+    return total_pages;
+}
+
+size_t page_free_blocks(unsigned int order) {
+    return (order < PAGE_MAX_ORDER) ? free_blocks[order] : 0;
+}
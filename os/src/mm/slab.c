@@ -0,0 +1,403 @@
+#include <slab.h>
+#include <page_alloc.h>
+#include <mini_lib.h>
+#include <panic.h>
+
+// Object caches in the style of Bonwick's slab + magazine allocator.
+// Each hart has two magazines per cache (loaded and previous); alloc/free only touch those with
+// interrupts off, so the common path takes no lock. When both are exhausted the hart trades a
+// magazine with the cache's depot, and only when the depot is dry do we carve objects out of slabs.
+
+#define SLAB_MIN_OBJECTS 8   // Grow the slab order until at least this many objects fit
+#define SLAB_MAX_ORDER 3     // ...but never past 32 KiB per slab
+
+static const size_t kmalloc_sizes[] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+static const char* const kmalloc_names[] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+#define KMALLOC_CLASSES (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+
+static SlabCache_t cache_cache;     // Holds every other SlabCache_t, statically allocated to bootstrap
+static SlabCache_t* magazine_cache; // Holds SlabMagazine_t
+static SlabCache_t* kmalloc_caches[KMALLOC_CLASSES];
+
+static SlabCache_t* all_caches = NULL;
+static spinlock_t caches_lock = SPINLOCK_INIT;
+
+static void cache_setup(SlabCache_t* cache, const char* name, size_t size, size_t align, unsigned int flags) {
+    memset(cache, 0, sizeof(*cache));
+
+    size_t length = strlen(name);
+    if (length >= SLAB_NAME_LENGTH) length = SLAB_NAME_LENGTH - 1;
+    memcpy(cache->name, name, length);
+
+    // Free objects hold the free list link, so they need room for a pointer
+    if (align < sizeof(void*)) align = sizeof(void*);
+    if (size < sizeof(void*)) size = sizeof(void*);
+    size = (size + align - 1) & ~(align - 1);
+
+    cache->object_size = size;
+    cache->object_offset = (sizeof(Slab_t) + align - 1) & ~(align - 1);
+    cache->flags = flags;
+
+    unsigned int order = 0;
+    while (order < SLAB_MAX_ORDER && ((PAGE_SIZE << order) - cache->object_offset) / size < SLAB_MIN_OBJECTS) {
+        order++;
+    }
+    cache->slab_order = order;
+    cache->objects_per_slab = (unsigned int) (((PAGE_SIZE << order) - cache->object_offset) / size);
+
+    uint64_t irq = spin_lock_irqsave(&caches_lock); // Held with interrupts off, so never preempted
+    cache->next = all_caches;
+    all_caches = cache;
+    spin_unlock_irqrestore(&caches_lock, irq);
+}
+
+// Slab layer, all of it runs with cache->lock held
+
+static Slab_t** slab_list_for(SlabCache_t* cache, unsigned int in_use) {
+    if (in_use == 0) return &cache->empty;
+    if (in_use == cache->objects_per_slab) return &cache->full;
+    return &cache->partial;
+}
+
+static void slab_unlink(Slab_t** list, Slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) slab->next->prev = slab->prev;
+}
+
+static void slab_link(Slab_t** list, Slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (slab->next) slab->next->prev = slab;
+    *list = slab;
+}
+
+static Slab_t* slab_grow(SlabCache_t* cache) {
+    Slab_t* slab = (Slab_t*) page_alloc(cache->slab_order);
+    if (!slab) return NULL;
+
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+
+    // Thread the free list back to front so objects come out in address order
+    unsigned char* first = (unsigned char*) slab + cache->object_offset;
+    for (unsigned int i = cache->objects_per_slab; i > 0; i--) {
+        void** object = (void**) (first + (size_t) (i - 1) * cache->object_size);
+        *object = slab->free_list;
+        slab->free_list = object;
+    }
+
+    slab_link(&cache->empty, slab);
+    cache->slab_count++;
+    return slab;
+}
+
+static void* slab_take(SlabCache_t* cache) {
+    Slab_t* slab = cache->partial ? cache->partial : cache->empty;
+    if (!slab) {
+        slab = slab_grow(cache);
+        if (!slab) return NULL;
+    }
+
+    slab_unlink(slab_list_for(cache, slab->in_use), slab);
+    void** object = (void**) slab->free_list;
+    slab->free_list = *object;
+    slab->in_use++;
+    slab_link(slab_list_for(cache, slab->in_use), slab);
+
+    cache->slab_in_use++;
+    return object;
+}
+
+static Slab_t* slab_of(const SlabCache_t* cache, const void* object) {
+    uintptr_t mask = (uintptr_t) (PAGE_SIZE << cache->slab_order) - 1;
+    return (Slab_t*) ((uintptr_t) object & ~mask);
+}
+
+static void slab_give(SlabCache_t* cache, void* object) {
+    Slab_t* slab = slab_of(cache, object);
+    if (slab->cache != cache) {
+        panic("slab_free: object does not belong to this cache");
+        return;
+    }
+
+    slab_unlink(slab_list_for(cache, slab->in_use), slab);
+    *(void**) object = slab->free_list;
+    slab->free_list = object;
+    slab->in_use--;
+    cache->slab_in_use--;
+
+    // Keep one empty slab around as a buffer, give the rest back
+    if (slab->in_use == 0 && cache->empty) {
+        cache->slab_count--;
+        page_free(slab);
+        return;
+    }
+
+    slab_link(slab_list_for(cache, slab->in_use), slab);
+}
+
+// Magazine layer
+
+static void* magazine_pop(SlabCpuCache_t* cpu) {
+    if (cpu->loaded && cpu->loaded->rounds > 0) {
+        return cpu->loaded->objects[--cpu->loaded->rounds];
+    }
+
+    if (cpu->previous && cpu->previous->rounds > 0) {
+        SlabMagazine_t* swap = cpu->loaded;
+        cpu->loaded = cpu->previous;
+        cpu->previous = swap;
+        return cpu->loaded->objects[--cpu->loaded->rounds];
+    }
+
+    return NULL;
+}
+
+static int magazine_push(SlabCpuCache_t* cpu, void* object) {
+    if (cpu->loaded && cpu->loaded->rounds < SLAB_MAGAZINE_SIZE) {
+        cpu->loaded->objects[cpu->loaded->rounds++] = object;
+        return 1;
+    }
+
+    if (cpu->previous && cpu->previous->rounds < SLAB_MAGAZINE_SIZE) {
+        SlabMagazine_t* swap = cpu->loaded;
+        cpu->loaded = cpu->previous;
+        cpu->previous = swap;
+        cpu->loaded->objects[cpu->loaded->rounds++] = object;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void depot_push(SlabMagazine_t** list, SlabMagazine_t* magazine) {
+    magazine->next = *list;
+    *list = magazine;
+}
+
+static SlabMagazine_t* depot_pop(SlabMagazine_t** list) {
+    SlabMagazine_t* magazine = *list;
+    if (magazine) *list = magazine->next;
+    return magazine;
+}
+
+// Rotate a fresh magazine in as loaded, the old loaded one becomes previous and the old previous goes to the depot
+static void magazine_rotate(SlabCache_t* cache, SlabCpuCache_t* cpu, SlabMagazine_t* incoming) {
+    if (cpu->previous) {
+        depot_push(cpu->previous->rounds ? &cache->depot_full : &cache->depot_empty, cpu->previous);
+    }
+
+    cpu->previous = cpu->loaded;
+    cpu->loaded = incoming;
+}
+
+void* slab_alloc(SlabCache_t* cache) {
+    if (!cache) return NULL;
+
+    if (cache->flags & SLAB_NO_MAGAZINES) {
+        uint64_t flags = spin_lock_irqsave(&cache->lock);
+        void* object = slab_take(cache);
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return object;
+    }
+
+    uint64_t flags = irq_save();
+    SlabCpuCache_t* cpu = &cache->cpu[cpu_index()];
+    void* object = magazine_pop(cpu);
+    if (object) {
+        cpu->hits++;
+        irq_restore(flags);
+        return object;
+    }
+
+    cpu->misses++;
+    spin_lock(&cache->lock);
+    SlabMagazine_t* full = depot_pop(&cache->depot_full);
+    if (full) {
+        magazine_rotate(cache, cpu, full);
+        object = full->objects[--full->rounds];
+    } else {
+        object = slab_take(cache);
+    }
+    spin_unlock(&cache->lock);
+
+    irq_restore(flags);
+    return object;
+}
+
+void slab_free(SlabCache_t* cache, void* object) {
+    if (!cache || !object) return;
+
+    if (cache->flags & SLAB_NO_MAGAZINES) {
+        uint64_t flags = spin_lock_irqsave(&cache->lock);
+        slab_give(cache, object);
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    SlabCpuCache_t* cpu = &cache->cpu[cpu_index()];
+    if (magazine_push(cpu, object)) {
+        cpu->hits++;
+        irq_restore(flags);
+        return;
+    }
+
+    cpu->misses++;
+    spin_lock(&cache->lock);
+    SlabMagazine_t* empty = depot_pop(&cache->depot_empty);
+    if (!empty) {
+        empty = (SlabMagazine_t*) slab_alloc(magazine_cache);
+        if (empty) empty->rounds = 0;
+    }
+
+    if (empty) {
+        magazine_rotate(cache, cpu, empty);
+        empty->objects[empty->rounds++] = object;
+    } else {
+        slab_give(cache, object); // No memory for a magazine, skip the cache layer
+    }
+    spin_unlock(&cache->lock);
+
+    irq_restore(flags);
+}
+
+SlabCache_t* slab_cache_create(const char* name, size_t size, size_t align, unsigned int flags) {
+    if (!name || size == 0 || (align & (align - 1)) != 0) return NULL; // Bad input
+    if (size > (PAGE_SIZE << SLAB_MAX_ORDER) / SLAB_MIN_OBJECTS) return NULL; // Too big for a slab, use pages
+
+    SlabCache_t* cache = (SlabCache_t*) slab_alloc(&cache_cache);
+    if (!cache) return NULL;
+
+    cache_setup(cache, name, size, align, flags);
+    return cache;
+}
+
+// Empties every magazine back into the slabs, caller guarantees nobody is using the cache
+static void cache_drain(SlabCache_t* cache) {
+    SlabMagazine_t* magazines = NULL;
+    for (int i = 0; i < MAX_HARTS; i++) {
+        if (cache->cpu[i].loaded) depot_push(&magazines, cache->cpu[i].loaded);
+        if (cache->cpu[i].previous) depot_push(&magazines, cache->cpu[i].previous);
+        cache->cpu[i].loaded = NULL;
+        cache->cpu[i].previous = NULL;
+    }
+
+    while (cache->depot_full) depot_push(&magazines, depot_pop(&cache->depot_full));
+    while (cache->depot_empty) depot_push(&magazines, depot_pop(&cache->depot_empty));
+
+    while (magazines) {
+        SlabMagazine_t* magazine = depot_pop(&magazines);
+        while (magazine->rounds) slab_give(cache, magazine->objects[--magazine->rounds]);
+        slab_free(magazine_cache, magazine);
+    }
+}
+
+void slab_cache_destroy(SlabCache_t* cache) {
+    if (!cache || cache == &cache_cache) return;
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    cache_drain(cache);
+    if (cache->slab_in_use != 0) {
+        spin_unlock_irqrestore(&cache->lock, flags);
+        panic("slab_cache_destroy: objects still allocated");
+        return;
+    }
+
+    while (cache->empty) {
+        Slab_t* slab = cache->empty;
+        slab_unlink(&cache->empty, slab);
+        page_free(slab);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    flags = spin_lock_irqsave(&caches_lock);
+    SlabCache_t** link = &all_caches;
+    while (*link && *link != cache) link = &(*link)->next;
+    if (*link) *link = cache->next;
+    spin_unlock_irqrestore(&caches_lock, flags);
+
+    slab_free(&cache_cache, cache);
+}
+
+void slab_init(void) {
+    cache_setup(&cache_cache, "slab-cache", sizeof(SlabCache_t), 0, SLAB_NO_MAGAZINES);
+    magazine_cache = slab_cache_create("slab-magazine", sizeof(SlabMagazine_t), 0, SLAB_NO_MAGAZINES);
+    if (!magazine_cache) {
+        panic("slab_init: can't create magazine cache");
+        return;
+    }
+
+    lock_stats_register("slab-caches", &caches_lock.stats);
+    for (size_t i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = slab_cache_create(kmalloc_names[i], kmalloc_sizes[i], 0, 0);
+        if (!kmalloc_caches[i]) {
+            panic("slab_init: can't create kmalloc caches");
+            return;
+        }
+        lock_stats_register(kmalloc_caches[i]->name, &kmalloc_caches[i]->lock.stats);
+    }
+}
+
+void* kmalloc(size_t size) {
+    if (size == 0) return NULL;
+
+    for (size_t i = 0; i < KMALLOC_CLASSES; i++) {
+        if (size <= kmalloc_sizes[i]) return slab_alloc(kmalloc_caches[i]);
+    }
+
+    return page_alloc(page_order_for(size));
+}
+
+void kfree(void* pointer) {
+    if (!pointer) return;
+
+    // Slab objects are never at the start of their block (the header is), page allocations always are
+    void* block = page_block_start(pointer);
+    if (!block) {
+        panic("kfree: pointer was not allocated");
+        return;
+    }
+
+    if (block == pointer) {
+        page_free(pointer);
+        return;
+    }
+
+    Slab_t* slab = (Slab_t*) block;
+    slab_free(slab->cache, pointer);
+}
+
+SlabCache_t* slab_cache_first(void) {
+    return all_caches;
+}
+
+void slab_cache_stats(SlabCache_t* cache, SlabStats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    for (int i = 0; i < MAX_HARTS; i++) {
+        const SlabCpuCache_t* cpu = &cache->cpu[i];
+        stats->hits += cpu->hits;
+        stats->misses += cpu->misses;
+        if (cpu->loaded) stats->cached += cpu->loaded->rounds;
+        if (cpu->previous) stats->cached += cpu->previous->rounds;
+    }
+
+    for (const SlabMagazine_t* magazine = cache->depot_full; magazine; magazine = magazine->next) {
+        stats->cached += magazine->rounds;
+    }
+
+    stats->slabs = cache->slab_count;
+    stats->total = cache->slab_count * cache->objects_per_slab;
+    stats->active = cache->slab_in_use - stats->cached;
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
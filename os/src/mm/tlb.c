@@ -0,0 +1,211 @@
+#include <tlb.h>
+#include <vm.h>
+#include <page_alloc.h>
+#include <sbi.h>
+#include <sched.h>
+#include <percpu.h>
+#include <klog.h>
+#include <mini_lib.h>
+
+static int have_rfence = 0;
+static TlbStats_t stats;
+
+static volatile uint32_t stale_mask = 0; // Idle harts that skipped a flush and owe themselves one
+
+// No-RFENCE fallback: bump a hart's request, IPI it, wait for it to echo the count back
+static volatile uint64_t flush_requested[MAX_HARTS];
+static volatile uint64_t flush_done[MAX_HARTS];
+
+static inline void count(volatile uint64_t* counter, uint64_t amount) {
+    atomic_fetch_add64(counter, amount);
+}
+
+void tlb_init(void) {
+    have_rfence = sbi_probe_extension(SBI_EID_RFENCE) != 0;
+    if (!have_rfence) klog("tlb: no SBI RFENCE, shootdowns fall back to IPIs and full flushes\n");
+}
+
+static uint64_t batch_pages(const TlbBatch_t* batch) {
+    uint64_t pages = 0;
+    for (uint32_t i = 0; i < batch->count; i++) pages += (batch->ranges[i].end - batch->ranges[i].start) >> PAGE_SHIFT;
+    return pages;
+}
+
+void tlb_queue(struct VmSpace* space, uintptr_t address, size_t size) {
+    TlbBatch_t* batch = &space->batch;
+    uintptr_t start = PAGE_ALIGN_DOWN(address);
+    uintptr_t end = PAGE_ALIGN_UP(address + size);
+    if (end <= start) return;
+    count(&stats.queued_pages, (end - start) >> PAGE_SHIFT);
+
+    uint64_t flags = spin_lock_irqsave(&batch->lock);
+    if (batch->full) {
+        spin_unlock_irqrestore(&batch->lock, flags);
+        return;
+    }
+
+    // Grow into any range we overlap or touch, the grown range may then swallow others
+    uint32_t i = 0;
+    while (i < batch->count) {
+        TlbRange_t* range = &batch->ranges[i];
+        if (start <= range->end && end >= range->start) {
+            if (range->start < start) start = range->start;
+            if (range->end > end) end = range->end;
+            *range = batch->ranges[--batch->count];
+            continue;
+        }
+        i++;
+    }
+
+    if (batch->count == TLB_BATCH_RANGES) {
+        batch->full = 1;
+    } else {
+        batch->ranges[batch->count].start = start;
+        batch->ranges[batch->count].end = end;
+        batch->count++;
+        if (batch_pages(batch) > TLB_FLUSH_ALL_PAGES) batch->full = 1;
+    }
+    spin_unlock_irqrestore(&batch->lock, flags);
+}
+
+static void flush_local(const TlbBatch_t* work) {
+    count(&stats.local_fences, 1);
+    if (work->full) {
+        sfence_vma_all();
+        return;
+    }
+    for (uint32_t i = 0; i < work->count; i++) {
+        for (uintptr_t page = work->ranges[i].start; page < work->ranges[i].end; page += PAGE_SIZE) sfence_vma_page(page);
+    }
+}
+
+// One SBI call per range per group of 64 hart ids
+static void flush_remote(const struct VmSpace* space, const TlbBatch_t* work, uint32_t targets) {
+    while (targets) {
+        uint64_t base = UINT64_MAX;
+        for (unsigned int cpu = 0; cpu < MAX_HARTS; cpu++) {
+            if ((targets & (1u << cpu)) && cpus[cpu].hart_id < base) base = cpus[cpu].hart_id;
+        }
+
+        uint64_t hart_mask = 0;
+        for (unsigned int cpu = 0; cpu < MAX_HARTS; cpu++) {
+            if ((targets & (1u << cpu)) && cpus[cpu].hart_id - base < 64) {
+                hart_mask |= 1ull << (cpus[cpu].hart_id - base);
+                targets &= ~(1u << cpu);
+            }
+        }
+
+        for (uint32_t i = 0; i < (work->full ? 1u : work->count); i++) {
+            uint64_t start = work->full ? 0 : work->ranges[i].start;
+            uint64_t size = work->full ? UINT64_MAX : work->ranges[i].end - work->ranges[i].start;
+            if (space->asid == 0) {
+                sbi_remote_sfence_vma(hart_mask, base, start, size);
+            } else {
+                sbi_remote_sfence_vma_asid(hart_mask, base, start, size, space->asid);
+            }
+            count(&stats.fences_sent, 1);
+        }
+    }
+}
+
+static void flush_by_ipi(uint32_t targets) {
+    uint64_t wanted[MAX_HARTS];
+    for (unsigned int cpu = 0; cpu < MAX_HARTS; cpu++) {
+        if (!(targets & (1u << cpu))) continue;
+        wanted[cpu] = atomic_fetch_add64(&flush_requested[cpu], 1) + 1;
+        sbi_send_ipi(1, cpus[cpu].hart_id);
+        count(&stats.ipis_sent, 1);
+    }
+
+    // Answer anyone waiting on us while we wait, in case our interrupts are off too
+    for (unsigned int cpu = 0; cpu < MAX_HARTS; cpu++) {
+        if (!(targets & (1u << cpu))) continue;
+        while (atomic_load_acquire64(&flush_done[cpu]) < wanted[cpu]) {
+            tlb_ipi();
+            cpu_relax();
+        }
+    }
+}
+
+void tlb_take(struct VmSpace* space, TlbBatch_t* work) {
+    TlbBatch_t* batch = &space->batch;
+    uint64_t flags = spin_lock_irqsave(&batch->lock);
+    work->count = batch->count;
+    work->full = batch->full;
+    memcpy(work->ranges, batch->ranges, sizeof(work->ranges));
+    batch->count = 0;
+    batch->full = 0;
+    spin_unlock_irqrestore(&batch->lock, flags);
+}
+
+void tlb_flush(struct VmSpace* space) {
+    TlbBatch_t work;
+    tlb_take(space, &work);
+    tlb_flush_taken(space, &work, 0);
+}
+
+void tlb_flush_taken(struct VmSpace* space, const TlbBatch_t* work, int freeing_tables) {
+    if (!work->count && !work->full) return;
+    count(&stats.batches, 1);
+    if (work->full) {
+        count(&stats.full_flushes, 1);
+    } else {
+        count(&stats.flushed_pages, batch_pages(work));
+    }
+
+    // Pinned while we pick who is remote, a migration after that only means an extra fence
+    uint64_t flags = irq_save();
+    unsigned int self = cpu_index();
+    uint32_t users = atomic_load_acquire32(&space->cpus);
+    if (users & (1u << self)) flush_local(work);
+    irq_restore(flags);
+
+    uint32_t targets = 0;
+    for (unsigned int cpu = 0; cpu < cpu_count(); cpu++) {
+        if (cpu != self && (users & (1u << cpu)) && cpus[cpu].online) targets |= 1u << cpu;
+    }
+
+    // Idle harts: mark them stale, then look again. One that left idle in between either sees
+    // the mark in tlb_idle_exit or shows up as busy here, the fences on both sides see to it.
+    // Not when tables are about to be freed: an idle hart's walk cache can still point into them,
+    // so everyone gets the fence before the pages go back.
+    uint32_t idle = freeing_tables ? 0 : targets & sched_idle_mask();
+    if (idle) {
+        atomic_fetch_or32(&stale_mask, idle);
+        atomic_fence();
+        idle &= sched_idle_mask();
+        targets &= ~idle;
+        for (uint32_t bits = idle; bits; bits &= bits - 1) count(&stats.lazy_skips, 1);
+    }
+    if (!targets) return;
+
+    if (have_rfence) {
+        flush_remote(space, work, targets);
+    } else {
+        flush_by_ipi(targets);
+    }
+}
+
+void tlb_ipi(void) {
+    uint64_t flags = irq_save(); // The flush and the ack have to come from the same hart
+    unsigned int self = cpu_index();
+    uint64_t requested = atomic_load_acquire64(&flush_requested[self]);
+    if (requested != flush_done[self]) {
+        sfence_vma_all();
+        atomic_store_release64(&flush_done[self], requested);
+    }
+    irq_restore(flags);
+}
+
+void tlb_idle_exit(void) {
+    uint32_t bit = 1u << cpu_index();
+    atomic_fence(); // Out of the idle mask before we look, see tlb_flush
+    if (atomic_load_acquire32(&stale_mask) & bit) {
+        atomic_fetch_and32(&stale_mask, ~bit);
+        sfence_vma_all();
+    }
+}
+
+void tlb_stats(TlbStats_t* output) {
+    *output = stats;
+}
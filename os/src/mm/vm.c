@@ -0,0 +1,326 @@
+#include <vm.h>
+#include <page_alloc.h>
+#include <fdt_index.h>
+#include <isa.h>
+#include <klog.h>
+#include <sync.h>
+#include <uart.h>
+#include <mini_lib.h>
+
+extern char __kernel_start[];
+extern char __text_end[];
+extern char __sdata_start[];
+extern char __kernel_end[];
+
+#define PTE_LEAF_MASK (PTE_R | PTE_W | PTE_X)
+#define PTE_PPN_MASK  ((1ull << 44) - 1)
+#define DEVICE_REGS_MAPPED 4
+
+VmSpace_t vm_kernel = { .lock = SPINLOCK_INIT, .batch = { .lock = SPINLOCK_INIT } };
+static int device_pbmt = 0;
+
+static inline int pte_is_leaf(pte_t pte) {
+    return (pte & PTE_LEAF_MASK) != 0;
+}
+
+static inline uint64_t pte_address(pte_t pte) {
+    return ((pte >> PTE_PPN_SHIFT) & PTE_PPN_MASK) << 12;
+}
+
+static inline pte_t* pte_table(pte_t pte) {
+    return (pte_t*) (uintptr_t) pte_address(pte); // Tables live in RAM, which is identity mapped
+}
+
+static inline pte_t pte_make(uint64_t physical_address, uint64_t flags) {
+    return ((physical_address >> 12) << PTE_PPN_SHIFT) | flags;
+}
+
+// Leaf bits for a vm_map protection. A and D are set up front: nothing here tracks them, and
+// harts that don't update them in hardware would fault on first touch instead.
+static pte_t leaf_flags(uint64_t protection) {
+    pte_t flags = PTE_V | PTE_G | PTE_A | (protection & (PTE_R | PTE_W | PTE_X));
+    if (flags & PTE_W) flags |= PTE_R | PTE_D; // W without R is reserved
+    if ((protection & VM_DEVICE) && device_pbmt) flags |= PTE_PBMT_IO;
+    return flags;
+}
+
+static pte_t* table_alloc(void) {
+    pte_t* table = (pte_t*) page_alloc(0);
+    if (table) memset(table, 0, PAGE_SIZE);
+    return table;
+}
+
+// Queues a table and everything under it for freeing after the next shootdown, another hart's
+// walker may be halfway through it until then. level is the table's own level.
+static void table_free(pte_t* table, unsigned int level) {
+    if (level > 0) {
+        for (unsigned int i = 0; i < VM_PTES; i++) {
+            if ((table[i] & PTE_V) && !pte_is_leaf(table[i])) table_free(pte_table(table[i]), level - 1);
+        }
+    }
+    table[0] = (pte_t) (uintptr_t) vm_kernel.deferred; // Children are done with, the link can go in
+    vm_kernel.deferred = table;
+}
+
+// Replaces a leaf with a table of 512 leaves one level down that map the same thing
+static int split(pte_t* pte, unsigned int level) {
+    pte_t* table = table_alloc();
+    if (!table) return -1;
+
+    uint64_t base = pte_address(*pte);
+    pte_t flags = *pte & (PTE_FLAGS_MASK | PTE_PBMT_IO | PTE_PBMT_NC);
+    for (unsigned int i = 0; i < VM_PTES; i++) table[i] = pte_make(base + i * VM_LEVEL_SIZE(level - 1), flags);
+
+    __atomic_store_n(pte, pte_make((uint64_t) (uintptr_t) table, PTE_V), __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Finds the entry for address at target level, making or splitting tables on the way down
+static pte_t* walk(uintptr_t address, unsigned int target) {
+    pte_t* table = vm_kernel.root;
+    for (unsigned int level = VM_LEVELS - 1; level > target; level--) {
+        pte_t* pte = &table[VM_VPN(address, level)];
+        if (!(*pte & PTE_V)) {
+            pte_t* next = table_alloc();
+            if (!next) return NULL;
+            __atomic_store_n(pte, pte_make((uint64_t) (uintptr_t) next, PTE_V), __ATOMIC_RELEASE);
+        } else if (pte_is_leaf(*pte) && split(pte, level) < 0) {
+            return NULL;
+        }
+        table = pte_table(*pte);
+    }
+    return &table[VM_VPN(address, target)];
+}
+
+static int map_locked(uintptr_t virtual_address, uint64_t physical_address, size_t size, uint64_t protection,
+                      unsigned int max_leaf) {
+    uintptr_t address = PAGE_ALIGN_DOWN(virtual_address);
+    uint64_t physical = PAGE_ALIGN_DOWN(physical_address);
+    uintptr_t end = PAGE_ALIGN_UP(virtual_address + size);
+    pte_t flags = leaf_flags(protection);
+    if (max_leaf >= VM_LEVELS) max_leaf = VM_LEVELS - 1;
+
+    while (address < end) {
+        // Biggest leaf both addresses are aligned for that doesn't run past the end
+        unsigned int level = max_leaf;
+        while (level > 0 && (((address | physical) & (VM_LEVEL_SIZE(level) - 1)) || end - address < VM_LEVEL_SIZE(level))) {
+            level--;
+        }
+
+        pte_t* pte = walk(address, level);
+        if (!pte) return -1;
+        if ((*pte & PTE_V) && !pte_is_leaf(*pte)) table_free(pte_table(*pte), level - 1);
+        __atomic_store_n(pte, pte_make(physical, flags), __ATOMIC_RELEASE);
+
+        address += VM_LEVEL_SIZE(level);
+        physical += VM_LEVEL_SIZE(level);
+    }
+    return 0;
+}
+
+// Tables are unhooked and their range queued under vm_kernel.lock, so taking the list and the
+// batch under it too means every table we free was fenced by the batch we send. Anything unhooked
+// after waits for whoever takes the next batch.
+void vm_sync(void) {
+    TlbBatch_t work;
+    uint64_t flags = spin_lock_irqsave(&vm_kernel.lock);
+    pte_t* deferred = vm_kernel.deferred;
+    vm_kernel.deferred = NULL;
+    tlb_take(&vm_kernel, &work);
+    spin_unlock_irqrestore(&vm_kernel.lock, flags);
+
+    tlb_flush_taken(&vm_kernel, &work, deferred != NULL);
+
+    while (deferred) {
+        pte_t* next = (pte_t*) (uintptr_t) deferred[0];
+        page_free(deferred);
+        deferred = next;
+    }
+}
+
+// Invalid to valid needs a fence too without Svvptc, so new mappings go through the batch like the rest
+int vm_map(uintptr_t virtual_address, uint64_t physical_address, size_t size, uint64_t protection, unsigned int max_leaf) {
+    if (!vm_kernel.root || virtual_address + size > VM_USER_TOP) return -1;
+
+    uint64_t flags = spin_lock_irqsave(&vm_kernel.lock);
+    int result = map_locked(virtual_address, physical_address, size, protection, max_leaf);
+    tlb_queue(&vm_kernel, virtual_address, size); // Before unlocking, see vm_sync
+    spin_unlock_irqrestore(&vm_kernel.lock, flags);
+
+    vm_sync();
+    return result;
+}
+
+int vm_unmap(uintptr_t virtual_address, size_t size) {
+    int result = vm_unmap_queued(virtual_address, size);
+    vm_sync();
+    return result;
+}
+
+int vm_unmap_queued(uintptr_t virtual_address, size_t size) {
+    if (!vm_kernel.root) return -1;
+
+    uintptr_t address = PAGE_ALIGN_DOWN(virtual_address);
+    uintptr_t end = PAGE_ALIGN_UP(virtual_address + size);
+    int result = 0;
+
+    uint64_t flags = spin_lock_irqsave(&vm_kernel.lock);
+    while (address < end && result == 0) {
+        pte_t* table = vm_kernel.root;
+        for (unsigned int level = VM_LEVELS - 1;; level--) {
+            pte_t* pte = &table[VM_VPN(address, level)];
+            uint64_t span = VM_LEVEL_SIZE(level);
+            if (!(*pte & PTE_V)) {
+                address = (address & ~(span - 1)) + span;
+                break;
+            }
+            // Whole entry inside the range: drop it (and anything under it), otherwise go down a level
+            if ((address & (span - 1)) == 0 && end - address >= span) {
+                if (!pte_is_leaf(*pte)) table_free(pte_table(*pte), level - 1);
+                __atomic_store_n(pte, 0, __ATOMIC_RELEASE);
+                address += span;
+                break;
+            }
+            if (pte_is_leaf(*pte) && split(pte, level) < 0) {
+                result = -1;
+                break;
+            }
+            table = pte_table(*pte);
+        }
+    }
+    tlb_queue(&vm_kernel, virtual_address, size); // Before unlocking, see vm_sync
+    spin_unlock_irqrestore(&vm_kernel.lock, flags);
+    return result;
+}
+
+int vm_map_device(uint64_t base, size_t size) {
+    return vm_map((uintptr_t) base, base, size, VM_READ | VM_WRITE | VM_DEVICE, VM_LEAF_1G);
+}
+
+int vm_translate(uintptr_t virtual_address, uint64_t* physical_address, unsigned int* level) {
+    if (!vm_kernel.root) return -1;
+
+    pte_t* table = vm_kernel.root;
+    for (int current = VM_LEVELS - 1; current >= 0; current--) {
+        pte_t pte = table[VM_VPN(virtual_address, current)];
+        if (!(pte & PTE_V)) return -1;
+        if (pte_is_leaf(pte)) {
+            if (physical_address) *physical_address = pte_address(pte) + (virtual_address & (VM_LEVEL_SIZE(current) - 1));
+            if (level) *level = (unsigned int) current;
+            return 0;
+        }
+        table = pte_table(pte);
+    }
+    return -1;
+}
+
+int vm_enabled(void) {
+    return vm_kernel.satp != 0;
+}
+
+static void count_table(const pte_t* table, unsigned int level, VmStats_t* output) {
+    output->tables++;
+    for (unsigned int i = 0; i < VM_PTES; i++) {
+        if (!(table[i] & PTE_V)) continue;
+        if (pte_is_leaf(table[i])) {
+            output->leaves[level]++;
+        } else if (level > 0) {
+            count_table(pte_table(table[i]), level - 1, output);
+        }
+    }
+}
+
+void vm_stats(VmStats_t* output) {
+    memset(output, 0, sizeof(*output));
+    if (!vm_kernel.root) return;
+
+    uint64_t flags = spin_lock_irqsave(&vm_kernel.lock);
+    count_table(vm_kernel.root, VM_LEVELS - 1, output);
+    spin_unlock_irqrestore(&vm_kernel.lock, flags);
+}
+
+// RAM at or above the kernel, OpenSBI owns what's below it and gets no mapping
+static int map_ram(uint64_t kernel_start) {
+    FDTRegRegion_t regions[16];
+    int region_count = fdt_memory_regions(regions, 16);
+    for (int i = 0; i < region_count; i++) {
+        uint64_t start = regions[i].base;
+        uint64_t end = regions[i].base + regions[i].size;
+        if (end <= kernel_start) continue;
+        if (start < kernel_start) start = kernel_start;
+        if (map_locked((uintptr_t) start, start, end - start, VM_READ | VM_WRITE, VM_LEAF_1G) < 0) return -1;
+    }
+    return 0;
+}
+
+// Every reg region outside /memory, /reserved-memory and /cpus is a device. Mapping them all
+// up front means drivers never have to ask.
+static int map_devices(void) {
+    const FDTNode_t* skip[] = { fdt_find_path("/cpus"), fdt_find_path("/reserved-memory") };
+
+    for (size_t i = 0; i < fdt_node_count(); i++) {
+        const FDTNode_t* node = fdt_node_at(i);
+        if (node->size_cells == 0 || fdt_node_is(node, "memory")) continue;
+
+        int skipped = 0;
+        for (const FDTNode_t* parent = node; parent && !skipped; parent = parent->parent) {
+            skipped = parent == skip[0] || parent == skip[1];
+        }
+        if (skipped) continue;
+
+        FDTRegRegion_t reg[DEVICE_REGS_MAPPED];
+        int count = fdt_node_reg(node, reg, DEVICE_REGS_MAPPED);
+        for (int r = 0; r < count; r++) {
+            if (reg[r].size == 0) continue;
+            if (map_locked((uintptr_t) reg[r].base, reg[r].base, reg[r].size, VM_READ | VM_WRITE | VM_DEVICE, VM_LEAF_1G) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    // The console might be the fallback address rather than anything the FDT mentions
+    return map_locked(g_uart_base, g_uart_base, PAGE_SIZE, VM_READ | VM_WRITE | VM_DEVICE, VM_LEAF_4K);
+}
+
+// The image goes down to 4 KiB pages so each section gets only what it needs. linker.ld
+// page-aligns the boundaries: .text, then read-only data up to .sdata, then everything writable.
+static int map_kernel(void) {
+    uint64_t start = (uint64_t) (uintptr_t) __kernel_start;
+    uint64_t text_end = PAGE_ALIGN_UP((uintptr_t) __text_end);
+    uint64_t rodata_end = (uint64_t) (uintptr_t) __sdata_start;
+    uint64_t end = PAGE_ALIGN_UP((uintptr_t) __kernel_end);
+
+    if (map_locked(start, start, text_end - start, VM_READ | VM_EXEC, VM_LEAF_4K) < 0) return -1;
+    if (map_locked(text_end, text_end, rodata_end - text_end, VM_READ, VM_LEAF_4K) < 0) return -1;
+    return map_locked(rodata_end, rodata_end, end - rodata_end, VM_READ | VM_WRITE, VM_LEAF_4K);
+}
+
+int vm_init(void) {
+    device_pbmt = isa_has(ISA_EXT_SVPBMT);
+    vm_kernel.root = table_alloc();
+    if (!vm_kernel.root) return -1;
+
+    // RAM first in big leaves, then the kernel on top, which splits only the leaves it lands in
+    if (map_ram((uint64_t) (uintptr_t) __kernel_start) < 0 || map_devices() < 0 || map_kernel() < 0) {
+        klog("vm: out of memory for page tables\n");
+        return -1;
+    }
+
+    vm_kernel.satp = SATP_MODE_SV39 | ((uint64_t) (uintptr_t) vm_kernel.root >> 12);
+    tlb_init();
+    vm_init_local();
+
+    VmStats_t stats;
+    vm_stats(&stats);
+    klog("vm: Sv39 on, %lu 1G + %lu 2M + %lu 4K leaves in %lu tables%s\n", stats.leaves[2], stats.leaves[1],
+         stats.leaves[0], stats.tables, device_pbmt ? ", MMIO through Svpbmt IO" : "");
+    return 0;
+}
+
+void vm_init_local(void) {
+    if (!vm_kernel.satp) return;
+    atomic_fetch_or32(&vm_kernel.cpus, 1u << cpu_index()); // Before satp, so no shootdown can miss us
+    sfence_vma_all(); // Order the table writes before the walker can see them
+    csr_write(satp, vm_kernel.satp);
+    sfence_vma_all();
+}
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Decode TetOS deferred klog frames (KLOG_DEFERRED=1 builds) back into text.
+
+Usage: qemu-system-riscv64 ... | klog_decode.py tetos.elf
+       klog_decode.py tetos.elf capture.bin
+
+Anything that isn't a frame (monitor output, kprintf) is passed straight through.
+Frame layout, see os/include/klog.h:
+    0x00, varint zigzag(timestamp delta), varint format id, signed mask byte, arguments
+"""
+
+import re
+import struct
+import sys
+
+TIMEBASE_HZ = 10_000_000  # QEMU virt rdtime rate
+FORMAT_SECTION = ".klog_fmt"
+
+SPEC = re.compile(r"%([-+ 0#]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|z|t|j)?([diuxXopcs%])")
+
+
+def load_formats(elf_path):
+    """Map of offset-in-.klog_fmt -> format string."""
+    with open(elf_path, "rb") as f:
+        data = f.read()
+
+    if data[:4] != b"\x7fELF" or data[4] != 2:
+        sys.exit(f"{elf_path}: not an ELF64 file")
+
+    (shoff,) = struct.unpack_from("<Q", data, 0x28)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x3A)
+
+    def section(index):
+        name, _type, _flags, _addr, offset, size = struct.unpack_from("<IIQQQQ", data, shoff + index * shentsize)
+        return name, offset, size
+
+    _, names_offset, _ = section(shstrndx)
+    for i in range(shnum):
+        name, offset, size = section(i)
+        end = data.index(b"\0", names_offset + name)
+        if data[names_offset + name:end].decode() != FORMAT_SECTION:
+            continue
+
+        blob = data[offset:offset + size]
+        formats = {}
+        start = 0
+        while start < len(blob):
+            stop = blob.index(b"\0", start)
+            formats[start] = blob[start:stop].decode(errors="replace")
+            start = stop + 1
+            while start < len(blob) and blob[start] == 0:  # Alignment padding between strings
+                start += 1
+        return formats
+
+    sys.exit(f"{elf_path}: no {FORMAT_SECTION} section, was it built with KLOG_DEFERRED=1?")
+
+
+class Stream:
+    def __init__(self, raw):
+        self.raw = raw
+
+    def byte(self):
+        b = self.raw.read(1)
+        if not b:
+            raise EOFError
+        return b[0]
+
+    def varint(self):
+        value, shift = 0, 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return value
+
+    def bytes(self, count):
+        return bytes(self.byte() for _ in range(count))
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def render(fmt, stream, mask):
+    """Pull arguments for fmt off the stream and format them like kprintf would."""
+    out = []
+    position = 0
+    index = 0
+
+    for match in SPEC.finditer(fmt):
+        out.append(fmt[position:match.start()])
+        position = match.end()
+        flags, width, precision, length, conversion = match.groups()
+
+        if conversion == "%":
+            out.append("%")
+            continue
+
+        if conversion == "s":
+            text = stream.bytes(stream.varint()).decode(errors="replace")
+            value = text
+        else:
+            raw = stream.varint()
+            value = unzigzag(raw) if mask & (1 << index) else raw
+            if conversion in "diuxXo" and length not in ("l", "ll", "z", "t", "j"):  # int-sized, drop what sign extension added
+                value &= 0xFFFFFFFF
+                if conversion in "di" and value & 0x80000000:
+                    value -= 1 << 32
+        index += 1
+
+        spec = "%" + flags + (width or "") + ("." + precision if precision else "")
+        if conversion == "p":
+            out.append("0x%016x" % (value & 0xFFFFFFFFFFFFFFFF))
+        elif conversion == "c":
+            out.append((spec + "c") % chr(value & 0xFF))
+        elif conversion == "u":
+            out.append((spec + "d") % (value & 0xFFFFFFFFFFFFFFFF))
+        else:
+            out.append((spec + conversion) % value)
+
+    out.append(fmt[position:])
+    return "".join(out)
+
+
+def decode(formats, raw, output):
+    stream = Stream(raw)
+    now = 0
+    try:
+        while True:
+            b = stream.byte()
+            if b != 0:
+                if b != ord("\r"):
+                    output.write(chr(b))
+                    if b == ord("\n"):
+                        output.flush()
+                continue
+
+            now += unzigzag(stream.varint())
+            format_id = stream.varint()
+            mask = stream.byte()
+            fmt = formats.get(format_id)
+            if fmt is None:
+                output.write(f"<klog: unknown format id {format_id}, stream out of sync?>\n")
+                continue
+
+            seconds, ticks = divmod(now, TIMEBASE_HZ)
+            output.write("[%5d.%06d] " % (seconds, ticks * 1_000_000 // TIMEBASE_HZ))
+            output.write(render(fmt, stream, mask))
+            output.flush()
+    except EOFError:
+        pass
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit(__doc__)
+
+    formats = load_formats(sys.argv[1])
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], "rb") as raw:
+            decode(formats, raw, sys.stdout)
+    else:
+        decode(formats, sys.stdin.buffer, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()